@@ -2,7 +2,15 @@ QT       += core gui openglwidgets opengl
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
-CONFIG += c++11
+CONFIG += c++17
+
+# Image export deflates PNG data itself, band by band, and gzip compressed grids are
+# inflated while they are parsed. zstd compressed grids need libzstd.
+LIBS += -lz
+packagesExist(libzstd) {
+    DEFINES += TV_WITH_ZSTD
+    LIBS += -lzstd
+}
 
 # You can make your code fail to compile if it uses deprecated APIs.
 # In order to do so, uncomment the following line.
@@ -10,19 +18,76 @@ CONFIG += c++11
 
 SOURCES += \
     camera.cpp \
+    camerapath.cpp \
+    clipmaprenderer.cpp \
+    contourrenderer.cpp \
+    contours.cpp \
+    decompressor.cpp \
+    difference.cpp \
     esriasciiireader.cpp \
+    float4x4.cpp \
+    frametimer.cpp \
     glcamera.cpp \
     glwidget.cpp \
+    gridparser.cpp \
+    heightpyramid.cpp \
+    heightsampler.cpp \
+    horizon.cpp \
+    horizonmap.cpp \
+    hydrology.cpp \
     main.cpp \
-    mainwindow.cpp
+    mainwindow.cpp \
+    meshexporter.cpp \
+    normalmap.cpp \
+    overlaytexture.cpp \
+    pngwriter.cpp \
+    rasterkernels.cpp \
+    rasterrenderer.cpp \
+    renderthread.cpp \
+    terrainbrush.cpp \
+    tilebatch.cpp \
+    tileexporter.cpp \
+    viewshed.cpp
 
 HEADERS += \
+    arena.h \
+    boundedqueue.h \
     camera.h \
+    camerapath.h \
+    clipmaprenderer.h \
+    contourrenderer.h \
+    contours.h \
+    decompressor.h \
+    difference.h \
     esriasciiireader.h \
+    float4x4.h \
+    frametimer.h \
     glcamera.h \
     glwidget.h \
+    gridparser.h \
+    heightgrid.h \
+    heightpyramid.h \
+    heightsampler.h \
+    horizon.h \
+    horizonmap.h \
+    hydrology.h \
+    jobqueue.h \
     mainwindow.h \
-    utils.h
+    meshexporter.h \
+    normalmap.h \
+    overlaytexture.h \
+    parallel.h \
+    pngwriter.h \
+    rasterkernels.h \
+    rasterrenderer.h \
+    renderthread.h \
+    simd.h \
+    snapshotbuffer.h \
+    terrainbrush.h \
+    tilebatch.h \
+    tileexporter.h \
+    utils.h \
+    viewshed.h
 
 FORMS += \
     glwidget.ui \
@@ -0,0 +1,64 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+namespace tv
+{
+
+/**
+ * Monotonic memory resource for short lived bulk data such as the mesh built while
+ * loading a grid. Allocations only bump a pointer, deallocations are ignored and
+ * release() frees everything in one go. Containers keep pointing at the arena across
+ * releases, so they must be emptied before release() is called.
+ */
+class Arena : public std::pmr::memory_resource
+{
+public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    size_t bytesAllocated() const{return m_bytes;}
+    size_t numAllocations() const{return m_count;}
+    /**
+     * Frees all memory and lets the next block chain start with a block of the given
+     * size, so a load of known size is served by a single upstream allocation.
+     */
+    void reserve(size_t bytes)
+    {
+        release();
+        m_pool = std::make_unique<std::pmr::monotonic_buffer_resource>(bytes);
+    }
+    void release()
+    {
+        m_pool.reset();
+        m_bytes = 0;
+        m_count = 0;
+    }
+
+private:
+    std::unique_ptr<std::pmr::monotonic_buffer_resource> m_pool;
+    size_t m_bytes = 0;
+    size_t m_count = 0;
+
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        if(not m_pool) m_pool = std::make_unique<std::pmr::monotonic_buffer_resource>();
+        m_bytes += bytes;
+        ++m_count;
+        return m_pool->allocate(bytes, alignment);
+    }
+    void do_deallocate(void*, size_t, size_t) override
+    {
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+} //namespace tv
+
+#endif // ARENA_H
@@ -0,0 +1,81 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+namespace tv
+{
+
+/**
+ * Queue between two pipeline stages. The producer waits while the queue holds capacity
+ * items, so a fast stage cannot run away from a slow one, and the consumer waits while it
+ * is empty. close() ends the stream: items already queued are still handed out.
+ */
+template<typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity) :
+        m_capacity(capacity > 0 ? capacity : 1)
+    {}
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_closed = true;
+        }
+        m_changed.notify_all();
+    }
+
+    /**
+     * Takes the next item, waiting for one. Returns false once the queue is closed and
+     * empty.
+     */
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_changed.wait(lock, [this]()
+        {
+            return m_closed or not m_items.empty();
+        });
+        if(m_items.empty()) return false;
+        item = std::move(m_items.front());
+        m_items.pop_front();
+        lock.unlock();
+        m_changed.notify_all();
+        return true;
+    }
+
+    /**
+     * Appends an item, waiting for room. Returns false and drops the item if the queue
+     * has been closed.
+     */
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_changed.wait(lock, [this]()
+        {
+            return m_closed or m_items.size() < m_capacity;
+        });
+        if(m_closed) return false;
+        m_items.push_back(std::move(item));
+        lock.unlock();
+        m_changed.notify_all();
+        return true;
+    }
+
+private:
+    bool                    m_closed    = false;
+    size_t                  m_capacity;
+    std::condition_variable m_changed;
+    std::deque<T>           m_items;
+    std::mutex              m_lock;
+};
+
+} //namespace tv
+
+#endif // BOUNDEDQUEUE_H
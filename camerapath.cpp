@@ -0,0 +1,137 @@
+#include "camerapath.h"
+#include <QDebug>
+#include <QFile>
+#include <QTextStream>
+#include <algorithm>
+
+namespace cam
+{
+
+/**
+ * Camera at a time along the path, held at the first and last keyframe outside of it.
+ * Needs at least one keyframe.
+ */
+CameraPath::Keyframe CameraPath::at(double time) const
+{
+    if(time <= m_keys.front().time) return m_keys.front();
+    if(time >= m_keys.back().time) return m_keys.back();
+
+    auto next = std::upper_bound(m_keys.begin(), m_keys.end(), time, [](double t, const Keyframe& key)
+    {
+        return t < key.time;
+    });
+    size_t i = size_t(next - m_keys.begin()) - 1;
+    const Keyframe& a = m_keys[i];
+    const Keyframe& b = m_keys[i + 1];
+    double h = b.time - a.time;
+    if(h <= 0.0) return b;
+
+    float u = float((time - a.time) / h);
+    float u2 = u * u;
+    float u3 = u2 * u;
+    float h00 = 2 * u3 - 3 * u2 + 1;
+    float h10 = u3 - 2 * u2 + u;
+    float h01 = -2 * u3 + 3 * u2;
+    float h11 = u3 - u2;
+    auto hermite = [&](QVector3D Keyframe::* member)
+    {
+        return h00 * a.*member + h10 * float(h) * tangent(i, member)
+             + h01 * b.*member + h11 * float(h) * tangent(i + 1, member);
+    };
+
+    Keyframe key;
+    key.time = time;
+    key.eye = hermite(&Keyframe::eye);
+    key.center = hermite(&Keyframe::center);
+    key.up = hermite(&Keyframe::up).normalized();
+    return key;
+}
+
+/**
+ * Inserts a keyframe after all keyframes with the same or an earlier time.
+ */
+void CameraPath::addKeyframe(const Keyframe& key)
+{
+    auto pos = std::upper_bound(m_keys.begin(), m_keys.end(), key.time, [](double t, const Keyframe& k)
+    {
+        return t < k.time;
+    });
+    m_keys.insert(pos, key);
+}
+
+/**
+ * Replaces the path by the one in a file. Leaves the path as it is if the file cannot be
+ * read or has a malformed line.
+ */
+bool CameraPath::load(const QString& fileName)
+{
+    QFile file(fileName);
+    if(not file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        qDebug() << "Cannot open camera path" << fileName << ":" << file.errorString();
+        return false;
+    }
+    CameraPath path;
+    QTextStream in(&file);
+    for(int lineNo = 1; not in.atEnd(); ++lineNo)
+    {
+        QString line = in.readLine().trimmed();
+        if(line.isEmpty() or line.startsWith('#')) continue;
+        QStringList fields = line.split(' ', Qt::SkipEmptyParts);
+        double v[10];
+        bool ok = fields.size() == 10;
+        for(int i = 0; ok and i < 10; ++i) v[i] = fields[i].toDouble(&ok);
+        if(not ok)
+        {
+            qDebug() << "Malformed keyframe in line" << lineNo << "of" << fileName;
+            return false;
+        }
+        Keyframe key;
+        key.time = v[0];
+        key.eye = QVector3D(v[1], v[2], v[3]);
+        key.center = QVector3D(v[4], v[5], v[6]);
+        key.up = QVector3D(v[7], v[8], v[9]);
+        path.addKeyframe(key);
+    }
+    *this = std::move(path);
+    return true;
+}
+
+bool CameraPath::save(const QString& fileName) const
+{
+    QFile file(fileName);
+    if(not file.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        qDebug() << "Cannot write camera path" << fileName << ":" << file.errorString();
+        return false;
+    }
+    QTextStream out(&file);
+    out.setRealNumberPrecision(10);
+    out << "# time eye.x eye.y eye.z center.x center.y center.z up.x up.y up.z\n";
+    for(const Keyframe& key : m_keys)
+    {
+        out << key.time << ' '
+            << key.eye.x() << ' ' << key.eye.y() << ' ' << key.eye.z() << ' '
+            << key.center.x() << ' ' << key.center.y() << ' ' << key.center.z() << ' '
+            << key.up.x() << ' ' << key.up.y() << ' ' << key.up.z() << '\n';
+    }
+    out.flush();
+    return file.error() == QFile::NoError;
+}
+
+//------->Private
+
+/**
+ * Rate of change of a keyframe member per second, from the neighbouring keyframes, or
+ * from the single neighbour at either end.
+ */
+QVector3D CameraPath::tangent(size_t i, QVector3D Keyframe::* member) const
+{
+    size_t prev = i > 0 ? i - 1 : i;
+    size_t next = i + 1 < m_keys.size() ? i + 1 : i;
+    double dt = m_keys[next].time - m_keys[prev].time;
+    if(dt <= 0.0) return QVector3D();
+    return (m_keys[next].*member - m_keys[prev].*member) / float(dt);
+}
+
+} //namespace cam
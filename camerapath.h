@@ -0,0 +1,50 @@
+#ifndef CAMERAPATH_H
+#define CAMERAPATH_H
+
+#include <QString>
+#include <QVector3D>
+#include <vector>
+
+namespace cam
+{
+
+/**
+ * Keyframed camera flight. Eye, center and up each follow a cubic Hermite spline through
+ * the keyframes whose tangents are Catmull-Rom differences divided by the time between
+ * the neighbouring keyframes, so the speed stays continuous where keyframes are spaced
+ * unevenly. Up is normalized after interpolation.
+ *
+ * Paths are stored as text, one keyframe per line: time in seconds, then eye, center and
+ * up with three coordinates each. Lines starting with # are comments.
+ */
+class CameraPath
+{
+public:
+    struct Keyframe
+    {
+        double      time    = 0.0;
+        QVector3D   eye;
+        QVector3D   center;
+        QVector3D   up      {0, 0, 1};
+    };
+
+    CameraPath() = default;
+    bool isEmpty() const{return m_keys.empty();}
+    const std::vector<Keyframe>& keyframes() const{return m_keys;}
+    double duration() const{return m_keys.empty() ? 0.0 : m_keys.back().time;}
+    size_t numKeyframes() const{return m_keys.size();}
+    Keyframe at(double time) const;
+    void addKeyframe(const Keyframe& key);
+    void clear(){m_keys.clear();}
+    bool load(const QString& fileName);
+    bool save(const QString& fileName) const;
+
+private:
+    std::vector<Keyframe> m_keys;
+
+    QVector3D tangent(size_t i, QVector3D Keyframe::* member) const;
+};
+
+} //namespace cam
+
+#endif // CAMERAPATH_H
@@ -0,0 +1,403 @@
+#include "clipmaprenderer.h"
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace render
+{
+
+namespace
+{
+
+inline int floorDiv(int v, int d)
+{
+    return v >= 0 ? v / d : -((-v + d - 1) / d);
+}
+
+inline int wrap(int v, int size)
+{
+    int m = v % size;
+    return m < 0 ? m + size : m;
+}
+
+} //namespace
+
+/**
+ * The ring size is rounded down to a multiple of four, so that the hole of every ring
+ * lies on whole quads of the next finer level.
+ */
+ClipmapRenderer::ClipmapRenderer(int ringSize) :
+    m_n(std::max(8, ringSize - ringSize % 4)),
+    m_texSize(1)
+{
+    while(m_texSize < m_n + 1) m_texSize <<= 1;
+}
+
+/**
+ * The overlay and lighting, if any, must belong to the grid the clipmap is built from.
+ */
+void ClipmapRenderer::draw(const QMatrix4x4& mvp, const QVector2D& viewer, OverlayTexture* overlay, const Lighting* lighting)
+{
+    if(not m_initialized or m_levels.empty()) return;
+
+    for(int l = 0; l < numLevels(); ++l) updateLevel(l, levelOrigin(l, viewer));
+
+    m_shProg.bind();
+    m_vbo.bind();
+    m_ibo.bind();
+    int gridLoc = m_shProg.attributeLocation("a_grid");
+    m_shProg.enableAttributeArray(gridLoc);
+    m_shProg.setAttributeBuffer(gridLoc, GL_FLOAT, 0, 2, 2 * sizeof(float));
+
+    m_shProg.setUniformValue("mvp_matrix", mvp);
+    m_shProg.setUniformValue("u_fine", 0);
+    m_shProg.setUniformValue("u_coarse", 1);
+    m_shProg.setUniformValue("u_gridMax", QVector2D(m_grid->numRows() - 1, m_grid->numCols() - 1));
+    m_shProg.setUniformValue("u_heightScale", float(m_heightScale));
+    m_shProg.setUniformValue("u_n", float(m_n));
+    m_shProg.setUniformValue("u_texSize", float(m_texSize));
+    if(overlay) overlay->apply(m_shProg);
+    else m_shProg.setUniformValue("u_overlayMode", 0);
+    if(lighting) lighting->apply(m_shProg);
+    else m_shProg.setUniformValue("u_lighting", false);
+
+    for(int l = 0; l < numLevels(); ++l)
+    {
+        const Level& lv = m_levels[l];
+        int s = 1 << l;
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, lv.texture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, m_levels[std::min(l + 1, numLevels() - 1)].texture);
+
+        m_shProg.setUniformValue("u_origin", QVector2D(lv.origin.x(), lv.origin.y()));
+        m_shProg.setUniformValue("u_spacing", float(s));
+        m_shProg.setUniformValue("u_morph", l + 1 < numLevels() ? 1.0f : 0.0f);
+        if(l == 0)
+        {
+            m_shProg.setUniformValue("u_hole", QVector4D());
+            glDrawElements(GL_TRIANGLES, m_fullCount, GL_UNSIGNED_INT, nullptr);
+        }
+        else
+        {
+            //Everything the next finer level covers is discarded in the fragment shader.
+            const QPoint& fo = m_levels[l - 1].origin;
+            float ext = float(m_n) * float(s) * 0.5f;
+            m_shProg.setUniformValue("u_hole", QVector4D(fo.x(), fo.y(), fo.x() + ext, fo.y() + ext));
+            glDrawElements(GL_TRIANGLES, m_ringCount, GL_UNSIGNED_INT,
+                           reinterpret_cast<const void*>(m_fullCount * sizeof(GLuint)));
+        }
+    }
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    m_shProg.disableAttributeArray(gridLoc);
+    m_ibo.release();
+    m_vbo.release();
+}
+
+/**
+ * Needs a current context.
+ */
+void ClipmapRenderer::initialize()
+{
+    if(m_initialized) return;
+    initializeOpenGLFunctions();
+    if(not m_shProg.addShaderFromSourceFile(QOpenGLShader::Vertex, ":/shader/vclipmap.glsl")
+       or not m_shProg.addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shader/fshader.glsl")
+       or not m_shProg.link())
+    {
+        qDebug() << "Cannot build clipmap shader pipeline:" << m_shProg.log();
+        return;
+    }
+    buildMesh();
+    m_initialized = true;
+    if(m_grid) createLevels();
+}
+
+/**
+ * Tells the system that the grid samples the levels gain on the way to the given viewer
+ * position are going to be read, so that pages it has swapped out come back in the
+ * background before an upload has to wait for them. Only samples not covered for an
+ * earlier position are advised, so a position a little ahead of a moving camera costs a
+ * few strips per frame. Does not touch the GPU.
+ */
+void ClipmapRenderer::prefetch(const QVector2D& viewer)
+{
+#ifdef Q_OS_UNIX
+    if(not m_grid or m_grid->isEmpty()) return;
+    const uintptr_t page = uintptr_t(sysconf(_SC_PAGESIZE));
+    long rows = long(m_grid->numRows());
+    long cols = long(m_grid->numCols());
+    for(int l = 0; l < numLevels(); ++l)
+    {
+        Level& lv = m_levels[l];
+        if(not lv.valid) continue;
+        QPoint origin = levelOrigin(l, viewer);
+        int s = 1 << l;
+        for(const Region& r : enteringRegions(l, lv.prefetched, origin))
+        {
+            long c0 = std::clamp(long(r.col0) * s, 0L, cols - 1);
+            long c1 = std::clamp(long(r.col0 + r.cols - 1) * s, 0L, cols - 1);
+            for(int i = 0; i < r.rows; ++i)
+            {
+                long row = std::clamp(long(r.row0 + i) * s, 0L, rows - 1);
+                uintptr_t begin = reinterpret_cast<uintptr_t>(m_grid->row(size_t(row)) + c0) & ~(page - 1);
+                uintptr_t end = reinterpret_cast<uintptr_t>(m_grid->row(size_t(row)) + c1 + 1);
+                madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED);
+            }
+        }
+        lv.prefetched = origin;
+    }
+#else
+    Q_UNUSED(viewer);
+#endif
+}
+
+/**
+ * Frees all GPU resources. Needs a current context.
+ */
+void ClipmapRenderer::release()
+{
+    if(not m_initialized) return;
+    destroyLevels();
+    m_vbo.destroy();
+    m_ibo.destroy();
+    m_shProg.removeAllShaders();
+    m_initialized = false;
+}
+
+/**
+ * Sets the grid the clipmap is built from. The grid must outlive the renderer or be
+ * replaced before it is destroyed. Needs a current context once initialized.
+ */
+void ClipmapRenderer::setTerrain(const tv::HeightGrid* grid, double heightScale)
+{
+    m_grid = grid and not grid->isEmpty() ? grid : nullptr;
+    m_heightScale = heightScale;
+    if(not m_initialized) return;
+    destroyLevels();
+    if(m_grid) createLevels();
+}
+
+/**
+ * Re-uploads the samples of all levels that lie in an edited rectangle of the grid.
+ * Needs a current context.
+ */
+void ClipmapRenderer::updateRegion(const tv::GridRect& rect)
+{
+    if(not m_initialized or not m_grid) return;
+    int n1 = m_n + 1;
+    for(int l = 0; l < numLevels(); ++l)
+    {
+        const Level& lv = m_levels[l];
+        if(not lv.valid) continue;
+        int s = 1 << l;
+        int wr0 = lv.origin.x() / s;
+        int wc0 = lv.origin.y() / s;
+        //samples outside the grid repeat its border, so border edits reach past it
+        int r0 = rect.row0 == 0 ? wr0 : int((rect.row0 + s - 1) / s);
+        int c0 = rect.col0 == 0 ? wc0 : int((rect.col0 + s - 1) / s);
+        int r1 = rect.row1 >= m_grid->numRows() ? wr0 + n1 : int((rect.row1 + s - 1) / s);
+        int c1 = rect.col1 >= m_grid->numCols() ? wc0 + n1 : int((rect.col1 + s - 1) / s);
+        r0 = std::max(r0, wr0);
+        c0 = std::max(c0, wc0);
+        r1 = std::min(r1, wr0 + n1);
+        c1 = std::min(c1, wc0 + n1);
+        if(r1 > r0 and c1 > c0) uploadRegion(l, r0, c0, r1 - r0, c1 - c0);
+    }
+}
+
+//------->Private
+
+/**
+ * The blocks of samples that enter a level's window when it moves between two origins:
+ * a strip along each axis it moved on, or all of it after a jump farther than the window.
+ */
+std::vector<ClipmapRenderer::Region> ClipmapRenderer::enteringRegions(int level, const QPoint& from, const QPoint& to) const
+{
+    int s = 1 << level;
+    int n1 = m_n + 1;
+    int r0 = to.x() / s;
+    int c0 = to.y() / s;
+    int dr = r0 - from.x() / s;
+    int dc = c0 - from.y() / s;
+
+    std::vector<Region> regions;
+    if(std::abs(dr) >= n1 or std::abs(dc) >= n1)
+    {
+        regions.push_back({r0, c0, n1, n1});
+        return regions;
+    }
+    if(dr > 0) regions.push_back({r0 + n1 - dr, c0, dr, n1});
+    else if(dr < 0) regions.push_back({r0, c0, -dr, n1});
+    if(dc > 0) regions.push_back({r0, c0 + n1 - dc, n1, dc});
+    else if(dc < 0) regions.push_back({r0, c0, n1, -dc});
+    return regions;
+}
+
+/**
+ * Grid position of the first vertex of a level. Origins snap to the lattice of the next
+ * coarser level, so every ring's hole lines up with whole quads of its finer neighbour.
+ */
+QPoint ClipmapRenderer::levelOrigin(int level, const QVector2D& viewer) const
+{
+    int s = 1 << level;
+    int step = 2 * s;
+    int half = m_n / 2 * s;
+    return QPoint(floorDiv(int(std::floor(viewer.x())) - half, step) * step,
+                  floorDiv(int(std::floor(viewer.y())) - half, step) * step);
+}
+
+/**
+ * Creates the static (n+1)^2 vertex lattice and two index ranges into it: the full
+ * square drawn for the finest level and the ring with its center cut out for all others.
+ */
+void ClipmapRenderer::buildMesh()
+{
+    int n1 = m_n + 1;
+    std::vector<float> verts;
+    verts.reserve(size_t(n1) * n1 * 2);
+    for(int i = 0; i < n1; ++i)
+    {
+        for(int j = 0; j < n1; ++j)
+        {
+            verts.push_back(float(i));
+            verts.push_back(float(j));
+        }
+    }
+
+    Indices indices;
+    auto addQuads = [&](bool ring)
+    {
+        int h0 = m_n / 4 + 1;
+        int h1 = 3 * m_n / 4;
+        for(int i = 0; i < m_n; ++i)
+        {
+            for(int j = 0; j < m_n; ++j)
+            {
+                if(ring and i >= h0 and i < h1 and j >= h0 and j < h1) continue;
+                GLuint resCol = GLuint(j + i * n1);
+                indices.push_back(resCol);
+                indices.push_back(resCol + n1);
+                indices.push_back(resCol + 1);
+                indices.push_back(resCol + 1);
+                indices.push_back(resCol + n1);
+                indices.push_back(resCol + n1 + 1);
+            }
+        }
+    };
+    addQuads(false);
+    m_fullCount = int(indices.size());
+    addQuads(true);
+    m_ringCount = int(indices.size()) - m_fullCount;
+
+    m_vbo = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+    m_vbo.create();
+    m_vbo.bind();
+    m_vbo.allocate(verts.data(), int(verts.size() * sizeof(float)));
+    m_vbo.release();
+
+    m_ibo = QOpenGLBuffer(QOpenGLBuffer::IndexBuffer);
+    m_ibo.create();
+    m_ibo.bind();
+    m_ibo.allocate(indices.data(), int(indices.size() * sizeof(GLuint)));
+    m_ibo.release();
+}
+
+/**
+ * Adds levels until the coarsest one spans the grid twice, so it covers the whole
+ * terrain from any viewer position on it.
+ */
+void ClipmapRenderer::createLevels()
+{
+    long maxDim = long(std::max(m_grid->numRows(), m_grid->numCols()));
+    int count = 1;
+    while((long(m_n) << (count - 1)) < 2 * maxDim and count < 16) ++count;
+
+    m_levels.resize(count);
+    for(Level& lv : m_levels)
+    {
+        glGenTextures(1, &lv.texture);
+        glBindTexture(GL_TEXTURE_2D, lv.texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, m_texSize, m_texSize, 0, GL_RED, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        lv.valid = false;
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    qDebug() << "Clipmap:" << count << "levels," << numVertices() << "vertices";
+}
+
+void ClipmapRenderer::destroyLevels()
+{
+    for(Level& lv : m_levels) glDeleteTextures(1, &lv.texture);
+    m_levels.clear();
+}
+
+/**
+ * Moves a level's window to a new origin. Only the strips of samples that entered the
+ * window are uploaded; a jump farther than the window refreshes the whole level.
+ */
+void ClipmapRenderer::updateLevel(int level, const QPoint& origin)
+{
+    Level& lv = m_levels[level];
+    if(lv.valid and lv.origin == origin) return;
+
+    if(not lv.valid)
+    {
+        int s = 1 << level;
+        uploadRegion(level, origin.x() / s, origin.y() / s, m_n + 1, m_n + 1);
+        lv.prefetched = origin;
+    }
+    else
+    {
+        for(const Region& r : enteringRegions(level, lv.origin, origin)) uploadRegion(level, r.row0, r.col0, r.rows, r.cols);
+    }
+    lv.origin = origin;
+    lv.valid = true;
+}
+
+/**
+ * Uploads a block of level samples, given in level units, to its toroidal position in
+ * the level texture. The block is split where it wraps around the texture border.
+ */
+void ClipmapRenderer::uploadRegion(int level, int row0, int col0, int rows, int cols)
+{
+    int s = 1 << level;
+    glBindTexture(GL_TEXTURE_2D, m_levels[level].texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    for(int r = row0; r < row0 + rows;)
+    {
+        int tr = wrap(r, m_texSize);
+        int rn = std::min(row0 + rows - r, m_texSize - tr);
+        for(int c = col0; c < col0 + cols;)
+        {
+            int tc = wrap(c, m_texSize);
+            int cn = std::min(col0 + cols - c, m_texSize - tc);
+            m_scratch.resize(size_t(rn) * cn);
+            for(int i = 0; i < rn; ++i)
+            {
+                for(int j = 0; j < cn; ++j)
+                {
+                    m_scratch[size_t(i) * cn + j] = m_grid->clampedAt(long(r + i) * s, long(c + j) * s);
+                }
+            }
+            glTexSubImage2D(GL_TEXTURE_2D, 0, tc, tr, cn, rn, GL_RED, GL_FLOAT, m_scratch.data());
+            c += cn;
+        }
+        r += rn;
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+} //namespace render
@@ -0,0 +1,82 @@
+#ifndef CLIPMAPRENDERER_H
+#define CLIPMAPRENDERER_H
+
+#include "heightgrid.h"
+#include "horizonmap.h"
+#include "overlaytexture.h"
+#include <QMatrix4x4>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QPoint>
+#include <QtOpenGL/QOpenGLBuffer>
+
+namespace render
+{
+
+/**
+ * Geometry clipmap terrain renderer. Draws a fixed set of nested square rings centered
+ * on the viewer, each level twice as coarse as the previous one. Heights are fetched in
+ * the vertex shader from one float texture per level, which is refreshed toroidally so
+ * that only the rows and columns entering a level's window are uploaded when the viewer
+ * moves. Vertex count and per-frame work do not depend on the size of the grid.
+ */
+class ClipmapRenderer : protected QOpenGLExtraFunctions
+{
+public:
+    explicit ClipmapRenderer(int ringSize = 128);
+    bool isInitialized() const{return m_initialized;}
+    int numLevels() const{return int(m_levels.size());}
+    int ringSize() const{return m_n;}
+    size_t numVertices() const{return size_t(m_n + 1) * size_t(m_n + 1) * m_levels.size();}
+    void draw(const QMatrix4x4& mvp, const QVector2D& viewer, OverlayTexture* overlay = nullptr, const Lighting* lighting = nullptr);
+    void initialize();
+    void prefetch(const QVector2D& viewer);
+    void release();
+    void setTerrain(const tv::HeightGrid* grid, double heightScale);
+    void updateRegion(const tv::GridRect& rect);
+
+private:
+    struct Level
+    {
+        GLuint  texture = 0;
+        QPoint  origin;
+        QPoint  prefetched;
+        bool    valid   = false;
+    };
+
+    /**
+     * Block of level samples, in level units.
+     */
+    struct Region
+    {
+        int row0    = 0;
+        int col0    = 0;
+        int rows    = 0;
+        int cols    = 0;
+    };
+
+    bool                    m_initialized   = false;
+    const tv::HeightGrid*   m_grid          = nullptr;
+    double                  m_heightScale   = 1.0;
+    int                     m_fullCount     = 0;
+    int                     m_n;
+    int                     m_ringCount     = 0;
+    int                     m_texSize;
+    QOpenGLBuffer           m_ibo;
+    QOpenGLBuffer           m_vbo;
+    QOpenGLShaderProgram    m_shProg;
+    std::vector<float>      m_scratch;
+    std::vector<Level>      m_levels;
+
+    std::vector<Region> enteringRegions(int level, const QPoint& from, const QPoint& to) const;
+    QPoint levelOrigin(int level, const QVector2D& viewer) const;
+    void buildMesh();
+    void createLevels();
+    void destroyLevels();
+    void updateLevel(int level, const QPoint& origin);
+    void uploadRegion(int level, int row0, int col0, int rows, int cols);
+};
+
+} //namespace render
+
+#endif // CLIPMAPRENDERER_H
@@ -0,0 +1,102 @@
+#include "contourrenderer.h"
+#include <QDebug>
+
+namespace render
+{
+
+/**
+ * Queues the contours of one dataset. Grid positions are lifted to their level and
+ * moved by the dataset's offset.
+ */
+void ContourRenderer::addContours(const std::vector<analysis::Contour>& contours, double heightScale, const QVector3D& offset)
+{
+    size_t count = 0;
+    for(const analysis::Contour& contour : contours) count += contour.points.size() > 1 ? 2 * (contour.points.size() - 1) : 0;
+    m_pending.reserve(m_pending.size() + count);
+
+    for(const analysis::Contour& contour : contours)
+    {
+        float z = float(contour.level * heightScale) + offset.z();
+        for(size_t i = 1; i < contour.points.size(); ++i)
+        {
+            const QVector2D& a = contour.points[i - 1];
+            const QVector2D& b = contour.points[i];
+            m_pending.emplace_back(a.x() + offset.x(), a.y() + offset.y(), z);
+            m_pending.emplace_back(b.x() + offset.x(), b.y() + offset.y(), z);
+        }
+    }
+    m_dirty = true;
+}
+
+/**
+ * Drops all lines, including those already on the GPU once the next draw runs.
+ */
+void ContourRenderer::clear()
+{
+    m_pending.clear();
+    m_dirty = true;
+}
+
+void ContourRenderer::draw(const QMatrix4x4& mvp)
+{
+    if(not m_initialized) return;
+    if(m_dirty) upload();
+    if(m_numVertices == 0) return;
+
+    m_shProg.bind();
+    m_vbo.bind();
+    int vertLoc = m_shProg.attributeLocation("a_position");
+    m_shProg.enableAttributeArray(vertLoc);
+    m_shProg.setAttributeBuffer(vertLoc, GL_FLOAT, 0, 3, sizeof(QVector3D));
+    m_shProg.setUniformValue("mvp_matrix", mvp);
+    m_shProg.setUniformValue("u_color", QVector4D(0.1f, 0.1f, 0.1f, 0.8f));
+
+    glDrawArrays(GL_LINES, 0, m_numVertices);
+
+    m_shProg.disableAttributeArray(vertLoc);
+    m_vbo.release();
+}
+
+/**
+ * Needs a current context.
+ */
+void ContourRenderer::initialize()
+{
+    if(m_initialized) return;
+    initializeOpenGLFunctions();
+    if(not m_shProg.addShaderFromSourceFile(QOpenGLShader::Vertex, ":/shader/vline.glsl")
+       or not m_shProg.addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shader/fline.glsl")
+       or not m_shProg.link())
+    {
+        qDebug() << "Cannot build contour shader pipeline:" << m_shProg.log();
+        return;
+    }
+    m_vbo.create();
+    m_initialized = true;
+}
+
+/**
+ * Frees the vertex buffer. Needs a current context.
+ */
+void ContourRenderer::release()
+{
+    if(not m_initialized) return;
+    m_vbo.destroy();
+    m_shProg.removeAllShaders();
+    m_numVertices = 0;
+    m_initialized = false;
+}
+
+//------->Private
+
+void ContourRenderer::upload()
+{
+    m_vbo.bind();
+    m_vbo.allocate(m_pending.data(), int(m_pending.size() * sizeof(QVector3D)));
+    m_vbo.release();
+    m_numVertices = GLsizei(m_pending.size());
+    std::vector<QVector3D>().swap(m_pending);
+    m_dirty = false;
+}
+
+} //namespace render
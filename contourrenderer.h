@@ -0,0 +1,44 @@
+#ifndef CONTOURRENDERER_H
+#define CONTOURRENDERER_H
+
+#include "contours.h"
+#include <QMatrix4x4>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QVector3D>
+#include <QtOpenGL/QOpenGLBuffer>
+
+namespace render
+{
+
+/**
+ * Draws contour lines of any number of datasets as line segments from a single vertex
+ * buffer. Lines are handed over on the CPU side and uploaded by the next draw, so they
+ * can be replaced from any thread that holds the scene lock.
+ */
+class ContourRenderer : protected QOpenGLExtraFunctions
+{
+public:
+    ContourRenderer() = default;
+    bool isEmpty() const{return m_numVertices == 0 and m_pending.empty();}
+    size_t numSegments() const{return size_t(m_numVertices) / 2;}
+    void addContours(const std::vector<analysis::Contour>& contours, double heightScale, const QVector3D& offset);
+    void clear();
+    void draw(const QMatrix4x4& mvp);
+    void initialize();
+    void release();
+
+private:
+    bool                    m_initialized   = false;
+    bool                    m_dirty         = false;
+    GLsizei                 m_numVertices   = 0;
+    QOpenGLBuffer           m_vbo;
+    QOpenGLShaderProgram    m_shProg;
+    std::vector<QVector3D>  m_pending;
+
+    void upload();
+};
+
+} //namespace render
+
+#endif // CONTOURRENDERER_H
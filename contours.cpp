@@ -0,0 +1,385 @@
+#include "contours.h"
+#include "parallel.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+
+namespace analysis
+{
+
+namespace
+{
+
+/**
+ * Crossing points are identified by the grid edge they lie on, so that the two cells
+ * sharing an edge, possibly traced by different bands, produce the same key for it.
+ * Edges of a cell are numbered top, right, bottom, left.
+ */
+uint64_t edgeKey(size_t cols, size_t r, size_t c, int edge)
+{
+    switch(edge)
+    {
+    case 0:  return uint64_t(r * cols + c) << 1;
+    case 1:  return uint64_t(r * cols + c + 1) << 1 | 1;
+    case 2:  return uint64_t((r + 1) * cols + c) << 1;
+    default: return uint64_t(r * cols + c) << 1 | 1;
+    }
+}
+
+/**
+ * h holds the corners top left, top right, bottom right, bottom left. Each edge is
+ * interpolated from its lower to its higher grid index, whichever cell asks.
+ */
+QVector2D edgePoint(const float* h, size_t r, size_t c, int edge, float level)
+{
+    switch(edge)
+    {
+    case 0:  return QVector2D(float(r), float(c) + (level - h[0]) / (h[1] - h[0]));
+    case 1:  return QVector2D(float(r) + (level - h[1]) / (h[2] - h[1]), float(c + 1));
+    case 2:  return QVector2D(float(r + 1), float(c) + (level - h[3]) / (h[2] - h[3]));
+    default: return QVector2D(float(r) + (level - h[0]) / (h[3] - h[0]), float(c));
+    }
+}
+
+/**
+ * Edge pairs per marching squares case, indexed by tl << 3 | tr << 2 | br << 1 | bl.
+ * The saddles 5 and 10 are listed for a center above the level; the other reading of
+ * either saddle is the entry of its complement.
+ */
+const signed char kCases[16][4] = {
+    {-1, -1, -1, -1}, {3, 2, -1, -1}, {2, 1, -1, -1}, {3, 1, -1, -1},
+    {0, 1, -1, -1},   {3, 0, 2, 1},   {0, 2, -1, -1}, {3, 0, -1, -1},
+    {3, 0, -1, -1},   {0, 2, -1, -1}, {0, 1, 3, 2},   {0, 1, -1, -1},
+    {3, 1, -1, -1},   {2, 1, -1, -1}, {3, 2, -1, -1}, {-1, -1, -1, -1}
+};
+
+struct Segment
+{
+    uint64_t    head;
+    uint64_t    tail;
+    QVector2D   points[2];
+
+    const QVector2D* data() const{return points;}
+    size_t size() const{return 2;}
+};
+
+struct Chain
+{
+    uint64_t                head    = 0;
+    uint64_t                tail    = 0;
+    bool                    closed  = false;
+    std::vector<QVector2D>  points;
+
+    const QVector2D* data() const{return points.data();}
+    size_t size() const{return points.size();}
+};
+
+/**
+ * Pairs up the ends of pieces that share a key. An edge belongs to at most two cells,
+ * so a key is shared by at most two ends. Ends are numbered piece * 2 + side.
+ */
+template<typename Piece>
+std::vector<int> matchEnds(const std::vector<Piece>& pieces)
+{
+    std::vector<int> partners(pieces.size() * 2, -1);
+    std::unordered_map<uint64_t, int> open;
+    open.reserve(pieces.size() * 2);
+    for(int end = 0; end < int(partners.size()); ++end)
+    {
+        const Piece& piece = pieces[size_t(end >> 1)];
+        auto [it, fresh] = open.try_emplace(end & 1 ? piece.tail : piece.head, end);
+        if(fresh) continue;
+        partners[size_t(end)] = it->second;
+        partners[size_t(it->second)] = end;
+    }
+    return partners;
+}
+
+/**
+ * Joins matched pieces into maximal chains. Matched ends form simple paths and cycles.
+ */
+template<typename Piece>
+std::vector<Chain> link(const std::vector<Piece>& pieces, const std::vector<int>& partners)
+{
+    auto keyOf = [&](int end){return end & 1 ? pieces[size_t(end >> 1)].tail : pieces[size_t(end >> 1)].head;};
+
+    std::vector<Chain> chains;
+    std::vector<char> used(pieces.size(), 0);
+    for(int i = 0; i < int(pieces.size()); ++i)
+    {
+        if(used[size_t(i)]) continue;
+
+        // Walk back to the start of the path, or stay at i if it is a cycle.
+        int cur = i;
+        bool forward = true;
+        for(size_t steps = 0; steps < pieces.size(); ++steps)
+        {
+            int prev = partners[size_t(cur * 2 + (forward ? 0 : 1))];
+            if(prev < 0) break;
+            if(prev >> 1 == i)
+            {
+                cur = i;
+                forward = true;
+                break;
+            }
+            cur = prev >> 1;
+            forward = prev & 1;
+        }
+
+        Chain chain;
+        int start = cur;
+        chain.head = keyOf(cur * 2 + (forward ? 0 : 1));
+        while(true)
+        {
+            used[size_t(cur)] = 1;
+            const Piece& piece = pieces[size_t(cur)];
+            size_t skip = chain.points.empty() ? 0 : 1;
+            for(size_t k = skip; k < piece.size(); ++k)
+            {
+                chain.points.push_back(piece.data()[forward ? k : piece.size() - 1 - k]);
+            }
+            int exit = cur * 2 + (forward ? 1 : 0);
+            chain.tail = keyOf(exit);
+            int next = partners[size_t(exit)];
+            if(next < 0) break;
+            if(used[size_t(next >> 1)])
+            {
+                chain.closed = next >> 1 == start;
+                break;
+            }
+            cur = next >> 1;
+            forward = not (next & 1);
+        }
+        chains.push_back(std::move(chain));
+    }
+    return chains;
+}
+
+/**
+ * Segments of one level within a band. Ends are matched while scanning: a segment end
+ * on a cell's right edge stays open in right until the next cell claims it. Ends on
+ * bottom edges are kept per row for all levels together, in CrossingRow.
+ */
+struct LevelTrace
+{
+    struct Open
+    {
+        uint64_t    key = ~uint64_t(0);
+        int         end = -1;
+    };
+
+    std::vector<Segment>    segments;
+    std::vector<int>        partners;
+    Open                    right;
+};
+
+/**
+ * Open segment ends on the horizontal edges of one row of samples, one slot for every
+ * level that crosses each edge. The levels crossing the edge right of sample c are
+ * those from the smaller to the larger bracket of its ends, so the slots of an edge are
+ * consecutive and the row takes memory for its crossings only, however many levels
+ * there are.
+ */
+struct CrossingRow
+{
+    std::vector<size_t> offsets;
+    std::vector<int>    ends;
+    const int*          brackets    = nullptr;
+
+    void reset(const int* rowBrackets, size_t cols)
+    {
+        brackets = rowBrackets;
+        offsets.resize(cols);
+        size_t n = 0;
+        for(size_t c = 0; c + 1 < cols; ++c)
+        {
+            offsets[c] = n;
+            int b0 = brackets[c];
+            int b1 = brackets[c + 1];
+            if(b0 >= 0 and b1 >= 0) n += size_t(std::abs(b1 - b0));
+        }
+        ends.assign(n, -1);
+    }
+    int& at(size_t c, int level){return ends[offsets[c] + size_t(level - std::min(brackets[c], brackets[c + 1]))];}
+};
+
+/**
+ * Stores for every sample of a row the number of levels at or below it, or -1 for NODATA.
+ * A cell crosses exactly the levels between the smallest and largest count of its corners.
+ */
+void bracketRow(const float* heights, size_t cols, const std::vector<float>& levels, float noData, int* out)
+{
+    size_t i = 0;
+    for(size_t c = 0; c < cols; ++c)
+    {
+        float h = heights[c];
+        if(h == noData)
+        {
+            out[c] = -1;
+            continue;
+        }
+        // Neighbouring samples mostly fall between the same two levels.
+        if(not ((i == 0 or levels[i - 1] <= h) and (i == levels.size() or levels[i] > h)))
+        {
+            i = size_t(std::upper_bound(levels.begin(), levels.end(), h) - levels.begin());
+        }
+        out[c] = int(i);
+    }
+}
+
+void traceBand(const tv::HeightGrid& grid, const std::vector<float>& levels, float noData,
+               size_t row0, size_t row1, std::vector<LevelTrace>& traces)
+{
+    size_t cols = grid.numCols();
+    std::vector<int> topBrackets(cols);
+    std::vector<int> bottomBrackets(cols);
+    bracketRow(grid.row(row0), cols, levels, noData, topBrackets.data());
+    //Ends on the band's first row stay open; they are joined across the seam later.
+    CrossingRow above;
+    CrossingRow below;
+    above.reset(topBrackets.data(), cols);
+
+    for(size_t r = row0; r < row1; ++r)
+    {
+        const float* top = grid.row(r);
+        const float* bottom = grid.row(r + 1);
+        bracketRow(bottom, cols, levels, noData, bottomBrackets.data());
+        below.reset(bottomBrackets.data(), cols);
+        for(size_t c = 0; c + 1 < cols; ++c)
+        {
+            int b0 = topBrackets[c], b1 = topBrackets[c + 1], b2 = bottomBrackets[c + 1], b3 = bottomBrackets[c];
+            int lo = std::min(std::min(b0, b1), std::min(b2, b3));
+            int hi = std::max(std::max(b0, b1), std::max(b2, b3));
+            if(lo == hi or lo < 0) continue;
+
+            const float h[4] = {top[c], top[c + 1], bottom[c + 1], bottom[c]};
+            for(int l = lo; l < hi; ++l)
+            {
+                float level = levels[size_t(l)];
+                int index = (h[0] >= level) << 3 | (h[1] >= level) << 2 | (h[2] >= level) << 1 | int(h[3] >= level);
+                bool centerHigh = (h[0] + h[1] + h[2] + h[3]) * 0.25f >= level;
+                const signed char* edges = kCases[index];
+                if((index == 5 or index == 10) and centerHigh != (index == 5)) edges = kCases[15 - index];
+
+                LevelTrace& t = traces[size_t(l)];
+                int numEdges = edges[2] < 0 ? 2 : 4;
+                int firstEnd = int(t.segments.size()) * 2;
+                for(int e = 0; e < numEdges; e += 2)
+                {
+                    t.segments.push_back({edgeKey(cols, r, c, edges[e]), edgeKey(cols, r, c, edges[e + 1]),
+                                          {edgePoint(h, r, c, edges[e], level), edgePoint(h, r, c, edges[e + 1], level)}});
+                    t.partners.push_back(-1);
+                    t.partners.push_back(-1);
+                }
+                // Claim the ends left open on the top and left edges before leaving new
+                // ones on the right and bottom edges, which share the same slots.
+                for(int e = 0; e < numEdges; ++e)
+                {
+                    int end = -1;
+                    if(edges[e] == 0) end = above.at(c, l);
+                    else if(edges[e] == 3 and t.right.key == edgeKey(cols, r, c, 3)) end = t.right.end;
+                    if(end < 0) continue;
+                    t.partners[size_t(firstEnd + e)] = end;
+                    t.partners[size_t(end)] = firstEnd + e;
+                }
+                for(int e = 0; e < numEdges; ++e)
+                {
+                    if(edges[e] == 2) below.at(c, l) = firstEnd + e;
+                    else if(edges[e] == 1) t.right = {edgeKey(cols, r, c, 1), firstEnd + e};
+                }
+            }
+        }
+        topBrackets.swap(bottomBrackets);
+        std::swap(above, below);
+        above.brackets = topBrackets.data();
+    }
+}
+
+} //namespace
+
+std::vector<float> contourLevels(float lo, float hi, float interval)
+{
+    std::vector<float> levels;
+    if(not (interval > 0.0f) or not (hi > lo)) return levels;
+    double first = std::floor(double(lo) / interval) + 1.0;
+    double last = std::floor(double(hi) / interval);
+    if(last - first >= double(kMaxContourLevels)) return levels;
+    for(double i = first; i <= last; ++i) levels.push_back(float(i * interval));
+    return levels;
+}
+
+std::vector<float> contourLevels(const tv::HeightGrid& grid, float noData, float interval)
+{
+    float lo = 0.0f, hi = 0.0f;
+    bool any = false;
+    for(size_t i = 0; i < grid.size(); ++i)
+    {
+        float h = grid.data()[i];
+        if(h == noData) continue;
+        lo = any ? std::min(lo, h) : h;
+        hi = any ? std::max(hi, h) : h;
+        any = true;
+    }
+    return contourLevels(lo, hi, interval);
+}
+
+std::vector<Contour> traceContours(const tv::HeightGrid& grid, const std::vector<float>& levels, float noData)
+{
+    std::vector<Contour> contours;
+    size_t cellRows = grid.numRows() > 1 ? grid.numRows() - 1 : 0;
+    if(cellRows == 0 or grid.numCols() < 2 or levels.empty()) return contours;
+
+    // More bands than workers so that bands crossing few lines do not leave cores idle.
+    size_t numBands = std::max<size_t>(1, std::min(cellRows / 32, tv::numWorkers() * 4));
+    std::vector<std::vector<std::vector<Chain>>> bands(numBands);
+    tv::parallelTasks(numBands, [&](size_t band)
+    {
+        size_t row0 = cellRows * band / numBands;
+        size_t row1 = cellRows * (band + 1) / numBands;
+        std::vector<LevelTrace> traces(levels.size());
+        traceBand(grid, levels, noData, row0, row1, traces);
+        bands[band].resize(levels.size());
+        for(size_t l = 0; l < levels.size(); ++l)
+        {
+            bands[band][l] = link(traces[l].segments, traces[l].partners);
+            traces[l] = LevelTrace();
+        }
+    });
+
+    // A chain continues in the next band when one of its ends is a horizontal edge on
+    // the first row of a band.
+    size_t cols = grid.numCols();
+    std::vector<char> seam(grid.numRows(), 0);
+    for(size_t band = 1; band < numBands; ++band) seam[cellRows * band / numBands] = 1;
+    auto onSeam = [&](uint64_t key){return not (key & 1) and seam[size_t(key >> 1) / cols];};
+
+    std::vector<std::vector<Contour>> perLevel(levels.size());
+    tv::parallelTasks(levels.size(), [&](size_t l)
+    {
+        std::vector<Chain> open;
+        auto emit = [&](Chain& chain)
+        {
+            perLevel[l].push_back({levels[l], chain.closed, std::move(chain.points)});
+        };
+        for(auto& band : bands)
+        {
+            for(Chain& chain : band[l])
+            {
+                if(not chain.closed and (onSeam(chain.head) or onSeam(chain.tail))) open.push_back(std::move(chain));
+                else emit(chain);
+            }
+        }
+        std::vector<Chain> joined = link(open, matchEnds(open));
+        for(Chain& chain : joined) emit(chain);
+    });
+
+    for(auto& level : perLevel)
+    {
+        for(Contour& contour : level) contours.push_back(std::move(contour));
+    }
+    return contours;
+}
+
+} //namespace analysis
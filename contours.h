@@ -0,0 +1,48 @@
+#ifndef CONTOURS_H
+#define CONTOURS_H
+
+#include "heightgrid.h"
+#include <QVector2D>
+#include <vector>
+
+namespace analysis
+{
+
+/**
+ * One contour line. Points are grid positions, x being the row and y the column, so
+ * they map directly onto the mesh. Closed lines repeat their first point at the end.
+ */
+struct Contour
+{
+    float                   level   = 0.0f;
+    bool                    closed  = false;
+    std::vector<QVector2D>  points;
+};
+
+/**
+ * More levels than this are not traced: their lines would fill the view, and every level
+ * costs memory in every band.
+ */
+constexpr size_t kMaxContourLevels = 1000;
+
+/**
+ * Multiples of interval in (lo, hi], the levels a surface ranging from lo to hi crosses.
+ * None if there would be more than kMaxContourLevels.
+ */
+std::vector<float> contourLevels(float lo, float hi, float interval);
+
+/**
+ * Evenly spaced levels covering the samples of the grid that are not NODATA.
+ */
+std::vector<float> contourLevels(const tv::HeightGrid& grid, float noData, float interval);
+
+/**
+ * Traces the given ascending levels with marching squares. The grid is split into row
+ * bands that are traced and linked in parallel; lines that cross a band seam are joined
+ * afterwards. Cells with a NODATA corner are skipped, which ends lines at data holes.
+ */
+std::vector<Contour> traceContours(const tv::HeightGrid& grid, const std::vector<float>& levels, float noData);
+
+} //namespace analysis
+
+#endif // CONTOURS_H
@@ -0,0 +1,320 @@
+#include "decompressor.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <zlib.h>
+#ifdef TV_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace
+{
+
+/**
+ * Passes uncompressed data through.
+ */
+class CopySource
+{
+public:
+    CopySource(const char* begin, const char* end) :
+        m_next(begin),
+        m_end(end)
+    {}
+
+    bool fill(char* out, size_t size, size_t& filled, bool& done)
+    {
+        filled = std::min(size, size_t(m_end - m_next));
+        std::memcpy(out, m_next, filled);
+        m_next += filled;
+        done = m_next == m_end;
+        return true;
+    }
+
+private:
+    const char* m_next;
+    const char* m_end;
+};
+
+/**
+ * Inflates gzip data, including files of several concatenated members as written by
+ * parallel compressors. Zero bytes after the last member, as tape and block padded
+ * archives leave them, end the data.
+ */
+class GzipSource
+{
+public:
+    GzipSource(const char* begin, const char* end) :
+        m_next(begin),
+        m_end(end)
+    {
+        m_ok = inflateInit2(&m_zs, 15 + 16) == Z_OK;
+    }
+    ~GzipSource(){if(m_ok) inflateEnd(&m_zs);}
+
+    /**
+     * Fills out with up to size bytes. Returns false on corrupt or truncated data; done
+     * tells whether the data has ended.
+     */
+    bool fill(char* out, size_t size, size_t& filled, bool& done)
+    {
+        filled = 0;
+        done = false;
+        if(not m_ok) return false;
+        while(filled < size)
+        {
+            if(m_zs.avail_in == 0 and m_next < m_end)
+            {
+                //zlib counts input in 32 bits; larger files go in in pieces.
+                size_t piece = std::min<size_t>(size_t(m_end - m_next), UINT_MAX);
+                m_zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(m_next));
+                m_zs.avail_in = uInt(piece);
+                m_next += piece;
+            }
+            m_zs.next_out = reinterpret_cast<Bytef*>(out + filled);
+            m_zs.avail_out = uInt(size - filled);
+            int result = inflate(&m_zs, Z_NO_FLUSH);
+            filled = size - m_zs.avail_out;
+            if(result == Z_STREAM_END)
+            {
+                if(restIsZero())
+                {
+                    done = true;
+                    return true;
+                }
+                inflateReset(&m_zs);
+            }
+            else if(result != Z_OK)
+            {
+                bool truncated = result == Z_BUF_ERROR and m_zs.avail_in == 0 and m_next == m_end;
+                qDebug() << (truncated ? "Compressed grid ends early." : "Corrupt compressed grid:") << m_zs.msg;
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    bool        m_ok    = false;
+    const char* m_next;
+    const char* m_end;
+    z_stream    m_zs    = {};
+
+    bool restIsZero() const
+    {
+        auto zero = [](char c){return c == 0;};
+        const char* in = reinterpret_cast<const char*>(m_zs.next_in);
+        return std::all_of(in, in + m_zs.avail_in, zero) and std::all_of(m_next, m_end, zero);
+    }
+};
+
+#ifdef TV_WITH_ZSTD
+/**
+ * Decompresses zstd data, frame after frame.
+ */
+class ZstdSource
+{
+public:
+    ZstdSource(const char* begin, const char* end) :
+        m_stream(ZSTD_createDStream()),
+        m_in{begin, size_t(end - begin), 0}
+    {
+        if(m_stream) ZSTD_initDStream(m_stream);
+    }
+    ~ZstdSource(){ZSTD_freeDStream(m_stream);}
+
+    bool fill(char* out, size_t size, size_t& filled, bool& done)
+    {
+        filled = 0;
+        done = false;
+        if(not m_stream) return false;
+        ZSTD_outBuffer output{out, size, 0};
+        while(output.pos < output.size)
+        {
+            size_t result = ZSTD_decompressStream(m_stream, &output, &m_in);
+            filled = output.pos;
+            if(ZSTD_isError(result))
+            {
+                qDebug() << "Corrupt compressed grid:" << ZSTD_getErrorName(result);
+                return false;
+            }
+            if(m_in.pos == m_in.size)
+            {
+                //Output may still be buffered inside the stream; done once it is flushed.
+                if(result == 0)
+                {
+                    done = true;
+                    return true;
+                }
+                if(output.pos < output.size)
+                {
+                    qDebug() << "Compressed grid ends early.";
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+private:
+    ZSTD_DStream*   m_stream;
+    ZSTD_inBuffer   m_in;
+};
+#endif
+
+} //namespace
+
+namespace ascii
+{
+
+/**
+ * Starts decompressing right away. The compressed data must stay valid until the
+ * decompressor is destroyed.
+ */
+Decompressor::Decompressor(const char* begin, const char* end, Codec codec) :
+    m_begin(begin),
+    m_end(end),
+    m_codec(codec),
+    m_blocks(kNumBlocks, std::vector<char>(kCarry + kBlockSize))
+{
+    for(size_t i = 0; i < kNumBlocks; ++i) m_free.push_back(int(i));
+    m_thread = std::thread(&Decompressor::run, this);
+}
+
+Decompressor::~Decompressor()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stop = true;
+    }
+    m_changed.notify_all();
+    m_thread.join();
+}
+
+/**
+ * Hands the block taken before back to the ring and waits for the next one. Returns false
+ * at the end of the data or on an error, which hasFailed() tells apart afterwards, just as
+ * busyNsecs() then tells the time spent filling blocks.
+ */
+bool Decompressor::next(Block& block)
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    if(m_held >= 0)
+    {
+        m_free.push_back(m_held);
+        m_held = -1;
+        m_changed.notify_all();
+    }
+    m_changed.wait(lock, [this]()
+    {
+        return not m_full.empty() or m_done;
+    });
+    if(m_full.empty()) return false;
+    m_held = m_full.front().first;
+    block.data = m_blocks[size_t(m_held)].data() + kCarry;
+    block.size = m_full.front().second;
+    m_full.pop_front();
+    return true;
+}
+
+/**
+ * Tells the codec from the magic number at the start of a file.
+ */
+Decompressor::Codec Decompressor::detect(const char* begin, const char* end)
+{
+    const unsigned char gzip[2] = {0x1F, 0x8B};
+    const unsigned char zstd[4] = {0x28, 0xB5, 0x2F, 0xFD};
+    size_t size = size_t(end - begin);
+    if(size >= sizeof(gzip) and std::memcmp(begin, gzip, sizeof(gzip)) == 0) return Codec::Gzip;
+    if(size >= sizeof(zstd) and std::memcmp(begin, zstd, sizeof(zstd)) == 0) return Codec::Zstd;
+    return Codec::None;
+}
+
+/**
+ * zstd is only available in builds against libzstd.
+ */
+bool Decompressor::isSupported(Codec codec)
+{
+#ifdef TV_WITH_ZSTD
+    return true;
+#else
+    return codec != Codec::Zstd;
+#endif
+}
+
+//------->Private
+
+/**
+ * Waits for a block to fill. Returns -1 once the decompressor is being destroyed.
+ */
+int Decompressor::acquireFree()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_changed.wait(lock, [this]()
+    {
+        return not m_free.empty() or m_stop;
+    });
+    if(m_stop) return -1;
+    int block = m_free.front();
+    m_free.pop_front();
+    return block;
+}
+
+void Decompressor::publish(int block, size_t size, bool last, bool failed, long long busyNs)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_busyNs += busyNs;
+        if(size > 0) m_full.emplace_back(block, size);
+        else m_free.push_back(block);
+        m_done = last or failed;
+        m_failed = failed;
+    }
+    m_changed.notify_all();
+}
+
+void Decompressor::run()
+{
+    if(m_codec == Codec::None)
+    {
+        CopySource source(m_begin, m_end);
+        runWith(source);
+        return;
+    }
+    if(m_codec == Codec::Gzip)
+    {
+        GzipSource source(m_begin, m_end);
+        runWith(source);
+        return;
+    }
+#ifdef TV_WITH_ZSTD
+    if(m_codec == Codec::Zstd)
+    {
+        ZstdSource source(m_begin, m_end);
+        runWith(source);
+        return;
+    }
+#endif
+    int block = acquireFree();
+    if(block >= 0) publish(block, 0, true, true, 0);
+}
+
+template<typename Source>
+void Decompressor::runWith(Source& source)
+{
+    while(true)
+    {
+        int block = acquireFree();
+        if(block < 0) return;
+        QElapsedTimer timer;
+        timer.start();
+        size_t filled = 0;
+        bool done = false;
+        bool ok = source.fill(m_blocks[size_t(block)].data() + kCarry, kBlockSize, filled, done);
+        publish(block, filled, done, not ok, timer.nsecsElapsed());
+        if(done or not ok) return;
+    }
+}
+
+} //namespace ascii
@@ -0,0 +1,83 @@
+#ifndef DECOMPRESSOR_H
+#define DECOMPRESSOR_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ascii
+{
+
+/**
+ * Inflates a gzip or zstd compressed file on a thread of its own into a ring of a few
+ * fixed blocks, which the caller takes one after the other. Decompressing the next block
+ * thus overlaps with parsing the current one, and memory stays bounded by the ring
+ * whatever the file's size. Uncompressed data is copied as it is, which moves paging in
+ * a mapped file to the decompressor's thread as well.
+ *
+ * In front of every block lie kCarry bytes that belong to the caller, meant for the end
+ * of the block before that did not make a whole token.
+ */
+class Decompressor
+{
+public:
+    enum class Codec
+    {
+        None    = 0,
+        Gzip    = 1,
+        Zstd    = 2
+    };
+
+    /**
+     * A block of decompressed data, valid until the next call to next().
+     */
+    struct Block
+    {
+        char*   data    = nullptr;
+        size_t  size    = 0;
+    };
+
+    static constexpr size_t kBlockSize  = size_t(4) << 20;
+    static constexpr size_t kCarry      = 4096;
+    static constexpr size_t kNumBlocks  = 4;
+
+    Decompressor(const char* begin, const char* end, Codec codec);
+    ~Decompressor();
+    Decompressor(const Decompressor&) = delete;
+    Decompressor& operator=(const Decompressor&) = delete;
+    bool hasFailed() const{return m_failed;}
+    long long busyNsecs() const{return m_busyNs;}
+    bool next(Block& block);
+    static Codec detect(const char* begin, const char* end);
+    static bool isSupported(Codec codec);
+
+private:
+    const char*                     m_begin;
+    const char*                     m_end;
+    Codec                           m_codec;
+    int                             m_held      = -1;
+    std::vector<std::vector<char>>  m_blocks;
+
+    //> Shared with the decompressing thread
+    long long                       m_busyNs    = 0;
+    bool                            m_done      = false;
+    bool                            m_failed    = false;
+    bool                            m_stop      = false;
+    std::condition_variable         m_changed;
+    std::deque<int>                 m_free;
+    std::deque<std::pair<int, size_t>> m_full;
+    std::mutex                      m_lock;
+    std::thread                     m_thread;
+
+    int acquireFree();
+    void publish(int block, size_t size, bool last, bool failed, long long busyNs);
+    void run();
+    template<typename Source> void runWith(Source& source);
+};
+
+} //namespace ascii
+
+#endif // DECOMPRESSOR_H
@@ -0,0 +1,281 @@
+#include "difference.h"
+#include "parallel.h"
+#include "rasterkernels.h"
+#include "simd.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace analysis
+{
+
+namespace
+{
+
+constexpr size_t kMinChunkRows = 16;
+constexpr size_t kRampSamples = size_t(1) << 20;
+
+/**
+ * Neumaier's variant of Kahan summation, which stays exact when an addend is larger than
+ * the running sum.
+ */
+struct CompensatedSum
+{
+    double  sum         = 0.0;
+    double  error       = 0.0;
+
+    void add(double v)
+    {
+        double t = sum + v;
+        error += std::fabs(sum) >= std::fabs(v) ? (sum - t) + v : (v - t) + sum;
+        sum = t;
+    }
+    void add(const CompensatedSum& o)
+    {
+        add(o.sum);
+        add(o.error);
+    }
+    double value() const{return sum + error;}
+};
+
+struct Sums
+{
+    CompensatedSum  cut;
+    CompensatedSum  fill;
+    size_t          cutCount    = 0;
+    size_t          fillCount   = 0;
+    size_t          count       = 0;
+
+    void add(const Sums& o)
+    {
+        cut.add(o.cut);
+        fill.add(o.fill);
+        cutCount += o.cutCount;
+        fillCount += o.fillCount;
+        count += o.count;
+    }
+};
+
+void sumSpan(const float* diff, size_t i0, size_t n, Sums& sums)
+{
+    for(size_t i = i0; i < n; ++i)
+    {
+        float d = diff[i];
+        if(std::isnan(d)) continue;
+        ++sums.count;
+        if(d > 0.0f)
+        {
+            sums.fill.add(double(d));
+            ++sums.fillCount;
+        }
+        else if(d < 0.0f)
+        {
+            sums.cut.add(-double(d));
+            ++sums.cutCount;
+        }
+    }
+}
+
+#ifdef TV_HAS_AVX2
+
+TV_TARGET_AVX2 inline void kahanAdd(__m256d& sum, __m256d& error, __m256d v)
+{
+    __m256d y = _mm256_sub_pd(v, error);
+    __m256d t = _mm256_add_pd(sum, y);
+    error = _mm256_sub_pd(_mm256_sub_pd(t, sum), y);
+    sum = t;
+}
+
+TV_TARGET_AVX2 inline void kahanAdd(__m256d& sum, __m256d& error, __m256 v)
+{
+    kahanAdd(sum, error, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+    kahanAdd(sum, error, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+}
+
+/**
+ * Eight samples per step, summed in double precision with a Kahan sum per lane. NaN
+ * fails both comparisons and so drops out of the sums. Returns the first index left for
+ * the scalar path.
+ */
+TV_TARGET_AVX2 size_t sumSpanAvx2(const float* diff, size_t n, Sums& sums)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    __m256d cut = _mm256_setzero_pd();
+    __m256d cutError = _mm256_setzero_pd();
+    __m256d fill = _mm256_setzero_pd();
+    __m256d fillError = _mm256_setzero_pd();
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+        __m256 d = _mm256_loadu_ps(diff + i);
+        __m256 above = _mm256_cmp_ps(d, zero, _CMP_GT_OQ);
+        __m256 below = _mm256_cmp_ps(d, zero, _CMP_LT_OQ);
+        sums.count += size_t(__builtin_popcount(unsigned(_mm256_movemask_ps(_mm256_cmp_ps(d, d, _CMP_ORD_Q)))));
+        sums.fillCount += size_t(__builtin_popcount(unsigned(_mm256_movemask_ps(above))));
+        sums.cutCount += size_t(__builtin_popcount(unsigned(_mm256_movemask_ps(below))));
+        kahanAdd(fill, fillError, _mm256_and_ps(above, d));
+        kahanAdd(cut, cutError, _mm256_and_ps(below, _mm256_sub_ps(zero, d)));
+    }
+
+    double lanes[4][4];
+    _mm256_storeu_pd(lanes[0], cut);
+    _mm256_storeu_pd(lanes[1], cutError);
+    _mm256_storeu_pd(lanes[2], fill);
+    _mm256_storeu_pd(lanes[3], fillError);
+    for(int k = 0; k < 4; ++k)
+    {
+        sums.cut.add(lanes[0][k]);
+        sums.cut.add(-lanes[1][k]);
+        sums.fill.add(lanes[2][k]);
+        sums.fill.add(-lanes[3][k]);
+    }
+    return i;
+}
+
+#endif
+
+/**
+ * Column spans [first, second) of the samples whose centers at height y lie inside the
+ * polygon.
+ */
+void polygonSpans(const std::vector<QPointF>& polygon, double y, const GridGeoref& georef, size_t cols,
+                  std::vector<double>& crossings, std::vector<std::pair<size_t, size_t>>& spans)
+{
+    crossings.clear();
+    spans.clear();
+    for(size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++)
+    {
+        const QPointF& a = polygon[i];
+        const QPointF& b = polygon[j];
+        if((a.y() > y) == (b.y() > y)) continue;
+        crossings.push_back(a.x() + (y - a.y()) * (b.x() - a.x()) / (b.y() - a.y()));
+    }
+    std::sort(crossings.begin(), crossings.end());
+
+    auto column = [&](double x)
+    {
+        double c = std::ceil((x - georef.xllCorner) / georef.cellSize - 0.5);
+        return size_t(std::min(std::max(c, 0.0), double(cols)));
+    };
+    for(size_t i = 0; i + 1 < crossings.size(); i += 2)
+    {
+        size_t c0 = column(crossings[i]);
+        size_t c1 = column(crossings[i + 1]);
+        if(c1 > c0) spans.emplace_back(c0, c1);
+    }
+}
+
+} //namespace
+
+void differenceRows(const tv::HeightGrid& earlier, float noData, const GridGeoref& georef, const HeightSampler& later,
+                    size_t row0, size_t row1, tv::HeightGrid& out)
+{
+    size_t rows = earlier.numRows();
+    size_t cols = earlier.numCols();
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float laterNoData = later.noData();
+    tv::parallelFor(row0, std::min(row1, rows), [&](size_t r0, size_t r1, size_t)
+    {
+        std::vector<QPointF> points(cols);
+        std::vector<float> heights(cols);
+        for(size_t c = 0; c < cols; ++c) points[c].setX(georef.xllCorner + (double(c) + 0.5) * georef.cellSize);
+        for(size_t r = r0; r < r1; ++r)
+        {
+            double y = georef.yllCorner + (double(rows - r) - 0.5) * georef.cellSize;
+            for(QPointF& p : points) p.setY(y);
+            later.sample(points.data(), cols, heights.data());
+
+            const float* src = earlier.row(r);
+            float* dst = out.row(r);
+            for(size_t c = 0; c < cols; ++c)
+            {
+                dst[c] = src[c] == noData or heights[c] == laterNoData ? nan : heights[c] - src[c];
+            }
+        }
+    }, kMinChunkRows);
+}
+
+CutFill cutFill(const tv::HeightGrid& diff, const GridGeoref& georef, const std::vector<QPointF>& polygon)
+{
+    size_t rows = diff.numRows();
+    size_t cols = diff.numCols();
+    bool clip = polygon.size() >= 3;
+    bool simd = tv::hasAvx2();
+
+    std::vector<Sums> chunkSums(tv::numWorkers());
+    size_t chunks = tv::parallelFor(0, rows, [&](size_t r0, size_t r1, size_t chunk)
+    {
+        Sums sums;
+        std::vector<double> crossings;
+        std::vector<std::pair<size_t, size_t>> spans;
+        if(not clip) spans.emplace_back(0, cols);
+        for(size_t r = r0; r < r1; ++r)
+        {
+            if(clip) polygonSpans(polygon, georef.yllCorner + (double(rows - r) - 0.5) * georef.cellSize, georef, cols,
+                                  crossings, spans);
+            for(const auto& [c0, c1] : spans)
+            {
+                //Every row starts a sum of its own, which keeps the lane sums small.
+                Sums row;
+                const float* src = diff.row(r) + c0;
+                size_t i = 0;
+#ifdef TV_HAS_AVX2
+                if(simd) i = sumSpanAvx2(src, c1 - c0, row);
+#else
+                (void)simd;
+#endif
+                sumSpan(src, i, c1 - c0, row);
+                sums.add(row);
+            }
+        }
+        chunkSums[chunk] = sums;
+    }, kMinChunkRows);
+
+    //Chunks are combined in order, so the result does not depend on the thread timing.
+    Sums total;
+    for(size_t i = 0; i < chunks; ++i) total.add(chunkSums[i]);
+    double cellArea = georef.cellSize * georef.cellSize;
+    CutFill result;
+    result.cut = total.cut.value() * cellArea;
+    result.fill = total.fill.value() * cellArea;
+    result.cutArea = double(total.cutCount) * cellArea;
+    result.fillArea = double(total.fillCount) * cellArea;
+    result.area = double(total.count) * cellArea;
+    return result;
+}
+
+float differenceOverlay(const tv::HeightGrid& diff, std::vector<qfloat16>& out)
+{
+    size_t count = diff.numRows() * diff.numCols();
+    const float* src = diff.data();
+
+    std::vector<float> magnitudes;
+    size_t stride = std::max<size_t>(1, count / kRampSamples);
+    magnitudes.reserve(count / stride + 1);
+    for(size_t i = 0; i < count; i += stride)
+    {
+        if(not std::isnan(src[i])) magnitudes.push_back(std::fabs(src[i]));
+    }
+    float span = 0.0f;
+    if(not magnitudes.empty())
+    {
+        auto nth = magnitudes.begin() + std::ptrdiff_t(double(magnitudes.size() - 1) * 0.99);
+        std::nth_element(magnitudes.begin(), nth, magnitudes.end());
+        span = *nth;
+    }
+    if(not (span > 0.0f)) span = 1.0f;
+
+    out.resize(count);
+    qfloat16* dst = out.data();
+    const float scale = 1.0f / span;
+    tv::parallelFor(0, count, [&](size_t i0, size_t i1, size_t)
+    {
+        for(size_t i = i0; i < i1; ++i)
+        {
+            dst[i] = qfloat16(std::isnan(src[i]) ? kNoValue : 1.0f + std::min(std::max(src[i] * scale, -1.0f), 1.0f));
+        }
+    }, size_t(1) << 16);
+    return span;
+}
+
+} //namespace analysis
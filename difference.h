@@ -0,0 +1,59 @@
+#ifndef DIFFERENCE_H
+#define DIFFERENCE_H
+
+#include "heightgrid.h"
+#include "heightsampler.h"
+#include <QFloat16>
+#include <QPointF>
+#include <vector>
+
+namespace analysis
+{
+
+/**
+ * Volumes between two surfaces in cubic height units: cut where the later surface lies
+ * below the earlier one, fill where it lies above, both positive. The areas count the
+ * samples with a difference in square map units, the cells of equal height included in
+ * neither.
+ */
+struct CutFill
+{
+    double  cut         = 0.0;
+    double  fill        = 0.0;
+    double  cutArea     = 0.0;
+    double  fillArea    = 0.0;
+    double  area        = 0.0;
+
+    double net() const{return fill - cut;}
+};
+
+/**
+ * Heights of the later grid, bilinearly resampled at the sample centers of the earlier
+ * one, minus the earlier heights, for rows [row0, row1) of the earlier grid. They are
+ * written to out, which must already have the earlier grid's size, so a caller can
+ * compute the difference in bands. Samples where either grid has no height are NaN. The
+ * grids may differ in cell size and origin; rows are resampled in parallel, eight
+ * samples at a time with AVX2 where available.
+ */
+void differenceRows(const tv::HeightGrid& earlier, float noData, const GridGeoref& georef, const HeightSampler& later,
+                    size_t row0, size_t row1, tv::HeightGrid& out);
+
+/**
+ * Cut and fill of a difference grid placed by georef, over the samples whose centers lie
+ * inside the polygon in map coordinates (even-odd rule), or over all samples if it has
+ * fewer than three vertices. Rows are summed in parallel with compensated summation, so
+ * the volumes of 10^8 samples keep their precision.
+ */
+CutFill cutFill(const tv::HeightGrid& diff, const GridGeoref& georef, const std::vector<QPointF>& polygon = {});
+
+/**
+ * Maps a difference grid to an overlay raster of half floats, row by row like the grid:
+ * 1 where nothing changed, 0 and 2 for the largest cut and fill drawn, kNoValue without
+ * a difference. The ramp spans the 99th percentile of the absolute differences, so that
+ * a few spikes do not wash it out; the span is returned.
+ */
+float differenceOverlay(const tv::HeightGrid& diff, std::vector<qfloat16>& out);
+
+} //namespace analysis
+
+#endif // DIFFERENCE_H
@@ -1,16 +1,45 @@
 #include "esriasciiireader.h"
 #include <QDebug>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <thread>
 
 namespace ascii
 {
 
-EsriAsciiReader::EsriAsciiReader(const QString &fName) :
+namespace
+{
+
+inline bool sameKey(const char* p, const char* e, const char* key)
+{
+    size_t len = std::strlen(key);
+    if(size_t(e - p) != len) return false;
+    for(size_t i = 0; i < len; ++i)
+    {
+        if(std::tolower(static_cast<unsigned char>(p[i])) != key[i]) return false;
+    }
+    return true;
+}
+
+} //namespace
+
+/**
+ * Loads the grid and builds its mesh. With a queue, every part of the mesh that is done
+ * is handed on while the rest is still being read; the queue is closed at the end, and
+ * after a failure the parts handed on are of no use.
+ */
+EsriAsciiReader::EsriAsciiReader(const QString &fName, MeshBlockQueue* meshBlocks) :
     m_file(fName)
 {
-    openFile();
-    readContents();
-    calculateNormals();
-    closeFile();
+    if(openFile())
+    {
+        m_valid = readContents(meshBlocks);
+        closeFile();
+    }
+    if(meshBlocks) meshBlocks->close();
 }
 
 bool EsriAsciiReader::openFile()
@@ -20,75 +49,449 @@ bool EsriAsciiReader::openFile()
     return false;
 }
 
-void EsriAsciiReader::calculateNormals()
+void EsriAsciiReader::closeFile()
+{
+    m_file.close();
+}
+
+/**
+ * Frees the CPU side mesh in one go, e.g. once it lives on the GPU. The height grid
+ * stays, and vertexAt() rebuilds single vertices from it on demand.
+ */
+void EsriAsciiReader::releaseMesh()
 {
-    int count = 0;
-    for(GLuint i : m_indices)
+    m_indices = Indices(&m_arena);
+    m_vertices = Vertices(&m_arena);
+    m_arena.release();
+    m_dirty.clear();
+}
+
+/**
+ * Sets a single sample, see editHeights().
+ */
+void EsriAsciiReader::setHeight(size_t row, size_t col, float sample)
+{
+    editHeights(tv::GridRect(row, col, row + 1, col + 1), [sample](size_t, size_t, float)
     {
-        if(count % 3 == 0)
+        return sample;
+    });
+}
+
+/**
+ * Mesh vertex of a grid sample, computed from the height grid.
+ */
+tv::Vertex3d EsriAsciiReader::vertexAt(size_t row, size_t col) const
+{
+    return tv::Vertex3d(QVector3D(row * m_cellSize, col * m_cellSize, m_grid.at(row, col) * m_srcCellSize));
+}
+
+/**
+ * Moves the vertices of changed samples. The recorded dirty region grows by one cell, as
+ * the normals of the direct neighbours change as well. Without a CPU mesh only the dirty
+ * region is recorded.
+ */
+void EsriAsciiReader::heightsChanged(const tv::GridRect& rect)
+{
+    tv::GridRect border = rect.expanded(1, m_rows, m_cols);
+    if(hasMesh())
+    {
+        for(size_t row = rect.row0; row < rect.row1; ++row)
         {
-            QVector3D norm = QVector3D::crossProduct(m_vertices[i].pos - m_vertices[i + 1].pos,
-                                                     m_vertices[i].pos - m_vertices[i + 2].pos).normalized();
-            m_vertices[i].norm = m_vertices[i + 1].norm = m_vertices[i + 2].norm = norm;
+            for(size_t col = rect.col0; col < rect.col1; ++col)
+            {
+                m_vertices[row * m_cols + col].pos.setZ(m_grid.at(row, col) * m_srcCellSize);
+            }
         }
-        ++count;
+    }
+    growTiles(rect);
+
+    for(tv::GridRect& d : m_dirty)
+    {
+        if(d.touches(border))
+        {
+            d = d.united(border);
+            return;
+        }
+    }
+    m_dirty.push_back(border);
+    //Many scattered edits are cheaper as one upload than as many small ones.
+    if(m_dirty.size() > 32)
+    {
+        tv::GridRect all;
+        for(const tv::GridRect& d : m_dirty) all = all.united(d);
+        m_dirty.assign(1, all);
     }
 }
 
-void EsriAsciiReader::closeFile()
+/**
+ * Widens the height bounds of the tiles that share vertices with the rectangle to the
+ * heights in it. Bounds only ever grow, which keeps them conservative for culling.
+ */
+void EsriAsciiReader::growTiles(const tv::GridRect& rect)
 {
-    m_file.close();
+    if(m_tiles.empty()) return;
+    float zMin = m_grid.at(rect.row0, rect.col0);
+    float zMax = zMin;
+    for(size_t row = rect.row0; row < rect.row1; ++row)
+    {
+        const float* line = m_grid.row(row);
+        for(size_t col = rect.col0; col < rect.col1; ++col)
+        {
+            zMin = std::min(zMin, line[col]);
+            zMax = std::max(zMax, line[col]);
+        }
+    }
+    zMin *= m_srcCellSize;
+    zMax *= m_srcCellSize;
+
+    //A vertex on a tile border belongs to the tiles on both sides.
+    size_t tilesAcross = (m_cols - 2) / kTileSize + 1;
+    size_t tilesDown = m_tiles.size() / tilesAcross;
+    size_t band0 = rect.row0 > 0 ? (rect.row0 - 1) / kTileSize : 0;
+    size_t band1 = std::min((rect.row1 - 1) / kTileSize + 1, tilesDown);
+    size_t tile0 = rect.col0 > 0 ? (rect.col0 - 1) / kTileSize : 0;
+    size_t tile1 = std::min((rect.col1 - 1) / kTileSize + 1, tilesAcross);
+    for(size_t band = band0; band < band1; ++band)
+    {
+        for(size_t t = tile0; t < tile1; ++t)
+        {
+            tv::MeshTile& tile = m_tiles[band * tilesAcross + t];
+            tile.bounds.min.setZ(std::min(tile.bounds.min.z(), zMin));
+            tile.bounds.max.setZ(std::max(tile.bounds.max.z(), zMax));
+        }
+    }
+}
+
+/**
+ * Maps the file into memory and interpretates it in place. Falls back to a single
+ * read of the whole file if the device cannot be mapped.
+ */
+bool EsriAsciiReader::readContents(MeshBlockQueue* meshBlocks)
+{
+    qint64 size = m_file.size();
+    if(uchar* mapped = m_file.map(0, size))
+    {
+        const char* begin = reinterpret_cast<const char*>(mapped);
+        bool ok = readContents(begin, begin + size, meshBlocks);
+        m_file.unmap(mapped);
+        return ok;
+    }
+    QByteArray data = m_file.readAll();
+    return readContents(data.constData(), data.constData() + data.size(), meshBlocks);
 }
 
 /**
- * Interpretates the contents of an esri ascii file.
+ * Interpretates the contents of an esri ascii file as a pipeline over blocks of the file:
+ * the decompressor's thread reads, and inflates if the file is compressed, the calling
+ * thread parses and a mesh thread builds vertices, normals and indices of the rows parsed
+ * so far. Queues between the stages hold a few blocks, so the load takes about as long
+ * as its slowest stage. A token cut by the end of a block is moved in front of the next
+ * one; the header has to lie within the first block.
  */
-void EsriAsciiReader::readContents()
+bool EsriAsciiReader::readContents(const char* begin, const char* end, MeshBlockQueue* meshBlocks)
 {
-    QTextStream in(&m_file);
-    m_cols          = (in.readLine().split(" ", Qt::SkipEmptyParts))[1].toLong();
-    m_rows          = (in.readLine().split(" ", Qt::SkipEmptyParts))[1].toLong();
-    m_xllCorner     = (in.readLine().split(" ", Qt::SkipEmptyParts))[1].toDouble();
-    m_yllCorner     = (in.readLine().split(" ", Qt::SkipEmptyParts))[1].toDouble();
-    m_cellSize      = 1.0;
-    double cellSize = (in.readLine().split(" ", Qt::SkipEmptyParts))[1].toDouble();
-    m_noDataValue   = (in.readLine().split(" ", Qt::SkipEmptyParts))[1].toInt();
+    Decompressor::Codec codec = Decompressor::detect(begin, end);
+    if(not Decompressor::isSupported(codec))
+    {
+        qDebug() << "File" << m_file.fileName() << "is compressed with zstd, which this build cannot read.";
+        return false;
+    }
 
+    Decompressor source(begin, end, codec);
+    Decompressor::Block block;
+    tv::BoundedQueue<size_t> parsedRows(kQueuedBlocks);
+    std::thread mesher;
+    std::vector<char> tail;
+    QElapsedTimer timer;
+    qint64 parseNs = 0;
+    bool ok = true;
+    bool header = true;
+    size_t n = 0;
+    while(ok and source.next(block))
+    {
+        timer.start();
+        if(tail.size() > Decompressor::kCarry)
+        {
+            qDebug() << "Overlong token in" << m_file.fileName();
+            ok = false;
+            break;
+        }
+        char* p = block.data - tail.size();
+        std::copy(tail.begin(), tail.end(), p);
+        const char* blockEnd = block.data + block.size;
+        const char* cut = blockEnd;
+        while(cut > p and not isBlank(cut[-1])) --cut;
+
+        const char* q = p;
+        if(header)
+        {
+            ok = readHeader(q, cut);
+            if(not ok) break;
+            header = false;
+            allocateMesh();
+            mesher = std::thread(&EsriAsciiReader::meshRows, this, std::ref(parsedRows), meshBlocks);
+        }
+        bool stopped = readBody(q, cut, n) < cut and n < m_grid.size();
+        if(stopped) tail.clear();
+        else tail.assign(cut, blockEnd);
+        parseNs += timer.nsecsElapsed();
+        parsedRows.push(n / m_cols);
+        if(stopped) break;
+    }
+    if(ok and not header and not tail.empty())
+    {
+        timer.start();
+        readBody(tail.data(), tail.data() + tail.size(), n);
+        parseNs += timer.nsecsElapsed();
+        parsedRows.push(n / m_cols);
+    }
+    parsedRows.close();
+    if(mesher.joinable()) mesher.join();
+    if(not ok) return false;
+    if(source.hasFailed() or header)
+    {
+        qDebug() << "Cannot read" << m_file.fileName();
+        return false;
+    }
+
+    m_loadTimes.read = double(source.busyNsecs()) / 1e6;
+    m_loadTimes.parse = double(parseNs) / 1e6;
+    return finishContents(n);
+}
+
+/**
+ * Checks that the samples filled the grid.
+ */
+bool EsriAsciiReader::finishContents(size_t n)
+{
+    if(n != m_grid.size())
+    {
+        qDebug() << "File" << m_file.fileName() << "ended after" << n << "of" << m_grid.size() << "samples.";
+        return false;
+    }
+    qDebug() << "Samples:" << sampleTypeName(m_sampleType);
+    qDebug() << "Mesh arena:" << m_arena.bytesAllocated() << "bytes in" << m_arena.numAllocations() << "allocations";
+    qDebug() << "Load stages in ms: read" << m_loadTimes.read << "parse" << m_loadTimes.parse << "mesh" << m_loadTimes.mesh;
+    return true;
+}
+
+/**
+ * Parses samples into the grid from sample n on, in the type found by readHeader(). A token
+ * that type rejects switches to double for the rest. Returns where parsing stopped.
+ */
+const char* EsriAsciiReader::readBody(const char* p, const char* end, size_t& n)
+{
+    switch(m_sampleType)
+    {
+    case SampleType::Int16:     p = readSamples<int16_t>(p, end, n);   break;
+    case SampleType::Int32:     p = readSamples<int32_t>(p, end, n);   break;
+    case SampleType::Float:     p = readSamples<float>(p, end, n);     break;
+    case SampleType::Double:    p = readSamples<double>(p, end, n);    break;
+    }
+    if(n < m_grid.size() and p < end and m_sampleType != SampleType::Double)
+    {
+        qDebug() << sampleTypeName(m_sampleType) << "parser stopped at sample" << n << "- continuing as double";
+        m_sampleType = SampleType::Double;
+        p = readSamples<double>(p, end, n);
+    }
+    return p;
+}
+
+/**
+ * Parses the header up to the first sample, where p is left, sizes the grid and guesses
+ * the sample type from the first rows.
+ */
+bool EsriAsciiReader::readHeader(const char*& p, const char* end)
+{
+    p = skipSpace(p, end);
+    bool centered = false;
+    bool floatHint = false;
+    while(p < end and std::isalpha(static_cast<unsigned char>(*p)))
+    {
+        const char* keyEnd = tokenEnd(p, end);
+        const char* val = skipSpace(keyEnd, end);
+        const char* valEnd = tokenEnd(val, end);
+        double value = 0.0;
+        if(std::from_chars(skipPlus(val, valEnd), valEnd, value).ec != std::errc())
+        {
+            qDebug() << "Malformed header in" << m_file.fileName();
+            return false;
+        }
+        if(sameKey(p, keyEnd, "ncols"))                 m_cols = size_t(value);
+        else if(sameKey(p, keyEnd, "nrows"))            m_rows = size_t(value);
+        else if(sameKey(p, keyEnd, "xllcorner"))        m_xllCorner = value;
+        else if(sameKey(p, keyEnd, "yllcorner"))        m_yllCorner = value;
+        else if(sameKey(p, keyEnd, "xllcenter"))        {m_xllCorner = value; centered = true;}
+        else if(sameKey(p, keyEnd, "yllcenter"))        {m_yllCorner = value; centered = true;}
+        else if(sameKey(p, keyEnd, "cellsize"))         m_srcCellSize = value;
+        else if(sameKey(p, keyEnd, "nodata_value"))
+        {
+            int32_t intValue = 0;
+            m_noDataValue = int(value);
+            floatHint = not parseSample(val, valEnd, intValue);
+        }
+        p = skipSpace(valEnd, end);
+    }
+    if(centered)
+    {
+        m_xllCorner -= m_srcCellSize / 2.0;
+        m_yllCorner -= m_srcCellSize / 2.0;
+    }
+    if(m_cols < 2 or m_rows < 2)
+    {
+        qDebug() << "Grid in" << m_file.fileName() << "is too small:" << m_cols << "x" << m_rows;
+        return false;
+    }
+
+    m_cellSize = 1.0;
+    m_grid.resize(m_cols, m_rows);
+
+    //Integer grids take the integer parser; a token it rejects hands the rest to double.
+    m_sampleType = sniffSampleType(p, end, 4 * m_cols);
+    if(floatHint and (m_sampleType == SampleType::Int16 or m_sampleType == SampleType::Int32))
+    {
+        m_sampleType = SampleType::Float;
+    }
+    return true;
+}
+
+/**
+ * Parses samples as T into the height grid, starting at sample n, until the grid is full
+ * or a token is not a valid T. Returns where parsing stopped.
+ */
+template<typename T>
+const char* EsriAsciiReader::readSamples(const char* p, const char* end, size_t& n)
+{
+    float* out = m_grid.data();
+    size_t total = m_grid.size();
+    while(n < total)
+    {
+        p = skipSpace(p, end);
+        if(p == end) break;
+        T value;
+        const char* next = parseSample(p, end, value);
+        if(not next) break;
+        out[n++] = float(value);
+        p = next;
+    }
+    return p;
+}
+
+/**
+ * Reserves the vertex and index arrays, which the mesh thread then fills row by row
+ * without them ever moving.
+ */
+void EsriAsciiReader::allocateMesh()
+{
+    size_t numIndices = (m_cols - 1) * (m_rows - 1) * 6;
+    m_arena.reserve(m_cols * m_rows * sizeof(tv::Vertex3d) + numIndices * sizeof(GLuint) + 64);
     m_vertices.reserve(m_cols * m_rows);
-    m_indices.reserve((m_cols - 1) * (m_rows - 1) * 6);
+    m_indices.reserve(numIndices);
+    size_t tilesDown = (m_rows - 1 + kTileSize - 1) / kTileSize;
+    size_t tilesAcross = (m_cols - 1 + kTileSize - 1) / kTileSize;
+    m_tiles.clear();
+    m_tiles.reserve(tilesDown * tilesAcross);
+}
 
-    size_t col = 0, row = 0;
-    double min = 100000, max = -100000;
-    while(!in.atEnd())
+/**
+ * Appends the triangles of the quad rows [row0, row1) tile by tile, so that every tile
+ * is one range of the index array, and records each tile's bounds. The vertices of the
+ * rows and of the row below them must be built.
+ */
+void EsriAsciiReader::buildBand(size_t row0, size_t row1)
+{
+    for(size_t col0 = 0; col0 < m_cols - 1; col0 += kTileSize)
     {
-        QString line = in.readLine();
-        for(const QString& str : line.split(" ", Qt::SkipEmptyParts))
+        size_t col1 = std::min(col0 + kTileSize, m_cols - 1);
+        tv::MeshTile tile;
+        tile.firstIndex = m_indices.size();
+        float zMin = m_vertices[row0 * m_cols + col0].pos.z();
+        float zMax = zMin;
+        for(size_t row = row0; row <= row1; ++row)
         {
-            if(col == m_cols)
+            for(size_t col = col0; col <= col1; ++col)
             {
-                col = 0;
-                ++row;
-            }
-            if(not str.isEmpty())
-            {
-                if(col < m_cols - 1 and row < m_rows - 1)
-                {
-                    size_t resCol = col + row * m_cols;
-                    m_indices.push_back(resCol);
-                    m_indices.push_back(resCol + m_cols);
-                    m_indices.push_back(resCol + 1);
-                    m_indices.push_back(resCol + 1);
-                    m_indices.push_back(resCol + m_cols);
-                    m_indices.push_back(resCol + m_cols + 1);
-                }
-                double value = str.toDouble() * cellSize;
-                min = std::min(value, min);
-                max = std::max(value, max);
-                m_vertices.emplace_back(QVector3D(row * m_cellSize, col * m_cellSize, value), QVector3D());
-                ++col;
+                size_t resCol = col + row * m_cols;
+                float z = m_vertices[resCol].pos.z();
+                zMin = std::min(zMin, z);
+                zMax = std::max(zMax, z);
+                if(row == row1 or col == col1) continue;
+                m_indices.push_back(resCol);
+                m_indices.push_back(resCol + m_cols);
+                m_indices.push_back(resCol + 1);
+                m_indices.push_back(resCol + 1);
+                m_indices.push_back(resCol + m_cols);
+                m_indices.push_back(resCol + m_cols + 1);
             }
         }
+        tile.numIndices = m_indices.size() - tile.firstIndex;
+        tile.bounds.min = QVector3D(row0 * m_cellSize, col0 * m_cellSize, zMin);
+        tile.bounds.max = QVector3D(row1 * m_cellSize, col1 * m_cellSize, zMax);
+        m_tiles.push_back(tile);
+    }
+}
+
+/**
+ * Appends the vertices of rows [row0, row1), which must be parsed.
+ */
+void EsriAsciiReader::buildRows(size_t row0, size_t row1, double& min, double& max)
+{
+    for(size_t row = row0; row < row1; ++row)
+    {
+        const float* line = m_grid.row(row);
+        for(size_t col = 0; col < m_cols; ++col)
+        {
+            double value = line[col] * m_srcCellSize;
+            min = std::min(value, min);
+            max = std::max(value, max);
+            m_vertices.emplace_back(QVector3D(row * m_cellSize, col * m_cellSize, value));
+        }
+    }
+}
+
+/**
+ * Mesh thread: takes the number of rows parsed so far and builds their vertices, then the
+ * triangles of every band of tiles whose vertices are all built. Hands each part built on
+ * to the queue, if any.
+ */
+void EsriAsciiReader::meshRows(tv::BoundedQueue<size_t>& parsedRows, MeshBlockQueue* meshBlocks)
+{
+    QElapsedTimer timer;
+    qint64 meshNs = 0;
+    double min = 100000, max = -100000;
+    size_t done = 0;
+    size_t bandRow = 0;
+    size_t parsed = 0;
+    while(parsedRows.pop(parsed))
+    {
+        size_t upTo = std::min(parsed, m_rows);
+        if(upTo <= done) continue;
+        timer.start();
+        buildRows(done, upTo, min, max);
+        size_t firstIndex = m_indices.size();
+        while(bandRow < m_rows - 1 and std::min(bandRow + kTileSize, m_rows - 1) < upTo)
+        {
+            size_t bandEnd = std::min(bandRow + kTileSize, m_rows - 1);
+            buildBand(bandRow, bandEnd);
+            bandRow = bandEnd;
+        }
+        meshNs += timer.nsecsElapsed();
+        if(meshBlocks)
+        {
+            MeshBlock block;
+            block.firstVertex = done * m_cols;
+            block.numVertices = (upTo - done) * m_cols;
+            block.vertices = m_vertices.data() + block.firstVertex;
+            block.firstIndex = firstIndex;
+            block.numIndices = m_indices.size() - firstIndex;
+            block.indices = m_indices.data() + block.firstIndex;
+            block.totalVertices = m_rows * m_cols;
+            block.totalIndices = (m_rows - 1) * (m_cols - 1) * 6;
+            meshBlocks->push(block);
+        }
+        done = upTo;
     }
+    m_loadTimes.mesh = double(meshNs) / 1e6;
     qDebug() << "Min:" << min << "Max:" << max;
 }
 
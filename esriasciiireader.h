@@ -1,6 +1,11 @@
 #ifndef ESRIASCIIREADER_H
 #define ESRIASCIIREADER_H
 
+#include "arena.h"
+#include "boundedqueue.h"
+#include "decompressor.h"
+#include "gridparser.h"
+#include "heightgrid.h"
 #include "utils.h"
 #include <QFile>
 
@@ -10,36 +15,123 @@ namespace ascii
 class EsriAsciiReader
 {
 public:
-    EsriAsciiReader(const QString& string);
+    /**
+     * Vertices and triangles of the mesh that are complete, as offsets into the whole
+     * vertex and index arrays. The data stays valid as long as the reader and its mesh.
+     */
+    struct MeshBlock
+    {
+        const tv::Vertex3d* vertices        = nullptr;
+        const GLuint*       indices         = nullptr;
+        size_t              firstVertex     = 0;
+        size_t              numVertices     = 0;
+        size_t              firstIndex      = 0;
+        size_t              numIndices      = 0;
+        size_t              totalVertices   = 0;
+        size_t              totalIndices    = 0;
+    };
+    using MeshBlockQueue = tv::BoundedQueue<MeshBlock>;
+
+    /**
+     * Time each load stage was busy, in milliseconds.
+     */
+    struct LoadTimes
+    {
+        double  read    = 0.0;
+        double  parse   = 0.0;
+        double  mesh    = 0.0;
+    };
+
+    static constexpr size_t kQueuedBlocks = 4;
+    static constexpr size_t kTileSize = 64;
+
+    explicit EsriAsciiReader(const QString& fName, MeshBlockQueue* meshBlocks = nullptr);
+    EsriAsciiReader(const EsriAsciiReader&) = delete;
+    EsriAsciiReader& operator=(const EsriAsciiReader&) = delete;
     const Indices& indexArray() const{return m_indices;}
+    const LoadTimes& loadTimes() const{return m_loadTimes;}
+    const std::vector<tv::MeshTile>& meshTiles() const{return m_tiles;}
+    const tv::HeightGrid& heightGrid() const{return m_grid;}
     const Vertices& vertexArray() const{return m_vertices;};
+    bool hasMesh() const{return not m_vertices.empty();}
+    bool isValid() const{return m_valid;}
     double cellSize() const{return m_cellSize;}
+    double heightScale() const{return m_srcCellSize;}
+    double sourceCellSize() const{return m_srcCellSize;}
     double xllCorner() const{return m_xllCorner;}
     double yllCorner() const{return m_yllCorner;}
+    bool isNoData(float sample) const{return sample == float(m_noDataValue);}
     int noDataValue() const{return m_noDataValue;}
+    QString fileName() const{return m_file.fileName();}
+    SampleType sampleType() const{return m_sampleType;}
     size_t numCols() const{return m_cols;}
     size_t numIndices() const{return m_indices.size();}
     size_t numRows() const{return m_rows;}
     size_t numVertices() const{return m_vertices.size();}
+    tv::Vertex3d vertexAt(size_t row, size_t col) const;
+    void releaseMesh();
+
+    //> Editing
+    const std::vector<tv::GridRect>& dirtyRects() const{return m_dirty;}
+    void clearDirtyRects(){m_dirty.clear();}
+    void setHeight(size_t row, size_t col, float sample);
+    template<typename Fn> void editHeights(const tv::GridRect& rect, Fn fn);
 
 private:
-    double  m_cellSize;
-    double  m_xllCorner;
-    double  m_yllCorner;
-    int     m_noDataValue;
+    bool    m_valid         = false;
+    double  m_cellSize      = 1.0;
+    double  m_srcCellSize   = 1.0;
+    double  m_xllCorner     = 0.0;
+    double  m_yllCorner     = 0.0;
+    int     m_noDataValue   = -9999;
     QFile   m_file;
-    size_t  m_cols;
-    size_t  m_rows;
+    size_t  m_cols          = 0;
+    size_t  m_rows          = 0;
+    SampleType m_sampleType = SampleType::Float;
+    LoadTimes  m_loadTimes;
 
-    Indices     m_indices;
-    Vertices    m_vertices;
+    tv::Arena       m_arena;
+    Indices         m_indices{&m_arena};
+    tv::HeightGrid  m_grid;
+    Vertices        m_vertices{&m_arena};
+    std::vector<tv::MeshTile> m_tiles;
+
+    std::vector<tv::GridRect> m_dirty;
 
     bool openFile();
-    void calculateNormals();
+    void allocateMesh();
+    void buildBand(size_t row0, size_t row1);
+    void buildRows(size_t row0, size_t row1, double& min, double& max);
     void closeFile();
-    void readContents();
+    bool finishContents(size_t n);
+    void growTiles(const tv::GridRect& rect);
+    void heightsChanged(const tv::GridRect& rect);
+    void meshRows(tv::BoundedQueue<size_t>& parsedRows, MeshBlockQueue* meshBlocks);
+    bool readContents(MeshBlockQueue* meshBlocks);
+    const char* readBody(const char* p, const char* end, size_t& n);
+    bool readContents(const char* begin, const char* end, MeshBlockQueue* meshBlocks);
+    bool readHeader(const char*& p, const char* end);
+    template<typename T> const char* readSamples(const char* p, const char* end, size_t& n);
 };
 
+/**
+ * Replaces every sample in the rectangle by fn(row, col, sample). The mesh is updated
+ * for the rectangle only and the touched region is recorded as dirty until the next
+ * clearDirtyRects().
+ */
+template<typename Fn>
+void EsriAsciiReader::editHeights(const tv::GridRect& rect, Fn fn)
+{
+    tv::GridRect r = rect.intersected(m_grid.bounds());
+    if(r.isEmpty()) return;
+    for(size_t row = r.row0; row < r.row1; ++row)
+    {
+        float* line = m_grid.row(row);
+        for(size_t col = r.col0; col < r.col1; ++col) line[col] = fn(row, col, line[col]);
+    }
+    heightsChanged(r);
+}
+
 } //namespace ascii
 
 #endif // ESRIASCIIREADER_H
@@ -0,0 +1,380 @@
+#include "float4x4.h"
+#include "simd.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QtMath>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+namespace
+{
+
+#ifdef TV_HAS_AVX2
+/**
+ * Tests each box against all eight planes at once. A box is outside if the corner
+ * farthest along a plane's normal lies behind it.
+ */
+TV_TARGET_AVX2 size_t frustumTestAvx2(const tv::Frustum& f, const char* boxes, size_t count, size_t stride,
+                                      uint8_t* visible)
+{
+    const __m256 a = _mm256_load_ps(f.a);
+    const __m256 b = _mm256_load_ps(f.b);
+    const __m256 c = _mm256_load_ps(f.c);
+    const __m256 d = _mm256_load_ps(f.d);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 posA = _mm256_cmp_ps(a, zero, _CMP_GT_OQ);
+    const __m256 posB = _mm256_cmp_ps(b, zero, _CMP_GT_OQ);
+    const __m256 posC = _mm256_cmp_ps(c, zero, _CMP_GT_OQ);
+    size_t numVisible = 0;
+    for(size_t i = 0; i < count; ++i)
+    {
+        const tv::Aabb& box = *reinterpret_cast<const tv::Aabb*>(boxes + i * stride);
+        __m256 x = _mm256_blendv_ps(_mm256_set1_ps(box.min.x()), _mm256_set1_ps(box.max.x()), posA);
+        __m256 y = _mm256_blendv_ps(_mm256_set1_ps(box.min.y()), _mm256_set1_ps(box.max.y()), posB);
+        __m256 z = _mm256_blendv_ps(_mm256_set1_ps(box.min.z()), _mm256_set1_ps(box.max.z()), posC);
+        __m256 dist = _mm256_fmadd_ps(a, x, _mm256_fmadd_ps(b, y, _mm256_fmadd_ps(c, z, d)));
+        bool in = _mm256_movemask_ps(_mm256_cmp_ps(dist, zero, _CMP_LT_OQ)) == 0;
+        visible[i] = in;
+        numVisible += in;
+    }
+    return numVisible;
+}
+#endif
+
+#ifdef TV_HAS_SSE2
+inline __m128 select(__m128 mask, __m128 ifSet, __m128 ifClear)
+{
+    return _mm_or_ps(_mm_and_ps(mask, ifSet), _mm_andnot_ps(mask, ifClear));
+}
+
+/**
+ * Four planes of the frustum against one box. Returns whether the box is in front of all.
+ */
+inline bool inFrontSse2(const float* a, const float* b, const float* c, const float* d, const tv::Aabb& box)
+{
+    const __m128 zero = _mm_setzero_ps();
+    __m128 pa = _mm_load_ps(a);
+    __m128 pb = _mm_load_ps(b);
+    __m128 pc = _mm_load_ps(c);
+    __m128 x = select(_mm_cmpgt_ps(pa, zero), _mm_set1_ps(box.max.x()), _mm_set1_ps(box.min.x()));
+    __m128 y = select(_mm_cmpgt_ps(pb, zero), _mm_set1_ps(box.max.y()), _mm_set1_ps(box.min.y()));
+    __m128 z = select(_mm_cmpgt_ps(pc, zero), _mm_set1_ps(box.max.z()), _mm_set1_ps(box.min.z()));
+    __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pa, x), _mm_mul_ps(pb, y)),
+                             _mm_add_ps(_mm_mul_ps(pc, z), _mm_load_ps(d)));
+    return _mm_movemask_ps(_mm_cmplt_ps(dist, zero)) == 0;
+}
+#else
+/**
+ * m times (x, y, z, 1), as QMatrix4x4::map() sums it.
+ */
+inline void mapAffine(const tv::Float4x4& m, float x, float y, float z, float out[4])
+{
+    for(int row = 0; row < 4; ++row) out[row] = x * m(row, 0) + y * m(row, 1) + z * m(row, 2) + m(row, 3);
+}
+#endif
+
+} //namespace
+
+namespace tv
+{
+
+Float4x4 Float4x4::fromQMatrix(const QMatrix4x4& q)
+{
+    Float4x4 r;
+    std::copy(q.constData(), q.constData() + 16, r.m);
+    return r;
+}
+
+/**
+ * Identity if eye and center coincide, as QMatrix4x4::lookAt() then leaves the matrix
+ * alone.
+ */
+Float4x4 Float4x4::lookAt(const QVector3D& eye, const QVector3D& center, const QVector3D& up)
+{
+    Float4x4 r = identity();
+    QVector3D forward = center - eye;
+    if(qFuzzyIsNull(forward.x()) and qFuzzyIsNull(forward.y()) and qFuzzyIsNull(forward.z())) return r;
+    forward.normalize();
+    QVector3D side = QVector3D::crossProduct(forward, up).normalized();
+    QVector3D upVector = QVector3D::crossProduct(side, forward);
+    const QVector3D rows[3] = {side, upVector, -forward};
+    for(int row = 0; row < 3; ++row)
+    {
+        r(row, 0) = rows[row].x();
+        r(row, 1) = rows[row].y();
+        r(row, 2) = rows[row].z();
+        r(row, 3) = rows[row].x() * -eye.x() + rows[row].y() * -eye.y() + rows[row].z() * -eye.z();
+    }
+    return r;
+}
+
+/**
+ * Identity for an empty volume, as QMatrix4x4::perspective() then leaves the matrix
+ * alone. The angle is in degrees.
+ */
+Float4x4 Float4x4::perspective(float verticalAngle, float aspectRatio, float nearPlane, float farPlane)
+{
+    Float4x4 r = identity();
+    if(nearPlane == farPlane or aspectRatio == 0.0f) return r;
+    float radians = qDegreesToRadians(verticalAngle / 2.0f);
+    float sine = std::sin(radians);
+    if(sine == 0.0f) return r;
+    float cotan = std::cos(radians) / sine;
+    float clip = farPlane - nearPlane;
+    r(0, 0) = cotan / aspectRatio;
+    r(1, 1) = cotan;
+    r(2, 2) = -(nearPlane + farPlane) / clip;
+    r(2, 3) = -(2.0f * nearPlane * farPlane) / clip;
+    r(3, 2) = -1.0f;
+    r(3, 3) = 0.0f;
+    return r;
+}
+
+QMatrix4x4 Float4x4::toQMatrix() const
+{
+    QMatrix4x4 q(Qt::Uninitialized);
+    std::copy(m, m + 16, q.data());
+    //Lets QMatrix4x4 take its shortcuts for translations and scales again.
+    q.optimize();
+    return q;
+}
+
+/**
+ * Planes from the rows of the matrix, one pair per clip space axis. Their normals are not
+ * normalized, which the sign tests do not need.
+ */
+Frustum::Frustum(const Float4x4& viewProjection)
+{
+    const Float4x4& m = viewProjection;
+    for(int i = 0; i < 3; ++i)
+    {
+        a[2 * i] = m(3, 0) + m(i, 0);
+        b[2 * i] = m(3, 1) + m(i, 1);
+        c[2 * i] = m(3, 2) + m(i, 2);
+        d[2 * i] = m(3, 3) + m(i, 3);
+        a[2 * i + 1] = m(3, 0) - m(i, 0);
+        b[2 * i + 1] = m(3, 1) - m(i, 1);
+        c[2 * i + 1] = m(3, 2) - m(i, 2);
+        d[2 * i + 1] = m(3, 3) - m(i, 3);
+    }
+    d[6] = d[7] = 1.0f;
+}
+
+/**
+ * Sets visible[i] to 1 for each box that may intersect the frustum, else to 0, and
+ * returns how many may. Boxes lie stride bytes apart, so bounds embedded in larger
+ * records can be tested in place. Conservative: a box near a corner of the frustum may
+ * pass although it lies outside.
+ */
+size_t frustumTest(const Frustum& frustum, const Aabb* boxes, size_t count, uint8_t* visible, size_t stride)
+{
+    const char* base = reinterpret_cast<const char*>(boxes);
+#ifdef TV_HAS_AVX2
+    if(hasAvx2()) return frustumTestAvx2(frustum, base, count, stride, visible);
+#endif
+    const Frustum& f = frustum;
+    size_t numVisible = 0;
+    for(size_t i = 0; i < count; ++i)
+    {
+        const Aabb& box = *reinterpret_cast<const Aabb*>(base + i * stride);
+#ifdef TV_HAS_SSE2
+        bool in = inFrontSse2(f.a, f.b, f.c, f.d, box) and inFrontSse2(f.a + 4, f.b + 4, f.c + 4, f.d + 4, box);
+#else
+        bool in = true;
+        for(int p = 0; in and p < 6; ++p)
+        {
+            float x = f.a[p] > 0.0f ? box.max.x() : box.min.x();
+            float y = f.b[p] > 0.0f ? box.max.y() : box.min.y();
+            float z = f.c[p] > 0.0f ? box.max.z() : box.min.z();
+            in = f.a[p] * x + f.b[p] * y + f.c[p] * z + f.d[p] >= 0.0f;
+        }
+#endif
+        visible[i] = in;
+        numVisible += in;
+    }
+    return numVisible;
+}
+
+/**
+ * Bounds of the boxes after an affine transformation, from the transformed center and the
+ * extents summed over the absolute matrix columns. Projections need the corners mapped one
+ * by one instead.
+ */
+void transformAabbs(const Float4x4& m, const Aabb* boxes, size_t count, Aabb* out)
+{
+#ifdef TV_HAS_SSE2
+    const __m128 c0 = _mm_load_ps(m.m);
+    const __m128 c1 = _mm_load_ps(m.m + 4);
+    const __m128 c2 = _mm_load_ps(m.m + 8);
+    const __m128 c3 = _mm_load_ps(m.m + 12);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 a0 = _mm_and_ps(c0, absMask);
+    const __m128 a1 = _mm_and_ps(c1, absMask);
+    const __m128 a2 = _mm_and_ps(c2, absMask);
+    const __m128 half = _mm_set1_ps(0.5f);
+    alignas(16) float lo[4];
+    alignas(16) float hi[4];
+    for(size_t i = 0; i < count; ++i)
+    {
+        const Aabb& box = boxes[i];
+        __m128 bmin = _mm_setr_ps(box.min.x(), box.min.y(), box.min.z(), 0.0f);
+        __m128 bmax = _mm_setr_ps(box.max.x(), box.max.y(), box.max.z(), 0.0f);
+        __m128 center = _mm_mul_ps(_mm_add_ps(bmin, bmax), half);
+        __m128 extent = _mm_mul_ps(_mm_sub_ps(bmax, bmin), half);
+        __m128 mc = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_shuffle_ps(center, center, 0x00)),
+                                          _mm_mul_ps(c1, _mm_shuffle_ps(center, center, 0x55))),
+                               _mm_add_ps(_mm_mul_ps(c2, _mm_shuffle_ps(center, center, 0xAA)), c3));
+        __m128 me = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a0, _mm_shuffle_ps(extent, extent, 0x00)),
+                                          _mm_mul_ps(a1, _mm_shuffle_ps(extent, extent, 0x55))),
+                               _mm_mul_ps(a2, _mm_shuffle_ps(extent, extent, 0xAA)));
+        _mm_store_ps(lo, _mm_sub_ps(mc, me));
+        _mm_store_ps(hi, _mm_add_ps(mc, me));
+        out[i].min = QVector3D(lo[0], lo[1], lo[2]);
+        out[i].max = QVector3D(hi[0], hi[1], hi[2]);
+    }
+#else
+    for(size_t i = 0; i < count; ++i)
+    {
+        QVector3D center = (boxes[i].min + boxes[i].max) * 0.5f;
+        QVector3D extent = (boxes[i].max - boxes[i].min) * 0.5f;
+        float mc[4];
+        mapAffine(m, center.x(), center.y(), center.z(), mc);
+        float me[3];
+        for(int row = 0; row < 3; ++row)
+        {
+            me[row] = std::abs(m(row, 0)) * extent.x() + std::abs(m(row, 1)) * extent.y() + std::abs(m(row, 2)) * extent.z();
+        }
+        out[i].min = QVector3D(mc[0] - me[0], mc[1] - me[1], mc[2] - me[2]);
+        out[i].max = QVector3D(mc[0] + me[0], mc[1] + me[1], mc[2] + me[2]);
+    }
+#endif
+}
+
+/**
+ * Maps the points like QMatrix4x4::map(), dividing by w, and to the same bits. out may be
+ * points.
+ */
+void transformPoints(const Float4x4& m, const QVector3D* points, size_t count, QVector3D* out)
+{
+#ifdef TV_HAS_SSE2
+    const __m128 c0 = _mm_load_ps(m.m);
+    const __m128 c1 = _mm_load_ps(m.m + 4);
+    const __m128 c2 = _mm_load_ps(m.m + 8);
+    const __m128 c3 = _mm_load_ps(m.m + 12);
+    alignas(16) float p[4];
+    for(size_t i = 0; i < count; ++i)
+    {
+        __m128 v = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(points[i].x()), c0),
+                                                    _mm_mul_ps(_mm_set1_ps(points[i].y()), c1)),
+                                         _mm_mul_ps(_mm_set1_ps(points[i].z()), c2)), c3);
+        _mm_store_ps(p, _mm_div_ps(v, _mm_shuffle_ps(v, v, 0xFF)));
+        out[i] = QVector3D(p[0], p[1], p[2]);
+    }
+#else
+    for(size_t i = 0; i < count; ++i)
+    {
+        float p[4];
+        mapAffine(m, points[i].x(), points[i].y(), points[i].z(), p);
+        out[i] = QVector3D(p[0] / p[3], p[1] / p[3], p[2] / p[3]);
+    }
+#endif
+}
+
+/**
+ * Times the camera matrices, point mapping and frustum culling of count items against
+ * the same work done through QMatrix4x4, and logs both and how far the results differ.
+ */
+void benchmarkFloat4x4(size_t count)
+{
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> coord(-1000.0f, 1000.0f);
+    std::vector<QVector3D> points(count);
+    for(QVector3D& p : points) p = QVector3D(coord(random), coord(random), coord(random) * 0.1f);
+    std::vector<Aabb> boxes(count);
+    for(size_t i = 0; i < count; ++i) boxes[i] = {points[i], points[i] + QVector3D(64.0f, 64.0f, 20.0f)};
+
+    QElapsedTimer timer;
+    auto ms = [&timer](){return double(timer.nsecsElapsed()) / 1e6;};
+    QVector3D eye(-300.0f, -400.0f, 250.0f);
+    QVector3D center(0.0f, 0.0f, 0.0f);
+    QVector3D up(0.0f, 0.0f, 1.0f);
+
+    //Camera rebuilds, the eye moving a little each time like while dragging.
+    volatile float sink = 0.0f;
+    timer.start();
+    for(size_t i = 0; i < count; ++i)
+    {
+        QMatrix4x4 projection;
+        QMatrix4x4 modelView;
+        projection.perspective(60.0f, 1.5f, 1.0f, 5000.0f);
+        modelView.lookAt(eye + QVector3D(float(i & 255), 0.0f, 0.0f), center, up);
+        sink = sink + (projection * modelView)(0, 3);
+    }
+    double qtCamera = ms();
+    timer.start();
+    for(size_t i = 0; i < count; ++i)
+    {
+        Float4x4 mvp = Float4x4::perspective(60.0f, 1.5f, 1.0f, 5000.0f)
+                     * Float4x4::lookAt(eye + QVector3D(float(i & 255), 0.0f, 0.0f), center, up);
+        sink = sink - mvp(0, 3);
+    }
+    double ownCamera = ms();
+
+    QMatrix4x4 qmvp;
+    qmvp.perspective(60.0f, 1.5f, 1.0f, 5000.0f);
+    qmvp.lookAt(eye, center, up);
+    Float4x4 mvp = Float4x4::fromQMatrix(qmvp);
+
+    std::vector<QVector3D> qtPoints(count);
+    std::vector<QVector3D> ownPoints(count);
+    timer.start();
+    for(size_t i = 0; i < count; ++i) qtPoints[i] = qmvp.map(points[i]);
+    double qtMap = ms();
+    timer.start();
+    transformPoints(mvp, points.data(), count, ownPoints.data());
+    double ownMap = ms();
+    size_t mapDiffers = 0;
+    for(size_t i = 0; i < count; ++i) mapDiffers += std::memcmp(&qtPoints[i], &ownPoints[i], sizeof(QVector3D)) != 0;
+
+    //The frustum test as it was written against QMatrix4x4 rows.
+    std::vector<uint8_t> qtVisible(count);
+    std::vector<uint8_t> ownVisible(count);
+    timer.start();
+    QVector4D planes[6];
+    for(int i = 0; i < 3; ++i)
+    {
+        planes[2 * i] = qmvp.row(3) + qmvp.row(i);
+        planes[2 * i + 1] = qmvp.row(3) - qmvp.row(i);
+    }
+    for(size_t i = 0; i < count; ++i)
+    {
+        bool in = true;
+        for(const QVector4D& p : planes)
+        {
+            QVector3D corner(p.x() > 0.0f ? boxes[i].max.x() : boxes[i].min.x(),
+                             p.y() > 0.0f ? boxes[i].max.y() : boxes[i].min.y(),
+                             p.z() > 0.0f ? boxes[i].max.z() : boxes[i].min.z());
+            if(QVector4D::dotProduct(p, QVector4D(corner, 1.0f)) < 0.0f)
+            {
+                in = false;
+                break;
+            }
+        }
+        qtVisible[i] = in;
+    }
+    double qtCull = ms();
+    timer.start();
+    size_t numVisible = frustumTest(Frustum(mvp), boxes.data(), count, ownVisible.data());
+    double ownCull = ms();
+    size_t cullDiffers = 0;
+    for(size_t i = 0; i < count; ++i) cullDiffers += qtVisible[i] != ownVisible[i];
+
+    qDebug() << "Float4x4 against QMatrix4x4 for" << count << "items in ms," << (hasAvx2() ? "AVX2" : "SSE2");
+    qDebug() << "  camera rebuild" << qtCamera << ownCamera;
+    qDebug() << "  map points    " << qtMap << ownMap << "differing" << mapDiffers;
+    qDebug() << "  frustum test  " << qtCull << ownCull << "visible" << numVisible << "differing" << cullDiffers;
+}
+
+} //namespace tv
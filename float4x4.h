@@ -0,0 +1,92 @@
+#ifndef FLOAT4X4_H
+#define FLOAT4X4_H
+
+#include "utils.h"
+#include <QMatrix4x4>
+#include <cstdint>
+
+namespace tv
+{
+
+/**
+ * Plain 4x4 float matrix, column major like QMatrix4x4 and OpenGL, aligned so that each
+ * column loads as one SSE register. Unlike QMatrix4x4 it carries no flags, so building
+ * one is writing sixteen floats and the construction functions below produce the same
+ * matrices as their QMatrix4x4 namesakes applied to an identity, without multiplying.
+ */
+struct alignas(16) Float4x4
+{
+    float m[16] = {};
+
+    constexpr float operator()(int row, int col) const{return m[col * 4 + row];}
+    constexpr float& operator()(int row, int col){return m[col * 4 + row];}
+
+    static constexpr Float4x4 identity()
+    {
+        Float4x4 r;
+        r(0, 0) = r(1, 1) = r(2, 2) = r(3, 3) = 1.0f;
+        return r;
+    }
+
+    /**
+     * Identity for an empty box, as QMatrix4x4::ortho() then leaves the matrix alone.
+     */
+    static constexpr Float4x4 ortho(float left, float right, float bottom, float top, float nearPlane, float farPlane)
+    {
+        Float4x4 r = identity();
+        if(left == right or bottom == top or nearPlane == farPlane) return r;
+        float width = right - left;
+        float height = top - bottom;
+        float clip = farPlane - nearPlane;
+        r(0, 0) = 2.0f / width;
+        r(0, 3) = -(left + right) / width;
+        r(1, 1) = 2.0f / height;
+        r(1, 3) = -(top + bottom) / height;
+        r(2, 2) = -2.0f / clip;
+        r(2, 3) = -(nearPlane + farPlane) / clip;
+        return r;
+    }
+
+    static Float4x4 fromQMatrix(const QMatrix4x4& q);
+    static Float4x4 lookAt(const QVector3D& eye, const QVector3D& center, const QVector3D& up);
+    static Float4x4 perspective(float verticalAngle, float aspectRatio, float nearPlane, float farPlane);
+    QMatrix4x4 toQMatrix() const;
+};
+
+constexpr Float4x4 operator*(const Float4x4& a, const Float4x4& b)
+{
+    Float4x4 r;
+    for(int col = 0; col < 4; ++col)
+    {
+        for(int row = 0; row < 4; ++row)
+        {
+            r(row, col) = a(row, 0) * b(0, col) + a(row, 1) * b(1, col) + a(row, 2) * b(2, col) + a(row, 3) * b(3, col);
+        }
+    }
+    return r;
+}
+
+/**
+ * The six clip planes of a view projection matrix, stored plane by plane per coefficient
+ * so that one AVX register holds a coefficient of all of them. The last two lanes are
+ * planes every point passes.
+ */
+struct alignas(32) Frustum
+{
+    float a[8] = {};
+    float b[8] = {};
+    float c[8] = {};
+    float d[8] = {};
+
+    explicit Frustum(const Float4x4& viewProjection);
+};
+
+size_t frustumTest(const Frustum& frustum, const Aabb* boxes, size_t count, uint8_t* visible,
+                   size_t stride = sizeof(Aabb));
+void transformAabbs(const Float4x4& m, const Aabb* boxes, size_t count, Aabb* out);
+void transformPoints(const Float4x4& m, const QVector3D* points, size_t count, QVector3D* out);
+void benchmarkFloat4x4(size_t count);
+
+} //namespace tv
+
+#endif // FLOAT4X4_H
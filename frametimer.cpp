@@ -0,0 +1,78 @@
+#include "frametimer.h"
+#include <QDebug>
+
+namespace render
+{
+
+/**
+ * Starts timing a frame. While all queries still wait for their results the frame goes
+ * untimed rather than stalling on the oldest one.
+ */
+void FrameTimer::begin()
+{
+    if(not m_initialized or m_running or m_begun - m_read == kQueries) return;
+    m_queries[m_begun % kQueries]->begin();
+    m_running = true;
+}
+
+void FrameTimer::end()
+{
+    if(not m_running) return;
+    m_queries[m_begun % kQueries]->end();
+    m_running = false;
+    ++m_begun;
+}
+
+/**
+ * Needs a current context. Without timer query support frames simply stay untimed.
+ */
+void FrameTimer::initialize()
+{
+    if(m_initialized) return;
+    for(std::unique_ptr<QOpenGLTimerQuery>& query : m_queries)
+    {
+        query = std::make_unique<QOpenGLTimerQuery>();
+        if(not query->create())
+        {
+            qDebug() << "Timer queries unsupported, interactive quality stays fixed.";
+            release();
+            return;
+        }
+    }
+    m_initialized = true;
+}
+
+/**
+ * Collects the results that have arrived since the last call. Returns false if there
+ * were none, otherwise frameMs holds the most recent one.
+ */
+bool FrameTimer::poll(double& frameMs)
+{
+    bool found = false;
+    while(m_read != m_begun and m_queries[m_read % kQueries]->isResultAvailable())
+    {
+        //Available results are returned right away.
+        frameMs = double(m_queries[m_read % kQueries]->waitForResult()) / 1e6;
+        ++m_read;
+        found = true;
+    }
+    return found;
+}
+
+/**
+ * Needs the context the timer was initialized in to be current.
+ */
+void FrameTimer::release()
+{
+    for(std::unique_ptr<QOpenGLTimerQuery>& query : m_queries)
+    {
+        if(query and query->isCreated()) query->destroy();
+        query.reset();
+    }
+    m_initialized = false;
+    m_running = false;
+    m_begun = 0;
+    m_read = 0;
+}
+
+} //namespace render
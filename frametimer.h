@@ -0,0 +1,39 @@
+#ifndef FRAMETIMER_H
+#define FRAMETIMER_H
+
+#include <QtOpenGL/QOpenGLTimerQuery>
+#include <array>
+#include <memory>
+
+namespace render
+{
+
+/**
+ * Measures the GPU time of frames without waiting for the GPU. Every timed frame is
+ * bracketed by a GL_TIME_ELAPSED query, whose result is read back once it is available,
+ * usually one or two frames later. Queries are not shared between contexts, so each
+ * context needs its own timer, used only while that context is current.
+ */
+class FrameTimer
+{
+public:
+    static constexpr size_t kQueries = 3;
+
+    FrameTimer() = default;
+    void begin();
+    void end();
+    void initialize();
+    bool poll(double& frameMs);
+    void release();
+
+private:
+    bool                    m_initialized   = false;
+    bool                    m_running       = false;
+    size_t                  m_begun         = 0;
+    size_t                  m_read          = 0;
+    std::array<std::unique_ptr<QOpenGLTimerQuery>, kQueries> m_queries;
+};
+
+} //namespace render
+
+#endif // FRAMETIMER_H
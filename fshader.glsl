@@ -1,14 +1,102 @@
+uniform vec4 u_hole;
+uniform sampler2D u_overlay;
+uniform vec2 u_overlaySize;
+uniform int u_overlayMode;
+uniform sampler2D u_heights;
+uniform vec2 u_heightsSize;
+uniform float u_heightScale;
+uniform bool u_raster;
+uniform sampler2D u_normals;
+uniform vec2 u_normalsSize;
+uniform vec3 u_lightDir;
+uniform bool u_lighting;
+uniform sampler2D u_horizons0;
+uniform sampler2D u_horizons1;
+uniform vec4 u_sunWeights0;
+uniform vec4 u_sunWeights1;
+uniform bool u_shadows;
+
 varying vec3 v_coord;
 
+vec3 hue(float h)
+{
+    return clamp(abs(mod(h * 6.0 + vec3(0.0, 4.0, 2.0), 6.0) - 3.0) - 1.0, 0.0, 1.0);
+}
+
+// u_overlayMode: 1 hillshade, 2 slope in degrees, 3 aspect in degrees, 4 visibility,
+// 5 log10 of the samples draining through, drawn as streams from 100 on, 6 difference
+// to a later grid from 0 (cut) over 1 (unchanged) to 2 (fill)
+vec4 overlay(vec4 color)
+{
+    float o = texture2D(u_overlay, (v_coord.yx + 0.5) / u_overlaySize.yx).r;
+    if(o < 0.0) return color;
+    if(u_overlayMode == 1) return vec4(color.rgb * (0.25 + 0.75 * o), color.a);
+    if(u_overlayMode == 2)
+    {
+        float t = clamp(o / 45.0, 0.0, 1.0);
+        vec3 ramp = mix(vec3(0.1, 0.6, 0.1), vec3(0.95, 0.85, 0.1), min(2.0 * t, 1.0));
+        return vec4(mix(ramp, vec3(0.8, 0.1, 0.1), max(2.0 * t - 1.0, 0.0)), color.a);
+    }
+    if(u_overlayMode == 3) return vec4(mix(color.rgb, hue(o / 360.0), 0.7), color.a);
+    if(u_overlayMode == 4) return vec4(mix(color.rgb * vec3(0.45, 0.3, 0.3), color.rgb, o), color.a);
+    if(u_overlayMode == 5)
+    {
+        if(o < 2.0) return color;
+        float t = clamp((o - 2.0) / 4.0, 0.0, 1.0);
+        return vec4(mix(vec3(0.45, 0.8, 1.0), vec3(0.0, 0.15, 0.65), t), color.a);
+    }
+    if(u_overlayMode == 6)
+    {
+        float t = clamp(o - 1.0, -1.0, 1.0);
+        vec3 ramp = mix(vec3(0.97), t < 0.0 ? vec3(0.7, 0.05, 0.15) : vec3(0.05, 0.25, 0.7), sqrt(abs(t)));
+        return vec4(ramp * (0.6 + 0.4 * color.rgb), color.a);
+    }
+    return color;
+}
+
+// normals are octahedral encoded, see render::NormalMap
+vec3 normal()
+{
+    vec2 e = texture2D(u_normals, (v_coord.yx + 0.5) / u_normalsSize.yx).rg;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if(n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * sign(n.xy);
+    return normalize(n);
+}
+
+// horizons hold the sine of the horizon elevation in eight directions, see
+// analysis::horizonAngles; the sun weights pick the two directions beside the sun
+float light()
+{
+    float direct = max(dot(normal(), u_lightDir), 0.0);
+    float ambient = 1.0;
+    if(u_shadows)
+    {
+        vec2 uv = (v_coord.yx + 0.5) / u_normalsSize.yx;
+        vec4 h0 = texture2D(u_horizons0, uv);
+        vec4 h1 = texture2D(u_horizons1, uv);
+        float horizon = dot(h0, u_sunWeights0) + dot(h1, u_sunWeights1);
+        direct *= smoothstep(horizon - 0.02, horizon + 0.02, u_lightDir.z);
+        // cosine weighted sky seen above a horizon of sine h is 1 - h^2
+        ambient = 1.0 - 0.125 * (dot(h0, h0) + dot(h1, h1));
+    }
+    return 0.35 * ambient + 0.65 * direct;
+}
+
 void main()
 {
+    if(all(greaterThan(v_coord.xy, u_hole.xy)) && all(lessThan(v_coord.xy, u_hole.zw))) discard;
+    // the raster renderer draws a flat quad and looks the heights up per fragment
+    float z = v_coord.z;
+    if(u_raster) z = texture2D(u_heights, (v_coord.yx + 0.5) / u_heightsSize.yx).r * u_heightScale;
     vec4 color;
-    float v = v_coord.z/30;
-    if(v_coord.z < 0.0) color = vec4(0, 0, 1 + v, 1);
-    else if(v_coord.z < 0.2) color = vec4(0.8 - v * 6, 0.8 - v * 6, 0.1 - v, 1);
-    else if(v_coord.z < 1) color = vec4(0.2 + v, 0.2 + v, 0.01 + v, 1);
-    else if(v_coord.z < 3) color = vec4(0, 0.4 + v, 0, 1);
-    else if(v_coord.z < 8.0) color = vec4(0.4 + v, 0.4 + v, 0.4 + v, 1);
+    float v = z/30;
+    if(z < 0.0) color = vec4(0, 0, 1 + v, 1);
+    else if(z < 0.2) color = vec4(0.8 - v * 6, 0.8 - v * 6, 0.1 - v, 1);
+    else if(z < 1) color = vec4(0.2 + v, 0.2 + v, 0.01 + v, 1);
+    else if(z < 3) color = vec4(0, 0.4 + v, 0, 1);
+    else if(z < 8.0) color = vec4(0.4 + v, 0.4 + v, 0.4 + v, 1);
     else color = vec4(0.65 + v, 0.65 + v, 0.65 + v, 1);
+    if(u_overlayMode > 0) color = overlay(color);
+    if(u_lighting) color.rgb *= light();
     gl_FragColor = color;
 }
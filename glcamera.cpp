@@ -1,5 +1,6 @@
 #include "glcamera.h"
 
+#include "float4x4.h"
 #include "utils.h"
 #include <QtMath>
 #include <GL/gl.h>
@@ -29,6 +30,19 @@ void GlCamera::apply()
     m_modelView.setToIdentity();
 }
 
+CameraState GlCamera::state() const
+{
+    CameraState st;
+    st.type         = type();
+    st.modelView    = m_modelView;
+    st.projection   = m_projection;
+    st.viewport     = QRect(m_viewportX, m_viewportY, m_viewportW, m_viewportH);
+    st.center       = m_center;
+    st.eye          = m_eye;
+    st.up           = m_up;
+    return st;
+}
+
 void GlCamera::lookAt(const QVector3D &eye, const QVector3D &center, const QVector3D &up)
 {
     setEye(eye);
@@ -99,11 +113,13 @@ void GlCamera::truck(double x)
  * >OrthographicCamera
  * ********************************************/
 
+/**
+ * Writes the matrices directly instead of multiplying them onto identities.
+ */
 void OrthographicCamera::apply()
 {
-    GlCamera::apply();
-    m_projection.ortho(m_l * m_zoom, m_r * m_zoom, m_b * m_zoom, m_t * m_zoom, m_nearPlane, m_farPlane);
-    m_modelView.lookAt(m_eye, m_center, m_up);
+    m_projection = tv::Float4x4::ortho(m_l * m_zoom, m_r * m_zoom, m_b * m_zoom, m_t * m_zoom, m_nearPlane, m_farPlane).toQMatrix();
+    m_modelView = tv::Float4x4::lookAt(m_eye, m_center, m_up).toQMatrix();
 }
 
 void OrthographicCamera::setRect(double left, double right, double bottom, double top)
@@ -153,9 +169,8 @@ QVector3D PerspectiveCamera::arcballVector(const QVector2D &v, double sWidth, do
 
 void PerspectiveCamera::apply()
 {
-    GlCamera::apply();
-    m_projection.perspective(m_verticalAngle * m_zoom, m_aspectRatio, m_nearPlane, m_farPlane);
-    m_modelView.lookAt(m_eye, m_center, m_up);
+    m_projection = tv::Float4x4::perspective(m_verticalAngle * m_zoom, m_aspectRatio, m_nearPlane, m_farPlane).toQMatrix();
+    m_modelView = tv::Float4x4::lookAt(m_eye, m_center, m_up).toQMatrix();
 }
 
 void PerspectiveCamera::dolly(double z)
@@ -3,10 +3,14 @@
 
 #include "utils.h"
 #include <QMatrix4x4>
+#include <QRect>
+#include <vector>
 
 namespace cam
 {
 
+struct CameraState;
+
 class CameraCube
 {
 public:
@@ -35,7 +39,9 @@ public:
     };
 
     GlCamera() = default;
+    virtual ~GlCamera() = default;
     CameraCube cube(double radius) const;
+    CameraState state() const;
     const QMatrix4x4& modelView() const{return m_modelView;}
     const QMatrix4x4& projection() const{return m_projection;}
     const QVector3D& center() const{return m_center;}
@@ -48,6 +54,7 @@ public:
     double zoom() const{return m_zoom;}
     QMatrix4x4& rModelView(){return m_modelView;}
     QMatrix4x4& rProjection(){return m_projection;}
+    virtual CameraType type() const = 0;
     virtual void apply();
     virtual void toDefault();
     void lookAt(const QVector3D& eye, const QVector3D& center, const QVector3D& up);
@@ -83,6 +90,34 @@ protected:
     QVector3D   m_up;
 };
 
+/**
+ * Copy of the matrices and placement of a camera at its last apply(), detached from
+ * the camera object so it can be handed to another thread.
+ */
+struct CameraState
+{
+    GlCamera::CameraType    type = GlCamera::Orthographic;
+    QMatrix4x4              modelView;
+    QMatrix4x4              projection;
+    QRect                   viewport;
+    QVector3D               center;
+    QVector3D               eye;
+    QVector3D               up;
+};
+
+/**
+ * Camera states of all views drawn into one frame. The viewport of each lies within the
+ * frame's size, with y pointing down as in widget coordinates. While the camera follows a
+ * path, lookAhead is where its eye will be shortly.
+ */
+struct ViewSet
+{
+    bool                        hasLookAhead = false;
+    QSize                       size;
+    std::vector<CameraState>    views;
+    QVector3D                   lookAhead;
+};
+
 class OrthographicCamera : public GlCamera
 {
 public:
@@ -91,6 +126,7 @@ public:
     double left() const{return m_l;}
     double right() const{return m_r;}
     double top() const{return m_t;}
+    CameraType type() const override{return Orthographic;}
     void apply() override;
     void setBottom(double bottom){m_b = bottom;}
     void setLeft(double left){m_l = left;}
@@ -118,6 +154,7 @@ public:
     double tilt() const{return m_tilt;}
     double verticalAngle() const{return m_verticalAngle;}
     QVector3D arcballVector(const QVector2D& v, double sWidth, double sHeight) const;
+    CameraType type() const override{return Perspective;}
     void apply() override;
     void dolly(double z);
     void orbit(const QVector2D &last, const QVector2D &cur);
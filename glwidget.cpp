@@ -1,20 +1,105 @@
 #include "glwidget.h"
+#include "horizon.h"
+#include "hydrology.h"
+#include "meshexporter.h"
+#include "rasterkernels.h"
+#include "terrainbrush.h"
 #include "ui_glwidget.h"
+#include "viewshed.h"
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QtMath>
 #include <QMouseEvent>
+#include <QOpenGLFramebufferObject>
+#include <QTimerEvent>
 #include <QWheelEvent>
+#include <algorithm>
+#include <numeric>
+#include <thread>
+
+namespace
+{
+
+constexpr size_t kCoarseStep = 4;
+constexpr int kRefineDelay = 250;
+constexpr float kMinRenderScale = 0.25f;
+constexpr int kViewGap = 2;
+constexpr int kFlightInterval = 16;
+constexpr double kKeyframeSpacing = 2.0;
+constexpr double kLookAhead = 1.0;
+constexpr size_t kDifferenceBand = 256;
+constexpr size_t kMaxUndoSteps = 32;
+
+/**
+ * Spacing of a grid's samples in its own height units, as the relief is drawn: samples
+ * sit cellSize() apart and heights are scaled by heightScale(). Slopes, shading and
+ * horizons computed with it match the surface on screen, whatever unit the file's cell
+ * size is in.
+ */
+float drawnCellSize(const EaReader& reader)
+{
+    return float(reader.cellSize() / reader.heightScale());
+}
+
+/**
+ * Triangles over every step-th row and column of a grid, keeping the last row and column
+ * so that the coarse mesh covers the same area. Wound like the full mesh.
+ */
+std::vector<GLuint> coarseIndices(size_t rows, size_t cols, size_t step)
+{
+    auto lattice = [step](size_t n)
+    {
+        std::vector<size_t> at;
+        for(size_t i = 0; i < n; i += step) at.push_back(i);
+        if(n > 0 and at.back() != n - 1) at.push_back(n - 1);
+        return at;
+    };
+    std::vector<size_t> r = lattice(rows);
+    std::vector<size_t> c = lattice(cols);
+    std::vector<GLuint> indices;
+    if(r.size() < 2 or c.size() < 2) return indices;
+    indices.reserve((r.size() - 1) * (c.size() - 1) * 6);
+    for(size_t i = 0; i + 1 < r.size(); ++i)
+    {
+        for(size_t j = 0; j + 1 < c.size(); ++j)
+        {
+            GLuint a = GLuint(r[i] * cols + c[j]);
+            GLuint b = GLuint(r[i + 1] * cols + c[j]);
+            GLuint right = GLuint(c[j + 1] - c[j]);
+            indices.insert(indices.end(), {a, b, a + right, a + right, b, b + right});
+        }
+    }
+    return indices;
+}
+
+} //namespace
 
 GlWidget::GlWidget(QWidget *parent) :
     QOpenGLWidget(parent),
-    ui(new Ui::GlWidget),
-    m_ascii(":/ascii/gebco_2021_n43.3135986328125_s38.3038330078125_w7.580566406250001_e10.491943359375.asc")
+    ui(new Ui::GlWidget)
 {
     ui->setupUi(this);
 }
 
 GlWidget::~GlWidget()
 {
+    m_renderThread.reset();
+    cancelExport();
+    m_derivedJobs.clear();
+    if(isValid())
+    {
+        makeCurrent();
+        releaseDatasets();
+        m_clipmap.release();
+        m_contours.release();
+        m_overlay.release();
+        m_raster.release();
+        m_tileBatch.release();
+        m_lowResFbo.reset();
+        m_frameTimer.release();
+        m_blitter.destroy();
+        doneCurrent();
+    }
     delete ui;
 }
 
@@ -80,89 +165,48 @@ void GlWidget::initializeGL()
     m_pstCam.setVerticalAngle(60.0);
     m_pstCam.lookAt({600, -500, 0}, {600, 350, 0}, {0, 0, 1});
 
-    m_vbo.create();
-    m_vbo.bind();
-    m_vbo.allocate(m_ascii.vertexArray().data(), m_ascii.numVertices() * sizeof(tv::Vertex3d));
+    uploadDatasets();
 
     setupShaders();
 
-//    m_vbo.allocate(m_terrain.triangleArray().data(), m_terrain.numTriangles() * sizeof(QVector3D));
-//    m_vbo.release();
+    m_clipmap.initialize();
+    m_contours.initialize();
+    m_overlay.initialize();
+    m_raster.initialize();
+    m_tileBatch.initialize();
+    m_frameTimer.initialize();
+    m_blitter.create();
 }
 
 void GlWidget::paintGL()
 {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    float   w = float(width()) * .5f;
-    float   h = float(height()) * .5f;
-
-    switch(m_camMode)
-    {
-    case GlCam::Orthographic:
+    if(m_renderThread)
     {
-        //> CAMERA VIEWPORT
-        m_otgCam.setViewport(0, 0, width(), height());
-        //> CAMERA FAR PLANE MEASURES
-        m_otgCam.setRect(-w, w, -h, h);
-        m_otgCam.apply();
-        //> SET MATRICES
-//        glMatrixMode(GL_PROJECTION);
-//        glLoadMatrixf(m_otgCam.projection().data());
-//        glMatrixMode(GL_MODELVIEW);
-//        glLoadMatrixf(m_otgCam.modelView().data());
-        m_shProg.setUniformValue("mvp_matrix", m_otgCam.projection() * m_otgCam.modelView());
-
-        int vertLoc = m_shProg.attributeLocation("a_position");
-        m_shProg.enableAttributeArray(vertLoc);
-        m_shProg.setAttributeBuffer(vertLoc, GL_FLOAT, 0, 3, sizeof(tv::Vertex3d));
-
-        int fragLoc = m_shProg.attributeLocation("a_coord");
-        m_shProg.enableAttributeArray(fragLoc);
-        m_shProg.setAttributeBuffer(fragLoc, GL_FLOAT, 0, 3, sizeof(tv::Vertex3d));
-
-        glDrawElements(GL_TRIANGLES,
-                       m_ascii.indexArray().size(),
-                       GL_UNSIGNED_INT,
-                       m_ascii.indexArray().data());
-
-        break;
+        presentFrame();
+        return;
     }
-    case GlCam::Perspective:
-    {
-        //> CAMERA VIEWPORT
-        m_pstCam.setViewport(0, 0, width(), height());
-        //> CAMERA FAR PLANE MEASURES
-        m_pstCam.setAspectRatio(w / h);
-        m_pstCam.apply();
-        //> SET MATRICES
-//        glMatrixMode(GL_PROJECTION);
-//        glLoadMatrixf(m_pstCam.projection().data());
-//        glMatrixMode(GL_MODELVIEW);
-//        glLoadMatrixf(m_pstCam.modelView().data());
-
-        m_shProg.setUniformValue("mvp_matrix", m_pstCam.projection() * m_pstCam.modelView());
-
-        int vertLoc = m_shProg.attributeLocation("a_position");
-        m_shProg.enableAttributeArray(vertLoc);
-        m_shProg.setAttributeBuffer(vertLoc, GL_FLOAT, 0, 3, sizeof(tv::Vertex3d));
-
-        int fragLoc = m_shProg.attributeLocation("a_coord");
-        m_shProg.enableAttributeArray(fragLoc);
-        m_shProg.setAttributeBuffer(fragLoc, GL_FLOAT, 0, 3, sizeof(tv::Vertex3d));
 
-        glDrawElements(GL_TRIANGLES,
-                       m_ascii.indexArray().size(),
-                       GL_UNSIGNED_INT,
-                       m_ascii.indexArray().data());
-
-        break;
-    }
-    default:
+    cam::ViewSet frame = cameraStates();
+    if(frame.size == size() or frame.size.isEmpty())
     {
-        break;
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        renderScene(frame, devicePixelRatioF(), &m_frameTimer);
+        return;
     }
+
+    //Reduced resolution while interacting: draw small, then stretch over the widget.
+    if(not m_lowResFbo or m_lowResFbo->size() != frame.size)
+    {
+        m_lowResFbo = std::make_unique<QOpenGLFramebufferObject>(frame.size, QOpenGLFramebufferObject::Depth);
     }
+    m_lowResFbo->bind();
+    glViewport(0, 0, frame.size.width(), frame.size.height());
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    renderScene(frame, 1.0, &m_frameTimer);
+    m_lowResFbo->release();
+    glViewport(0, 0, qRound(width() * devicePixelRatioF()), qRound(height() * devicePixelRatioF()));
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    blitFrame(m_lowResFbo->texture());
 
 //    glViewport(0, 0, width(), height());
 
@@ -221,13 +265,26 @@ void GlWidget::resizeGL(int w, int h)
 {
     m_height = h;
     m_width = w;
+    if(m_renderThread) requestRender();
 }
 
 void GlWidget::mouseMoveEvent(QMouseEvent *e)
 {
+    if(e->buttons() == Qt::NoButton)
+    {
+        moveObserver(e->position());
+        return;
+    }
+    if(editAt(e->position(), e->buttons(), e->modifiers()))
+    {
+        m_dragStart = e->position();
+        return;
+    }
     QPointF dis = e->position() - m_dragStart;
+    std::vector<View> all = views();
+    GlCam* camera = all[size_t(std::min(m_activeView, int(all.size()) - 1))].camera;
 
-    switch(m_camMode)
+    switch(camera->type())
     {
     case GlCam::Orthographic:
     {
@@ -237,21 +294,22 @@ void GlWidget::mouseMoveEvent(QMouseEvent *e)
     }
     case GlCam::Perspective:
     {
-        QVector3D eye = m_pstCam.eye();
-        QVector3D center = m_pstCam.center();
+        PstCam& pstCam = static_cast<PstCam&>(*camera);
+        QVector3D eye = pstCam.eye();
+        QVector3D center = pstCam.center();
         switch(e->buttons())
         {
         case Qt::LeftButton:
         {
-            double dollyFac = (center - (eye + (center - eye).normalized() * m_pstCam.dolly())).length()/1000;
-            m_pstCam.truck(-dis.x() * m_pstCam.zoom() * dollyFac);
-            m_pstCam.pedestal(dis.y() * m_pstCam.zoom() * dollyFac);
+            double dollyFac = (center - (eye + (center - eye).normalized() * pstCam.dolly())).length()/1000;
+            pstCam.truck(-dis.x() * pstCam.zoom() * dollyFac);
+            pstCam.pedestal(dis.y() * pstCam.zoom() * dollyFac);
             break;
         }
         case Qt::RightButton:
         {
             m_arcCur = e->position();
-            m_pstCam.orbit(tv::qpfToQv2(m_arcStart), tv::qpfToQv2(m_arcCur));
+            pstCam.orbit(tv::qpfToQv2(m_arcStart), tv::qpfToQv2(m_arcCur));
             m_arcStart = m_arcCur;
             break;
         }
@@ -269,12 +327,18 @@ void GlWidget::mouseMoveEvent(QMouseEvent *e)
     }
 
     m_dragStart = e->position();
-    update();
+    beginInteraction();
+    requestRender();
 }
 
 void GlWidget::mousePressEvent(QMouseEvent *e)
 {
+    //Taking hold of the view ends a flight. A drag stays with the view it started in.
+    stopPath();
+    m_activeView = viewAt(e->position());
     m_dragStart = m_arcStart = e->position();
+    m_newStroke = true;
+    editAt(e->position(), e->buttons(), e->modifiers());
 }
 
 void GlWidget::mouseReleaseEvent(QMouseEvent *e)
@@ -284,7 +348,55 @@ void GlWidget::mouseReleaseEvent(QMouseEvent *e)
 
 void GlWidget::timerEvent(QTimerEvent *e)
 {
-
+    if(e->timerId() == m_derivedTimer)
+    {
+        killTimer(m_derivedTimer);
+        m_derivedTimer = 0;
+        tv::GridRect edited = m_edited;
+        m_edited = tv::GridRect();
+        updateDerived(edited);
+    }
+    else if(e->timerId() == m_exportTimer)
+    {
+        makeCurrent();
+        bool more = m_exporter->step();
+        doneCurrent();
+        emit exportProgress(int(m_exporter->tilesDone()), int(m_exporter->numTiles()));
+        if(not more)
+        {
+            killTimer(m_exportTimer);
+            m_exportTimer = 0;
+        }
+    }
+    else if(e->timerId() == m_flightTimer)
+    {
+        double time = double(m_flightClock.nsecsElapsed()) / 1e9;
+        if(time >= m_path.duration())
+        {
+            flyTo(m_path.duration());
+            stopPath();
+            emit pathFinished();
+            return;
+        }
+        flyTo(time);
+        beginInteraction();
+        requestRender();
+    }
+    else if(e->timerId() == m_refineTimer)
+    {
+        //Input has rested: one more frame at full quality.
+        killTimer(m_refineTimer);
+        m_refineTimer = 0;
+        m_interactive = false;
+        requestRender();
+    }
+    else if(e->timerId() == m_viewshedTimer)
+    {
+        killTimer(m_viewshedTimer);
+        m_viewshedTimer = 0;
+        updateOverlay();
+        requestRender();
+    }
 }
 
 void GlWidget::wheelEvent(QWheelEvent *e)
@@ -293,31 +405,34 @@ void GlWidget::wheelEvent(QWheelEvent *e)
     int deltaY = e->angleDelta().y();
     bool front = deltaY > 0;
     float fac = front ? 0.8 : 1.25;
+    m_activeView = viewAt(e->position());
+    View view = views()[size_t(m_activeView)];
 
-    switch(m_camMode)
+    switch(view.camera->type())
     {
     case GlCam::Orthographic:
     {
-        m_otgCam.zoomAt(tv::screenPosV(e->position(), size()), fac);
+        m_otgCam.zoomAt(tv::screenPosV(e->position() - view.rect.topLeft(), view.rect.size()), fac);
         break;
     }
     case GlCam::Perspective:
     {
+        PstCam& pstCam = static_cast<PstCam&>(*view.camera);
         switch(e->modifiers())
         {
         case Qt::NoModifier:
         {
-            m_pstCam.dolly(front ? 20 : -20);
+            pstCam.dolly(front ? 20 : -20);
             break;
         }
         case Qt::ControlModifier:
         {
-            m_pstCam.zoom(fac);
+            pstCam.zoom(fac);
             break;
         }
         case Qt::ShiftModifier:
         {
-            m_pstCam.dolly(front ? 10 : -10);
+            pstCam.dolly(front ? 10 : -10);
             break;
         }
         default:
@@ -333,15 +448,1410 @@ void GlWidget::wheelEvent(QWheelEvent *e)
     }
     }
 //    m_camera.zoomAt(fac, qpfToQv3(screenPos(e->posF())));
-    update();
+    beginInteraction();
+    requestRender();
 }
 
 /*********************************************
  * > Slots
  * ******************************************/
 
+/**
+ * Appends the perspective camera's current pose to the path, kKeyframeSpacing seconds
+ * after the last keyframe.
+ */
+void GlWidget::addKeyframe()
+{
+    cam::CameraPath::Keyframe key;
+    key.time = m_path.isEmpty() ? 0.0 : m_path.duration() + kKeyframeSpacing;
+    key.eye = m_pstCam.eye();
+    key.center = m_pstCam.center();
+    key.up = m_pstCam.up();
+    m_path.addKeyframe(key);
+}
+
+/**
+ * Flies the path in steps of 1/fps seconds as fast as frames can be drawn, each into an
+ * offscreen framebuffer of the widget's size and waited for, and logs how long the
+ * frames took. A frame over the budget of 1/fps would have been late on screen.
+ */
+bool GlWidget::benchmarkPath(double fps)
+{
+    if(m_path.numKeyframes() < 2 or not isValid() or fps <= 0.0) return false;
+    stopPath();
+    if(not m_splitView) setCameraMode(GlCam::Perspective);
+    //Full quality throughout, or the numbers would measure the adaptation instead.
+    m_interactive = false;
+
+    makeCurrent();
+    QOpenGLFramebufferObject fbo(size(), QOpenGLFramebufferObject::Depth);
+    fbo.bind();
+    size_t numFrames = size_t(std::floor(m_path.duration() * fps)) + 1;
+    std::vector<double> frameMs;
+    frameMs.reserve(numFrames);
+    QElapsedTimer timer;
+    for(size_t i = 0; i < numFrames; ++i)
+    {
+        flyTo(double(i) / fps);
+        cam::ViewSet frame = cameraStates();
+        timer.start();
+        glViewport(0, 0, frame.size.width(), frame.size.height());
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        renderScene(frame, 1.0);
+        glFinish();
+        frameMs.push_back(double(timer.nsecsElapsed()) / 1e6);
+    }
+    fbo.release();
+    doneCurrent();
+    m_flightTime = -1.0;
+
+    double budget = 1000.0 / fps;
+    size_t late = size_t(std::count_if(frameMs.begin(), frameMs.end(), [budget](double ms){return ms > budget;}));
+    double mean = std::accumulate(frameMs.begin(), frameMs.end(), 0.0) / double(numFrames);
+    std::sort(frameMs.begin(), frameMs.end());
+    auto percentile = [&frameMs](double p)
+    {
+        return frameMs[size_t(std::round(p * double(frameMs.size() - 1)))];
+    };
+    qDebug() << "Flight of" << numFrames << "frames in ms: mean" << mean << "median" << percentile(0.5)
+             << "p99" << percentile(0.99) << "max" << frameMs.back() << "late" << late;
+    requestRender();
+    return true;
+}
+
+/**
+ * Stops a running image or mesh export and removes the unfinished file.
+ */
+void GlWidget::cancelExport()
+{
+    if(m_meshExport)
+    {
+        m_meshCancelled = true;
+        m_meshExport->join();
+        m_meshExport.reset();
+    }
+    if(not m_exporter) return;
+    if(m_exportTimer) killTimer(m_exportTimer);
+    m_exportTimer = 0;
+    if(isValid())
+    {
+        makeCurrent();
+        m_exporter->release();
+        doneCurrent();
+    }
+    m_exporter.reset();
+}
+
+void GlWidget::clearPath()
+{
+    stopPath();
+    m_path.clear();
+}
+
+/**
+ * Starts measuring cut and fill from the first dataset to the second over a polygon in
+ * map coordinates, or over the whole first grid if the polygon is empty, on the job
+ * queue. Reuses the difference drawn by the overlay if it is current. cutFillFinished()
+ * reports the volumes. Returns false if fewer than two datasets are loaded.
+ */
+bool GlWidget::cutFill(const std::vector<QPointF>& polygon)
+{
+    if(m_datasets.size() < 2) return false;
+    const EaReader& earlier = *m_datasets.front().reader;
+    analysis::GridGeoref georef{earlier.xllCorner(), earlier.yllCorner(), earlier.sourceCellSize()};
+    m_derivedJobs.post([this, diff = m_difference, georef, polygon]()
+    {
+        std::shared_ptr<const tv::HeightGrid> grid = diff ? diff : differenceGrid(0);
+        analysis::CutFill result = analysis::cutFill(*grid, georef, polygon);
+        QMetaObject::invokeMethod(this, [this, result]()
+        {
+            emit cutFillFinished(result);
+        }, Qt::QueuedConnection);
+    });
+    return true;
+}
+
+/**
+ * Starts exporting the current view, the one last used in a split view, as a PNG image
+ * of the given width, its height following the view's aspect ratio. Tiles are drawn
+ * between events and encoded in the background; exportProgress() reports each tile and
+ * exportFinished() the end. Only one export runs at a time.
+ */
+bool GlWidget::exportImage(const QString& fileName, int width)
+{
+    if(m_exporter or m_meshExport or not isValid() or width <= 0) return false;
+    std::vector<View> all = views();
+    const View& active = all[size_t(std::min(m_activeView, int(all.size()) - 1))];
+    cam::CameraState view = fittedCameraState(active);
+    QSize size(width, std::max(1, qRound(double(width) * active.rect.height() / std::max(1, active.rect.width()))));
+    m_exporter = std::make_unique<render::TileExporter>(view, size, fileName, [this](const cam::CameraState& st)
+    {
+        renderScene(cam::ViewSet{st.viewport.size(), {st}}, 1.0);
+    });
+    connect(m_exporter.get(), &render::TileExporter::finished, this, [this, exporter = m_exporter.get()](bool ok)
+    {
+        //Ignore exports that have been cancelled meanwhile.
+        if(m_exporter.get() != exporter) return;
+        QString fileName = m_exporter->fileName();
+        cancelExport();
+        emit exportFinished(ok, fileName);
+    }, Qt::QueuedConnection);
+    //Not a zero timer: while the writer is behind, steps return at once and would spin.
+    m_exportTimer = startTimer(1);
+    return true;
+}
+
+/**
+ * Starts writing the first dataset as a mesh file, binary PLY or glTF as the file's
+ * suffix says, on a thread of its own. Coarse keeps every kCoarseStep-th sample, like the
+ * mesh drawn while interacting. exportProgress() reports the rows written and
+ * exportFinished() the end. The grid is read while it is written, so edits are ignored
+ * meanwhile. Only one export runs at a time.
+ */
+bool GlWidget::exportMesh(const QString& fileName, bool coarse)
+{
+    tv::MeshFormat format;
+    if(m_exporter or m_meshExport or m_datasets.empty() or not tv::MeshExporter::formatFor(fileName, format)) return false;
+    const EaReader& reader = *m_datasets.front().reader;
+    analysis::GridGeoref georef{reader.xllCorner(), reader.yllCorner(), reader.sourceCellSize()};
+    tv::MeshExporter exporter(reader.heightGrid(), float(reader.noDataValue()), georef);
+    exporter.setStep(coarse ? kCoarseStep : 1);
+
+    size_t job = ++m_meshExports;
+    m_meshCancelled = false;
+    m_meshExport = std::make_unique<std::thread>([this, exporter, fileName, format, job]()
+    {
+        bool ok = exporter.write(fileName, format, [this](size_t done, size_t total)
+        {
+            emit exportProgress(int(done), int(total));
+            return not m_meshCancelled;
+        });
+        QMetaObject::invokeMethod(this, [this, ok, fileName, job]()
+        {
+            //Ignore exports that have been cancelled meanwhile.
+            if(job != m_meshExports or not m_meshExport) return;
+            m_meshExport->join();
+            m_meshExport.reset();
+            emit exportFinished(ok, fileName);
+        }, Qt::QueuedConnection);
+    });
+    return true;
+}
+
+/**
+ * Replaces the camera path by the one stored in a file. Keeps the current path if the
+ * file cannot be read.
+ */
+bool GlWidget::loadPath(const QString& fileName)
+{
+    stopPath();
+    return m_path.load(fileName);
+}
+
+/**
+ * Replaces the displayed terrain by the given grid files. Every further dataset is
+ * placed relative to the first one according to its georeference.
+ */
+bool GlWidget::openFiles(const QStringList& fNames)
+{
+    std::vector<Dataset> loaded;
+    for(const QString& fName : fNames)
+    {
+        Dataset set;
+        if(not loadDataset(fName, set))
+        {
+            qDebug() << "Skipping unreadable dataset" << fName;
+            continue;
+        }
+        if(not loaded.empty())
+        {
+            const EaReader& first = *loaded.front().reader;
+            double cs = first.sourceCellSize();
+            double firstTop = first.yllCorner() + first.numRows() * cs;
+            double top = set.reader->yllCorner() + set.reader->numRows() * set.reader->sourceCellSize();
+            set.offset = QVector3D((firstTop - top) / cs * first.cellSize(),
+                                   (set.reader->xllCorner() - first.xllCorner()) / cs * first.cellSize(),
+                                   0);
+        }
+        buildPyramid(set);
+        set.horizons = std::make_unique<render::HorizonMap>();
+        set.normals = std::make_unique<render::NormalMap>();
+        set.normals->setTerrain(&set.reader->heightGrid(), set.reader->heightScale());
+        loaded.push_back(std::move(set));
+    }
+    if(loaded.empty() and not fNames.isEmpty()) return false;
+
+    cancelExport();
+    //Jobs still tracing refer to the datasets and take the scene lock themselves.
+    m_derivedJobs.clear();
+    QMutexLocker lock(&m_sceneLock);
+    if(isValid()) makeCurrent();
+    releaseDatasets();
+    m_datasets = std::move(loaded);
+    m_edited = tv::GridRect();
+    m_undoSteps.clear();
+    if(not m_datasets.empty())
+    {
+        const EaReader& first = *m_datasets.front().reader;
+        m_clipmap.setTerrain(&first.heightGrid(), first.heightScale());
+        m_raster.setTerrain(&first.heightGrid(), &m_datasets.front().pyramid, first.heightScale());
+    }
+    if(isValid())
+    {
+        uploadDatasets();
+        doneCurrent();
+    }
+    lock.unlock();
+    updateDerived();
+    requestRender();
+    return true;
+}
+
+/**
+ * Reads a grid on a thread of its own while this thread uploads the mesh block by block
+ * as the reader hands it on, so the transfer overlaps reading, parsing and meshing. The
+ * buffers are allocated at their full size with the first block. Without a context the
+ * blocks are only taken, leaving the upload to uploadDatasets().
+ */
+bool GlWidget::loadDataset(const QString& fName, Dataset& set)
+{
+    EaReader::MeshBlockQueue blocks(EaReader::kQueuedBlocks);
+    std::thread loader([&set, &fName, &blocks]()
+    {
+        set.reader = std::make_unique<EaReader>(fName, &blocks);
+    });
+
+    bool upload = isValid();
+    if(upload) makeCurrent();
+    QElapsedTimer timer;
+    qint64 uploadNs = 0;
+    EaReader::MeshBlock block;
+    while(blocks.pop(block))
+    {
+        if(not upload) continue;
+        timer.start();
+        if(not set.vbo.isCreated())
+        {
+            set.vbo.create();
+            set.vbo.bind();
+            set.vbo.allocate(int(block.totalVertices * sizeof(tv::Vertex3d)));
+            set.ibo = QOpenGLBuffer(QOpenGLBuffer::IndexBuffer);
+            set.ibo.create();
+            set.ibo.bind();
+            set.ibo.allocate(int(block.totalIndices * sizeof(GLuint)));
+        }
+        set.vbo.write(int(block.firstVertex * sizeof(tv::Vertex3d)), block.vertices,
+                      int(block.numVertices * sizeof(tv::Vertex3d)));
+        if(block.numIndices > 0)
+        {
+            set.ibo.write(int(block.firstIndex * sizeof(GLuint)), block.indices, int(block.numIndices * sizeof(GLuint)));
+        }
+        uploadNs += timer.nsecsElapsed();
+    }
+    loader.join();
+
+    bool valid = set.reader->isValid();
+    if(set.vbo.isCreated())
+    {
+        set.vbo.release();
+        set.ibo.release();
+        if(valid)
+        {
+            set.numIndices = GLsizei(set.reader->numIndices());
+            qDebug() << "Load stage upload in ms:" << double(uploadNs) / 1e6;
+        }
+        else
+        {
+            set.vbo.destroy();
+            set.ibo.destroy();
+        }
+    }
+    if(upload) doneCurrent();
+    return valid;
+}
+
+/**
+ * Flies the perspective camera along the path in real time, from its first keyframe on.
+ * A single view switches to the perspective camera. Needs at least two keyframes.
+ */
+bool GlWidget::playPath()
+{
+    if(m_path.numKeyframes() < 2) return false;
+    if(not m_splitView) setCameraMode(GlCam::Perspective);
+    flyTo(0.0);
+    m_flightClock.start();
+    if(not m_flightTimer) m_flightTimer = startTimer(kFlightInterval, Qt::PreciseTimer);
+    requestRender();
+    return true;
+}
+
+bool GlWidget::savePath(const QString& fileName)
+{
+    return m_path.save(fileName);
+}
+
+/**
+ * Whether the pyramids of opened grids are kept in a file next to each grid and read
+ * from there the next time. Applies to datasets opened from now on.
+ */
+void GlWidget::setCachePyramids(bool cache)
+{
+    m_cachePyramids = cache;
+}
+
+/**
+ * Camera of the single view. The split view shows both cameras regardless.
+ */
 void GlWidget::setCameraMode(CamMode mode)
 {
-    m_camMode = mode;
-    update();
+    if(mode != m_camMode)
+    {
+        m_camMode = mode;
+        emit cameraModeChanged(mode);
+    }
+    requestRender();
+}
+
+/**
+ * Shows contour lines every interval height units of the source data, or hides them for
+ * an interval of zero.
+ */
+void GlWidget::setContourInterval(double interval)
+{
+    m_contourInterval = std::max(0.0, interval);
+    updateContours();
+    requestRender();
+}
+
+/**
+ * Number of further perspective views shown in a strip below the split view, each with
+ * a camera of its own that starts as a copy of the main perspective camera.
+ */
+void GlWidget::setExtraViews(int count)
+{
+    m_extraCams.resize(size_t(std::max(0, count)), m_pstCam);
+    m_activeView = 0;
+    requestRender();
+}
+
+/**
+ * Shows the orthographic overview and the perspective view side by side, together with
+ * any extra views. All views draw from the same GPU buffers within one frame.
+ */
+void GlWidget::setSplitView(bool split)
+{
+    m_splitView = split;
+    m_activeView = 0;
+    requestRender();
+}
+
+/**
+ * Places the sun that lights the terrain, azimuth in degrees clockwise from north and
+ * altitude in degrees above the horizon. Shadows follow right away as the horizons do
+ * not depend on the sun.
+ */
+void GlWidget::setSunPosition(float azimuth, float altitude)
+{
+    QMutexLocker lock(&m_sceneLock);
+    m_sunAzimuth = azimuth;
+    m_sunAltitude = std::clamp(altitude, 0.0f, 90.0f);
+    lock.unlock();
+    requestRender();
+}
+
+/**
+ * Colors the first dataset by a product derived from its heights, or plainly by height
+ * for OverlayMode::None.
+ */
+void GlWidget::setSurfaceOverlay(render::OverlayMode mode)
+{
+    m_overlayMode = mode;
+    //The viewshed follows the cursor, which needs move events without a button held.
+    setMouseTracking(mode == render::OverlayMode::Viewshed);
+    updateOverlay();
+    requestRender();
+}
+
+/**
+ * Whether datasets keep their CPU side mesh after it has been uploaded. Applies to
+ * datasets uploaded from now on.
+ */
+void GlWidget::setKeepCpuMesh(bool keep)
+{
+    m_keepCpuMesh = keep;
+}
+
+/**
+ * Shades the terrain per pixel from the normal map of each dataset, with shadows and
+ * ambient occlusion from its horizons. The normal maps are built when lighting is first
+ * drawn, the horizons in the background right away; shadows appear once they are done.
+ */
+void GlWidget::setLighting(bool enabled)
+{
+    QMutexLocker lock(&m_sceneLock);
+    m_lighting = enabled;
+    lock.unlock();
+    updateHorizons();
+    requestRender();
+}
+
+/**
+ * Draws the first dataset as a flat raster in the orthographic view, whose camera always
+ * looks straight down, instead of as a mesh.
+ */
+void GlWidget::setOrthoRaster(bool enabled)
+{
+    m_orthoRaster = enabled;
+    requestRender();
+}
+
+/**
+ * Frame time in milliseconds to keep while the view is dragged or zoomed. Frames are then
+ * drawn at a reduced resolution, and on a coarser mesh if that is not enough, and redrawn
+ * at full quality once input rests. Zero always draws at full quality.
+ */
+void GlWidget::setTargetFrameTime(double ms)
+{
+    m_targetFrameMs = std::max(0.0, ms);
+}
+
+/**
+ * Draws the first dataset through the geometry clipmap instead of the full mesh.
+ */
+void GlWidget::setClipmapEnabled(bool enabled)
+{
+    QMutexLocker lock(&m_sceneLock);
+    m_useClipmap = enabled;
+    lock.unlock();
+    requestRender();
+}
+
+/**
+ * Moves drawing to a dedicated thread. The GUI thread then only handles input, hands
+ * camera states over and shows the latest finished frame.
+ */
+void GlWidget::setThreadedRendering(bool enabled)
+{
+    if(enabled == bool(m_renderThread) or not isValid()) return;
+    if(enabled)
+    {
+        m_renderThread = std::make_unique<render::RenderThread>(context(), [this](const cam::ViewSet& frame, render::FrameTimer& frameTimer)
+        {
+            renderScene(frame, 1.0, &frameTimer);
+        });
+        connect(m_renderThread.get(), &render::RenderThread::frameReady,
+                this, QOverload<>::of(&QWidget::update), Qt::QueuedConnection);
+        m_renderThread->start();
+    }
+    else
+    {
+        m_renderThread.reset();
+    }
+    requestRender();
+}
+
+/**
+ * Ends a flight, leaving the camera where it is.
+ */
+void GlWidget::stopPath()
+{
+    if(m_flightTimer) killTimer(m_flightTimer);
+    m_flightTimer = 0;
+    m_flightTime = -1.0;
+}
+
+/**
+ * Restores the heights of the first dataset as they were before the last brush stroke.
+ * Returns false if there is none to undo or a mesh export is reading the grid.
+ */
+bool GlWidget::undoEdit()
+{
+    if(m_undoSteps.empty() or m_meshExport or m_datasets.empty()) return false;
+    std::vector<HeightPatch> step = std::move(m_undoSteps.back());
+    m_undoSteps.pop_back();
+
+    tv::GridRect changed;
+    QMutexLocker lock(&m_sceneLock);
+    EaReader& reader = *m_datasets.front().reader;
+    //Each patch was saved on top of the ones before it, so the last goes back first.
+    for(auto it = step.rbegin(); it != step.rend(); ++it)
+    {
+        const HeightPatch& patch = *it;
+        reader.editHeights(patch.rect, [&patch](size_t r, size_t c, float)
+        {
+            return patch.heights[(r - patch.rect.row0) * patch.rect.numCols() + c - patch.rect.col0];
+        });
+        changed = changed.united(patch.rect);
+    }
+    lock.unlock();
+    heightsEdited(changed);
+    return true;
+}
+
+/*********************************************
+ * > Private
+ * ******************************************/
+
+/**
+ * Steers the resolution scale and mesh detail towards the target frame time from the
+ * time the last interactive frame took. The resolution follows first, as the pixel cost
+ * goes with its square; the coarse mesh has a sixteenth of the vertices and is only left
+ * again once even that would fit.
+ */
+void GlWidget::adaptQuality(double frameMs)
+{
+    double target = m_targetFrameMs;
+    float scale = m_renderScale;
+    if(frameMs > target)
+    {
+        if(scale > kMinRenderScale) scale = std::max(kMinRenderScale, scale * float(std::max(0.5, std::sqrt(target / frameMs))));
+        else m_coarseMesh = true;
+    }
+    else if(frameMs < 0.5 * target)
+    {
+        if(m_coarseMesh and frameMs * double(kCoarseStep * kCoarseStep) < target) m_coarseMesh = false;
+        else scale = std::min(1.0f, scale * 1.25f);
+    }
+    m_renderScale = scale;
+}
+
+/**
+ * Marks the frames from now on as interactive, until input rests for a moment.
+ */
+void GlWidget::beginInteraction()
+{
+    if(m_targetFrameMs <= 0.0) return;
+    m_interactive = true;
+    if(m_refineTimer) killTimer(m_refineTimer);
+    m_refineTimer = startTimer(kRefineDelay);
+}
+
+/**
+ * Stretches a color texture over the current viewport.
+ */
+void GlWidget::blitFrame(GLuint texture)
+{
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDisable(GL_DEPTH_TEST);
+    m_blitter.bind();
+    m_blitter.blit(texture, QMatrix4x4(), QOpenGLTextureBlitter::OriginBottomLeft);
+    m_blitter.release();
+    glEnable(GL_DEPTH_TEST);
+}
+
+/**
+ * Gives a dataset the pyramid of its grid, from the cache next to its file if enabled
+ * and up to date, else by building and, if enabled, caching it.
+ */
+void GlWidget::buildPyramid(Dataset& set)
+{
+    const EaReader& reader = *set.reader;
+    float noData = float(reader.noDataValue());
+    if(m_cachePyramids and set.pyramid.load(reader.fileName(), reader.heightGrid(), noData, tv::Reducer::Mean)) return;
+    set.pyramid.build(reader.heightGrid(), noData, tv::Reducer::Mean);
+    if(m_cachePyramids) set.pyramid.save(reader.fileName());
+}
+
+/**
+ * Fits the camera of every view to its rectangle and applies it. While interacting the
+ * frame and the viewports in it shrink to the current resolution scale; the views
+ * themselves stay the same.
+ */
+cam::ViewSet GlWidget::cameraStates()
+{
+    cam::ViewSet frame;
+    frame.size = size();
+    for(const View& view : views()) frame.views.push_back(fittedCameraState(view));
+
+    float scale = m_renderScale;
+    if(m_interactive and scale < 1.0f)
+    {
+        frame.size = QSize(std::max(1, qRound(width() * scale)), std::max(1, qRound(height() * scale)));
+        for(cam::CameraState& st : frame.views)
+        {
+            const QRect& r = st.viewport;
+            st.viewport = QRect(qRound(r.x() * scale), qRound(r.y() * scale),
+                                std::max(1, qRound(r.width() * scale)), std::max(1, qRound(r.height() * scale)));
+        }
+    }
+    if(m_flightTime >= 0.0)
+    {
+        frame.hasLookAhead = true;
+        frame.lookAhead = m_path.at(std::min(m_flightTime + kLookAhead, m_path.duration())).eye;
+    }
+    return frame;
+}
+
+cam::CameraState GlWidget::fittedCameraState(const View& view)
+{
+    const QRect& r = view.rect;
+    float   w = float(r.width()) * .5f;
+    float   h = float(r.height()) * .5f;
+
+    switch(view.camera->type())
+    {
+    case GlCam::Perspective:
+    {
+        PstCam& pstCam = static_cast<PstCam&>(*view.camera);
+        //> CAMERA VIEWPORT
+        pstCam.setViewport(r.x(), r.y(), r.width(), r.height());
+        //> CAMERA FAR PLANE MEASURES
+        pstCam.setAspectRatio(w / h);
+        pstCam.apply();
+        return pstCam.state();
+    }
+    case GlCam::Orthographic:
+    default:
+    {
+        //> CAMERA VIEWPORT
+        m_otgCam.setViewport(r.x(), r.y(), r.width(), r.height());
+        //> CAMERA FAR PLANE MEASURES
+        m_otgCam.setRect(-w, w, -h, h);
+        m_otgCam.apply();
+        return m_otgCam.state();
+    }
+    }
+}
+
+/**
+ * The difference of the second dataset to the first, resampled at the samples of the
+ * first. Runs on the job queue. The first dataset may be edited meanwhile, so the scene
+ * lock is held for one band of rows at a time; the second one is never edited. Returns
+ * null as soon as a later overlay makes the job stale, except for job 0.
+ */
+std::shared_ptr<tv::HeightGrid> GlWidget::differenceGrid(size_t job)
+{
+    const EaReader& earlier = *m_datasets[0].reader;
+    const EaReader& later = *m_datasets[1].reader;
+    analysis::GridGeoref earlierRef{earlier.xllCorner(), earlier.yllCorner(), earlier.sourceCellSize()};
+    analysis::GridGeoref laterRef{later.xllCorner(), later.yllCorner(), later.sourceCellSize()};
+    analysis::HeightSampler sampler(later.heightGrid(), float(later.noDataValue()), laterRef);
+    size_t rows = earlier.numRows();
+    auto diff = std::make_shared<tv::HeightGrid>(earlier.numCols(), rows);
+    for(size_t r = 0; r < rows; r += kDifferenceBand)
+    {
+        if(job != 0 and job != m_overlayJobs) return nullptr;
+        QMutexLocker lock(&m_sceneLock);
+        analysis::differenceRows(earlier.heightGrid(), float(earlier.noDataValue()), earlierRef, sampler, r,
+                                 std::min(rows, r + kDifferenceBand), *diff);
+    }
+    return diff;
+}
+
+/**
+ * Draws the datasets from the given one on as meshes, the full ones as their tiles in
+ * view and coarse ones from the decimated index buffers.
+ */
+void GlWidget::drawDatasets(const QMatrix4x4& mvp, bool coarse, size_t first)
+{
+    //Differences are drawn on the first dataset, which the later ones would cover.
+    size_t end = m_overlay.mode() == render::OverlayMode::Difference ? std::min<size_t>(1, m_datasets.size())
+                                                                     : m_datasets.size();
+    if(first >= end) return;
+    m_shProg.bind();
+    int vertLoc = m_shProg.attributeLocation("a_position");
+    int fragLoc = m_shProg.attributeLocation("a_coord");
+    for(size_t i = first; i < end; ++i)
+    {
+        Dataset& set = m_datasets[i];
+        QMatrix4x4 model;
+        model.translate(set.offset);
+        m_shProg.setUniformValue("mvp_matrix", mvp * model);
+        m_overlay.apply(m_shProg, &set == &m_datasets.front());
+        lightingFor(set).apply(m_shProg);
+
+        bool useCoarse = coarse and set.coarseIbo.isCreated();
+        QOpenGLBuffer& ibo = useCoarse ? set.coarseIbo : set.ibo;
+        set.vbo.bind();
+        ibo.bind();
+        m_shProg.enableAttributeArray(vertLoc);
+        m_shProg.setAttributeBuffer(vertLoc, GL_FLOAT, 0, 3, sizeof(tv::Vertex3d));
+        m_shProg.enableAttributeArray(fragLoc);
+        m_shProg.setAttributeBuffer(fragLoc, GL_FLOAT, 0, 3, sizeof(tv::Vertex3d));
+
+        if(useCoarse) glDrawElements(GL_TRIANGLES, set.numCoarseIndices, GL_UNSIGNED_INT, nullptr);
+        else m_tileBatch.draw(set.reader->meshTiles(), mvp * model);
+        ibo.release();
+    }
+}
+
+/**
+ * Shows the latest frame finished by the render thread.
+ */
+void GlWidget::presentFrame()
+{
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    m_renderThread->frames().fetch();
+    render::RenderThread::Frame& frame = m_renderThread->frames().front();
+    if(not frame.fbo) return;
+    if(frame.fence)
+    {
+        glWaitSync(frame.fence, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(frame.fence);
+        frame.fence = nullptr;
+    }
+    blitFrame(frame.fbo->texture());
+}
+
+/**
+ * Height brush of the orthographic view: Ctrl with the left button raises the terrain
+ * under the cursor, with the right button lowers it, with Shift added smooths it and with
+ * Alt added fills the NODATA holes under it. Each stroke can be undone by undoEdit().
+ * Returns false if the event is not an edit.
+ */
+bool GlWidget::editAt(const QPointF& pos, Qt::MouseButtons buttons, Qt::KeyboardModifiers mods)
+{
+    if(views()[size_t(viewAt(pos))].camera != &m_otgCam or not (mods & Qt::ControlModifier) or m_datasets.empty()) return false;
+    if(not (buttons & (Qt::LeftButton | Qt::RightButton))) return false;
+
+    //A mesh export is reading the grid.
+    if(m_meshExport) return true;
+    QVector3D grid = gridPosAt(pos);
+
+    Dataset& set = m_datasets.front();
+    const tv::HeightGrid& heights = set.reader->heightGrid();
+    //One cell more than the brush reaches, for the rounding of its center.
+    double reach = m_brushRadius + 1.0;
+    tv::GridRect brush = tv::GridRect(size_t(std::max(0.0, double(grid.x()) - reach)),
+                                      size_t(std::max(0.0, double(grid.y()) - reach)),
+                                      size_t(std::max(0.0, double(grid.x()) + reach + 1.0)),
+                                      size_t(std::max(0.0, double(grid.y()) + reach + 1.0))).intersected(heights.bounds());
+    if(brush.isEmpty()) return true;
+
+    //Everything from a press to the release is undone as one step.
+    if(m_newStroke or m_undoSteps.empty())
+    {
+        if(m_undoSteps.size() == kMaxUndoSteps) m_undoSteps.erase(m_undoSteps.begin());
+        m_undoSteps.emplace_back();
+        m_newStroke = false;
+    }
+    HeightPatch patch{brush, std::vector<float>(brush.numRows() * brush.numCols())};
+    for(size_t r = brush.row0; r < brush.row1; ++r)
+    {
+        std::copy_n(heights.row(r) + brush.col0, brush.numCols(), patch.heights.data() + (r - brush.row0) * brush.numCols());
+    }
+    m_undoSteps.back().push_back(std::move(patch));
+
+    QMutexLocker lock(&m_sceneLock);
+    if(mods & Qt::AltModifier)
+    {
+        edit::fillHoles(*set.reader, brush);
+    }
+    else if(mods & Qt::ShiftModifier)
+    {
+        edit::smooth(*set.reader, grid.x(), grid.y(), m_brushRadius, 0.5f);
+    }
+    else
+    {
+        float amount = buttons & Qt::LeftButton ? m_brushStrength : -m_brushStrength;
+        edit::raise(*set.reader, grid.x(), grid.y(), m_brushRadius, amount);
+    }
+    lock.unlock();
+    heightsEdited(brush);
+    return true;
+}
+
+/**
+ * Rederives what depends on the heights of the first dataset after the cells in rect
+ * have changed.
+ */
+void GlWidget::heightsEdited(const tv::GridRect& rect)
+{
+    //A difference still being computed misses this edit.
+    m_difference.reset();
+    ++m_overlayJobs;
+    m_edited = m_edited.united(rect);
+    //Rederive once the brush has rested for a moment instead of on every stroke.
+    if(m_contourInterval > 0.0 or m_lighting or m_overlayMode != render::OverlayMode::None)
+    {
+        if(m_derivedTimer) killTimer(m_derivedTimer);
+        m_derivedTimer = startTimer(150);
+    }
+    requestRender();
+}
+
+/**
+ * Position in the grid of the first dataset under a widget position, in the orthographic
+ * view. Needs at least one dataset.
+ */
+QVector3D GlWidget::gridPosAt(const QPointF& pos)
+{
+    QRect r = rect();
+    for(const View& view : views())
+    {
+        if(view.camera == &m_otgCam) r = view.rect;
+    }
+    QPointF p = pos - r.topLeft();
+    QVector3D ndc(2.0 * p.x() / r.width() - 1.0, 1.0 - 2.0 * p.y() / r.height(), 0.0);
+    QVector3D world = (m_otgCam.projection() * m_otgCam.modelView()).inverted().map(ndc);
+    return world - m_datasets.front().offset;
+}
+
+/**
+ * Puts the viewshed observer on the sample under the cursor. The viewshed is recomputed
+ * once pending events are handled, so fast moves only pay for the last position.
+ */
+void GlWidget::moveObserver(const QPointF& pos)
+{
+    if(m_overlayMode != render::OverlayMode::Viewshed or m_datasets.empty()) return;
+    if(views()[size_t(viewAt(pos))].camera != &m_otgCam) return;
+    QVector3D grid = gridPosAt(pos);
+    const EaReader& reader = *m_datasets.front().reader;
+    int row = qRound(grid.x());
+    int col = qRound(grid.y());
+    if(row < 0 or col < 0 or row >= int(reader.numRows()) or col >= int(reader.numCols())) return;
+    m_observer = QPoint(row, col);
+    if(not m_viewshedTimer) m_viewshedTimer = startTimer(0);
+}
+
+/**
+ * Puts the perspective camera where the path is at the given time.
+ */
+void GlWidget::flyTo(double time)
+{
+    cam::CameraPath::Keyframe key = m_path.at(time);
+    m_pstCam.lookAt(key.eye, key.center, key.up);
+    m_flightTime = time;
+}
+
+/**
+ * Draws the terrain through the renderer that suits the view: the flat raster from
+ * straight above, else the clipmap or the full meshes. The clipmap's levels are centered
+ * on lodEye, so that views of one frame share them.
+ */
+void GlWidget::drawTerrain(const cam::CameraState& st, const QVector3D& lodEye, bool coarse)
+{
+    QMatrix4x4 mvp = st.projection * st.modelView;
+    if((m_useClipmap or (m_orthoRaster and st.type == GlCam::Orthographic)) and not m_datasets.empty())
+    {
+        const Dataset& set = m_datasets.front();
+        QMatrix4x4 model;
+        model.translate(set.offset);
+        render::Lighting lighting = lightingFor(set);
+        if(m_orthoRaster and st.type == GlCam::Orthographic) m_raster.draw(mvp * model, &m_overlay, &lighting);
+        else m_clipmap.draw(mvp * model, (lodEye - set.offset).toVector2D(), &m_overlay, &lighting);
+        //Only the first dataset has a raster and a clipmap; the others stay meshes.
+        drawDatasets(mvp, coarse, 1);
+        return;
+    }
+    drawDatasets(mvp, coarse);
+}
+
+/**
+ * The lighting of a dataset as the settings stand, nothing while lighting is off. Needs
+ * the scene lock.
+ */
+render::Lighting GlWidget::lightingFor(const Dataset& set) const
+{
+    render::Lighting lighting;
+    if(not m_lighting) return lighting;
+    lighting.normals = set.normals.get();
+    lighting.horizons = set.horizons.get();
+    lighting.azimuth = m_sunAzimuth;
+    lighting.altitude = m_sunAltitude;
+    return lighting;
+}
+
+/**
+ * Draws the scene as seen by every view of the frame into the current framebuffer, whose
+ * pixels are pixelScale times those of the frame. A single view keeps the viewport that
+ * is set. Edits are uploaded once for all views, which share the GPU buffers. Runs on
+ * the render thread when threaded rendering is enabled. Interactive frames adapt their
+ * quality to the times measured by frameTimer, which belongs to the current context.
+ */
+void GlWidget::renderScene(const cam::ViewSet& frame, double pixelScale, render::FrameTimer* frameTimer)
+{
+    QElapsedTimer timer;
+    timer.start();
+    bool interactive = m_interactive;
+    if(interactive and frameTimer) frameTimer->begin();
+
+    //The clipmap follows the first perspective view; recentering it per view would
+    //upload its levels again and again.
+    QVector3D lodEye = frame.views.empty() ? QVector3D() : frame.views.front().eye;
+    for(const cam::CameraState& st : frame.views)
+    {
+        if(st.type == GlCam::Perspective)
+        {
+            lodEye = st.eye;
+            break;
+        }
+    }
+
+    QMutexLocker lock(&m_sceneLock);
+    uploadEdits();
+    if(frame.hasLookAhead and m_useClipmap and not m_datasets.empty())
+    {
+        m_clipmap.prefetch((frame.lookAhead - m_datasets.front().offset).toVector2D());
+    }
+    for(const cam::CameraState& st : frame.views)
+    {
+        if(frame.views.size() > 1)
+        {
+            const QRect& r = st.viewport;
+            glViewport(qRound(r.x() * pixelScale), qRound((frame.size.height() - r.y() - r.height()) * pixelScale),
+                       qRound(r.width() * pixelScale), qRound(r.height() * pixelScale));
+        }
+        drawTerrain(st, lodEye, interactive and m_coarseMesh);
+        m_contours.draw(st.projection * st.modelView);
+    }
+    if(frame.views.size() > 1)
+    {
+        glViewport(0, 0, qRound(frame.size.width() * pixelScale), qRound(frame.size.height() * pixelScale));
+    }
+    lock.unlock();
+    if(not frameTimer) return;
+    frameTimer->end();
+
+    //The GPU time arrives a frame or two late, but waiting for it would stall this thread
+    //and the GPU alike. Whichever of the two takes longer limits the frame rate.
+    double gpuMs = 0.0;
+    bool timed = frameTimer->poll(gpuMs);
+    if(interactive and timed) adaptQuality(std::max(gpuMs, double(timer.nsecsElapsed()) / 1e6));
+}
+
+/**
+ * Updates the view, either directly or by handing the current camera state over to the
+ * render thread.
+ */
+void GlWidget::requestRender()
+{
+    if(not m_renderThread)
+    {
+        update();
+        return;
+    }
+    m_renderThread->cameras().back() = cameraStates();
+    m_renderThread->cameras().publish();
+    m_renderThread->requestFrame();
+}
+
+/**
+ * Destroys the GPU buffers of all datasets. Needs a current context.
+ */
+void GlWidget::releaseDatasets()
+{
+    m_clipmap.setTerrain(nullptr, 1.0);
+    m_raster.setTerrain(nullptr, nullptr, 1.0);
+    for(Dataset& set : m_datasets)
+    {
+        if(set.vbo.isCreated()) set.vbo.destroy();
+        if(set.ibo.isCreated()) set.ibo.destroy();
+        if(set.coarseIbo.isCreated()) set.coarseIbo.destroy();
+        set.horizons->release();
+        set.normals->release();
+    }
+    m_datasets.clear();
+}
+
+/**
+ * Draws a raster that an overlay job has finished, unless a later overlay or edit has
+ * replaced the job meanwhile. Returns false for such a stale job.
+ */
+bool GlWidget::setOverlayRaster(size_t job, std::vector<qfloat16>&& raster, size_t rows, size_t cols,
+                                render::OverlayMode mode)
+{
+    if(job != m_overlayJobs) return false;
+    QMutexLocker lock(&m_sceneLock);
+    m_overlay.setRaster(std::move(raster), rows, cols, mode);
+    lock.unlock();
+    requestRender();
+    return true;
+}
+
+/**
+ * Job of updateHorizons(): traces the horizons of a dataset, all of them or those around
+ * the edited cells, and swaps them in under the scene lock. Only the first dataset is
+ * ever edited, so its heights are copied under the lock; the others are read in place.
+ */
+void GlWidget::traceHorizons(Dataset& set, const tv::GridRect& edited)
+{
+    const EaReader& reader = *set.reader;
+    const tv::HeightGrid& grid = reader.heightGrid();
+    size_t rows = grid.numRows();
+    size_t cols = grid.numCols();
+    analysis::HorizonParams params;
+    params.cellSize = drawnCellSize(reader);
+    params.noData = float(reader.noDataValue());
+
+    //An edit changes the horizons of the samples that see it, which in turn see the
+    //samples up to the search distance beyond them.
+    size_t reach = size_t(std::ceil(params.maxDistance));
+    tv::GridRect region = edited.isEmpty() ? grid.bounds() : edited.expanded(reach, rows, cols);
+    tv::GridRect window = edited.isEmpty() ? grid.bounds() : region.expanded(reach, rows, cols);
+    std::vector<uint8_t> traced;
+    if(&set == &m_datasets.front())
+    {
+        tv::HeightGrid heights(window.numCols(), window.numRows());
+        QMutexLocker lock(&m_sceneLock);
+        for(size_t r = window.row0; r < window.row1; ++r)
+        {
+            std::copy_n(grid.row(r) + window.col0, window.numCols(), heights.row(r - window.row0));
+        }
+        lock.unlock();
+        analysis::horizonAngles(heights, params, traced);
+    }
+    else
+    {
+        analysis::horizonAngles(grid, params, traced);
+    }
+
+    if(edited.isEmpty())
+    {
+        QMutexLocker lock(&m_sceneLock);
+        set.horizons->setHorizons(std::move(traced), rows, cols);
+    }
+    else
+    {
+        //Keep the region out of the window, plane by plane.
+        size_t width = region.numCols() * 4;
+        size_t plane = window.numRows() * window.numCols() * 4;
+        size_t regionPlane = region.numRows() * width;
+        std::vector<uint8_t> horizons(regionPlane * 2);
+        for(size_t i = 0; i < 2; ++i)
+        {
+            for(size_t r = region.row0; r < region.row1; ++r)
+            {
+                const uint8_t* src = traced.data() + i * plane +
+                                     ((r - window.row0) * window.numCols() + region.col0 - window.col0) * 4;
+                std::copy_n(src, width, horizons.data() + i * regionPlane + (r - region.row0) * width);
+            }
+        }
+        QMutexLocker lock(&m_sceneLock);
+        set.horizons->updateRegion(region, std::move(horizons));
+    }
+    QMetaObject::invokeMethod(this, [this]()
+    {
+        requestRender();
+    }, Qt::QueuedConnection);
+}
+
+/**
+ * Retraces the contour lines of all datasets. Tracing runs on the calling thread, split
+ * across workers; the lines are uploaded by the next frame.
+ */
+void GlWidget::updateContours()
+{
+    std::vector<std::vector<analysis::Contour>> traced;
+    if(m_contourInterval > 0.0)
+    {
+        for(const Dataset& set : m_datasets)
+        {
+            const EaReader& reader = *set.reader;
+            float noData = float(reader.noDataValue());
+            std::vector<float> levels = analysis::contourLevels(reader.heightGrid(), noData, float(m_contourInterval));
+            if(levels.empty())
+            {
+                qDebug() << "No contours every" << m_contourInterval << "in" << reader.fileName()
+                         << "- the grid is flat or would need more than" << analysis::kMaxContourLevels << "levels.";
+            }
+            traced.push_back(analysis::traceContours(reader.heightGrid(), levels, noData));
+        }
+    }
+
+    QMutexLocker lock(&m_sceneLock);
+    m_contours.clear();
+    for(size_t i = 0; i < traced.size(); ++i)
+    {
+        m_contours.addContours(traced[i], m_datasets[i].reader->heightScale(), m_datasets[i].offset);
+    }
+}
+
+/**
+ * Brings everything derived from the heights up to date after the terrain changed, the
+ * cells of the first dataset in edited or everywhere if it is empty.
+ */
+void GlWidget::updateDerived(const tv::GridRect& edited)
+{
+    updateContours();
+    updateHorizons(edited);
+    updateOverlay();
+}
+
+/**
+ * Starts recomputing the difference of the second dataset to the first on the job queue
+ * and drawing it as the overlay once it is done; differenceDrawn() reports the span of
+ * the ramp. Returns false if fewer than two datasets are loaded.
+ */
+bool GlWidget::updateDifference()
+{
+    if(m_datasets.size() < 2)
+    {
+        qDebug() << "Height differences need a second grid to compare the first with.";
+        m_difference.reset();
+        return false;
+    }
+    size_t job = m_overlayJobs;
+    m_derivedJobs.post([this, job]()
+    {
+        std::shared_ptr<tv::HeightGrid> diff = differenceGrid(job);
+        if(not diff) return;
+        auto raster = std::make_shared<std::vector<qfloat16>>();
+        float span = analysis::differenceOverlay(*diff, *raster);
+        QMetaObject::invokeMethod(this, [this, job, diff, raster, span]()
+        {
+            if(not setOverlayRaster(job, std::move(*raster), diff->numRows(), diff->numCols(),
+                                    render::OverlayMode::Difference)) return;
+            m_difference = diff;
+            emit differenceDrawn(span);
+        }, Qt::QueuedConnection);
+    });
+    return true;
+}
+
+/**
+ * Starts routing drainage over the first dataset on the job queue and drawing it as the
+ * overlay once it is done. Flooding needs the whole grid at once, so the job works on a
+ * copy taken under the scene lock.
+ */
+void GlWidget::updateDrainage()
+{
+    size_t job = m_overlayJobs;
+    m_derivedJobs.post([this, job]()
+    {
+        if(job != m_overlayJobs) return;
+        const EaReader& reader = *m_datasets.front().reader;
+        QMutexLocker lock(&m_sceneLock);
+        tv::HeightGrid heights = reader.heightGrid();
+        lock.unlock();
+
+        analysis::HydrologyParams hydrology;
+        hydrology.noData = float(reader.noDataValue());
+        tv::HeightGrid raster;
+        if(not analysis::drainage(heights, hydrology, raster))
+        {
+            qDebug() << "Grid of" << reader.numCols() << "x" << reader.numRows() << "samples is too large to route drainage.";
+        }
+        heights = tv::HeightGrid();
+        auto half = std::make_shared<std::vector<qfloat16>>(raster.size());
+        qFloatToFloat16(half->data(), raster.data(), qsizetype(raster.size()));
+        QMetaObject::invokeMethod(this, [this, job, half, rows = raster.numRows(), cols = raster.numCols()]()
+        {
+            setOverlayRaster(job, std::move(*half), rows, cols, render::OverlayMode::Drainage);
+        }, Qt::QueuedConnection);
+    });
+}
+
+/**
+ * Retraces the horizons of all datasets while lighting is on, or after an edit only
+ * those of the first dataset that the edited cells can change. Tracing runs on the job
+ * queue, split across workers; the horizons are uploaded by the next frame.
+ */
+void GlWidget::updateHorizons(const tv::GridRect& edited)
+{
+    if(not m_lighting) return;
+    for(Dataset& set : m_datasets)
+    {
+        m_derivedJobs.post([this, &set, edited]()
+        {
+            traceHorizons(set, edited);
+        });
+        if(not edited.isEmpty()) break;
+    }
+}
+
+/**
+ * Recomputes the overlay raster of the first dataset. The kernels run on the calling
+ * thread, split across workers, except for drainage and the difference, which run on the
+ * job queue; the raster is uploaded by the next frame.
+ */
+void GlWidget::updateOverlay()
+{
+    //Whatever an overlay job still computes is out of date from here on.
+    ++m_overlayJobs;
+    if(m_overlayMode != render::OverlayMode::Difference) m_difference.reset();
+    tv::HeightGrid raster;
+    if(not m_datasets.empty())
+    {
+        const EaReader& reader = *m_datasets.front().reader;
+        analysis::KernelParams params;
+        params.cellSize = drawnCellSize(reader);
+        params.noData = float(reader.noDataValue());
+        switch(m_overlayMode)
+        {
+        case render::OverlayMode::Hillshade:
+            analysis::deriveSurface(reader.heightGrid(), analysis::SurfaceProduct::Hillshade, params, raster);
+            break;
+        case render::OverlayMode::Slope:
+            analysis::deriveSurface(reader.heightGrid(), analysis::SurfaceProduct::Slope, params, raster);
+            break;
+        case render::OverlayMode::Aspect:
+            analysis::deriveSurface(reader.heightGrid(), analysis::SurfaceProduct::Aspect, params, raster);
+            break;
+        case render::OverlayMode::Viewshed:
+        {
+            //Start from the center until the cursor picks a sample of this grid.
+            if(size_t(m_observer.x()) >= reader.numRows() or size_t(m_observer.y()) >= reader.numCols())
+            {
+                m_observer = QPoint(int(reader.numRows() / 2), int(reader.numCols() / 2));
+            }
+            analysis::ViewshedParams view;
+            view.cellSize = params.cellSize;
+            view.noData = params.noData;
+            view.observerHeight = m_observerHeight;
+            analysis::viewshed(reader.heightGrid(), size_t(m_observer.x()), size_t(m_observer.y()), view, raster);
+            break;
+        }
+        //Drawn by a job once it is done; until then the previous overlay stays.
+        case render::OverlayMode::Drainage:
+            updateDrainage();
+            return;
+        case render::OverlayMode::Difference:
+            if(updateDifference()) return;
+            break;
+        default:
+            break;
+        }
+    }
+
+    QMutexLocker lock(&m_sceneLock);
+    m_overlay.setRaster(raster, m_overlayMode);
+}
+
+/**
+ * Uploads every dataset that has no GPU buffers yet, or only the mesh uploaded while
+ * loading. Needs a current context.
+ */
+void GlWidget::uploadDatasets()
+{
+    for(Dataset& set : m_datasets)
+    {
+        set.horizons->initialize();
+        set.normals->initialize();
+        if(set.coarseIbo.isCreated()) continue;
+        if(not set.vbo.isCreated())
+        {
+            set.vbo.create();
+            set.vbo.bind();
+            set.vbo.allocate(set.reader->vertexArray().data(), set.reader->numVertices() * sizeof(tv::Vertex3d));
+            set.vbo.release();
+
+            set.ibo = QOpenGLBuffer(QOpenGLBuffer::IndexBuffer);
+            set.ibo.create();
+            set.ibo.bind();
+            set.ibo.allocate(set.reader->indexArray().data(), set.reader->numIndices() * sizeof(GLuint));
+            set.ibo.release();
+            set.numIndices = GLsizei(set.reader->numIndices());
+        }
+
+        std::vector<GLuint> coarse = coarseIndices(set.reader->numRows(), set.reader->numCols(), kCoarseStep);
+        if(not coarse.empty())
+        {
+            set.coarseIbo = QOpenGLBuffer(QOpenGLBuffer::IndexBuffer);
+            set.coarseIbo.create();
+            set.coarseIbo.bind();
+            set.coarseIbo.allocate(coarse.data(), int(coarse.size() * sizeof(GLuint)));
+            set.coarseIbo.release();
+            set.numCoarseIndices = GLsizei(coarse.size());
+        }
+
+        if(not m_keepCpuMesh) set.reader->releaseMesh();
+    }
+}
+
+/**
+ * Index of the view under a widget position, or of the nearest one in a gap.
+ */
+int GlWidget::viewAt(const QPointF& pos)
+{
+    std::vector<View> all = views();
+    int nearest = 0;
+    double best = 1e300;
+    for(size_t i = 0; i < all.size(); ++i)
+    {
+        const QRect& r = all[i].rect;
+        double dx = std::max({double(r.left()) - pos.x(), 0.0, pos.x() - double(r.right() + 1)});
+        double dy = std::max({double(r.top()) - pos.y(), 0.0, pos.y() - double(r.bottom() + 1)});
+        if(dx * dx + dy * dy < best)
+        {
+            best = dx * dx + dy * dy;
+            nearest = int(i);
+        }
+    }
+    return nearest;
+}
+
+/**
+ * The views on screen. A single view shows the camera of the camera mode. The split view
+ * shows the orthographic overview on the left and the perspective view on the right, with
+ * the extra perspective views side by side in a strip below both.
+ */
+std::vector<GlWidget::View> GlWidget::views()
+{
+    QRect all = rect();
+    if(not m_splitView)
+    {
+        GlCam* camera = m_camMode == GlCam::Perspective ? static_cast<GlCam*>(&m_pstCam) : &m_otgCam;
+        return {View{camera, all}};
+    }
+
+    auto cell = [](int x0, int y0, int x1, int y1)
+    {
+        return QRect(x0, y0, std::max(1, x1 - x0), std::max(1, y1 - y0));
+    };
+    int stripTop = m_extraCams.empty() ? all.height() : all.height() * 2 / 3;
+    int half = all.width() / 2;
+    std::vector<View> result;
+    result.push_back(View{&m_otgCam, cell(0, 0, half - kViewGap / 2, stripTop)});
+    result.push_back(View{&m_pstCam, cell(half + kViewGap / 2, 0, all.width(), stripTop)});
+    int n = int(m_extraCams.size());
+    for(int i = 0; i < n; ++i)
+    {
+        int x0 = all.width() * i / n + (i > 0 ? kViewGap / 2 : 0);
+        int x1 = all.width() * (i + 1) / n - (i + 1 < n ? kViewGap / 2 : 0);
+        result.push_back(View{&m_extraCams[size_t(i)], cell(x0, stripTop + kViewGap, x1, all.height())});
+    }
+    return result;
+}
+
+/**
+ * Writes back the vertices of edited regions, one range per row of a dirty rectangle or a
+ * single range if it spans whole rows. Vertices of datasets without a CPU mesh are rebuilt
+ * from the height grid for the ranges only. The pyramids and the textures built from them
+ * follow. Needs a current context.
+ */
+void GlWidget::uploadEdits()
+{
+    for(size_t i = 0; i < m_datasets.size(); ++i)
+    {
+        Dataset& set = m_datasets[i];
+        EaReader& reader = *set.reader;
+        if(reader.dirtyRects().empty() or not set.vbo.isCreated()) continue;
+
+        size_t cols = reader.numCols();
+        set.vbo.bind();
+        for(const tv::GridRect& rect : reader.dirtyRects())
+        {
+            bool wholeRows = rect.numCols() == cols;
+            size_t count = wholeRows ? rect.numRows() * cols : rect.numCols();
+            for(size_t row = rect.row0; row < rect.row1; row += wholeRows ? rect.numRows() : 1)
+            {
+                size_t first = row * cols + rect.col0;
+                const tv::Vertex3d* src = nullptr;
+                if(reader.hasMesh())
+                {
+                    src = &reader.vertexArray()[first];
+                }
+                else
+                {
+                    m_editScratch.clear();
+                    for(size_t v = first; v < first + count; ++v) m_editScratch.push_back(reader.vertexAt(v / cols, v % cols));
+                    src = m_editScratch.data();
+                }
+                set.vbo.write(int(first * sizeof(tv::Vertex3d)), src, int(count * sizeof(tv::Vertex3d)));
+            }
+            set.pyramid.update(reader.heightGrid(), rect);
+            set.normals->updateRegion(rect);
+            if(i == 0)
+            {
+                m_clipmap.updateRegion(rect);
+                m_raster.updateRegion(rect);
+            }
+        }
+        set.vbo.release();
+        reader.clearDirtyRects();
+    }
 }
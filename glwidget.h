@@ -1,12 +1,30 @@
 #ifndef GLWIDGET_H
 #define GLWIDGET_H
 
+#include "camerapath.h"
+#include "clipmaprenderer.h"
+#include "contourrenderer.h"
+#include "difference.h"
 #include "esriasciiireader.h"
+#include "frametimer.h"
 #include "glcamera.h"
+#include "horizonmap.h"
+#include "jobqueue.h"
+#include "overlaytexture.h"
+#include "rasterrenderer.h"
+#include "renderthread.h"
+#include "tilebatch.h"
+#include "tileexporter.h"
+#include <QElapsedTimer>
+#include <QMutex>
 #include <QOpenGLExtraFunctions>
 #include <QOpenGLShaderProgram>
+#include <QOpenGLTextureBlitter>
 #include <QtOpenGL/QOpenGLBuffer>
 #include <QtOpenGLWidgets/QOpenGLWidget>
+#include <atomic>
+#include <memory>
+#include <thread>
 
 namespace Ui {
 class GlWidget;
@@ -25,26 +43,154 @@ class GlWidget : public QOpenGLWidget, protected QOpenGLExtraFunctions
 public:
     explicit GlWidget(QWidget *parent = nullptr);
     ~GlWidget();
+    bool isSplitView() const{return m_splitView;}
+    bool isFlying() const{return m_flightTimer != 0;}
+    bool isLighting() const{return m_lighting;}
+    const cam::CameraPath& cameraPath() const{return m_path;}
+    double contourInterval() const{return m_contourInterval;}
+    double targetFrameTime() const{return m_targetFrameMs;}
+    int numExtraViews() const{return int(m_extraCams.size());}
+    float sunAltitude() const{return m_sunAltitude;}
+    float sunAzimuth() const{return m_sunAzimuth;}
+
+    /**
+     * A loaded terrain grid together with its GPU buffer, its lighting textures and
+     * its placement relative to the first dataset.
+     */
+    struct Dataset
+    {
+        std::unique_ptr<EaReader>   reader;
+        GLsizei                     numIndices  = 0;
+        GLsizei                     numCoarseIndices = 0;
+        QOpenGLBuffer               coarseIbo;
+        QOpenGLBuffer               ibo;
+        QOpenGLBuffer               vbo;
+        QVector3D                   offset;
+        tv::HeightPyramid           pyramid;
+        std::unique_ptr<render::HorizonMap> horizons;
+        std::unique_ptr<render::NormalMap> normals;
+    };
 
 private:
+    /**
+     * Heights of a rectangle of the first dataset as they were before a brush stroke.
+     */
+    struct HeightPatch
+    {
+        tv::GridRect        rect;
+        std::vector<float>  heights;
+    };
+
+    /**
+     * A camera on screen and its rectangle in widget coordinates.
+     */
+    struct View
+    {
+        GlCam*  camera;
+        QRect   rect;
+    };
+
     Ui::GlWidget*           ui;
 
+    bool                    m_cachePyramids = false;
+    bool                    m_keepCpuMesh   = true;
+    bool                    m_lighting      = false;
+    bool                    m_newStroke     = false;
+    bool                    m_orthoRaster   = true;
+    bool                    m_splitView     = false;
+    bool                    m_useClipmap    = false;
+    double                  m_brushRadius   = 8.0;
+    float                   m_brushStrength = 10.0f;
+    float                   m_observerHeight = 2.0f;
+    float                   m_sunAltitude   = 45.0f;
+    float                   m_sunAzimuth    = 315.0f;
+    double                  m_contourInterval = 0.0;
+    double                  m_flightTime    = -1.0;
+    int                     m_activeView    = 0;
+    int                     m_derivedTimer  = 0;
+    int                     m_exportTimer   = 0;
+    int                     m_flightTimer   = 0;
+    int                     m_refineTimer   = 0;
+    int                     m_viewshedTimer = 0;
     int                     m_height;
     int                     m_width;
 
     CamMode                 m_camMode   = GlCam::Orthographic;
-    EaReader                m_ascii;
+    cam::CameraPath         m_path;
+    QElapsedTimer           m_flightClock;
+    render::OverlayMode     m_overlayMode = render::OverlayMode::None;
+    std::vector<Dataset>    m_datasets;
+    std::shared_ptr<const tv::HeightGrid> m_difference;
+    tv::GridRect            m_edited;
+    std::vector<std::vector<HeightPatch>> m_undoSteps;
     OtgCam                  m_otgCam;
     PstCam                  m_pstCam;
+    std::vector<PstCam>     m_extraCams;
     QPointF                 m_dragStart;
+    QPoint                  m_observer  {-1, -1};
 
     QPointF                 m_arcStart;
     QPointF                 m_arcCur;
 
-    QOpenGLBuffer           m_vbo;
+    render::ClipmapRenderer m_clipmap;
+    render::ContourRenderer m_contours;
+    render::OverlayTexture  m_overlay;
+    render::RasterRenderer  m_raster;
+    render::TileBatch       m_tileBatch;
+    QMutex                  m_sceneLock;
+    QOpenGLTextureBlitter   m_blitter;
+    std::vector<tv::Vertex3d> m_editScratch;
+    std::unique_ptr<render::RenderThread> m_renderThread;
+    std::unique_ptr<render::TileExporter> m_exporter;
+    std::unique_ptr<std::thread> m_meshExport;
+    size_t                  m_meshExports   = 0;
+    std::atomic<bool>       m_meshCancelled {false};
+    tv::JobQueue            m_derivedJobs;
+    std::atomic<size_t>     m_overlayJobs   {0};
     QOpenGLShaderProgram    m_shProg;
+    std::unique_ptr<QOpenGLFramebufferObject> m_lowResFbo;
+    render::FrameTimer      m_frameTimer;
 
+    //> Interactive quality, adapted by whichever thread renders
+    std::atomic<bool>       m_coarseMesh    {false};
+    std::atomic<bool>       m_interactive   {false};
+    std::atomic<double>     m_targetFrameMs {33.0};
+    std::atomic<float>      m_renderScale   {1.0f};
+
+    void adaptQuality(double frameMs);
+    void beginInteraction();
+    void blitFrame(GLuint texture);
+    void buildPyramid(Dataset& set);
+    cam::ViewSet cameraStates();
+    std::shared_ptr<tv::HeightGrid> differenceGrid(size_t job);
+    void drawDatasets(const QMatrix4x4& mvp, bool coarse, size_t first = 0);
+    void drawTerrain(const cam::CameraState& st, const QVector3D& lodEye, bool coarse);
+    bool editAt(const QPointF& pos, Qt::MouseButtons buttons, Qt::KeyboardModifiers mods);
+    cam::CameraState fittedCameraState(const View& view);
+    void flyTo(double time);
+    QVector3D gridPosAt(const QPointF& pos);
+    void heightsEdited(const tv::GridRect& rect);
+    render::Lighting lightingFor(const Dataset& set) const;
+    bool loadDataset(const QString& fName, Dataset& set);
+    void moveObserver(const QPointF& pos);
+    void presentFrame();
+    void releaseDatasets();
+    void renderScene(const cam::ViewSet& frame, double pixelScale, render::FrameTimer* frameTimer = nullptr);
+    void requestRender();
+    bool setOverlayRaster(size_t job, std::vector<qfloat16>&& raster, size_t rows, size_t cols,
+                          render::OverlayMode mode);
     void setupShaders();
+    void traceHorizons(Dataset& set, const tv::GridRect& edited);
+    void updateContours();
+    void updateDerived(const tv::GridRect& edited = tv::GridRect());
+    bool updateDifference();
+    void updateDrainage();
+    void updateHorizons(const tv::GridRect& edited = tv::GridRect());
+    void updateOverlay();
+    void uploadDatasets();
+    void uploadEdits();
+    int viewAt(const QPointF& pos);
+    std::vector<View> views();
 
 protected:
     void initializeGL() override;
@@ -57,8 +203,41 @@ protected:
     void timerEvent(QTimerEvent* e) override;
     void wheelEvent(QWheelEvent* e) override;
 
+signals:
+    void cameraModeChanged(CamMode mode);
+    void cutFillFinished(const analysis::CutFill& result);
+    void differenceDrawn(float span);
+    void exportFinished(bool ok, const QString& fileName);
+    void exportProgress(int done, int total);
+    void pathFinished();
+
 public slots:
+    void addKeyframe();
+    bool benchmarkPath(double fps);
+    void cancelExport();
+    void clearPath();
+    bool cutFill(const std::vector<QPointF>& polygon);
+    bool exportImage(const QString& fileName, int width);
+    bool exportMesh(const QString& fileName, bool coarse);
+    bool loadPath(const QString& fileName);
+    bool openFiles(const QStringList& fNames);
+    bool playPath();
+    bool savePath(const QString& fileName);
+    void setCachePyramids(bool cache);
     void setCameraMode(CamMode mode);
+    void setClipmapEnabled(bool enabled);
+    void setContourInterval(double interval);
+    void setExtraViews(int count);
+    void setKeepCpuMesh(bool keep);
+    void setLighting(bool enabled);
+    void setOrthoRaster(bool enabled);
+    void setTargetFrameTime(double ms);
+    void setSplitView(bool split);
+    void setSunPosition(float azimuth, float altitude);
+    void setSurfaceOverlay(render::OverlayMode mode);
+    void setThreadedRendering(bool enabled);
+    void stopPath();
+    bool undoEdit();
 };
 
 #endif // GLWIDGET_H
@@ -0,0 +1,67 @@
+#include "gridparser.h"
+
+namespace ascii
+{
+
+const char* sampleTypeName(SampleType type)
+{
+    switch(type)
+    {
+    case SampleType::Int16:     return "int16";
+    case SampleType::Int32:     return "int32";
+    case SampleType::Float:     return "float";
+    case SampleType::Double:    return "double";
+    }
+    return "unknown";
+}
+
+/**
+ * Guesses the narrowest sample type from the first tokens of the data section. Any
+ * decimal point, exponent or non-numeric token selects a floating point type, and more
+ * significant digits than a float holds select double. The guess only picks the fast
+ * path; the reader falls back to double if a later token does not fit.
+ */
+SampleType sniffSampleType(const char* p, const char* end, size_t maxTokens)
+{
+    bool integral = true;
+    bool wide = false;
+    bool precise = false;
+    for(size_t n = 0; n < maxTokens; ++n)
+    {
+        p = skipSpace(p, end);
+        if(p == end) break;
+        const char* e = tokenEnd(p, end);
+        int significant = 0;
+        bool leading = true;
+        for(const char* c = p; c < e; ++c)
+        {
+            if(*c >= '0' and *c <= '9')
+            {
+                if(*c != '0') leading = false;
+                if(not leading) ++significant;
+            }
+            else if(*c == 'e' or *c == 'E')
+            {
+                integral = false;
+                break;
+            }
+            else if(*c != '-' and *c != '+')
+            {
+                integral = false;
+            }
+        }
+        if(significant > 7) precise = true;
+        if(integral and not wide)
+        {
+            int32_t v = 0;
+            int16_t narrow = 0;
+            if(not parseSample(p, e, v)) integral = false;
+            else if(not parseSample(p, e, narrow)) wide = true;
+        }
+        p = e;
+    }
+    if(integral) return wide ? SampleType::Int32 : SampleType::Int16;
+    return precise ? SampleType::Double : SampleType::Float;
+}
+
+} //namespace ascii
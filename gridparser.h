@@ -0,0 +1,96 @@
+#ifndef GRIDPARSER_H
+#define GRIDPARSER_H
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+namespace ascii
+{
+
+/**
+ * Native type of the samples of a grid file.
+ */
+enum class SampleType
+{
+    Int16 = 0,
+    Int32,
+    Float,
+    Double
+};
+
+/**
+ * Spaces, line breaks and all other control characters separate tokens.
+ */
+inline bool isBlank(char c)
+{
+    return static_cast<unsigned char>(c) <= ' ';
+}
+
+inline const char* skipSpace(const char* p, const char* end)
+{
+    while(p < end and isBlank(*p)) ++p;
+    return p;
+}
+
+inline const char* tokenEnd(const char* p, const char* end)
+{
+    while(p < end and not isBlank(*p)) ++p;
+    return p;
+}
+
+/**
+ * Skips one leading plus sign, which std::from_chars does not accept. A sign following
+ * it is left in place so that the token stays invalid.
+ */
+inline const char* skipPlus(const char* p, const char* end)
+{
+    return p + 1 < end and *p == '+' and p[1] != '-' and p[1] != '+' ? p + 1 : p;
+}
+
+/**
+ * Parses one sample token starting at p. Returns the end of the token, or nullptr if the
+ * token is not a valid T. Integer types take a path without any decimal point, exponent
+ * or rounding handling and reject tokens that need it or do not fit into T.
+ */
+template<typename T>
+inline const char* parseSample(const char* p, const char* end, T& value)
+{
+    if constexpr(std::is_integral_v<T>)
+    {
+        bool neg = false;
+        if(p < end and (*p == '-' or *p == '+'))
+        {
+            neg = *p == '-';
+            ++p;
+        }
+        const char* digits = p;
+        uint64_t v = 0;
+        unsigned d;
+        while(p < end and (d = static_cast<unsigned>(*p - '0')) < 10u)
+        {
+            v = v * 10 + d;
+            ++p;
+        }
+        if(p == digits or p - digits > 10 or (p < end and not isBlank(*p))) return nullptr;
+        int64_t sv = neg ? -int64_t(v) : int64_t(v);
+        if(sv < std::numeric_limits<T>::min() or sv > std::numeric_limits<T>::max()) return nullptr;
+        value = T(sv);
+        return p;
+    }
+    else
+    {
+        std::from_chars_result res = std::from_chars(skipPlus(p, end), end, value);
+        if(res.ec != std::errc() or (res.ptr < end and not isBlank(*res.ptr))) return nullptr;
+        return res.ptr;
+    }
+}
+
+const char* sampleTypeName(SampleType type);
+SampleType sniffSampleType(const char* p, const char* end, size_t maxTokens);
+
+} //namespace ascii
+
+#endif // GRIDPARSER_H
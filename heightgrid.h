@@ -0,0 +1,105 @@
+#ifndef HEIGHTGRID_H
+#define HEIGHTGRID_H
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace tv
+{
+
+/**
+ * Half open rectangle of grid cells, [row0, row1) x [col0, col1).
+ */
+struct GridRect
+{
+    size_t row0 = 0;
+    size_t col0 = 0;
+    size_t row1 = 0;
+    size_t col1 = 0;
+
+    GridRect() = default;
+    GridRect(size_t r0, size_t c0, size_t r1, size_t c1) :
+        row0(r0), col0(c0), row1(r1), col1(c1)
+    {}
+    bool isEmpty() const{return row1 <= row0 or col1 <= col0;}
+    size_t numCols() const{return isEmpty() ? 0 : col1 - col0;}
+    size_t numRows() const{return isEmpty() ? 0 : row1 - row0;}
+    /**
+     * Grows the rectangle by a border of cells, clipped to a grid of the given size.
+     */
+    GridRect expanded(size_t border, size_t rows, size_t cols) const
+    {
+        return {row0 > border ? row0 - border : 0, col0 > border ? col0 - border : 0,
+                std::min(row1 + border, rows), std::min(col1 + border, cols)};
+    }
+    /**
+     * The cells of a grid of half the resolution that cover this rectangle.
+     */
+    GridRect halved() const
+    {
+        return {row0 / 2, col0 / 2, (row1 + 1) / 2, (col1 + 1) / 2};
+    }
+    GridRect intersected(const GridRect& o) const
+    {
+        return {std::max(row0, o.row0), std::max(col0, o.col0), std::min(row1, o.row1), std::min(col1, o.col1)};
+    }
+    /**
+     * True if the rectangles overlap or share an edge.
+     */
+    bool touches(const GridRect& o) const
+    {
+        return row0 <= o.row1 and o.row0 <= row1 and col0 <= o.col1 and o.col0 <= col1;
+    }
+    GridRect united(const GridRect& o) const
+    {
+        if(isEmpty()) return o;
+        if(o.isEmpty()) return *this;
+        return {std::min(row0, o.row0), std::min(col0, o.col0), std::max(row1, o.row1), std::max(col1, o.col1)};
+    }
+};
+
+/**
+ * Row major grid of raw height samples as stored in the source file. Row 0 is the
+ * northernmost row, which is the mesh's x axis; columns run along the mesh's y axis.
+ */
+class HeightGrid
+{
+public:
+    HeightGrid() = default;
+    HeightGrid(size_t cols, size_t rows) :
+        m_cols(cols), m_rows(rows), m_data(cols * rows, 0.0f)
+    {}
+    const float* data() const{return m_data.data();}
+    const float* row(size_t r) const{return m_data.data() + r * m_cols;}
+    float at(size_t r, size_t c) const{return m_data[r * m_cols + c];}
+    float& at(size_t r, size_t c){return m_data[r * m_cols + c];}
+    float clampedAt(long r, long c) const
+    {
+        r = r < 0 ? 0 : (r >= long(m_rows) ? long(m_rows) - 1 : r);
+        c = c < 0 ? 0 : (c >= long(m_cols) ? long(m_cols) - 1 : c);
+        return m_data[size_t(r) * m_cols + size_t(c)];
+    }
+    float* data(){return m_data.data();}
+    float* row(size_t r){return m_data.data() + r * m_cols;}
+    bool isEmpty() const{return m_data.empty();}
+    GridRect bounds() const{return {0, 0, m_rows, m_cols};}
+    size_t numCols() const{return m_cols;}
+    size_t numRows() const{return m_rows;}
+    size_t size() const{return m_data.size();}
+    void resize(size_t cols, size_t rows)
+    {
+        m_cols = cols;
+        m_rows = rows;
+        m_data.assign(cols * rows, 0.0f);
+    }
+
+private:
+    size_t              m_cols = 0;
+    size_t              m_rows = 0;
+    std::vector<float>  m_data;
+};
+
+} //namespace tv
+
+#endif // HEIGHTGRID_H
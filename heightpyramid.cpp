@@ -0,0 +1,335 @@
+#include "heightpyramid.h"
+#include "parallel.h"
+#include "simd.h"
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <cstring>
+
+namespace tv
+{
+
+namespace
+{
+
+/**
+ * Levels produced per pass over the source. A tile of the source covers 2^kTileLevels
+ * rows, so the last level of a pass still gets whole rows from every tile.
+ */
+constexpr size_t kTileLevels = 6;
+constexpr size_t kTileRows = size_t(1) << kTileLevels;
+constexpr size_t kTileCols = 1024;
+
+constexpr char kMagic[8] = {'T', 'V', 'P', 'Y', 'R', 'A', 'M', '1'};
+
+/**
+ * Start of a pyramid cache file, followed by the samples of every level in order. The
+ * source stamp tells whether the source file changed since the cache was written.
+ */
+struct CacheHeader
+{
+    char    magic[8];
+    qint64  sourceSize;
+    qint64  sourceModified;
+    quint64 baseCols;
+    quint64 baseRows;
+    quint64 numLevels;
+    float   noData;
+    qint32  reducer;
+};
+
+template<Reducer R>
+float reduceBlock(const float* up, const float* down, size_t c, size_t cols, float noData)
+{
+    float acc = noData;
+    int n = 0;
+    auto add = [&](float v)
+    {
+        if(v == noData) return;
+        if(n++ == 0) acc = v;
+        else if(R == Reducer::Mean) acc += v;
+        else if(R == Reducer::Min) acc = std::min(acc, v);
+        else acc = std::max(acc, v);
+    };
+    bool right = c + 1 < cols;
+    if(R == Reducer::Mean and right and down and up[c] != noData and up[c + 1] != noData
+            and down[c] != noData and down[c + 1] != noData)
+    {
+        //Summed like the vector path, so that partial updates match a full build.
+        return ((up[c] + up[c + 1]) + (down[c] + down[c + 1])) * 0.25f;
+    }
+    add(up[c]);
+    if(right) add(up[c + 1]);
+    if(down)
+    {
+        add(down[c]);
+        if(right) add(down[c + 1]);
+    }
+    return R == Reducer::Mean and n > 1 ? acc / float(n) : acc;
+}
+
+#ifdef TV_HAS_AVX2
+
+/**
+ * Eight samples of the next level per step while both source rows are complete and free
+ * of NODATA. Returns the first column left for the scalar path.
+ */
+template<Reducer R>
+TV_TARGET_AVX2 size_t reduceRowAvx2(const float* up, const float* down, size_t c0, size_t c1, size_t srcCols,
+                                    float noData, float* out)
+{
+    const __m256 nd = _mm256_set1_ps(noData);
+    size_t c = c0;
+    for(; c + 8 <= c1 and 2 * c + 16 <= srcCols; c += 8)
+    {
+        __m256 a0 = _mm256_loadu_ps(up + 2 * c);
+        __m256 a1 = _mm256_loadu_ps(up + 2 * c + 8);
+        __m256 b0 = _mm256_loadu_ps(down + 2 * c);
+        __m256 b1 = _mm256_loadu_ps(down + 2 * c + 8);
+        __m256 missing = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(a0, nd, _CMP_EQ_OQ), _mm256_cmp_ps(a1, nd, _CMP_EQ_OQ)),
+                                      _mm256_or_ps(_mm256_cmp_ps(b0, nd, _CMP_EQ_OQ), _mm256_cmp_ps(b1, nd, _CMP_EQ_OQ)));
+        if(_mm256_movemask_ps(missing))
+        {
+            for(size_t k = c; k < c + 8; ++k) out[k] = reduceBlock<R>(up, down, 2 * k, srcCols, noData);
+            continue;
+        }
+        //Even and odd columns of both rows, in the lane order 0 1 4 5 2 3 6 7.
+        __m256 ae = _mm256_shuffle_ps(a0, a1, _MM_SHUFFLE(2, 0, 2, 0));
+        __m256 ao = _mm256_shuffle_ps(a0, a1, _MM_SHUFFLE(3, 1, 3, 1));
+        __m256 be = _mm256_shuffle_ps(b0, b1, _MM_SHUFFLE(2, 0, 2, 0));
+        __m256 bo = _mm256_shuffle_ps(b0, b1, _MM_SHUFFLE(3, 1, 3, 1));
+        __m256 r;
+        if(R == Reducer::Mean)
+        {
+            r = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(ae, ao), _mm256_add_ps(be, bo)), _mm256_set1_ps(0.25f));
+        }
+        else if(R == Reducer::Min)
+        {
+            r = _mm256_min_ps(_mm256_min_ps(ae, ao), _mm256_min_ps(be, bo));
+        }
+        else
+        {
+            r = _mm256_max_ps(_mm256_max_ps(ae, ao), _mm256_max_ps(be, bo));
+        }
+        r = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(r), _MM_SHUFFLE(3, 1, 2, 0)));
+        _mm256_storeu_ps(out + c, r);
+    }
+    return c;
+}
+
+#endif
+
+/**
+ * Fills the rectangle of dst, which must be the level following src.
+ */
+template<Reducer R>
+void reduceRect(const HeightGrid& src, HeightGrid& dst, const GridRect& rect, float noData, bool simd)
+{
+    size_t srcCols = src.numCols();
+    for(size_t r = rect.row0; r < rect.row1; ++r)
+    {
+        const float* up = src.row(2 * r);
+        const float* down = 2 * r + 1 < src.numRows() ? src.row(2 * r + 1) : nullptr;
+        float* out = dst.row(r);
+        size_t c = rect.col0;
+#ifdef TV_HAS_AVX2
+        if(simd and down) c = reduceRowAvx2<R>(up, down, c, rect.col1, srcCols, noData, out);
+#else
+        (void)simd;
+#endif
+        for(; c < rect.col1; ++c) out[c] = reduceBlock<R>(up, down, 2 * c, srcCols, noData);
+    }
+}
+
+void reduce(Reducer reducer, const HeightGrid& src, HeightGrid& dst, const GridRect& rect, float noData, bool simd)
+{
+    switch(reducer)
+    {
+    case Reducer::Mean: reduceRect<Reducer::Mean>(src, dst, rect, noData, simd); break;
+    case Reducer::Min:  reduceRect<Reducer::Min>(src, dst, rect, noData, simd); break;
+    case Reducer::Max:  reduceRect<Reducer::Max>(src, dst, rect, noData, simd); break;
+    }
+}
+
+bool sourceStamp(const QString& sourceFile, qint64& size, qint64& modified)
+{
+    QFileInfo info(sourceFile);
+    if(not info.exists()) return false;
+    size = info.size();
+    modified = info.lastModified().toMSecsSinceEpoch();
+    return true;
+}
+
+} //namespace
+
+/**
+ * The coarsest level that still has at least one sample per pixel when drawing
+ * samplesPerPixel full resolution samples on a pixel, or 0 for the full resolution.
+ */
+size_t HeightPyramid::levelFor(double samplesPerPixel) const
+{
+    size_t i = 0;
+    while(i < m_levels.size() and samplesPerPixel >= 2.0)
+    {
+        samplesPerPixel /= 2.0;
+        ++i;
+    }
+    return i;
+}
+
+/**
+ * Builds all levels down to a single sample.
+ */
+void HeightPyramid::build(const HeightGrid& base, float noData, Reducer reducer)
+{
+    m_noData = noData;
+    m_reducer = reducer;
+    allocate(base);
+
+    bool simd = hasAvx2();
+    for(size_t first = 0; first < m_levels.size(); first += kTileLevels)
+    {
+        const HeightGrid& src = first == 0 ? base : m_levels[first - 1];
+        size_t last = std::min(first + kTileLevels, m_levels.size());
+        size_t tilesAcross = (src.numCols() + kTileCols - 1) / kTileCols;
+        size_t tilesDown = (src.numRows() + kTileRows - 1) / kTileRows;
+        parallelTasks(tilesAcross * tilesDown, [&](size_t tile)
+        {
+            size_t r0 = tile / tilesAcross * kTileRows;
+            size_t c0 = tile % tilesAcross * kTileCols;
+            GridRect rect(r0, c0, std::min(r0 + kTileRows, src.numRows()), std::min(c0 + kTileCols, src.numCols()));
+            for(size_t i = first; i < last; ++i)
+            {
+                rect = rect.halved();
+                reduce(m_reducer, i == 0 ? base : m_levels[i - 1], m_levels[i], rect, m_noData, simd);
+            }
+        });
+    }
+}
+
+void HeightPyramid::clear()
+{
+    std::vector<HeightGrid>().swap(m_levels);
+    m_baseCols = 0;
+    m_baseRows = 0;
+}
+
+/**
+ * Brings the levels up to date after the samples in rect of the base grid changed.
+ */
+void HeightPyramid::update(const HeightGrid& base, const GridRect& rect)
+{
+    if(base.numCols() != m_baseCols or base.numRows() != m_baseRows) return;
+    GridRect r = rect.intersected(base.bounds());
+    bool simd = hasAvx2();
+    for(size_t i = 0; i < m_levels.size() and not r.isEmpty(); ++i)
+    {
+        r = r.halved().intersected(m_levels[i].bounds());
+        reduce(m_reducer, i == 0 ? base : m_levels[i - 1], m_levels[i], r, m_noData, simd);
+    }
+}
+
+/**
+ * Where the pyramid of a source file is kept, next to the file itself.
+ */
+QString HeightPyramid::cachePath(const QString& sourceFile)
+{
+    return sourceFile + ".pyr";
+}
+
+/**
+ * Reads the levels cached for the source file. Fails, leaving the pyramid empty, if
+ * there is no cache, or it was built for another version of the file or other settings.
+ */
+bool HeightPyramid::load(const QString& sourceFile, const HeightGrid& base, float noData, Reducer reducer)
+{
+    clear();
+    QFile file(cachePath(sourceFile));
+    qint64 size = 0;
+    qint64 modified = 0;
+    if(not sourceStamp(sourceFile, size, modified) or not file.open(QIODevice::ReadOnly)) return false;
+
+    CacheHeader header;
+    if(file.read(reinterpret_cast<char*>(&header), sizeof(header)) != qint64(sizeof(header))) return false;
+    if(std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 or header.sourceSize != size
+            or header.sourceModified != modified or header.baseCols != base.numCols()
+            or header.baseRows != base.numRows() or header.noData != noData or header.reducer != qint32(reducer))
+    {
+        return false;
+    }
+
+    m_noData = noData;
+    m_reducer = reducer;
+    allocate(base);
+    if(header.numLevels != m_levels.size())
+    {
+        clear();
+        return false;
+    }
+    for(HeightGrid& level : m_levels)
+    {
+        qint64 bytes = qint64(level.size() * sizeof(float));
+        if(file.read(reinterpret_cast<char*>(level.data()), bytes) != bytes)
+        {
+            qDebug() << "Pyramid cache" << file.fileName() << "is truncated.";
+            clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Writes the levels next to the source file they were built from.
+ */
+bool HeightPyramid::save(const QString& sourceFile) const
+{
+    CacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    if(isEmpty() or not sourceStamp(sourceFile, header.sourceSize, header.sourceModified)) return false;
+    header.baseCols = m_baseCols;
+    header.baseRows = m_baseRows;
+    header.numLevels = m_levels.size();
+    header.noData = m_noData;
+    header.reducer = qint32(m_reducer);
+
+    QFile file(cachePath(sourceFile));
+    if(not file.open(QIODevice::WriteOnly))
+    {
+        qDebug() << "Cannot write pyramid cache" << file.fileName() << ":" << file.errorString();
+        return false;
+    }
+    bool ok = file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == qint64(sizeof(header));
+    for(const HeightGrid& level : m_levels)
+    {
+        qint64 bytes = qint64(level.size() * sizeof(float));
+        ok = ok and file.write(reinterpret_cast<const char*>(level.data()), bytes) == bytes;
+    }
+    if(not ok)
+    {
+        file.remove();
+        qDebug() << "Cannot write pyramid cache" << file.fileName();
+    }
+    return ok;
+}
+
+//------->Private
+
+void HeightPyramid::allocate(const HeightGrid& base)
+{
+    m_levels.clear();
+    m_baseCols = base.numCols();
+    m_baseRows = base.numRows();
+    size_t cols = m_baseCols;
+    size_t rows = m_baseRows;
+    while(cols > 1 or rows > 1)
+    {
+        cols = (cols + 1) / 2;
+        rows = (rows + 1) / 2;
+        m_levels.emplace_back(cols, rows);
+    }
+}
+
+} //namespace tv
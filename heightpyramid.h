@@ -0,0 +1,60 @@
+#ifndef HEIGHTPYRAMID_H
+#define HEIGHTPYRAMID_H
+
+#include "heightgrid.h"
+#include <QString>
+
+namespace tv
+{
+
+/**
+ * How the up to four samples of a 2x2 block are combined into one sample of the next
+ * level. NODATA samples are left out; a block of NODATA only stays NODATA.
+ */
+enum class Reducer
+{
+    Mean    = 0,
+    Min     = 1,
+    Max     = 2
+};
+
+/**
+ * Coarser copies of a height grid, each level halving the one before in both directions
+ * and rounding odd sizes up. Level i is reduced by 2^i; the full resolution grid is level
+ * 0 and not held by the pyramid.
+ *
+ * Building walks the grid once in tiles that produce several levels while their source
+ * is still in cache, with tiles spread over all workers.
+ */
+class HeightPyramid
+{
+public:
+    HeightPyramid() = default;
+    const HeightGrid& level(size_t i) const{return m_levels[i - 1];}
+    bool isEmpty() const{return m_levels.empty();}
+    float noData() const{return m_noData;}
+    Reducer reducer() const{return m_reducer;}
+    size_t numLevels() const{return m_levels.size();}
+    size_t levelFor(double samplesPerPixel) const;
+    void build(const HeightGrid& base, float noData, Reducer reducer = Reducer::Mean);
+    void clear();
+    void update(const HeightGrid& base, const GridRect& rect);
+
+    //> Persistence
+    static QString cachePath(const QString& sourceFile);
+    bool load(const QString& sourceFile, const HeightGrid& base, float noData, Reducer reducer);
+    bool save(const QString& sourceFile) const;
+
+private:
+    float                   m_noData    = -9999.0f;
+    Reducer                 m_reducer   = Reducer::Mean;
+    size_t                  m_baseCols  = 0;
+    size_t                  m_baseRows  = 0;
+    std::vector<HeightGrid> m_levels;
+
+    void allocate(const HeightGrid& base);
+};
+
+} //namespace tv
+
+#endif // HEIGHTPYRAMID_H
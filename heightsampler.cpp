@@ -0,0 +1,214 @@
+#include "heightsampler.h"
+#include "simd.h"
+#include <algorithm>
+#include <cmath>
+
+namespace analysis
+{
+
+namespace
+{
+
+constexpr size_t kLanes = 8;
+
+#ifdef TV_HAS_AVX2
+
+/**
+ * Blends eight grid positions without branching. Lanes outside the grid or next to a
+ * NODATA sample are flagged in the returned mask and left for the scalar path; their
+ * gathers still read valid memory as the positions are clamped first.
+ */
+TV_TARGET_AVX2 int sampleLanesAvx2(const tv::HeightGrid& grid, float noData, const float* rowPos,
+                                   const float* colPos, float* out)
+{
+    const int rows = int(grid.numRows());
+    const int cols = int(grid.numCols());
+    const float* base = grid.data();
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 lastRow = _mm256_set1_ps(float(rows - 1));
+    const __m256 lastCol = _mm256_set1_ps(float(cols - 1));
+
+    __m256 r = _mm256_loadu_ps(rowPos);
+    __m256 c = _mm256_loadu_ps(colPos);
+    __m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(r, _mm256_sub_ps(zero, half), _CMP_GE_OQ),
+                                                _mm256_cmp_ps(r, _mm256_add_ps(lastRow, half), _CMP_LE_OQ)),
+                                  _mm256_and_ps(_mm256_cmp_ps(c, _mm256_sub_ps(zero, half), _CMP_GE_OQ),
+                                                _mm256_cmp_ps(c, _mm256_add_ps(lastCol, half), _CMP_LE_OQ)));
+    r = _mm256_min_ps(_mm256_max_ps(r, zero), lastRow);
+    c = _mm256_min_ps(_mm256_max_ps(c, zero), lastCol);
+    __m256 r0 = _mm256_min_ps(_mm256_floor_ps(r), _mm256_set1_ps(float(std::max(rows - 2, 0))));
+    __m256 c0 = _mm256_min_ps(_mm256_floor_ps(c), _mm256_set1_ps(float(std::max(cols - 2, 0))));
+    __m256 fr = _mm256_sub_ps(r, r0);
+    __m256 fc = _mm256_sub_ps(c, c0);
+
+    __m256i topLeft = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvtps_epi32(r0), _mm256_set1_epi32(cols)),
+                                       _mm256_cvtps_epi32(c0));
+    __m256i right = _mm256_set1_epi32(cols > 1 ? 1 : 0);
+    __m256i down = _mm256_set1_epi32(rows > 1 ? cols : 0);
+    __m256i bottomLeft = _mm256_add_epi32(topLeft, down);
+    __m256 a = _mm256_i32gather_ps(base, topLeft, 4);
+    __m256 b = _mm256_i32gather_ps(base, _mm256_add_epi32(topLeft, right), 4);
+    __m256 d = _mm256_i32gather_ps(base, bottomLeft, 4);
+    __m256 e = _mm256_i32gather_ps(base, _mm256_add_epi32(bottomLeft, right), 4);
+
+    const __m256 nd = _mm256_set1_ps(noData);
+    __m256 missing = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(a, nd, _CMP_EQ_OQ), _mm256_cmp_ps(b, nd, _CMP_EQ_OQ)),
+                                  _mm256_or_ps(_mm256_cmp_ps(d, nd, _CMP_EQ_OQ), _mm256_cmp_ps(e, nd, _CMP_EQ_OQ)));
+    __m256 top = _mm256_fmadd_ps(_mm256_sub_ps(b, a), fc, a);
+    __m256 bottom = _mm256_fmadd_ps(_mm256_sub_ps(e, d), fc, d);
+    _mm256_storeu_ps(out, _mm256_fmadd_ps(_mm256_sub_ps(bottom, top), fr, top));
+    return _mm256_movemask_ps(_mm256_or_ps(missing, _mm256_andnot_ps(inside, _mm256_castsi256_ps(_mm256_set1_epi32(-1)))));
+}
+
+#endif
+
+} //namespace
+
+HeightSampler::HeightSampler(const tv::HeightGrid& grid, float noData, const GridGeoref& georef) :
+    m_grid(grid),
+    m_noData(noData),
+    m_colOrigin(georef.xllCorner),
+    m_rowOrigin(georef.yllCorner + double(grid.numRows()) * georef.cellSize),
+    m_invCellSize(1.0 / georef.cellSize)
+{}
+
+float HeightSampler::sample(const QPointF& pos) const
+{
+    float row = 0.0f;
+    float col = 0.0f;
+    toGrid(pos, row, col);
+    return sampleGrid(row, col);
+}
+
+/**
+ * Heights of count points, written to heights.
+ */
+void HeightSampler::sample(const QPointF* points, size_t count, float* heights) const
+{
+    size_t i = 0;
+#ifdef TV_HAS_AVX2
+    //32 bit gather offsets limit the vector path to grids of less than 2^31 samples.
+    if(tv::hasAvx2() and not m_grid.isEmpty() and m_grid.size() < 0x7fffffffu)
+    {
+        float rowPos[kLanes];
+        float colPos[kLanes];
+        for(; i + kLanes <= count; i += kLanes)
+        {
+            for(size_t k = 0; k < kLanes; ++k) toGrid(points[i + k], rowPos[k], colPos[k]);
+            int rest = sampleLanesAvx2(m_grid, m_noData, rowPos, colPos, heights + i);
+            for(; rest; rest &= rest - 1)
+            {
+                int k = __builtin_ctz(unsigned(rest));
+                heights[i + size_t(k)] = sampleGrid(rowPos[k], colPos[k]);
+            }
+        }
+    }
+#endif
+    for(; i < count; ++i) heights[i] = sample(points[i]);
+}
+
+std::vector<float> HeightSampler::sample(const std::vector<QPointF>& points) const
+{
+    std::vector<float> heights(points.size());
+    sample(points.data(), points.size(), heights.data());
+    return heights;
+}
+
+/**
+ * Count evenly spaced samples on the straight line between two points, both included.
+ */
+std::vector<ProfileSample> HeightSampler::profile(const QPointF& from, const QPointF& to, size_t count) const
+{
+    std::vector<QPointF> points(count);
+    for(size_t i = 0; i < count; ++i)
+    {
+        double t = count > 1 ? double(i) / double(count - 1) : 0.0;
+        points[i] = from + (to - from) * t;
+    }
+    std::vector<float> heights = sample(points);
+
+    double length = std::hypot(to.x() - from.x(), to.y() - from.y());
+    std::vector<ProfileSample> result(count);
+    for(size_t i = 0; i < count; ++i)
+    {
+        result[i] = {count > 1 ? length * double(i) / double(count - 1) : 0.0, points[i], heights[i]};
+    }
+    return result;
+}
+
+/**
+ * Samples along a polyline, one every spacing map units measured along the line, plus
+ * one on every vertex so that sharp bends are kept.
+ */
+std::vector<ProfileSample> HeightSampler::profile(const std::vector<QPointF>& polyline, double spacing) const
+{
+    std::vector<QPointF> points;
+    std::vector<double> distances;
+    if(polyline.empty() or not (spacing > 0.0)) return {};
+
+    double walked = 0.0;
+    points.push_back(polyline.front());
+    distances.push_back(0.0);
+    for(size_t v = 1; v < polyline.size(); ++v)
+    {
+        QPointF from = polyline[v - 1];
+        QPointF step = polyline[v] - from;
+        double length = std::hypot(step.x(), step.y());
+        for(double d = spacing; d < length; d += spacing)
+        {
+            points.push_back(from + step * (d / length));
+            distances.push_back(walked + d);
+        }
+        walked += length;
+        points.push_back(polyline[v]);
+        distances.push_back(walked);
+    }
+    std::vector<float> heights = sample(points);
+
+    std::vector<ProfileSample> result(points.size());
+    for(size_t i = 0; i < points.size(); ++i) result[i] = {distances[i], points[i], heights[i]};
+    return result;
+}
+
+//------->Private
+
+/**
+ * Bilinear height at a fractional grid position, in samples.
+ */
+float HeightSampler::sampleGrid(float row, float col) const
+{
+    size_t rows = m_grid.numRows();
+    size_t cols = m_grid.numCols();
+    if(m_grid.isEmpty()) return m_noData;
+    if(not (row >= -0.5f and row <= float(rows) - 0.5f and col >= -0.5f and col <= float(cols) - 0.5f)) return m_noData;
+
+    row = std::min(std::max(row, 0.0f), float(rows - 1));
+    col = std::min(std::max(col, 0.0f), float(cols - 1));
+    size_t r0 = std::min(size_t(row), rows > 1 ? rows - 2 : 0);
+    size_t c0 = std::min(size_t(col), cols > 1 ? cols - 2 : 0);
+    size_t r1 = std::min(r0 + 1, rows - 1);
+    size_t c1 = std::min(c0 + 1, cols - 1);
+    float fr = row - float(r0);
+    float fc = col - float(c0);
+
+    const float h[4] = {m_grid.at(r0, c0), m_grid.at(r0, c1), m_grid.at(r1, c0), m_grid.at(r1, c1)};
+    const float w[4] = {(1.0f - fr) * (1.0f - fc), (1.0f - fr) * fc, fr * (1.0f - fc), fr * fc};
+    float sum = 0.0f;
+    float weight = 0.0f;
+    for(int i = 0; i < 4; ++i)
+    {
+        if(h[i] == m_noData) continue;
+        sum += h[i] * w[i];
+        weight += w[i];
+    }
+    return weight > 1e-6f ? sum / weight : m_noData;
+}
+
+void HeightSampler::toGrid(const QPointF& pos, float& row, float& col) const
+{
+    row = float((m_rowOrigin - pos.y()) * m_invCellSize - 0.5);
+    col = float((pos.x() - m_colOrigin) * m_invCellSize - 0.5);
+}
+
+} //namespace analysis
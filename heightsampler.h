@@ -0,0 +1,62 @@
+#ifndef HEIGHTSAMPLER_H
+#define HEIGHTSAMPLER_H
+
+#include "heightgrid.h"
+#include <QPointF>
+#include <vector>
+
+namespace analysis
+{
+
+/**
+ * Placement of a grid in map coordinates: the lower left corner of its lower left cell
+ * and the cell size. Every sample sits at the center of its cell, row 0 being the top.
+ */
+struct GridGeoref
+{
+    double  xllCorner   = 0.0;
+    double  yllCorner   = 0.0;
+    double  cellSize    = 1.0;
+};
+
+struct ProfileSample
+{
+    double  distance;
+    QPointF pos;
+    float   height;
+};
+
+/**
+ * Bilinear height queries at map coordinates. Points outside the grid's extent give
+ * NODATA; between the outermost sample centers and the extent the border samples are
+ * held. NODATA corners are left out of the blend and the remaining weights renormalized.
+ *
+ * The sampler keeps no state besides the grid reference, so one instance can serve any
+ * number of threads as long as the grid is not edited meanwhile. Batches are sampled
+ * eight points at a time with AVX2 where available.
+ */
+class HeightSampler
+{
+public:
+    HeightSampler(const tv::HeightGrid& grid, float noData, const GridGeoref& georef);
+    float noData() const{return m_noData;}
+    float sample(const QPointF& pos) const;
+    void sample(const QPointF* points, size_t count, float* heights) const;
+    std::vector<float> sample(const std::vector<QPointF>& points) const;
+    std::vector<ProfileSample> profile(const QPointF& from, const QPointF& to, size_t count) const;
+    std::vector<ProfileSample> profile(const std::vector<QPointF>& polyline, double spacing) const;
+
+private:
+    const tv::HeightGrid&   m_grid;
+    float                   m_noData;
+    double                  m_colOrigin;
+    double                  m_rowOrigin;
+    double                  m_invCellSize;
+
+    float sampleGrid(float row, float col) const;
+    void toGrid(const QPointF& pos, float& row, float& col) const;
+};
+
+} //namespace analysis
+
+#endif // HEIGHTSAMPLER_H
@@ -0,0 +1,135 @@
+#include "horizon.h"
+#include "parallel.h"
+#include "simd.h"
+#include <algorithm>
+#include <cmath>
+
+namespace analysis
+{
+
+namespace
+{
+
+constexpr size_t kBlockRows = 16;
+
+/**
+ * Row and column step of each direction, clockwise from north. Row 0 is the northernmost.
+ */
+constexpr int kSteps[kHorizonDirections][2] = {{-1, 0}, {-1, 1}, {0, 1}, {1, 1}, {1, 0}, {1, -1}, {0, -1}, {-1, -1}};
+
+/**
+ * Distances in steps to sample along each direction: every step up to four, then a
+ * quarter further each time.
+ */
+std::vector<size_t> marchDistances(float maxDistance)
+{
+    std::vector<size_t> distances;
+    for(size_t k = 1; float(k) <= maxDistance; k += std::max<size_t>(1, k / 4)) distances.push_back(k);
+    return distances;
+}
+
+/**
+ * Raises tan[i] to the slope from mid[i] to src[i] for i in [i0, n), inv being one over
+ * their distance.
+ */
+void raiseRow(const float* mid, const float* src, size_t i0, size_t n, float inv, float noData, float* tan)
+{
+    for(size_t i = i0; i < n; ++i)
+    {
+        if(src[i] != noData) tan[i] = std::max(tan[i], (src[i] - mid[i]) * inv);
+    }
+}
+
+#ifdef TV_HAS_AVX2
+
+/**
+ * Eight samples per step. Returns the first index left for the scalar path.
+ */
+TV_TARGET_AVX2 size_t raiseRowAvx2(const float* mid, const float* src, size_t n, float inv, float noData, float* tan)
+{
+    const __m256 vInv = _mm256_set1_ps(inv);
+    const __m256 vNoData = _mm256_set1_ps(noData);
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+        __m256 s = _mm256_loadu_ps(src + i);
+        __m256 t = _mm256_mul_ps(_mm256_sub_ps(s, _mm256_loadu_ps(mid + i)), vInv);
+        t = _mm256_andnot_ps(_mm256_cmp_ps(s, vNoData, _CMP_EQ_OQ), t);
+        _mm256_storeu_ps(tan + i, _mm256_max_ps(_mm256_loadu_ps(tan + i), t));
+    }
+    return i;
+}
+
+#endif
+
+/**
+ * Horizons of row r in direction d, written as bytes to every fourth byte of out from the
+ * row's first sample on.
+ */
+void traceRow(const tv::HeightGrid& grid, size_t r, int d, const std::vector<size_t>& distances,
+              const HorizonParams& params, bool simd, std::vector<float>& tan, uint8_t* out)
+{
+    size_t rows = grid.numRows();
+    size_t cols = grid.numCols();
+    const float* mid = grid.row(r);
+    const int dr = kSteps[d][0];
+    const int dc = kSteps[d][1];
+    const float stepLength = (dr != 0 and dc != 0 ? std::sqrt(2.0f) : 1.0f) * params.cellSize;
+
+    //Below level counts as level: terrain lower than a sample never shadows it.
+    std::fill(tan.begin(), tan.end(), 0.0f);
+    for(size_t k : distances)
+    {
+        bool rowOutside = (dr < 0 and k > r) or (dr > 0 and r + k >= rows);
+        if(rowOutside or (dc != 0 and k >= cols)) break;
+        size_t rr = dr < 0 ? r - k : dr > 0 ? r + k : r;
+        size_t c0 = dc < 0 ? k : 0;
+        size_t n = cols - (dc != 0 ? k : 0);
+        const float* src = grid.row(rr) + (dc > 0 ? k : 0);
+        const float* base = mid + c0;
+        float inv = 1.0f / (float(k) * stepLength);
+        size_t i = 0;
+#ifdef TV_HAS_AVX2
+        if(simd) i = raiseRowAvx2(base, src, n, inv, params.noData, tan.data() + c0);
+#else
+        (void)simd;
+#endif
+        raiseRow(base, src, i, n, inv, params.noData, tan.data() + c0);
+    }
+
+    for(size_t c = 0; c < cols; ++c)
+    {
+        float t = mid[c] == params.noData ? 0.0f : tan[c];
+        out[c * 4] = uint8_t(t / std::sqrt(1.0f + t * t) * 255.0f + 0.5f);
+    }
+}
+
+} //namespace
+
+void horizonAngles(const tv::HeightGrid& grid, const HorizonParams& params, std::vector<uint8_t>& out)
+{
+    size_t rows = grid.numRows();
+    size_t cols = grid.numCols();
+    size_t plane = rows * cols * 4;
+    out.assign(plane * 2, 0);
+    if(grid.isEmpty()) return;
+
+    std::vector<size_t> distances = marchDistances(params.maxDistance);
+    bool simd = tv::hasAvx2();
+    size_t blocks = (rows + kBlockRows - 1) / kBlockRows;
+    tv::parallelTasks(blocks, [&](size_t block)
+    {
+        std::vector<float> tan(cols);
+        size_t r1 = std::min(rows, (block + 1) * kBlockRows);
+        for(size_t r = block * kBlockRows; r < r1; ++r)
+        {
+            for(int d = 0; d < kHorizonDirections; ++d)
+            {
+                uint8_t* row = out.data() + size_t(d / 4) * plane + r * cols * 4 + size_t(d % 4);
+                traceRow(grid, r, d, distances, params, simd, tan, row);
+            }
+        }
+    });
+}
+
+} //namespace analysis
@@ -0,0 +1,44 @@
+#ifndef HORIZON_H
+#define HORIZON_H
+
+#include "heightgrid.h"
+#include <cstdint>
+#include <vector>
+
+namespace analysis
+{
+
+/**
+ * Number of directions horizons are traced in, clockwise from north in steps of 45
+ * degrees: north, north east, east and so on.
+ */
+constexpr int kHorizonDirections = 8;
+
+/**
+ * The cell size is the sample spacing in height units. Horizons are searched up to
+ * maxDistance cells away.
+ */
+struct HorizonParams
+{
+    float   cellSize    = 1.0f;
+    float   noData      = -9999.0f;
+    float   maxDistance = 256.0f;
+};
+
+/**
+ * Elevation angle of the horizon seen from every sample in each of the eight directions,
+ * stored as its sine in one byte, 0 for a horizon at or below level and 255 straight up.
+ * out is resized to eight bytes per sample in two planes of four: directions 0 to 3 of
+ * all samples row by row, then directions 4 to 7, so that each plane uploads as an RGBA
+ * texture. NODATA samples get 0 and do not occlude.
+ *
+ * Each direction is marched at distances that grow by a quarter per step, so near
+ * terrain is sampled densely and far terrain coarsely. A step reads the same row for all
+ * samples of a row, so rows are processed eight samples at a time with AVX2 where
+ * available, and blocks of rows in parallel.
+ */
+void horizonAngles(const tv::HeightGrid& grid, const HorizonParams& params, std::vector<uint8_t>& out);
+
+} //namespace analysis
+
+#endif // HORIZON_H
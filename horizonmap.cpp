@@ -0,0 +1,175 @@
+#include "horizonmap.h"
+#include "horizon.h"
+#include <QDebug>
+#include <QVector4D>
+#include <QtMath>
+#include <cmath>
+
+namespace render
+{
+
+/**
+ * Binds the horizons for the terrain shader, which must be bound, and weighs the two
+ * directions either side of the sun. Returns false if there are none to bind.
+ */
+bool HorizonMap::apply(QOpenGLShaderProgram& prog, float sunAzimuth)
+{
+    if(m_initialized and m_dirty) upload();
+    if(m_initialized and not m_regions.empty()) uploadRegions();
+    if(not m_textures[0]) return false;
+
+    float sector = std::fmod(sunAzimuth / 45.0f, float(analysis::kHorizonDirections));
+    if(sector < 0.0f) sector += float(analysis::kHorizonDirections);
+    int first = int(sector) % analysis::kHorizonDirections;
+    int second = (first + 1) % analysis::kHorizonDirections;
+    float weights[analysis::kHorizonDirections] = {};
+    weights[first] = 1.0f - (sector - std::floor(sector));
+    weights[second] += sector - std::floor(sector);
+
+    for(int i = 0; i < 2; ++i)
+    {
+        glActiveTexture(GLenum(GL_TEXTURE0 + kTextureUnit + i));
+        glBindTexture(GL_TEXTURE_2D, m_textures[i]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    prog.setUniformValue("u_horizons0", kTextureUnit);
+    prog.setUniformValue("u_horizons1", kTextureUnit + 1);
+    prog.setUniformValue("u_sunWeights0", QVector4D(weights[0], weights[1], weights[2], weights[3]));
+    prog.setUniformValue("u_sunWeights1", QVector4D(weights[4], weights[5], weights[6], weights[7]));
+    return true;
+}
+
+/**
+ * Needs a current context.
+ */
+void HorizonMap::initialize()
+{
+    if(m_initialized) return;
+    initializeOpenGLFunctions();
+    m_initialized = true;
+}
+
+/**
+ * Frees the textures. Needs a current context.
+ */
+void HorizonMap::release()
+{
+    if(not m_initialized) return;
+    if(m_textures[0]) glDeleteTextures(2, m_textures);
+    m_textures[0] = m_textures[1] = 0;
+    m_initialized = false;
+}
+
+/**
+ * Queues the horizons of a grid of the given size, in the layout horizonAngles() writes.
+ * Empty horizons remove the textures.
+ */
+void HorizonMap::setHorizons(std::vector<uint8_t>&& horizons, size_t rows, size_t cols)
+{
+    m_pending = std::move(horizons);
+    m_regions.clear();
+    m_rows = rows;
+    m_cols = cols;
+    m_dirty = true;
+}
+
+/**
+ * Queues the horizons of a rectangle of the grid, in the layout horizonAngles() writes
+ * for a grid of the rectangle's size.
+ */
+void HorizonMap::updateRegion(const tv::GridRect& rect, std::vector<uint8_t>&& horizons)
+{
+    if(rect.isEmpty() or horizons.size() != rect.numRows() * rect.numCols() * analysis::kHorizonDirections) return;
+    m_regions.push_back({rect, std::move(horizons)});
+}
+
+//------->Private
+
+void HorizonMap::upload()
+{
+    m_dirty = false;
+    if(m_pending.size() != m_rows * m_cols * analysis::kHorizonDirections or m_pending.empty())
+    {
+        if(m_textures[0]) glDeleteTextures(2, m_textures);
+        m_textures[0] = m_textures[1] = 0;
+        std::vector<uint8_t>().swap(m_pending);
+        return;
+    }
+
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    if(m_cols > size_t(maxSize) or m_rows > size_t(maxSize))
+    {
+        qDebug() << "Horizons of" << m_cols << "x" << m_rows << "samples exceed the texture size limit, drawing without shadows.";
+        std::vector<uint8_t>().swap(m_pending);
+        return;
+    }
+
+    if(not m_textures[0]) glGenTextures(2, m_textures);
+    size_t plane = m_rows * m_cols * 4;
+    for(int i = 0; i < 2; ++i)
+    {
+        glBindTexture(GL_TEXTURE_2D, m_textures[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, GLsizei(m_cols), GLsizei(m_rows), 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                     m_pending.data() + size_t(i) * plane);
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    std::vector<uint8_t>().swap(m_pending);
+}
+
+/**
+ * Writes the queued rectangles into the base level and rebuilds the mip levels once.
+ */
+void HorizonMap::uploadRegions()
+{
+    std::vector<Region> regions;
+    regions.swap(m_regions);
+    if(not m_textures[0]) return;
+    bool changed = false;
+    for(const Region& region : regions)
+    {
+        const tv::GridRect& r = region.rect;
+        if(r.row1 > m_rows or r.col1 > m_cols) continue;
+        size_t plane = r.numRows() * r.numCols() * 4;
+        for(int i = 0; i < 2; ++i)
+        {
+            glBindTexture(GL_TEXTURE_2D, m_textures[i]);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, GLint(r.col0), GLint(r.row0), GLsizei(r.numCols()), GLsizei(r.numRows()),
+                            GL_RGBA, GL_UNSIGNED_BYTE, region.horizons.data() + size_t(i) * plane);
+        }
+        changed = true;
+    }
+    if(changed)
+    {
+        for(int i = 0; i < 2; ++i)
+        {
+            glBindTexture(GL_TEXTURE_2D, m_textures[i]);
+            glGenerateMipmap(GL_TEXTURE_2D);
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/**
+ * Sets the lighting uniforms of the terrain shader, which must be bound.
+ */
+void Lighting::apply(QOpenGLShaderProgram& prog) const
+{
+    bool lit = normals and normals->apply(prog);
+    prog.setUniformValue("u_lighting", lit);
+    if(not lit) return;
+
+    //North is -x and east is +y in mesh coordinates.
+    double az = qDegreesToRadians(double(azimuth));
+    double alt = qDegreesToRadians(double(altitude));
+    prog.setUniformValue("u_lightDir", QVector3D(float(-std::cos(az) * std::cos(alt)), float(std::sin(az) * std::cos(alt)),
+                                                 float(std::sin(alt))));
+    prog.setUniformValue("u_shadows", horizons and horizons->apply(prog, azimuth));
+}
+
+} //namespace render
@@ -0,0 +1,71 @@
+#ifndef HORIZONMAP_H
+#define HORIZONMAP_H
+
+#include "normalmap.h"
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <cstdint>
+#include <vector>
+
+namespace render
+{
+
+/**
+ * Horizons of a grid as computed by analysis::horizonAngles(), as two RGBA textures of
+ * four directions each laid over the grid like the overlay and bound to kTextureUnit and
+ * the unit after it. From them the terrain shader shadows the sun in any direction and
+ * darkens the ambient light where the sky is hidden, without drawing the terrain again.
+ * Horizons are handed over on the CPU side, whole or for an edited rectangle, and
+ * uploaded by the next draw, so they can be replaced from any thread that holds the
+ * scene lock.
+ */
+class HorizonMap : protected QOpenGLExtraFunctions
+{
+public:
+    static constexpr int kTextureUnit = 5;
+
+    HorizonMap() = default;
+    bool isInitialized() const{return m_initialized;}
+    bool apply(QOpenGLShaderProgram& prog, float sunAzimuth);
+    void initialize();
+    void release();
+    void setHorizons(std::vector<uint8_t>&& horizons, size_t rows, size_t cols);
+    void updateRegion(const tv::GridRect& rect, std::vector<uint8_t>&& horizons);
+
+private:
+    struct Region
+    {
+        tv::GridRect            rect;
+        std::vector<uint8_t>    horizons;
+    };
+
+    bool                    m_initialized   = false;
+    bool                    m_dirty         = false;
+    size_t                  m_cols          = 0;
+    size_t                  m_rows          = 0;
+    GLuint                  m_textures[2]   = {};
+    std::vector<uint8_t>    m_pending;
+    std::vector<Region>     m_regions;
+
+    void upload();
+    void uploadRegions();
+};
+
+/**
+ * What the terrain shader lights a grid with. Without normals the grid is drawn unlit,
+ * without horizons it is lit but neither shadowed nor occluded. The sun's azimuth is in
+ * degrees clockwise from north, its altitude in degrees above the horizon.
+ */
+struct Lighting
+{
+    NormalMap*  normals     = nullptr;
+    HorizonMap* horizons    = nullptr;
+    float       azimuth     = 315.0f;
+    float       altitude    = 45.0f;
+
+    void apply(QOpenGLShaderProgram& prog) const;
+};
+
+} //namespace render
+
+#endif // HORIZONMAP_H
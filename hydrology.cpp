@@ -0,0 +1,588 @@
+#include "hydrology.h"
+#include "parallel.h"
+#include "rasterkernels.h"
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <queue>
+#include <unordered_map>
+
+namespace analysis
+{
+
+namespace
+{
+
+/**
+ * Labels of a tile fit 16 bits: one per perimeter sample plus the two below.
+ */
+constexpr size_t kTileSize = 512;
+constexpr uint16_t kUnlabelled = 0;
+constexpr uint16_t kOcean = 1;
+constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+
+/**
+ * Row and column step of each flow direction, clockwise from north. Row 0 is the
+ * northernmost.
+ */
+constexpr int kDr[8] = {-1, -1, 0, 1, 1, 1, 0, -1};
+constexpr int kDc[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+constexpr float kDistance[8] = {1.0f, 1.41421356f, 1.0f, 1.41421356f, 1.0f, 1.41421356f, 1.0f, 1.41421356f};
+
+struct Tile
+{
+    size_t  r0;
+    size_t  c0;
+    size_t  r1;
+    size_t  c1;
+
+    bool contains(size_t r, size_t c) const{return r >= r0 and r < r1 and c >= c0 and c < c1;}
+    bool onPerimeter(size_t r, size_t c) const{return r == r0 or r + 1 == r1 or c == c0 or c + 1 == c1;}
+};
+
+class Tiling
+{
+public:
+    Tiling(size_t rows, size_t cols) :
+        m_rows(rows),
+        m_cols(cols),
+        m_across((cols + kTileSize - 1) / kTileSize),
+        m_down((rows + kTileSize - 1) / kTileSize)
+    {}
+    size_t numTiles() const{return m_across * m_down;}
+    size_t tileOf(size_t r, size_t c) const{return r / kTileSize * m_across + c / kTileSize;}
+    Tile tile(size_t t) const
+    {
+        size_t r0 = t / m_across * kTileSize;
+        size_t c0 = t % m_across * kTileSize;
+        return {r0, c0, std::min(r0 + kTileSize, m_rows), std::min(c0 + kTileSize, m_cols)};
+    }
+
+private:
+    size_t  m_rows;
+    size_t  m_cols;
+    size_t  m_across;
+    size_t  m_down;
+};
+
+/**
+ * Calls fn(direction, neighbourRow, neighbourCol) for every neighbour of a sample that
+ * lies on the grid.
+ */
+template<typename Fn>
+inline void forNeighbours(size_t r, size_t c, size_t rows, size_t cols, Fn fn)
+{
+    for(int d = 0; d < 8; ++d)
+    {
+        size_t nr = r + size_t(ptrdiff_t(kDr[d]));
+        size_t nc = c + size_t(ptrdiff_t(kDc[d]));
+        if(nr < rows and nc < cols) fn(d, nr, nc);
+    }
+}
+
+struct Spill
+{
+    float       level;
+    uint32_t    index;
+
+    bool operator>(const Spill& o) const{return level > o.level;}
+};
+
+using SpillQueue = std::priority_queue<Spill, std::vector<Spill>, std::greater<Spill>>;
+
+/**
+ * Result of flooding one tile: how many labels it used and the lowest pass between every
+ * pair of them, keyed by the smaller label in the high half.
+ */
+struct TileFlood
+{
+    uint16_t                            numLabels   = kOcean + 1;
+    std::unordered_map<uint32_t, float> passes;
+
+    void addPass(uint16_t a, uint16_t b, float level)
+    {
+        uint32_t key = a < b ? uint32_t(a) << 16 | b : uint32_t(b) << 16 | a;
+        auto it = passes.find(key);
+        if(it == passes.end()) passes.emplace(key, level);
+        else it->second = std::min(it->second, level);
+    }
+};
+
+/**
+ * Priority-flood of one tile from its perimeter and from the samples next to outlets or
+ * the grid border, which drain into the ocean label. Samples raised to the level they
+ * were reached at go through a plain queue instead of the heap, as they are flooded in
+ * order anyway.
+ */
+void floodTile(const tv::HeightGrid& grid, const HydrologyParams& params, const Tile& tile,
+               tv::HeightGrid& filled, std::vector<uint16_t>& labels, TileFlood& flood)
+{
+    size_t rows = grid.numRows();
+    size_t cols = grid.numCols();
+    auto isOutlet = [&](float z){return z == params.noData or z < params.seaLevel;};
+    SpillQueue open;
+    std::deque<uint32_t> pit;
+
+    for(size_t r = tile.r0; r < tile.r1; ++r)
+    {
+        for(size_t c = tile.c0; c < tile.c1; ++c)
+        {
+            float z = grid.at(r, c);
+            if(isOutlet(z)) continue;
+            bool drains = r == 0 or c == 0 or r + 1 == rows or c + 1 == cols;
+            forNeighbours(r, c, rows, cols, [&](int, size_t nr, size_t nc)
+            {
+                drains = drains or isOutlet(grid.at(nr, nc));
+            });
+            if(not drains and not tile.onPerimeter(r, c)) continue;
+            uint16_t label = drains ? kOcean : flood.numLabels++;
+            labels[r * cols + c] = label;
+            open.push({z, uint32_t(r * cols + c)});
+        }
+    }
+
+    while(not open.empty() or not pit.empty())
+    {
+        uint32_t i;
+        if(not pit.empty())
+        {
+            i = pit.front();
+            pit.pop_front();
+        }
+        else
+        {
+            i = open.top().index;
+            open.pop();
+        }
+        size_t r = i / cols;
+        size_t c = i % cols;
+        float level = filled.at(r, c);
+        uint16_t label = labels[i];
+        forNeighbours(r, c, rows, cols, [&](int, size_t nr, size_t nc)
+        {
+            if(not tile.contains(nr, nc)) return;
+            size_t n = nr * cols + nc;
+            float z = grid.at(nr, nc);
+            if(isOutlet(z)) return;
+            if(labels[n] != kUnlabelled)
+            {
+                if(labels[n] != label) flood.addPass(label, labels[n], std::max(level, filled.at(nr, nc)));
+                return;
+            }
+            labels[n] = label;
+            if(z <= level)
+            {
+                filled.at(nr, nc) = level;
+                pit.push_back(uint32_t(n));
+            }
+            else open.push({z, uint32_t(n)});
+        });
+    }
+}
+
+/**
+ * A tile sample where flow leaves the tile, and the flow it carries.
+ */
+struct Exit
+{
+    uint32_t    cell;
+    uint32_t    flow;
+};
+
+/**
+ * Tile sample that receives flow from another tile, the exit its own flow leaves the
+ * tile by, kNone if it ends inside, and the flow it receives.
+ */
+struct Entry
+{
+    uint32_t    cell;
+    uint32_t    exit;
+    uint32_t    inflow  = 0;
+};
+
+inline uint32_t receiver(const std::vector<uint8_t>& dirs, size_t i, size_t cols)
+{
+    uint8_t d = dirs[i];
+    if(d >= 8) return kNone;
+    return uint32_t(ptrdiff_t(i) + kDr[d] * ptrdiff_t(cols) + kDc[d]);
+}
+
+/**
+ * Topological accumulation of a tile, starting every sample at one plus its inflow from
+ * other tiles. Returns the samples in the order they were finished, upstream first.
+ */
+std::vector<uint32_t> accumulateTile(const std::vector<uint8_t>& dirs, size_t cols, const Tile& tile,
+                                     const std::vector<Entry>& entries, std::vector<uint32_t>& acc)
+{
+    size_t width = tile.c1 - tile.c0;
+    auto local = [&](uint32_t i){return (i / cols - tile.r0) * width + (i % cols - tile.c0);};
+    auto feeds = [&](uint32_t to){return to != kNone and tile.contains(to / cols, to % cols) and dirs[to] != kOutlet;};
+
+    std::vector<uint32_t> donors((tile.r1 - tile.r0) * width, 0);
+    for(size_t r = tile.r0; r < tile.r1; ++r)
+    {
+        for(size_t c = tile.c0; c < tile.c1; ++c)
+        {
+            size_t i = r * cols + c;
+            acc[i] = dirs[i] == kOutlet ? 0 : 1;
+            uint32_t to = receiver(dirs, i, cols);
+            if(acc[i] > 0 and feeds(to)) ++donors[local(to)];
+        }
+    }
+    for(const Entry& e : entries) acc[e.cell] += e.inflow;
+
+    std::vector<uint32_t> order;
+    order.reserve(donors.size());
+    for(size_t r = tile.r0; r < tile.r1; ++r)
+    {
+        for(size_t c = tile.c0; c < tile.c1; ++c)
+        {
+            uint32_t i = uint32_t(r * cols + c);
+            if(dirs[i] != kOutlet and donors[local(i)] == 0) order.push_back(i);
+        }
+    }
+    for(size_t k = 0; k < order.size(); ++k)
+    {
+        uint32_t i = order[k];
+        uint32_t to = receiver(dirs, i, cols);
+        if(not feeds(to)) continue;
+        acc[to] += acc[i];
+        if(--donors[local(to)] == 0) order.push_back(to);
+    }
+    return order;
+}
+
+} //namespace
+
+bool fitsHydrology(size_t rows, size_t cols)
+{
+    return cols == 0 or rows < size_t(kNone) / cols;
+}
+
+bool fillDepressions(const tv::HeightGrid& grid, const HydrologyParams& params, tv::HeightGrid& filled)
+{
+    size_t rows = grid.numRows();
+    size_t cols = grid.numCols();
+    filled = grid;
+    if(not fitsHydrology(rows, cols)) return false;
+    if(grid.isEmpty()) return true;
+
+    Tiling tiling(rows, cols);
+    std::vector<uint16_t> labels(rows * cols, kUnlabelled);
+    std::vector<TileFlood> floods(tiling.numTiles());
+    tv::parallelTasks(tiling.numTiles(), [&](size_t t)
+    {
+        floodTile(grid, params, tiling.tile(t), filled, labels, floods[t]);
+    });
+
+    //Labels of all tiles in one graph, the ocean of every tile being node 0.
+    std::vector<uint32_t> firstLabel(tiling.numTiles() + 1, 1);
+    for(size_t t = 0; t < tiling.numTiles(); ++t) firstLabel[t + 1] = firstLabel[t] + floods[t].numLabels - (kOcean + 1);
+    auto node = [&](size_t t, uint16_t label){return label == kOcean ? 0 : firstLabel[t] + label - (kOcean + 1);};
+
+    struct Pass
+    {
+        uint32_t    a;
+        uint32_t    b;
+        float       level;
+    };
+    std::vector<std::vector<Pass>> tilePasses(tiling.numTiles());
+    tv::parallelTasks(tiling.numTiles(), [&](size_t t)
+    {
+        Tile tile = tiling.tile(t);
+        std::vector<Pass>& passes = tilePasses[t];
+        for(const auto& [key, level] : floods[t].passes)
+        {
+            passes.push_back({node(t, uint16_t(key >> 16)), node(t, uint16_t(key & 0xFFFF)), level});
+        }
+        //Passes into tiles further on; those are found from this side only.
+        for(size_t r = tile.r0; r < tile.r1; ++r)
+        {
+            for(size_t c = tile.c0; c < tile.c1; ++c)
+            {
+                uint16_t label = labels[r * cols + c];
+                if(not tile.onPerimeter(r, c) or label == kUnlabelled) continue;
+                forNeighbours(r, c, rows, cols, [&](int, size_t nr, size_t nc)
+                {
+                    size_t other = tiling.tileOf(nr, nc);
+                    uint16_t otherLabel = labels[nr * cols + nc];
+                    if(other <= t or otherLabel == kUnlabelled) return;
+                    passes.push_back({node(t, label), node(other, otherLabel), std::max(filled.at(r, c), filled.at(nr, nc))});
+                });
+            }
+        }
+    });
+
+    size_t numNodes = firstLabel.back();
+    std::vector<uint32_t> offsets(numNodes + 1, 0);
+    for(const std::vector<Pass>& passes : tilePasses)
+    {
+        for(const Pass& p : passes)
+        {
+            ++offsets[p.a + 1];
+            ++offsets[p.b + 1];
+        }
+    }
+    for(size_t n = 0; n < numNodes; ++n) offsets[n + 1] += offsets[n];
+    std::vector<Spill> links(offsets.back());
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for(const std::vector<Pass>& passes : tilePasses)
+    {
+        for(const Pass& p : passes)
+        {
+            links[fill[p.a]++] = {p.level, p.b};
+            links[fill[p.b]++] = {p.level, p.a};
+        }
+    }
+
+    //Every label spills at the lowest level at which water can reach the ocean from it.
+    std::vector<float> spill(numNodes, std::numeric_limits<float>::infinity());
+    std::vector<bool> done(numNodes, false);
+    SpillQueue open;
+    spill[0] = -std::numeric_limits<float>::infinity();
+    open.push({spill[0], 0});
+    while(not open.empty())
+    {
+        Spill s = open.top();
+        open.pop();
+        if(done[s.index]) continue;
+        done[s.index] = true;
+        for(uint32_t k = offsets[s.index]; k < offsets[s.index + 1]; ++k)
+        {
+            const Spill& link = links[k];
+            float level = std::max(s.level, link.level);
+            if(level < spill[link.index])
+            {
+                spill[link.index] = level;
+                open.push({level, link.index});
+            }
+        }
+    }
+
+    tv::parallelTasks(tiling.numTiles(), [&](size_t t)
+    {
+        Tile tile = tiling.tile(t);
+        for(size_t r = tile.r0; r < tile.r1; ++r)
+        {
+            for(size_t c = tile.c0; c < tile.c1; ++c)
+            {
+                uint16_t label = labels[r * cols + c];
+                if(label != kUnlabelled) filled.at(r, c) = std::max(filled.at(r, c), spill[node(t, label)]);
+            }
+        }
+    });
+    return true;
+}
+
+bool flowDirections(const tv::HeightGrid& filled, const HydrologyParams& params, std::vector<uint8_t>& dirs)
+{
+    size_t rows = filled.numRows();
+    size_t cols = filled.numCols();
+    dirs.assign(rows * cols, kNoFlow);
+    if(not fitsHydrology(rows, cols)) return false;
+    if(filled.isEmpty()) return true;
+    auto isOutlet = [&](float z){return z == params.noData or z < params.seaLevel;};
+
+    //Samples left on a flat are marked with a direction past the last one.
+    const uint8_t kFlat = 8;
+    tv::parallelFor(0, rows, [&](size_t r0, size_t r1, size_t)
+    {
+        for(size_t r = r0; r < r1; ++r)
+        {
+            for(size_t c = 0; c < cols; ++c)
+            {
+                float z = filled.at(r, c);
+                if(isOutlet(z))
+                {
+                    dirs[r * cols + c] = kOutlet;
+                    continue;
+                }
+                float steepest = 0.0f;
+                int down = -1;
+                int outlet = -1;
+                forNeighbours(r, c, rows, cols, [&](int d, size_t nr, size_t nc)
+                {
+                    float n = filled.at(nr, nc);
+                    if(isOutlet(n))
+                    {
+                        if(outlet < 0) outlet = d;
+                        return;
+                    }
+                    float slope = (z - n) / kDistance[d];
+                    if(slope > steepest)
+                    {
+                        steepest = slope;
+                        down = d;
+                    }
+                });
+                bool border = r == 0 or c == 0 or r + 1 == rows or c + 1 == cols;
+                if(down < 0) down = outlet;
+                dirs[r * cols + c] = down >= 0 ? uint8_t(down) : border ? kNoFlow : kFlat;
+            }
+        }
+    }, 16);
+
+    //Flats drain towards the samples around them at the same level that already drain,
+    //each flat sample to the one it was reached from.
+    std::vector<std::vector<uint32_t>> edges(tv::numWorkers());
+    size_t chunks = tv::parallelFor(0, rows, [&](size_t r0, size_t r1, size_t chunk)
+    {
+        for(size_t r = r0; r < r1; ++r)
+        {
+            for(size_t c = 0; c < cols; ++c)
+            {
+                uint8_t d = dirs[r * cols + c];
+                if(d == kFlat or d == kOutlet) continue;
+                bool edge = false;
+                forNeighbours(r, c, rows, cols, [&](int, size_t nr, size_t nc)
+                {
+                    edge = edge or (dirs[nr * cols + nc] == kFlat and filled.at(nr, nc) == filled.at(r, c));
+                });
+                if(edge) edges[chunk].push_back(uint32_t(r * cols + c));
+            }
+        }
+    }, 16);
+    std::deque<uint32_t> open;
+    for(size_t chunk = 0; chunk < chunks; ++chunk) open.insert(open.end(), edges[chunk].begin(), edges[chunk].end());
+    while(not open.empty())
+    {
+        size_t i = open.front();
+        open.pop_front();
+        size_t r = i / cols;
+        size_t c = i % cols;
+        forNeighbours(r, c, rows, cols, [&](int d, size_t nr, size_t nc)
+        {
+            size_t n = nr * cols + nc;
+            if(dirs[n] != kFlat or filled.at(nr, nc) != filled.at(r, c)) return;
+            dirs[n] = uint8_t((d + 4) % 8);
+            open.push_back(uint32_t(n));
+        });
+    }
+
+    //Only flats without any outlet remain, which filling leaves none of.
+    std::replace(dirs.begin(), dirs.end(), kFlat, kNoFlow);
+    return true;
+}
+
+bool flowAccumulation(const std::vector<uint8_t>& dirs, size_t rows, size_t cols, std::vector<uint32_t>& out)
+{
+    out.assign(rows * cols, 0);
+    if(not fitsHydrology(rows, cols)) return false;
+    if(rows == 0 or cols == 0) return true;
+
+    //Flow across tile borders: where it leaves each tile, and where it enters.
+    Tiling tiling(rows, cols);
+    std::vector<std::vector<Exit>> exits(tiling.numTiles());
+    std::vector<std::vector<Entry>> entries(tiling.numTiles());
+    tv::parallelTasks(tiling.numTiles(), [&](size_t t)
+    {
+        Tile tile = tiling.tile(t);
+        std::vector<uint32_t> order = accumulateTile(dirs, cols, tile, {}, out);
+
+        //Downstream first, so a sample's receiver knows its exit before the sample.
+        size_t width = tile.c1 - tile.c0;
+        auto local = [&](uint32_t i){return (i / cols - tile.r0) * width + (i % cols - tile.c0);};
+        std::vector<uint32_t> exitOf((tile.r1 - tile.r0) * width, kNone);
+        for(auto it = order.rbegin(); it != order.rend(); ++it)
+        {
+            uint32_t i = *it;
+            uint32_t to = receiver(dirs, i, cols);
+            if(to == kNone or dirs[to] == kOutlet) continue;
+            if(tile.contains(to / cols, to % cols)) exitOf[local(i)] = exitOf[local(to)];
+            else
+            {
+                exitOf[local(i)] = i;
+                exits[t].push_back({i, out[i]});
+            }
+        }
+        for(size_t r = tile.r0; r < tile.r1; ++r)
+        {
+            for(size_t c = tile.c0; c < tile.c1; ++c)
+            {
+                if(not tile.onPerimeter(r, c) or dirs[r * cols + c] == kOutlet) continue;
+                uint32_t i = uint32_t(r * cols + c);
+                bool fed = false;
+                forNeighbours(r, c, rows, cols, [&](int, size_t nr, size_t nc)
+                {
+                    fed = fed or (not tile.contains(nr, nc) and receiver(dirs, nr * cols + nc, cols) == i);
+                });
+                if(fed) entries[t].push_back({i, exitOf[local(i)]});
+            }
+        }
+    });
+
+    //Flow leaving by an exit continues at the exit of the sample it enters; this graph
+    //of exits is acyclic as the flow is.
+    std::unordered_map<uint32_t, uint32_t> exitNode;
+    std::vector<uint32_t> exitCells;
+    std::vector<uint32_t> flow;
+    for(const std::vector<Exit>& tileExits : exits)
+    {
+        for(const Exit& e : tileExits)
+        {
+            exitNode.emplace(e.cell, uint32_t(exitCells.size()));
+            exitCells.push_back(e.cell);
+            flow.push_back(e.flow);
+        }
+    }
+    std::unordered_map<uint32_t, Entry*> entryOf;
+    for(std::vector<Entry>& tileEntries : entries)
+    {
+        for(Entry& e : tileEntries) entryOf.emplace(e.cell, &e);
+    }
+    std::vector<uint32_t> next(exitCells.size(), kNone);
+    std::vector<uint32_t> upstream(exitCells.size(), 0);
+    for(size_t n = 0; n < exitCells.size(); ++n)
+    {
+        const Entry* entry = entryOf.at(receiver(dirs, exitCells[n], cols));
+        if(entry->exit == kNone) continue;
+        next[n] = exitNode.at(entry->exit);
+        ++upstream[next[n]];
+    }
+    std::vector<uint32_t> order;
+    for(size_t n = 0; n < exitCells.size(); ++n)
+    {
+        if(upstream[n] == 0) order.push_back(uint32_t(n));
+    }
+    for(size_t k = 0; k < order.size(); ++k)
+    {
+        uint32_t n = order[k];
+        entryOf.at(receiver(dirs, exitCells[n], cols))->inflow += flow[n];
+        if(next[n] == kNone) continue;
+        flow[next[n]] += flow[n];
+        if(--upstream[next[n]] == 0) order.push_back(next[n]);
+    }
+
+    tv::parallelTasks(tiling.numTiles(), [&](size_t t)
+    {
+        accumulateTile(dirs, cols, tiling.tile(t), entries[t], out);
+    });
+    return true;
+}
+
+bool drainage(const tv::HeightGrid& grid, const HydrologyParams& params, tv::HeightGrid& out)
+{
+    size_t rows = grid.numRows();
+    size_t cols = grid.numCols();
+    if(out.numRows() != rows or out.numCols() != cols) out.resize(cols, rows);
+    if(not fitsHydrology(rows, cols))
+    {
+        std::fill(out.data(), out.data() + rows * cols, kNoValue);
+        return false;
+    }
+    tv::HeightGrid filled;
+    fillDepressions(grid, params, filled);
+    std::vector<uint8_t> dirs;
+    flowDirections(filled, params, dirs);
+    std::vector<uint32_t> acc;
+    flowAccumulation(dirs, rows, cols, acc);
+
+    tv::parallelFor(0, rows * cols, [&](size_t i0, size_t i1, size_t)
+    {
+        for(size_t i = i0; i < i1; ++i) out.data()[i] = acc[i] > 0 ? std::log10(float(acc[i])) : kNoValue;
+    }, 1 << 16);
+    return true;
+}
+
+} //namespace analysis
@@ -0,0 +1,73 @@
+#ifndef HYDROLOGY_H
+#define HYDROLOGY_H
+
+#include "heightgrid.h"
+#include <cstdint>
+#include <vector>
+
+namespace analysis
+{
+
+/**
+ * Samples that are NODATA or lie below the sea level are outlets: water reaching them
+ * leaves the terrain, and they get neither a flow direction nor an accumulation. The
+ * default sea level suits bathymetric grids such as GEBCO, of which only the land is
+ * analysed; set it below the lowest sample to analyse the whole grid.
+ */
+struct HydrologyParams
+{
+    float   noData      = -9999.0f;
+    float   seaLevel    = 0.0f;
+};
+
+/**
+ * Flow direction of a border sample without a lower neighbour, which drains off the
+ * grid, and of an outlet, which is not routed at all.
+ */
+constexpr uint8_t kNoFlow = 255;
+constexpr uint8_t kOutlet = 254;
+
+/**
+ * Samples are indexed with 32 bits, so the functions below take grids of less than 2^32
+ * samples, about 65k by 65k. They return false for larger grids and leave the outputs
+ * without any flow.
+ */
+bool fitsHydrology(size_t rows, size_t cols);
+
+/**
+ * Raises every depression to the level at which it spills, so that water can flow from
+ * every sample to an outlet or the border without going uphill.
+ *
+ * Priority-flood from the outlets and the border, run per tile after Barnes' parallel
+ * variant: tiles are flooded independently from their own perimeter, each perimeter seed
+ * labelling the cells it floods, while the lowest pass between every pair of labels is
+ * recorded. Flooding the small graph of labels from the outlets then gives the level
+ * each label spills at, and the tiles are raised to it in parallel.
+ */
+bool fillDepressions(const tv::HeightGrid& grid, const HydrologyParams& params, tv::HeightGrid& filled);
+
+/**
+ * D8 flow directions of a filled grid, 0 to 7 clockwise from north, towards the
+ * neighbour of steepest descent, or kNoFlow or kOutlet. Samples with no lower neighbour
+ * drain into an adjacent outlet if they have one; the rest lie on flats, which drain
+ * along the shortest path to their edge.
+ */
+bool flowDirections(const tv::HeightGrid& filled, const HydrologyParams& params, std::vector<uint8_t>& dirs);
+
+/**
+ * Number of samples draining through every sample, itself included, 0 for outlets.
+ * Tiles are accumulated in parallel; the flow passing from tile to tile is summed over
+ * the small graph of the samples where it leaves a tile and added in a second parallel
+ * pass.
+ */
+bool flowAccumulation(const std::vector<uint8_t>& dirs, size_t rows, size_t cols, std::vector<uint32_t>& out);
+
+/**
+ * Fills, routes and accumulates the grid and writes the decimal logarithm of the
+ * accumulation to out, which is resized to match, kNoValue at outlets.
+ */
+bool drainage(const tv::HeightGrid& grid, const HydrologyParams& params, tv::HeightGrid& out);
+
+} //namespace analysis
+
+#endif // HYDROLOGY_H
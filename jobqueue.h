@@ -0,0 +1,88 @@
+#ifndef JOBQUEUE_H
+#define JOBQUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace tv
+{
+
+/**
+ * Runs jobs one after another, in the order they were posted, on a thread of its own
+ * that starts with the first job. Posting never waits for a job to run; clear() drops
+ * the jobs not started yet and waits for the running one, so that whatever the jobs
+ * refer to can be replaced afterwards.
+ */
+class JobQueue
+{
+public:
+    JobQueue() = default;
+    JobQueue(const JobQueue&) = delete;
+    JobQueue& operator=(const JobQueue&) = delete;
+    ~JobQueue()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_jobs.clear();
+            m_closed = true;
+        }
+        m_changed.notify_all();
+        if(m_thread.joinable()) m_thread.join();
+    }
+
+    void clear()
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_jobs.clear();
+        m_changed.wait(lock, [this]()
+        {
+            return not m_busy;
+        });
+    }
+
+    void post(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_jobs.push_back(std::move(job));
+            if(not m_thread.joinable()) m_thread = std::thread(&JobQueue::run, this);
+        }
+        m_changed.notify_all();
+    }
+
+private:
+    bool                                m_busy      = false;
+    bool                                m_closed    = false;
+    std::condition_variable             m_changed;
+    std::deque<std::function<void()>>   m_jobs;
+    std::mutex                          m_lock;
+    std::thread                         m_thread;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        while(true)
+        {
+            m_changed.wait(lock, [this]()
+            {
+                return m_closed or not m_jobs.empty();
+            });
+            if(m_jobs.empty()) return;
+            std::function<void()> job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+            m_busy = true;
+            lock.unlock();
+            job();
+            lock.lock();
+            m_busy = false;
+            m_changed.notify_all();
+        }
+    }
+};
+
+} //namespace tv
+
+#endif // JOBQUEUE_H
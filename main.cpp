@@ -1,11 +1,39 @@
+#include "float4x4.h"
 #include "mainwindow.h"
 
 #include <QApplication>
+#include <QCommandLineParser>
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Viewer for ESRI ASCII terrain grids.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("files", "ESRI ASCII grid files (.asc, also gzip or zstd compressed) to open.", "[files...]");
+    QCommandLineOption releaseMesh("release-cpu-mesh", "Free the CPU copy of each mesh once it is uploaded.");
+    parser.addOption(releaseMesh);
+    QCommandLineOption cachePyramids("cache-pyramids", "Keep the reduced resolution levels of each grid in a .pyr file next to it.");
+    parser.addOption(cachePyramids);
+    QCommandLineOption flight("flight", "Fly the camera path stored in <file> once the terrain shows.", "file");
+    parser.addOption(flight);
+    QCommandLineOption benchmark("benchmark", "With --flight, draw the path offscreen in 60 fps steps as fast as possible, log the frame times and quit.");
+    parser.addOption(benchmark);
+    QCommandLineOption benchmarkMath("benchmark-math", "Time the batched matrix math against QMatrix4x4, log the results and quit.");
+    parser.addOption(benchmarkMath);
+    parser.process(a);
+    if(parser.isSet(benchmarkMath))
+    {
+        tv::benchmarkFloat4x4(size_t(1) << 21);
+        return 0;
+    }
+
     MainWindow w;
+    w.setKeepCpuMesh(not parser.isSet(releaseMesh));
+    w.setCachePyramids(parser.isSet(cachePyramids));
+    w.openFiles(parser.positionalArguments());
     w.show();
+    if(parser.isSet(flight) and not w.flyPath(parser.value(flight), parser.isSet(benchmark))) return 1;
     return a.exec();
 }
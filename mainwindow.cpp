@@ -1,5 +1,50 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
+#include <QActionGroup>
+#include <QApplication>
+#include <QDebug>
+#include <QFile>
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QInputDialog>
+#include <QMessageBox>
+#include <QProgressDialog>
+#include <QRegularExpression>
+#include <QStatusBar>
+#include <QTextStream>
+
+namespace
+{
+
+constexpr double kBenchmarkFps = 60.0;
+
+/**
+ * Reads a polygon in map coordinates, one vertex per line as x and y separated by blanks
+ * or a comma. Empty lines and lines starting with # are skipped.
+ */
+bool readPolygon(const QString& fName, std::vector<QPointF>& polygon)
+{
+    QFile file(fName);
+    if(not file.open(QIODevice::ReadOnly | QIODevice::Text)) return false;
+    polygon.clear();
+    QTextStream in(&file);
+    static const QRegularExpression separators("[\\s,]+");
+    while(not in.atEnd())
+    {
+        QString line = in.readLine().trimmed();
+        if(line.isEmpty() or line.startsWith('#')) continue;
+        QStringList fields = line.split(separators, Qt::SkipEmptyParts);
+        bool okX = false;
+        bool okY = false;
+        double x = fields.size() >= 2 ? fields[0].toDouble(&okX) : 0.0;
+        double y = fields.size() >= 2 ? fields[1].toDouble(&okY) : 0.0;
+        if(not okX or not okY) return false;
+        polygon.emplace_back(x, y);
+    }
+    return polygon.size() >= 3;
+}
+
+} //namespace
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
@@ -7,6 +52,18 @@ MainWindow::MainWindow(QWidget *parent)
 {
     ui->setupUi(this);
 
+    connect(ui->actionOpen, &QAction::triggered, [this]()
+    {
+        QStringList fNames = QFileDialog::getOpenFileNames(this, tr("Open terrain"), QString(),
+                                                           tr("ESRI ASCII grids (*.asc *.asc.gz *.asc.zst);;All files (*)"));
+        if(not fNames.isEmpty()) openFiles(fNames);
+    });
+    connect(ui->actionExportImage, &QAction::triggered, this, &MainWindow::exportImage);
+    connect(ui->actionExportMesh, &QAction::triggered, this, &MainWindow::exportMesh);
+
+    QActionGroup* cameras = new QActionGroup(this);
+    cameras->addAction(ui->actionOrthographic);
+    cameras->addAction(ui->actionPerspective);
     connect(ui->actionOrthographic, &QAction::triggered, [this]()
     {
         ui->widget->setCameraMode(GlCam::Orthographic);
@@ -15,6 +72,131 @@ MainWindow::MainWindow(QWidget *parent)
     {
         ui->widget->setCameraMode(GlCam::Perspective);
     });
+    //The widget switches cameras by itself too, when a path is played.
+    connect(ui->widget, &GlWidget::cameraModeChanged, [this](CamMode mode)
+    {
+        (mode == GlCam::Perspective ? ui->actionPerspective : ui->actionOrthographic)->setChecked(true);
+    });
+    connect(ui->actionSplitView, &QAction::toggled, ui->widget, &GlWidget::setSplitView);
+    connect(ui->actionExtraViews, &QAction::triggered, [this]()
+    {
+        bool ok = false;
+        int count = QInputDialog::getInt(this, tr("Extra perspective views"),
+                                         tr("Views below the split view, each with its own camera:"),
+                                         ui->widget->numExtraViews(), 0, 4, 1, &ok);
+        if(not ok) return;
+        ui->widget->setExtraViews(count);
+        ui->actionSplitView->setChecked(true);
+    });
+    connect(ui->actionClipmap, &QAction::toggled, ui->widget, &GlWidget::setClipmapEnabled);
+    connect(ui->actionOrthoRaster, &QAction::toggled, ui->widget, &GlWidget::setOrthoRaster);
+    connect(ui->actionLighting, &QAction::toggled, ui->widget, &GlWidget::setLighting);
+    connect(ui->actionSunPosition, &QAction::triggered, [this]()
+    {
+        bool ok = false;
+        double azimuth = QInputDialog::getDouble(this, tr("Sun position"), tr("Azimuth in degrees clockwise from north:"),
+                                                 ui->widget->sunAzimuth(), 0.0, 360.0, 1, &ok);
+        if(not ok) return;
+        double altitude = QInputDialog::getDouble(this, tr("Sun position"), tr("Altitude in degrees above the horizon:"),
+                                                  ui->widget->sunAltitude(), 0.0, 90.0, 1, &ok);
+        if(not ok) return;
+        ui->widget->setSunPosition(float(azimuth), float(altitude));
+        ui->actionLighting->setChecked(true);
+    });
+    connect(ui->actionCutFill, &QAction::triggered, [this]()
+    {
+        //Without a polygon the whole first grid is measured.
+        std::vector<QPointF> polygon;
+        QString fName = QFileDialog::getOpenFileName(this, tr("Cut/fill polygon (cancel for the whole grid)"), QString(),
+                                                     tr("Polygons (*.txt *.csv);;All files (*)"));
+        if(not fName.isEmpty() and not readPolygon(fName, polygon))
+        {
+            QMessageBox::warning(this, tr("Cut/fill volumes"), tr("Could not read a polygon from %1.").arg(fName));
+            return;
+        }
+        if(not ui->widget->cutFill(polygon))
+        {
+            QMessageBox::information(this, tr("Cut/fill volumes"), tr("Open two grids of the same area to compare them."));
+            return;
+        }
+        statusBar()->showMessage(tr("Measuring cut and fill..."));
+    });
+    connect(ui->widget, &GlWidget::cutFillFinished, [this](const analysis::CutFill& volumes)
+    {
+        statusBar()->clearMessage();
+        QMessageBox::information(this, tr("Cut/fill volumes"),
+                                 tr("Cut: %1 over %2\nFill: %3 over %4\nNet: %5\nCompared area: %6")
+                                 .arg(volumes.cut, 0, 'f', 2).arg(volumes.cutArea, 0, 'f', 2)
+                                 .arg(volumes.fill, 0, 'f', 2).arg(volumes.fillArea, 0, 'f', 2)
+                                 .arg(volumes.net(), 0, 'f', 2).arg(volumes.area, 0, 'f', 2));
+    });
+    connect(ui->widget, &GlWidget::differenceDrawn, [this](float span)
+    {
+        statusBar()->showMessage(tr("Height differences up to %1 drawn as the full ramp.").arg(double(span), 0, 'g', 4));
+    });
+    connect(ui->actionRenderThread, &QAction::toggled, ui->widget, &GlWidget::setThreadedRendering);
+    connect(ui->actionFrameTime, &QAction::triggered, [this]()
+    {
+        bool ok = false;
+        double ms = QInputDialog::getDouble(this, tr("Interactive frame time"),
+                                            tr("Target while dragging in milliseconds (0 keeps full quality):"),
+                                            ui->widget->targetFrameTime(), 0.0, 1000.0, 1, &ok);
+        if(ok) ui->widget->setTargetFrameTime(ms);
+    });
+    connect(ui->actionUndo, &QAction::triggered, ui->widget, &GlWidget::undoEdit);
+    connect(ui->actionAddKeyframe, &QAction::triggered, ui->widget, &GlWidget::addKeyframe);
+    connect(ui->actionPlayPath, &QAction::triggered, [this]()
+    {
+        if(ui->widget->isFlying()) ui->widget->stopPath();
+        else if(not ui->widget->playPath())
+        {
+            QMessageBox::information(this, tr("Camera path"), tr("A path needs at least two keyframes."));
+        }
+    });
+    connect(ui->actionClearPath, &QAction::triggered, ui->widget, &GlWidget::clearPath);
+    connect(ui->actionLoadPath, &QAction::triggered, [this]()
+    {
+        QString fName = QFileDialog::getOpenFileName(this, tr("Load camera path"), QString(),
+                                                     tr("Camera paths (*.path);;All files (*)"));
+        if(not fName.isEmpty() and not ui->widget->loadPath(fName))
+        {
+            QMessageBox::warning(this, tr("Load camera path"), tr("Could not read %1.").arg(fName));
+        }
+    });
+    connect(ui->actionSavePath, &QAction::triggered, [this]()
+    {
+        QString fName = QFileDialog::getSaveFileName(this, tr("Save camera path"), QString(), tr("Camera paths (*.path)"));
+        if(not fName.isEmpty() and not ui->widget->savePath(fName))
+        {
+            QMessageBox::warning(this, tr("Save camera path"), tr("Could not write %1.").arg(fName));
+        }
+    });
+    connect(ui->actionContours, &QAction::triggered, [this]()
+    {
+        bool ok = false;
+        double interval = QInputDialog::getDouble(this, tr("Contour lines"), tr("Interval (0 hides the lines):"),
+                                                  ui->widget->contourInterval(), 0.0, 1e6, 2, &ok);
+        if(ok) ui->widget->setContourInterval(interval);
+    });
+
+    QActionGroup* overlays = new QActionGroup(this);
+    const std::pair<QAction*, render::OverlayMode> overlayActions[] = {
+        {ui->actionOverlayNone, render::OverlayMode::None},
+        {ui->actionHillshade,   render::OverlayMode::Hillshade},
+        {ui->actionSlope,       render::OverlayMode::Slope},
+        {ui->actionAspect,      render::OverlayMode::Aspect},
+        {ui->actionViewshed,    render::OverlayMode::Viewshed},
+        {ui->actionDrainage,    render::OverlayMode::Drainage},
+        {ui->actionDifference,  render::OverlayMode::Difference}
+    };
+    for(const auto& [action, mode] : overlayActions)
+    {
+        overlays->addAction(action);
+        connect(action, &QAction::triggered, [this, mode = mode]()
+        {
+            ui->widget->setSurfaceOverlay(mode);
+        });
+    }
 }
 
 MainWindow::~MainWindow()
@@ -22,3 +204,121 @@ MainWindow::~MainWindow()
     delete ui;
 }
 
+void MainWindow::setCachePyramids(bool cache)
+{
+    ui->widget->setCachePyramids(cache);
+}
+
+void MainWindow::setKeepCpuMesh(bool keep)
+{
+    ui->widget->setKeepCpuMesh(keep);
+}
+
+/**
+ * Asks for a file and an image width and exports the current view, showing progress
+ * until the image is written.
+ */
+void MainWindow::exportImage()
+{
+    QString fName = QFileDialog::getSaveFileName(this, tr("Export image"), QString(), tr("PNG images (*.png)"));
+    if(fName.isEmpty()) return;
+    bool ok = false;
+    int width = QInputDialog::getInt(this, tr("Export image"), tr("Width in pixels:"),
+                                     ui->widget->width() * 4, 1, 1000000, 1, &ok);
+    if(not ok) return;
+    if(not ui->widget->exportImage(fName, width))
+    {
+        QMessageBox::warning(this, tr("Export image"), tr("An export is already running."));
+        return;
+    }
+
+    showExportProgress(tr("Export image"), fName);
+}
+
+/**
+ * Asks for a file and the level of detail and writes the first dataset as a mesh.
+ */
+void MainWindow::exportMesh()
+{
+    QString filter;
+    QString fName = QFileDialog::getSaveFileName(this, tr("Export mesh"), QString(),
+                                                 tr("Binary PLY (*.ply);;Binary glTF (*.glb)"), &filter);
+    if(fName.isEmpty()) return;
+    if(QFileInfo(fName).suffix().isEmpty()) fName += filter.contains("glb") ? ".glb" : ".ply";
+    const QStringList details = {tr("Full"), tr("Coarse, as drawn while dragging")};
+    bool ok = false;
+    QString detail = QInputDialog::getItem(this, tr("Export mesh"), tr("Detail:"), details, 0, false, &ok);
+    if(not ok) return;
+
+    if(not ui->widget->exportMesh(fName, detail == details.back()))
+    {
+        QMessageBox::warning(this, tr("Export mesh"), tr("Could not export to %1.").arg(fName));
+        return;
+    }
+    showExportProgress(tr("Export mesh"), fName);
+}
+
+/**
+ * Flies the camera path stored in a file once the view has drawn its first frame. A
+ * benchmark flies it offscreen at kBenchmarkFps steps instead, logs the frame times and
+ * quits the application.
+ */
+bool MainWindow::flyPath(const QString& fileName, bool benchmark)
+{
+    if(not ui->widget->loadPath(fileName) or ui->widget->cameraPath().numKeyframes() < 2)
+    {
+        qDebug() << "Not a camera path of two keyframes or more:" << fileName;
+        return false;
+    }
+    //The view has no context before its first frame.
+    connect(ui->widget, &QOpenGLWidget::frameSwapped, this, [this, benchmark]()
+    {
+        if(not benchmark)
+        {
+            ui->widget->playPath();
+            return;
+        }
+        QApplication::exit(ui->widget->benchmarkPath(kBenchmarkFps) ? 0 : 1);
+    }, Qt::ConnectionType(Qt::QueuedConnection | Qt::SingleShotConnection));
+    return true;
+}
+
+void MainWindow::openFiles(const QStringList& fNames)
+{
+    if(fNames.isEmpty()) return;
+    if(not ui->widget->openFiles(fNames))
+    {
+        QMessageBox::warning(this, tr("Open terrain"), tr("None of the selected files could be read."));
+        return;
+    }
+    setWindowTitle(fNames.size() == 1 ? QFileInfo(fNames.front()).fileName()
+                                      : tr("%1 datasets").arg(fNames.size()));
+}
+
+/**
+ * Shows the progress of the running export until it finishes, cancelling it if asked to.
+ */
+void MainWindow::showExportProgress(const QString& title, const QString& fName)
+{
+    QProgressDialog* progress = new QProgressDialog(tr("Exporting %1").arg(QFileInfo(fName).fileName()),
+                                                    tr("Cancel"), 0, 0, this);
+    progress->setWindowModality(Qt::WindowModal);
+    progress->setAutoClose(false);
+    progress->setAutoReset(false);
+    progress->setMinimumDuration(0);
+    connect(ui->widget, &GlWidget::exportProgress, progress, [progress](int done, int total)
+    {
+        progress->setMaximum(total);
+        progress->setValue(done);
+    });
+    connect(ui->widget, &GlWidget::exportFinished, progress, [this, progress, title](bool ok, const QString& fileName)
+    {
+        progress->deleteLater();
+        if(not ok) QMessageBox::warning(this, title, tr("Could not write %1.").arg(fileName));
+    });
+    connect(progress, &QProgressDialog::canceled, progress, [this, progress]()
+    {
+        ui->widget->cancelExport();
+        progress->deleteLater();
+    });
+}
@@ -14,8 +14,16 @@ class MainWindow : public QMainWindow
 public:
     MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
+    void exportImage();
+    void exportMesh();
+    bool flyPath(const QString& fileName, bool benchmark);
+    void openFiles(const QStringList& fNames);
+    void setCachePyramids(bool cache);
+    void setKeepCpuMesh(bool keep);
 
 private:
     Ui::MainWindow *ui;
+
+    void showExportProgress(const QString& title, const QString& fName);
 };
 #endif // MAINWINDOW_H
@@ -0,0 +1,400 @@
+#include "meshexporter.h"
+#include "parallel.h"
+#include <QDebug>
+#include <QFile>
+#include <QtGlobal>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <thread>
+
+#if Q_BYTE_ORDER != Q_LITTLE_ENDIAN
+#error "Mesh export writes little endian data as it is laid out in memory."
+#endif
+
+namespace
+{
+
+constexpr size_t kBandBytes = size_t(8) << 20;
+constexpr size_t kVertexBytes = 6 * sizeof(float);
+constexpr size_t kPlyFaceBytes = 1 + 3 * sizeof(uint32_t);
+constexpr size_t kGlbFaceBytes = 3 * sizeof(uint32_t);
+
+/**
+ * Every step-th of n samples, keeping the last one so that the mesh spans the grid.
+ */
+std::vector<size_t> lattice(size_t n, size_t step)
+{
+    std::vector<size_t> at;
+    for(size_t i = 0; i < n; i += step) at.push_back(i);
+    if(n > 0 and at.back() != n - 1) at.push_back(n - 1);
+    return at;
+}
+
+inline char* put(char* out, const void* data, size_t size)
+{
+    std::memcpy(out, data, size);
+    return out + size;
+}
+
+QByteArray number(double value)
+{
+    //Nine significant digits are enough to read back any float exactly.
+    return QByteArray::number(value, 'g', 9);
+}
+
+bool writeAll(QFile& file, const char* data, size_t size)
+{
+    if(file.write(data, qint64(size)) == qint64(size)) return true;
+    qDebug() << "Cannot write mesh" << file.fileName() << ":" << file.errorString();
+    return false;
+}
+
+/**
+ * Writes the bands that generate(begin, end, out) produces for rows [0, n), rows at a
+ * time. Each band is written on a second thread while the next one is generated, so the
+ * time taken approaches that of the slower of both. done(rows) is called with the rows
+ * generated so far and stops the stream when it returns false.
+ */
+template<typename Fn, typename Done>
+bool streamBands(QFile& file, size_t n, size_t rows, Fn generate, Done done)
+{
+    std::vector<char> bands[2];
+    std::thread writer;
+    bool ok = true;
+    size_t k = 0;
+    for(size_t i = 0; i < n; i += rows, ++k)
+    {
+        std::vector<char>& band = bands[k % 2];
+        generate(i, std::min(n, i + rows), band);
+        if(writer.joinable()) writer.join();
+        if(not ok or not done(std::min(n, i + rows))) return false;
+        writer = std::thread([&file, &band, &ok]()
+        {
+            ok = writeAll(file, band.data(), band.size());
+        });
+    }
+    if(writer.joinable()) writer.join();
+    return ok;
+}
+
+} //namespace
+
+namespace tv
+{
+
+/**
+ * The grid must outlive the exporter and not be edited while it writes.
+ */
+MeshExporter::MeshExporter(const HeightGrid& grid, float noData, const analysis::GridGeoref& georef) :
+    m_grid(grid),
+    m_noData(noData),
+    m_georef(georef)
+{
+    setStep(1);
+}
+
+/**
+ * Keeps only every step-th row and column of samples, plus the last of each, like the
+ * coarse mesh drawn while interacting. One exports the full grid.
+ */
+void MeshExporter::setStep(size_t step)
+{
+    m_step = std::max<size_t>(1, step);
+    m_rows = lattice(m_grid.numRows(), m_step);
+    m_cols = lattice(m_grid.numCols(), m_step);
+}
+
+/**
+ * Writes the mesh, replacing the file. A file that could not be written completely, or
+ * whose export was cancelled, is removed again.
+ */
+bool MeshExporter::write(const QString& fileName, MeshFormat format, const Progress& progress) const
+{
+    Summary summary = summarize();
+    if(summary.numFaces == 0)
+    {
+        qDebug() << "No triangles to export to" << fileName;
+        return false;
+    }
+    if(m_rows.size() * m_cols.size() > std::numeric_limits<uint32_t>::max())
+    {
+        qDebug() << "Too many vertices for 32 bit indices:" << m_rows.size() * m_cols.size();
+        return false;
+    }
+    QFile file(fileName);
+    if(not file.open(QIODevice::WriteOnly | QIODevice::Unbuffered))
+    {
+        qDebug() << "Cannot write mesh" << fileName << ":" << file.errorString();
+        return false;
+    }
+    bool ok = format == MeshFormat::Glb ? writeGlb(file, summary, progress) : writePly(file, summary, progress);
+    file.close();
+    if(not ok) file.remove();
+    return ok;
+}
+
+/**
+ * The format that a file name's suffix asks for. Returns false for other suffixes.
+ */
+bool MeshExporter::formatFor(const QString& fileName, MeshFormat& format)
+{
+    if(fileName.endsWith(".ply", Qt::CaseInsensitive)) format = MeshFormat::Ply;
+    else if(fileName.endsWith(".glb", Qt::CaseInsensitive)) format = MeshFormat::Glb;
+    else return false;
+    return true;
+}
+
+//------->Private
+
+/**
+ * Rows of the lattice per band for a given output size of one row.
+ */
+size_t MeshExporter::bandRows(size_t bytesPerRow) const
+{
+    return std::max<size_t>(1, kBandBytes / std::max<size_t>(1, bytesPerRow));
+}
+
+/**
+ * Appends the triangles of the lattice quads in rows [i0, i1) to out, as three vertex
+ * indices each, preceded by the count of three for PLY. Quads are split like the meshes
+ * the viewer draws and wound counter-clockwise seen from above.
+ */
+void MeshExporter::faces(size_t i0, size_t i1, bool withCount, std::vector<char>& out) const
+{
+    size_t nc = m_cols.size();
+    std::vector<std::vector<char>> chunks(tv::numWorkers());
+    tv::parallelFor(i0, i1, [&](size_t begin, size_t end, size_t chunk)
+    {
+        std::vector<char>& dst = chunks[chunk];
+        size_t faceBytes = withCount ? kPlyFaceBytes : kGlbFaceBytes;
+        dst.resize((end - begin) * (nc - 1) * 2 * faceBytes);
+        char* p = dst.data();
+        auto face = [&](uint32_t a, uint32_t b, uint32_t c)
+        {
+            if(withCount) *p++ = 3;
+            const uint32_t idx[3] = {a, b, c};
+            p = put(p, idx, sizeof(idx));
+        };
+        for(size_t i = begin; i < end; ++i)
+        {
+            for(size_t j = 0; j + 1 < nc; ++j)
+            {
+                bool va = isValid(i, j);
+                bool vb = isValid(i + 1, j);
+                bool vd = isValid(i, j + 1);
+                bool ve = isValid(i + 1, j + 1);
+                uint32_t a = uint32_t(i * nc + j);
+                if(va and vb and vd) face(a, a + uint32_t(nc), a + 1);
+                if(vd and vb and ve) face(a + 1, a + uint32_t(nc), a + uint32_t(nc) + 1);
+            }
+        }
+        dst.resize(size_t(p - dst.data()));
+    }, 16);
+
+    out.clear();
+    for(const std::vector<char>& chunk : chunks) out.insert(out.end(), chunk.begin(), chunk.end());
+}
+
+bool MeshExporter::isValid(size_t i, size_t j) const
+{
+    return m_grid.at(m_rows[i], m_cols[j]) != m_noData;
+}
+
+/**
+ * Counts the triangles and finds the height range, in one parallel pass over the lattice.
+ */
+MeshExporter::Summary MeshExporter::summarize() const
+{
+    size_t nr = m_rows.size();
+    size_t nc = m_cols.size();
+    Summary summary;
+    if(nr < 2 or nc < 2) return summary;
+
+    size_t workers = tv::numWorkers();
+    std::vector<size_t> counts(workers, 0);
+    std::vector<float> mins(workers, std::numeric_limits<float>::max());
+    std::vector<float> maxs(workers, std::numeric_limits<float>::lowest());
+    tv::parallelFor(0, nr, [&](size_t begin, size_t end, size_t chunk)
+    {
+        for(size_t i = begin; i < end; ++i)
+        {
+            for(size_t j = 0; j < nc; ++j)
+            {
+                float h = m_grid.at(m_rows[i], m_cols[j]);
+                if(h == m_noData) continue;
+                mins[chunk] = std::min(mins[chunk], h);
+                maxs[chunk] = std::max(maxs[chunk], h);
+            }
+            if(i + 1 == nr) continue;
+            for(size_t j = 0; j + 1 < nc; ++j)
+            {
+                bool vb = isValid(i + 1, j);
+                bool vd = isValid(i, j + 1);
+                counts[chunk] += size_t(isValid(i, j) and vb and vd) + size_t(vd and vb and isValid(i + 1, j + 1));
+            }
+        }
+    }, 16);
+
+    float lo = *std::min_element(mins.begin(), mins.end());
+    float hi = *std::max_element(maxs.begin(), maxs.end());
+    for(size_t n : counts) summary.numFaces += n;
+    summary.minHeight = lo <= hi ? lo : 0.0f;
+    summary.maxHeight = lo <= hi ? hi : 0.0f;
+    return summary;
+}
+
+/**
+ * Fills out with the vertices of lattice rows [i0, i1): position and normal, in the PLY
+ * or the glTF axes. NODATA samples get the height fill and an upward normal.
+ */
+void MeshExporter::vertices(size_t i0, size_t i1, float fill, bool gltf, std::vector<char>& out) const
+{
+    size_t nc = m_cols.size();
+    double cs = m_georef.cellSize;
+    size_t gridRows = m_grid.numRows();
+    out.resize((i1 - i0) * nc * kVertexBytes);
+    tv::parallelFor(i0, i1, [&](size_t begin, size_t end, size_t)
+    {
+        char* p = out.data() + (begin - i0) * nc * kVertexBytes;
+        for(size_t i = begin; i < end; ++i)
+        {
+            size_t r = m_rows[i];
+            size_t im = i > 0 ? i - 1 : i;
+            size_t ip = i + 1 < m_rows.size() ? i + 1 : i;
+            float north = float((double(gridRows - r) - 0.5) * cs);
+            for(size_t j = 0; j < nc; ++j)
+            {
+                size_t c = m_cols[j];
+                float h = m_grid.at(r, c);
+                float east = float((double(c) + 0.5) * cs);
+                float nx = 0.0f, ny = 0.0f, nz = 1.0f;
+                if(h == m_noData)
+                {
+                    h = fill;
+                }
+                else
+                {
+                    //Central differences over the lattice neighbours, holding NODATA ones.
+                    auto at = [&](size_t ii, size_t jj)
+                    {
+                        float v = m_grid.at(m_rows[ii], m_cols[jj]);
+                        return v == m_noData ? h : v;
+                    };
+                    size_t jm = j > 0 ? j - 1 : j;
+                    size_t jp = j + 1 < nc ? j + 1 : j;
+                    double dx = jp > jm ? (at(i, jp) - at(i, jm)) / (double(m_cols[jp] - m_cols[jm]) * cs) : 0.0;
+                    double dy = ip > im ? (at(im, j) - at(ip, j)) / (double(m_rows[ip] - m_rows[im]) * cs) : 0.0;
+                    double len = std::sqrt(dx * dx + dy * dy + 1.0);
+                    nx = float(-dx / len);
+                    ny = float(-dy / len);
+                    nz = float(1.0 / len);
+                }
+                const float v[6] = {east, north, h, nx, ny, nz};
+                const float g[6] = {east, h, -north, nx, nz, -ny};
+                p = put(p, gltf ? g : v, kVertexBytes);
+            }
+        }
+    }, 16);
+}
+
+/**
+ * Binary glTF: the JSON chunk, then one binary chunk with the interleaved vertices
+ * followed by the indices.
+ */
+bool MeshExporter::writeGlb(QFile& file, const Summary& summary, const Progress& progress) const
+{
+    size_t nr = m_rows.size();
+    size_t nc = m_cols.size();
+    size_t numVertices = nr * nc;
+    size_t vertexBytes = numVertices * kVertexBytes;
+    size_t indexBytes = summary.numFaces * kGlbFaceBytes;
+
+    //Bounds as the floats that are written, which validators compare against.
+    double cs = m_georef.cellSize;
+    float eastMin = float((double(m_cols.front()) + 0.5) * cs);
+    float eastMax = float((double(m_cols.back()) + 0.5) * cs);
+    float northMin = float((double(m_grid.numRows() - m_rows.back()) - 0.5) * cs);
+    float northMax = float((double(m_grid.numRows() - m_rows.front()) - 0.5) * cs);
+
+    QByteArray json;
+    json += "{\"asset\":{\"version\":\"2.0\",\"generator\":\"TerrainView\"},";
+    json += "\"scene\":0,\"scenes\":[{\"nodes\":[0],\"extras\":{\"origin\":[" + number(m_georef.xllCorner) + ","
+            + number(m_georef.yllCorner) + "]}}],";
+    json += "\"nodes\":[{\"mesh\":0}],";
+    json += "\"meshes\":[{\"primitives\":[{\"attributes\":{\"POSITION\":0,\"NORMAL\":1},\"indices\":2,\"mode\":4}]}],";
+    json += "\"buffers\":[{\"byteLength\":" + QByteArray::number(quint64(vertexBytes + indexBytes)) + "}],";
+    json += "\"bufferViews\":[{\"buffer\":0,\"byteOffset\":0,\"byteLength\":" + QByteArray::number(quint64(vertexBytes))
+            + ",\"byteStride\":" + QByteArray::number(quint64(kVertexBytes)) + ",\"target\":34962},";
+    json += "{\"buffer\":0,\"byteOffset\":" + QByteArray::number(quint64(vertexBytes)) + ",\"byteLength\":"
+            + QByteArray::number(quint64(indexBytes)) + ",\"target\":34963}],";
+    json += "\"accessors\":[{\"bufferView\":0,\"byteOffset\":0,\"componentType\":5126,\"count\":"
+            + QByteArray::number(quint64(numVertices)) + ",\"type\":\"VEC3\",\"min\":[" + number(eastMin) + ","
+            + number(summary.minHeight) + "," + number(-northMax) + "],\"max\":[" + number(eastMax) + ","
+            + number(summary.maxHeight) + "," + number(-northMin) + "]},";
+    json += "{\"bufferView\":0,\"byteOffset\":12,\"componentType\":5126,\"count\":"
+            + QByteArray::number(quint64(numVertices)) + ",\"type\":\"VEC3\"},";
+    json += "{\"bufferView\":1,\"componentType\":5125,\"count\":" + QByteArray::number(quint64(summary.numFaces * 3))
+            + ",\"type\":\"SCALAR\"}]}";
+    while(json.size() % 4 != 0) json += ' ';
+
+    size_t binBytes = vertexBytes + indexBytes;
+    size_t total = 12 + 8 + size_t(json.size()) + 8 + binBytes;
+    if(total > std::numeric_limits<uint32_t>::max())
+    {
+        qDebug() << "Mesh of" << total << "bytes exceeds the glTF binary limit of 4 GiB; export as PLY instead.";
+        return false;
+    }
+
+    const uint32_t header[5] = {0x46546C67, 2, uint32_t(total), uint32_t(json.size()), 0x4E4F534A};  //"glTF", "JSON"
+    const uint32_t binHeader[2] = {uint32_t(binBytes), 0x004E4942};                                 //"BIN\0"
+    if(not writeAll(file, reinterpret_cast<const char*>(header), sizeof(header))
+       or not writeAll(file, json.constData(), size_t(json.size()))
+       or not writeAll(file, reinterpret_cast<const char*>(binHeader), sizeof(binHeader)))
+    {
+        return false;
+    }
+
+    auto vertexBand = [&](size_t i0, size_t i1, std::vector<char>& out)
+    {
+        vertices(i0, i1, summary.minHeight, true, out);
+    };
+    auto faceBand = [&](size_t i0, size_t i1, std::vector<char>& out)
+    {
+        faces(i0, i1, false, out);
+    };
+    auto vertexRows = [&](size_t done){return not progress or progress(done, 2 * nr - 1);};
+    auto faceRows = [&](size_t done){return not progress or progress(nr + done, 2 * nr - 1);};
+    return streamBands(file, nr, bandRows(nc * kVertexBytes), vertexBand, vertexRows)
+           and streamBands(file, nr - 1, bandRows((nc - 1) * 2 * kGlbFaceBytes), faceBand, faceRows);
+}
+
+bool MeshExporter::writePly(QFile& file, const Summary& summary, const Progress& progress) const
+{
+    size_t nr = m_rows.size();
+    size_t nc = m_cols.size();
+    QByteArray header;
+    header += "ply\nformat binary_little_endian 1.0\ncomment TerrainView height grid\n";
+    header += "comment origin " + number(m_georef.xllCorner) + " " + number(m_georef.yllCorner) + "\n";
+    header += "element vertex " + QByteArray::number(quint64(nr * nc)) + "\n";
+    header += "property float x\nproperty float y\nproperty float z\n";
+    header += "property float nx\nproperty float ny\nproperty float nz\n";
+    header += "element face " + QByteArray::number(quint64(summary.numFaces)) + "\n";
+    header += "property list uchar uint vertex_indices\nend_header\n";
+    if(not writeAll(file, header.constData(), size_t(header.size()))) return false;
+
+    auto vertexBand = [&](size_t i0, size_t i1, std::vector<char>& out)
+    {
+        vertices(i0, i1, summary.minHeight, false, out);
+    };
+    auto faceBand = [&](size_t i0, size_t i1, std::vector<char>& out)
+    {
+        faces(i0, i1, true, out);
+    };
+    auto vertexRows = [&](size_t done){return not progress or progress(done, 2 * nr - 1);};
+    auto faceRows = [&](size_t done){return not progress or progress(nr + done, 2 * nr - 1);};
+    return streamBands(file, nr, bandRows(nc * kVertexBytes), vertexBand, vertexRows)
+           and streamBands(file, nr - 1, bandRows((nc - 1) * 2 * kPlyFaceBytes), faceBand, faceRows);
+}
+
+} //namespace tv
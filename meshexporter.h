@@ -0,0 +1,75 @@
+#ifndef MESHEXPORTER_H
+#define MESHEXPORTER_H
+
+#include "heightsampler.h"
+#include <QString>
+#include <functional>
+
+class QFile;
+
+namespace tv
+{
+
+enum class MeshFormat
+{
+    Ply     = 0,    //Binary little endian PLY
+    Glb     = 1     //Binary glTF 2.0
+};
+
+/**
+ * Writes a height grid as a triangle mesh with per vertex normals. Vertices and faces are
+ * generated band by band straight from the grid, on all workers, and each band goes out
+ * in one write; no more than a band of the mesh exists at a time.
+ *
+ * The mesh is in map units relative to the lower left corner of the grid's extent: x to
+ * the east, y to the north and z up for PLY, which glTF turns into x east, y up and z
+ * south. The corner itself is recorded as a comment or in the scene's extras, as floats
+ * would not hold it. Triangles touching NODATA are left out; their vertices stay, at the
+ * lowest valid height.
+ */
+class MeshExporter
+{
+public:
+    /**
+     * Told the rows of bands written so far and in all after every band. Returning false
+     * cancels the export.
+     */
+    using Progress = std::function<bool(size_t done, size_t total)>;
+
+    MeshExporter(const HeightGrid& grid, float noData, const analysis::GridGeoref& georef);
+    size_t step() const{return m_step;}
+    void setStep(size_t step);
+    bool write(const QString& fileName, MeshFormat format, const Progress& progress = Progress()) const;
+    static bool formatFor(const QString& fileName, MeshFormat& format);
+
+private:
+    /**
+     * Sizes and bounds known before anything is written, as both formats declare them
+     * up front.
+     */
+    struct Summary
+    {
+        size_t  numFaces    = 0;
+        float   minHeight   = 0.0f;
+        float   maxHeight   = 0.0f;
+    };
+
+    const HeightGrid&   m_grid;
+    float               m_noData;
+    size_t              m_step      = 1;
+    analysis::GridGeoref m_georef;
+    std::vector<size_t> m_cols;
+    std::vector<size_t> m_rows;
+
+    size_t bandRows(size_t bytesPerRow) const;
+    void faces(size_t i0, size_t i1, bool withCount, std::vector<char>& out) const;
+    bool isValid(size_t i, size_t j) const;
+    Summary summarize() const;
+    void vertices(size_t i0, size_t i1, float fill, bool gltf, std::vector<char>& out) const;
+    bool writeGlb(QFile& file, const Summary& summary, const Progress& progress) const;
+    bool writePly(QFile& file, const Summary& summary, const Progress& progress) const;
+};
+
+} //namespace tv
+
+#endif // MESHEXPORTER_H
@@ -0,0 +1,185 @@
+#include "normalmap.h"
+#include "parallel.h"
+#include <QDebug>
+#include <cmath>
+
+namespace render
+{
+
+/**
+ * Binds the normals for the terrain shader, which must be bound. Returns false if there
+ * are none to bind.
+ */
+bool NormalMap::apply(QOpenGLShaderProgram& prog)
+{
+    if(not m_initialized) return false;
+    if(m_dirty) upload();
+    for(const tv::GridRect& rect : m_pendingRects) uploadRegion(rect);
+    if(m_texture and not m_pendingRects.empty())
+    {
+        glBindTexture(GL_TEXTURE_2D, m_texture);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    m_pendingRects.clear();
+    if(not m_texture) return false;
+
+    glActiveTexture(GL_TEXTURE0 + kTextureUnit);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    glActiveTexture(GL_TEXTURE0);
+    prog.setUniformValue("u_normals", kTextureUnit);
+    prog.setUniformValue("u_normalsSize", QVector2D(float(m_grid->numRows()), float(m_grid->numCols())));
+    return true;
+}
+
+/**
+ * Needs a current context.
+ */
+void NormalMap::initialize()
+{
+    if(m_initialized) return;
+    initializeOpenGLFunctions();
+    m_initialized = true;
+    m_dirty = true;
+}
+
+/**
+ * Frees the texture. Needs a current context.
+ */
+void NormalMap::release()
+{
+    if(not m_initialized) return;
+    if(m_texture) glDeleteTextures(1, &m_texture);
+    m_texture = 0;
+    m_initialized = false;
+}
+
+/**
+ * Sets the grid to light, which must outlive the map or be replaced before it is
+ * destroyed. heightScale converts samples to mesh units.
+ */
+void NormalMap::setTerrain(const tv::HeightGrid* grid, double heightScale)
+{
+    m_grid = grid and not grid->isEmpty() ? grid : nullptr;
+    m_heightScale = heightScale;
+    m_unavailable = false;
+    m_pendingRects.clear();
+    m_dirty = true;
+}
+
+/**
+ * Queues an edited rectangle of the grid for upload. Normals depend on the direct
+ * neighbours, so the rectangle must already include the border around the changed
+ * samples, as the reader's dirty rectangles do.
+ */
+void NormalMap::updateRegion(const tv::GridRect& rect)
+{
+    if(m_grid and not m_dirty) m_pendingRects.push_back(rect);
+}
+
+/**
+ * Octahedral encoding of a unit vector, see the class description.
+ */
+QVector2D NormalMap::encode(const QVector3D& normal)
+{
+    float sum = std::abs(normal.x()) + std::abs(normal.y()) + std::abs(normal.z());
+    if(sum <= 0.0f) return QVector2D(0.0f, 0.0f);
+    float x = normal.x() / sum;
+    float y = normal.y() / sum;
+    if(normal.z() < 0.0f)
+    {
+        float fx = (1.0f - std::abs(y)) * (x < 0.0f ? -1.0f : 1.0f);
+        float fy = (1.0f - std::abs(x)) * (y < 0.0f ? -1.0f : 1.0f);
+        x = fx;
+        y = fy;
+    }
+    return QVector2D(x, y);
+}
+
+//------->Private
+
+/**
+ * Writes the encoded normals of rect row by row, two halfs per sample, from central
+ * differences with the border samples differencing against themselves.
+ */
+void NormalMap::encodeRegion(const tv::GridRect& rect, qfloat16* out) const
+{
+    size_t rows = m_grid->numRows();
+    size_t cols = m_grid->numCols();
+    for(size_t row = rect.row0; row < rect.row1; ++row)
+    {
+        size_t rm = row > 0 ? row - 1 : row;
+        size_t rp = row + 1 < rows ? row + 1 : row;
+        const float* above = m_grid->row(rm);
+        const float* here = m_grid->row(row);
+        const float* below = m_grid->row(rp);
+        for(size_t col = rect.col0; col < rect.col1; ++col)
+        {
+            size_t cm = col > 0 ? col - 1 : col;
+            size_t cp = col + 1 < cols ? col + 1 : col;
+            double dx = rp > rm ? (below[col] - above[col]) * m_heightScale / double(rp - rm) : 0.0;
+            double dy = cp > cm ? (here[cp] - here[cm]) * m_heightScale / double(cp - cm) : 0.0;
+            QVector2D e = encode(QVector3D(float(-dx), float(-dy), 1.0f));
+            *out++ = qfloat16(e.x());
+            *out++ = qfloat16(e.y());
+        }
+    }
+}
+
+void NormalMap::upload()
+{
+    m_dirty = false;
+    m_pendingRects.clear();
+    if(m_texture) glDeleteTextures(1, &m_texture);
+    m_texture = 0;
+    if(not m_grid or m_unavailable) return;
+
+    size_t rows = m_grid->numRows();
+    size_t cols = m_grid->numCols();
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    if(cols > size_t(maxSize) or rows > size_t(maxSize))
+    {
+        qDebug() << "Normal map of" << cols << "x" << rows << "samples exceeds the texture size limit, drawing unlit.";
+        m_unavailable = true;
+        return;
+    }
+
+    m_scratch.resize(rows * cols * 2);
+    tv::parallelFor(0, rows, [this, cols](size_t row0, size_t row1, size_t)
+    {
+        encodeRegion(tv::GridRect(row0, 0, row1, cols), m_scratch.data() + row0 * cols * 2);
+    }, 64);
+
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, GLsizei(cols), GLsizei(rows), 0, GL_RG, GL_HALF_FLOAT, m_scratch.data());
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    std::vector<qfloat16>().swap(m_scratch);
+}
+
+/**
+ * Re-encodes an edited rectangle of the base level. The caller rebuilds the mip levels
+ * once all regions are in.
+ */
+void NormalMap::uploadRegion(const tv::GridRect& rect)
+{
+    if(not m_texture) return;
+    tv::GridRect clipped = rect.intersected(tv::GridRect(0, 0, m_grid->numRows(), m_grid->numCols()));
+    if(clipped.isEmpty()) return;
+    m_scratch.resize(clipped.numRows() * clipped.numCols() * 2);
+    encodeRegion(clipped, m_scratch.data());
+
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, GLint(clipped.col0), GLint(clipped.row0), GLsizei(clipped.numCols()),
+                    GLsizei(clipped.numRows()), GL_RG, GL_HALF_FLOAT, m_scratch.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+    m_scratch.clear();
+}
+
+} //namespace render
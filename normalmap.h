@@ -0,0 +1,58 @@
+#ifndef NORMALMAP_H
+#define NORMALMAP_H
+
+#include "heightgrid.h"
+#include <QFloat16>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QVector2D>
+#include <QVector3D>
+
+namespace render
+{
+
+/**
+ * Surface normals of a height grid as a two channel half float texture with one texel per
+ * sample, for per pixel lighting in the terrain fragment shader. Each normal is stored
+ * octahedral encoded: projected onto the octahedron |x| + |y| + |z| = 1, of which x and y
+ * are kept, with the lower half folded out over the diagonals. Terrain normals always
+ * point up, so filtering never blends across a fold.
+ *
+ * Normals come from central differences of the heights in mesh units, so the shading
+ * shows the full resolution surface whatever mesh is drawn over it. Like the raster
+ * renderer's heights, the texture is built by the first apply() after setTerrain() and
+ * only edited regions after updateRegion(), so both can be called from any thread that
+ * holds the scene lock.
+ */
+class NormalMap : protected QOpenGLExtraFunctions
+{
+public:
+    static constexpr int kTextureUnit = 4;
+
+    NormalMap() = default;
+    bool isInitialized() const{return m_initialized;}
+    bool apply(QOpenGLShaderProgram& prog);
+    void initialize();
+    void release();
+    void setTerrain(const tv::HeightGrid* grid, double heightScale);
+    void updateRegion(const tv::GridRect& rect);
+    static QVector2D encode(const QVector3D& normal);
+
+private:
+    bool                        m_initialized   = false;
+    bool                        m_dirty         = false;
+    bool                        m_unavailable   = false;
+    const tv::HeightGrid*       m_grid          = nullptr;
+    double                      m_heightScale   = 1.0;
+    GLuint                      m_texture       = 0;
+    std::vector<qfloat16>       m_scratch;
+    std::vector<tv::GridRect>   m_pendingRects;
+
+    void encodeRegion(const tv::GridRect& rect, qfloat16* out) const;
+    void upload();
+    void uploadRegion(const tv::GridRect& rect);
+};
+
+} //namespace render
+
+#endif // NORMALMAP_H
@@ -0,0 +1,117 @@
+#include "overlaytexture.h"
+#include <QDebug>
+#include <QVector2D>
+
+namespace render
+{
+
+/**
+ * Binds the raster for the terrain shader, which must be bound. With enabled false, or
+ * without a raster, the shader draws the plain terrain.
+ */
+void OverlayTexture::apply(QOpenGLShaderProgram& prog, bool enabled)
+{
+    if(m_initialized and m_dirty) upload();
+    bool active = enabled and m_texture and m_mode != OverlayMode::None;
+    prog.setUniformValue("u_overlayMode", active ? int(m_mode) : 0);
+    if(not active) return;
+
+    glActiveTexture(GL_TEXTURE0 + kTextureUnit);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    glActiveTexture(GL_TEXTURE0);
+    prog.setUniformValue("u_overlay", kTextureUnit);
+    prog.setUniformValue("u_overlaySize", QVector2D(float(m_rows), float(m_cols)));
+}
+
+void OverlayTexture::clear()
+{
+    m_pending.clear();
+    m_mode = OverlayMode::None;
+    m_dirty = true;
+}
+
+/**
+ * Needs a current context.
+ */
+void OverlayTexture::initialize()
+{
+    if(m_initialized) return;
+    initializeOpenGLFunctions();
+    m_initialized = true;
+}
+
+/**
+ * Frees the texture. Needs a current context.
+ */
+void OverlayTexture::release()
+{
+    if(not m_initialized) return;
+    if(m_texture) glDeleteTextures(1, &m_texture);
+    m_texture = 0;
+    m_initialized = false;
+}
+
+/**
+ * Queues a raster of the size of the grid it is laid over.
+ */
+void OverlayTexture::setRaster(const tv::HeightGrid& raster, OverlayMode mode)
+{
+    m_pending.resize(raster.size());
+    qFloatToFloat16(m_pending.data(), raster.data(), qsizetype(raster.size()));
+    m_cols = raster.numCols();
+    m_rows = raster.numRows();
+    m_mode = raster.isEmpty() ? OverlayMode::None : mode;
+    m_dirty = true;
+}
+
+/**
+ * Queues a raster already converted to half floats, rows * cols of them row by row.
+ */
+void OverlayTexture::setRaster(std::vector<qfloat16>&& raster, size_t rows, size_t cols, OverlayMode mode)
+{
+    if(raster.size() != rows * cols) raster.clear();
+    m_pending = std::move(raster);
+    m_cols = m_pending.empty() ? 0 : cols;
+    m_rows = m_pending.empty() ? 0 : rows;
+    m_mode = m_pending.empty() ? OverlayMode::None : mode;
+    m_dirty = true;
+}
+
+//------->Private
+
+void OverlayTexture::upload()
+{
+    m_dirty = false;
+    if(m_pending.empty())
+    {
+        if(m_texture) glDeleteTextures(1, &m_texture);
+        m_texture = 0;
+        return;
+    }
+
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    if(m_cols > size_t(maxSize) or m_rows > size_t(maxSize))
+    {
+        qDebug() << "Overlay of" << m_cols << "x" << m_rows << "samples exceeds the texture size limit.";
+        std::vector<qfloat16>().swap(m_pending);
+        m_mode = OverlayMode::None;
+        return;
+    }
+
+    //Directions must not be blended across north, where they wrap around.
+    GLint filter = m_mode == OverlayMode::Aspect ? GL_NEAREST : GL_LINEAR;
+    if(not m_texture) glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, GLsizei(m_cols), GLsizei(m_rows), 0, GL_RED, GL_HALF_FLOAT, m_pending.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    std::vector<qfloat16>().swap(m_pending);
+}
+
+} //namespace render
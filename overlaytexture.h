@@ -0,0 +1,61 @@
+#ifndef OVERLAYTEXTURE_H
+#define OVERLAYTEXTURE_H
+
+#include "heightgrid.h"
+#include <QFloat16>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+
+namespace render
+{
+
+/**
+ * What an overlay raster holds. The values match u_overlayMode in fshader.glsl, which
+ * colors every kind differently.
+ */
+enum class OverlayMode
+{
+    None        = 0,
+    Hillshade   = 1,
+    Slope       = 2,
+    Aspect      = 3,
+    Viewshed    = 4,
+    Drainage    = 5,
+    Difference  = 6
+};
+
+/**
+ * Single channel raster with one texel per grid sample, looked up by grid position in
+ * the terrain fragment shader. Rasters are handed over on the CPU side as half floats
+ * and uploaded by the next draw, so they can be replaced from any thread that holds the
+ * scene lock. Negative values leave the terrain color unchanged.
+ */
+class OverlayTexture : protected QOpenGLExtraFunctions
+{
+public:
+    static constexpr int kTextureUnit = 2;
+
+    OverlayTexture() = default;
+    OverlayMode mode() const{return m_mode;}
+    void apply(QOpenGLShaderProgram& prog, bool enabled = true);
+    void clear();
+    void initialize();
+    void release();
+    void setRaster(const tv::HeightGrid& raster, OverlayMode mode);
+    void setRaster(std::vector<qfloat16>&& raster, size_t rows, size_t cols, OverlayMode mode);
+
+private:
+    bool                    m_initialized   = false;
+    bool                    m_dirty         = false;
+    GLuint                  m_texture       = 0;
+    OverlayMode             m_mode          = OverlayMode::None;
+    size_t                  m_cols          = 0;
+    size_t                  m_rows          = 0;
+    std::vector<qfloat16>   m_pending;
+
+    void upload();
+};
+
+} //namespace render
+
+#endif // OVERLAYTEXTURE_H
@@ -0,0 +1,67 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace tv
+{
+
+inline size_t numWorkers()
+{
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 4;
+}
+
+/**
+ * Splits [begin, end) into at most numWorkers() contiguous chunks of at least minChunk
+ * items and runs fn(chunkBegin, chunkEnd, chunkIndex) for each on its own thread. The
+ * calling thread takes the last chunk. Returns the number of chunks.
+ */
+template<typename Fn>
+size_t parallelFor(size_t begin, size_t end, Fn fn, size_t minChunk = 1)
+{
+    if(end <= begin) return 0;
+    size_t n = end - begin;
+    size_t chunks = std::max<size_t>(1, std::min(numWorkers(), n / std::max<size_t>(1, minChunk)));
+    if(chunks == 1)
+    {
+        fn(begin, end, size_t(0));
+        return 1;
+    }
+    std::vector<std::thread> threads;
+    threads.reserve(chunks - 1);
+    for(size_t i = 0; i + 1 < chunks; ++i)
+    {
+        threads.emplace_back(fn, begin + n * i / chunks, begin + n * (i + 1) / chunks, i);
+    }
+    fn(begin + n * (chunks - 1) / chunks, end, chunks - 1);
+    for(std::thread& t : threads) t.join();
+    return chunks;
+}
+
+/**
+ * Runs fn(task) for every task in [0, count) on all workers, each worker pulling the
+ * next task when it is done with one. Suits tasks of uneven cost.
+ */
+template<typename Fn>
+void parallelTasks(size_t count, Fn fn)
+{
+    std::atomic<size_t> next{0};
+    auto worker = [&]()
+    {
+        for(size_t task = next++; task < count; task = next++) fn(task);
+    };
+    size_t workers = std::min(numWorkers(), count);
+    std::vector<std::thread> threads;
+    for(size_t i = 1; i < workers; ++i) threads.emplace_back(worker);
+    worker();
+    for(std::thread& t : threads) t.join();
+}
+
+} //namespace tv
+
+#endif // PARALLEL_H
@@ -0,0 +1,198 @@
+#include "pngwriter.h"
+#include "parallel.h"
+#include <QDebug>
+#include <vector>
+#include <zlib.h>
+
+namespace
+{
+
+constexpr size_t kSliceRows = 32;
+constexpr unsigned char kSignature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+void put32(unsigned char* out, uint32_t value)
+{
+    out[0] = static_cast<unsigned char>(value >> 24);
+    out[1] = static_cast<unsigned char>(value >> 16);
+    out[2] = static_cast<unsigned char>(value >> 8);
+    out[3] = static_cast<unsigned char>(value);
+}
+
+/**
+ * One slice of rows, filtered and deflated as a raw deflate stream that ends on a sync
+ * flush, together with the Adler-32 checksum of the filtered bytes.
+ */
+struct Slice
+{
+    std::vector<unsigned char>  deflated;
+    uLong                       adler   = 1;
+    size_t                      rawSize = 0;
+    bool                        ok      = false;
+};
+
+/**
+ * Prefixes each row with the Sub filter, which stores every byte as the difference to the
+ * same channel of the pixel to its left. Needs no other row, so slices stay independent.
+ */
+void filterRows(const unsigned char* rgb, size_t numRows, size_t width, std::vector<unsigned char>& out)
+{
+    size_t rowBytes = width * 3;
+    out.resize(numRows * (rowBytes + 1));
+    unsigned char* dst = out.data();
+    for(size_t r = 0; r < numRows; ++r)
+    {
+        const unsigned char* src = rgb + r * rowBytes;
+        *dst++ = 1;
+        for(size_t i = 0; i < 3 and i < rowBytes; ++i) *dst++ = src[i];
+        for(size_t i = 3; i < rowBytes; ++i) *dst++ = static_cast<unsigned char>(src[i] - src[i - 3]);
+    }
+}
+
+void compressSlice(const std::vector<unsigned char>& raw, Slice& slice)
+{
+    slice.rawSize = raw.size();
+    slice.adler = adler32(1, raw.data(), uInt(raw.size()));
+
+    z_stream zs = {};
+    if(deflateInit2(&zs, Z_BEST_SPEED, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) return;
+    slice.deflated.resize(deflateBound(&zs, uLong(raw.size())) + 16);
+    zs.next_in = const_cast<Bytef*>(raw.data());
+    zs.avail_in = uInt(raw.size());
+    size_t produced = 0;
+    int result = Z_OK;
+    do
+    {
+        if(produced == slice.deflated.size()) slice.deflated.resize(slice.deflated.size() * 2);
+        zs.next_out = slice.deflated.data() + produced;
+        zs.avail_out = uInt(slice.deflated.size() - produced);
+        result = deflate(&zs, Z_SYNC_FLUSH);
+        produced = slice.deflated.size() - zs.avail_out;
+    } while(result == Z_OK and zs.avail_out == 0);
+    deflateEnd(&zs);
+    slice.deflated.resize(produced);
+    slice.ok = result == Z_OK and zs.avail_in == 0;
+}
+
+} //namespace
+
+namespace tv
+{
+
+/**
+ * Creates the file and writes the image header. Check isValid() before writing rows.
+ */
+PngWriter::PngWriter(const QString& fileName, size_t width, size_t height) :
+    m_height(height),
+    m_width(width),
+    m_file(fileName)
+{
+    if(width == 0 or height == 0 or width > 0x7FFFFFFF or height > 0x7FFFFFFF)
+    {
+        qDebug() << "Cannot write a PNG image of" << width << "x" << height << "pixels.";
+        return;
+    }
+    if(not m_file.open(QIODevice::WriteOnly))
+    {
+        qDebug() << "Cannot write image" << fileName << ":" << m_file.errorString();
+        return;
+    }
+
+    unsigned char header[13];
+    put32(header, uint32_t(width));
+    put32(header + 4, uint32_t(height));
+    header[8] = 8;      //Bits per channel
+    header[9] = 2;      //RGB
+    header[10] = 0;     //Deflate
+    header[11] = 0;     //Adaptive filtering
+    header[12] = 0;     //Not interlaced
+    //The zlib header opens the stream that all IDAT chunks continue.
+    const unsigned char zlibHeader[2] = {0x78, 0x01};
+    m_valid = m_file.write(reinterpret_cast<const char*>(kSignature), sizeof(kSignature)) == qint64(sizeof(kSignature))
+              and writeChunk("IHDR", header, sizeof(header))
+              and writeChunk("IDAT", zlibHeader, sizeof(zlibHeader));
+}
+
+PngWriter::~PngWriter()
+{
+    if(not m_file.isOpen()) return;
+    m_file.close();
+    if(not m_finished) m_file.remove();
+}
+
+/**
+ * Ends the stream and closes the file. Fails unless every row has been written.
+ */
+bool PngWriter::finish()
+{
+    if(not m_valid or m_finished) return false;
+    if(m_rowsWritten != m_height)
+    {
+        qDebug() << "PNG image" << m_file.fileName() << "ended after" << m_rowsWritten << "of" << m_height << "rows.";
+        m_valid = false;
+        return false;
+    }
+    //An empty final block with fixed codes, then the checksum of all filtered rows.
+    unsigned char trailer[6] = {0x03, 0x00};
+    put32(trailer + 2, m_adler);
+    m_valid = writeChunk("IDAT", trailer, sizeof(trailer)) and writeChunk("IEND", nullptr, 0);
+    m_finished = m_valid;
+    m_file.close();
+    if(not m_valid) m_file.remove();
+    return m_valid;
+}
+
+/**
+ * Appends numRows rows from top to bottom, each width tightly packed RGB pixels.
+ */
+bool PngWriter::writeRows(const unsigned char* rgb, size_t numRows)
+{
+    if(not m_valid or m_finished) return false;
+    if(numRows > m_height - m_rowsWritten)
+    {
+        qDebug() << "PNG image" << m_file.fileName() << "has no room for" << numRows << "more rows.";
+        m_valid = false;
+        return false;
+    }
+
+    size_t rowBytes = m_width * 3;
+    std::vector<Slice> slices((numRows + kSliceRows - 1) / kSliceRows);
+    tv::parallelTasks(slices.size(), [&](size_t s)
+    {
+        size_t row0 = s * kSliceRows;
+        std::vector<unsigned char> raw;
+        filterRows(rgb + row0 * rowBytes, std::min(kSliceRows, numRows - row0), m_width, raw);
+        compressSlice(raw, slices[s]);
+    });
+
+    for(const Slice& slice : slices)
+    {
+        if(not slice.ok or not writeChunk("IDAT", slice.deflated.data(), slice.deflated.size()))
+        {
+            qDebug() << "Cannot write image data to" << m_file.fileName();
+            m_valid = false;
+            return false;
+        }
+        m_adler = uint32_t(adler32_combine(m_adler, slice.adler, z_off_t(slice.rawSize)));
+    }
+    m_rowsWritten += numRows;
+    return true;
+}
+
+//------->Private
+
+bool PngWriter::writeChunk(const char* type, const unsigned char* data, size_t size)
+{
+    unsigned char head[8];
+    put32(head, uint32_t(size));
+    std::copy(type, type + 4, head + 4);
+    uLong crc = crc32(0, head + 4, 4);
+    if(size > 0) crc = crc32(crc, data, uInt(size));
+    unsigned char tail[4];
+    put32(tail, uint32_t(crc));
+
+    return m_file.write(reinterpret_cast<const char*>(head), 8) == 8
+           and (size == 0 or m_file.write(reinterpret_cast<const char*>(data), qint64(size)) == qint64(size))
+           and m_file.write(reinterpret_cast<const char*>(tail), 4) == 4;
+}
+
+} //namespace tv
@@ -0,0 +1,45 @@
+#ifndef PNGWRITER_H
+#define PNGWRITER_H
+
+#include <QFile>
+#include <QString>
+#include <cstdint>
+
+namespace tv
+{
+
+/**
+ * Writes an 8 bit RGB PNG image in bands of rows, so that images far larger than memory
+ * can be written. Each band is filtered and deflated in slices on all workers; every
+ * slice ends on a flush to a byte boundary, which lets the slices follow each other as
+ * one zlib stream without having been compressed in order.
+ *
+ * An image that is destroyed before finish() is removed again.
+ */
+class PngWriter
+{
+public:
+    PngWriter(const QString& fileName, size_t width, size_t height);
+    ~PngWriter();
+    bool isValid() const{return m_valid;}
+    size_t height() const{return m_height;}
+    size_t rowsWritten() const{return m_rowsWritten;}
+    size_t width() const{return m_width;}
+    bool finish();
+    bool writeRows(const unsigned char* rgb, size_t numRows);
+
+private:
+    bool        m_finished      = false;
+    bool        m_valid         = false;
+    size_t      m_height;
+    size_t      m_rowsWritten   = 0;
+    size_t      m_width;
+    uint32_t    m_adler         = 1;
+    QFile       m_file;
+
+    bool writeChunk(const char* type, const unsigned char* data, size_t size);
+};
+
+} //namespace tv
+
+#endif // PNGWRITER_H
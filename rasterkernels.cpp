@@ -0,0 +1,244 @@
+#include "rasterkernels.h"
+#include "parallel.h"
+#include "simd.h"
+#include <algorithm>
+#include <cmath>
+
+namespace analysis
+{
+
+namespace
+{
+
+constexpr float kPi = 3.14159265358979f;
+constexpr float kDegrees = 180.0f / kPi;
+constexpr size_t kTileRows = 64;
+constexpr size_t kTileCols = 1024;
+
+/**
+ * Minimax polynomial of atan(a) / a in a^2 on [0, 1], accurate to about 1e-5 radians.
+ * Shared by the scalar and the vector path so that both give the same products.
+ */
+constexpr float kAtan[6] = {0.99997726f, -0.33262347f, 0.19354346f, -0.11643287f, 0.05265332f, -0.01172120f};
+
+/**
+ * Constants of one kernel run. The hillshade of a sample with gradient gx towards east
+ * and gs towards south is (lz + lx * gx + ls * gs) / sqrt(1 + gx^2 + gs^2).
+ */
+struct Kernel
+{
+    SurfaceProduct  product;
+    float           noData;
+    float           gradScale;
+    float           lx;
+    float           ls;
+    float           lz;
+};
+
+Kernel makeKernel(SurfaceProduct product, const KernelParams& params)
+{
+    float azimuth = params.azimuth / kDegrees;
+    float altitude = params.altitude / kDegrees;
+    return {product, params.noData, 1.0f / (8.0f * params.cellSize),
+            -std::sin(azimuth) * std::cos(altitude), std::cos(azimuth) * std::cos(altitude), std::sin(altitude)};
+}
+
+float atan2Approx(float y, float x)
+{
+    float ax = std::fabs(x);
+    float ay = std::fabs(y);
+    float hi = std::max(ax, ay);
+    float a = hi > 0.0f ? std::min(ax, ay) / hi : 0.0f;
+    float s = a * a;
+    float r = a * (kAtan[0] + s * (kAtan[1] + s * (kAtan[2] + s * (kAtan[3] + s * (kAtan[4] + s * kAtan[5])))));
+    if(ay > ax) r = 0.5f * kPi - r;
+    if(x < 0.0f) r = kPi - r;
+    return std::copysign(r, y);
+}
+
+float finish(const Kernel& k, float gx, float gs)
+{
+    switch(k.product)
+    {
+    case SurfaceProduct::Hillshade:
+        return std::max(0.0f, (k.lz + k.lx * gx + k.ls * gs) / std::sqrt(1.0f + gx * gx + gs * gs));
+    case SurfaceProduct::Slope:
+        return atan2Approx(std::sqrt(gx * gx + gs * gs), 1.0f) * kDegrees;
+    case SurfaceProduct::Aspect:
+    default:
+    {
+        if(gx == 0.0f and gs == 0.0f) return -1.0f;
+        float a = atan2Approx(-gx, gs) * kDegrees;
+        return a < 0.0f ? a + 360.0f : a;
+    }
+    }
+}
+
+/**
+ * Product of the sample in column c of the middle row, with the window clamped at the
+ * left and right border.
+ */
+float deriveSample(const Kernel& k, const float* up, const float* mid, const float* down, size_t c, size_t cols)
+{
+    float e = mid[c];
+    if(e == k.noData) return kNoValue;
+    size_t cl = c > 0 ? c - 1 : 0;
+    size_t cr = c + 1 < cols ? c + 1 : c;
+    auto valid = [&](float v){return v == k.noData ? e : v;};
+    float a = valid(up[cl]), b = valid(up[c]), cc = valid(up[cr]);
+    float d = valid(mid[cl]), f = valid(mid[cr]);
+    float g = valid(down[cl]), h = valid(down[c]), i = valid(down[cr]);
+    float gx = ((cc + 2.0f * f + i) - (a + 2.0f * d + g)) * k.gradScale;
+    float gs = ((g + 2.0f * h + i) - (a + 2.0f * b + cc)) * k.gradScale;
+    return finish(k, gx, gs);
+}
+
+#ifdef TV_HAS_AVX2
+
+TV_TARGET_AVX2 inline __m256 atan2Avx(__m256 y, __m256 x)
+{
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256 ax = _mm256_andnot_ps(sign, x);
+    __m256 ay = _mm256_andnot_ps(sign, y);
+    __m256 hi = _mm256_max_ps(ax, ay);
+    __m256 a = _mm256_div_ps(_mm256_min_ps(ax, ay), hi);
+    a = _mm256_and_ps(a, _mm256_cmp_ps(hi, _mm256_setzero_ps(), _CMP_GT_OQ));
+    __m256 s = _mm256_mul_ps(a, a);
+    __m256 p = _mm256_set1_ps(kAtan[5]);
+    for(int i = 4; i >= 0; --i) p = _mm256_fmadd_ps(p, s, _mm256_set1_ps(kAtan[i]));
+    __m256 r = _mm256_mul_ps(a, p);
+    r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(0.5f * kPi), r), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+    r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(kPi), r), _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ));
+    return _mm256_or_ps(r, _mm256_and_ps(sign, y));
+}
+
+TV_TARGET_AVX2 inline __m256 validAvx(const float* p, __m256 center, __m256 noData)
+{
+    __m256 v = _mm256_loadu_ps(p);
+    return _mm256_blendv_ps(v, center, _mm256_cmp_ps(v, noData, _CMP_EQ_OQ));
+}
+
+/**
+ * Eight samples per step over [c0, c1), which must keep one column away from both
+ * borders. Returns the first column left for the scalar path.
+ */
+template<SurfaceProduct P>
+TV_TARGET_AVX2 size_t deriveRowAvx2(const Kernel& k, const float* up, const float* mid, const float* down,
+                                    size_t c0, size_t c1, float* out)
+{
+    const __m256 noData = _mm256_set1_ps(k.noData);
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 scale = _mm256_set1_ps(k.gradScale);
+    size_t c = c0;
+    for(; c + 8 <= c1; c += 8)
+    {
+        __m256 e = _mm256_loadu_ps(mid + c);
+        __m256 a = validAvx(up + c - 1, e, noData);
+        __m256 b = validAvx(up + c, e, noData);
+        __m256 cc = validAvx(up + c + 1, e, noData);
+        __m256 d = validAvx(mid + c - 1, e, noData);
+        __m256 f = validAvx(mid + c + 1, e, noData);
+        __m256 g = validAvx(down + c - 1, e, noData);
+        __m256 h = validAvx(down + c, e, noData);
+        __m256 i = validAvx(down + c + 1, e, noData);
+
+        __m256 east = _mm256_add_ps(_mm256_fmadd_ps(two, f, cc), i);
+        __m256 west = _mm256_add_ps(_mm256_fmadd_ps(two, d, a), g);
+        __m256 south = _mm256_add_ps(_mm256_fmadd_ps(two, h, g), i);
+        __m256 north = _mm256_add_ps(_mm256_fmadd_ps(two, b, a), cc);
+        __m256 gx = _mm256_mul_ps(_mm256_sub_ps(east, west), scale);
+        __m256 gs = _mm256_mul_ps(_mm256_sub_ps(south, north), scale);
+        __m256 g2 = _mm256_fmadd_ps(gx, gx, _mm256_mul_ps(gs, gs));
+
+        __m256 result;
+        if constexpr(P == SurfaceProduct::Hillshade)
+        {
+            __m256 lit = _mm256_fmadd_ps(_mm256_set1_ps(k.lx), gx,
+                                         _mm256_fmadd_ps(_mm256_set1_ps(k.ls), gs, _mm256_set1_ps(k.lz)));
+            result = _mm256_div_ps(lit, _mm256_sqrt_ps(_mm256_add_ps(_mm256_set1_ps(1.0f), g2)));
+            result = _mm256_max_ps(result, _mm256_setzero_ps());
+        }
+        else if constexpr(P == SurfaceProduct::Slope)
+        {
+            result = _mm256_mul_ps(atan2Avx(_mm256_sqrt_ps(g2), _mm256_set1_ps(1.0f)), _mm256_set1_ps(kDegrees));
+        }
+        else
+        {
+            const __m256 zero = _mm256_setzero_ps();
+            result = _mm256_mul_ps(atan2Avx(_mm256_sub_ps(zero, gx), gs), _mm256_set1_ps(kDegrees));
+            result = _mm256_add_ps(result, _mm256_and_ps(_mm256_cmp_ps(result, zero, _CMP_LT_OQ), _mm256_set1_ps(360.0f)));
+            result = _mm256_blendv_ps(result, _mm256_set1_ps(-1.0f), _mm256_cmp_ps(g2, zero, _CMP_EQ_OQ));
+        }
+        result = _mm256_blendv_ps(result, _mm256_set1_ps(kNoValue), _mm256_cmp_ps(e, noData, _CMP_EQ_OQ));
+        _mm256_storeu_ps(out + c, result);
+    }
+    return c;
+}
+
+size_t deriveRowSimd(const Kernel& k, const float* up, const float* mid, const float* down,
+                     size_t c0, size_t c1, float* out)
+{
+    switch(k.product)
+    {
+    case SurfaceProduct::Hillshade: return deriveRowAvx2<SurfaceProduct::Hillshade>(k, up, mid, down, c0, c1, out);
+    case SurfaceProduct::Slope:     return deriveRowAvx2<SurfaceProduct::Slope>(k, up, mid, down, c0, c1, out);
+    default:                        return deriveRowAvx2<SurfaceProduct::Aspect>(k, up, mid, down, c0, c1, out);
+    }
+}
+
+#endif
+
+/**
+ * Columns [c0, c1) of row r. Inner columns go through the vector path if enabled, the
+ * border columns and the remainder through the scalar one.
+ */
+void deriveRow(const Kernel& k, const tv::HeightGrid& grid, size_t r, size_t c0, size_t c1, float* out, bool simd)
+{
+    size_t cols = grid.numCols();
+    const float* up = grid.row(r > 0 ? r - 1 : 0);
+    const float* mid = grid.row(r);
+    const float* down = grid.row(r + 1 < grid.numRows() ? r + 1 : r);
+
+    size_t c = c0;
+    if(c == 0 and c < c1)
+    {
+        out[c] = deriveSample(k, up, mid, down, c, cols);
+        ++c;
+    }
+#ifdef TV_HAS_AVX2
+    if(simd) c = deriveRowSimd(k, up, mid, down, c, std::min(c1, cols - 1), out);
+#else
+    (void)simd;
+#endif
+    for(; c < c1; ++c) out[c] = deriveSample(k, up, mid, down, c, cols);
+}
+
+} //namespace
+
+bool hasSimdKernels()
+{
+    return tv::hasAvx2();
+}
+
+void deriveSurface(const tv::HeightGrid& grid, SurfaceProduct product, const KernelParams& params, tv::HeightGrid& out)
+{
+    size_t rows = grid.numRows();
+    size_t cols = grid.numCols();
+    if(out.numRows() != rows or out.numCols() != cols) out.resize(cols, rows);
+    if(grid.isEmpty()) return;
+
+    Kernel k = makeKernel(product, params);
+    bool simd = hasSimdKernels();
+    size_t tilesAcross = (cols + kTileCols - 1) / kTileCols;
+    size_t tilesDown = (rows + kTileRows - 1) / kTileRows;
+    tv::parallelTasks(tilesAcross * tilesDown, [&](size_t tile)
+    {
+        size_t r0 = tile / tilesAcross * kTileRows;
+        size_t c0 = tile % tilesAcross * kTileCols;
+        size_t r1 = std::min(r0 + kTileRows, rows);
+        size_t c1 = std::min(c0 + kTileCols, cols);
+        for(size_t r = r0; r < r1; ++r) deriveRow(k, grid, r, c0, c1, out.row(r), simd);
+    });
+}
+
+} //namespace analysis
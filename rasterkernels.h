@@ -0,0 +1,54 @@
+#ifndef RASTERKERNELS_H
+#define RASTERKERNELS_H
+
+#include "heightgrid.h"
+
+namespace analysis
+{
+
+/**
+ * Surface derivatives computed from the 3x3 neighbourhood of every sample with Horn's
+ * gradient, as most GIS packages do. Hillshade is Lambert shading in [0, 1], slope the
+ * steepness in degrees and aspect the downslope direction in degrees clockwise from
+ * north, -1 on flat ground.
+ */
+enum class SurfaceProduct
+{
+    Hillshade,
+    Slope,
+    Aspect
+};
+
+/**
+ * The cell size is the sample spacing in height units. Azimuth (clockwise from north)
+ * and altitude of the light are in degrees and only used for hillshading.
+ */
+struct KernelParams
+{
+    float   cellSize    = 1.0f;
+    float   noData      = -9999.0f;
+    float   azimuth     = 315.0f;
+    float   altitude    = 45.0f;
+};
+
+/**
+ * Value written where the input sample is NODATA. NODATA neighbours of a valid sample are
+ * replaced by the sample itself, as are neighbours beyond the border.
+ */
+constexpr float kNoValue = -1.0f;
+
+/**
+ * True if the vectorized kernels can run on this machine.
+ */
+bool hasSimdKernels();
+
+/**
+ * Computes a surface product of the whole grid into out, which is resized to match.
+ * The grid is cut into tiles that are processed in parallel; within a tile rows are
+ * processed eight samples at a time with AVX2 where available.
+ */
+void deriveSurface(const tv::HeightGrid& grid, SurfaceProduct product, const KernelParams& params, tv::HeightGrid& out);
+
+} //namespace analysis
+
+#endif // RASTERKERNELS_H
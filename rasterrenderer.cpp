@@ -0,0 +1,252 @@
+#include "rasterrenderer.h"
+#include <QDebug>
+#include <QVector2D>
+#include <QVector4D>
+#include <algorithm>
+
+namespace render
+{
+
+/**
+ * The overlay and lighting, if any, must belong to the grid drawn.
+ */
+void RasterRenderer::draw(const QMatrix4x4& mvp, OverlayTexture* overlay, const Lighting* lighting)
+{
+    if(not m_initialized or not m_grid) return;
+    if(m_dirty) upload();
+    for(const tv::GridRect& rect : m_pendingRects) uploadRegion(rect);
+    m_pendingRects.clear();
+    if(not m_texture) return;
+
+    m_shProg.bind();
+    m_vbo.bind();
+    int cornerLoc = m_shProg.attributeLocation("a_corner");
+    m_shProg.enableAttributeArray(cornerLoc);
+    m_shProg.setAttributeBuffer(cornerLoc, GL_FLOAT, 0, 2, 2 * sizeof(float));
+
+    QVector2D gridSize(float(m_grid->numRows()), float(m_grid->numCols()));
+    //The padded texture in full resolution samples.
+    float scale = float(size_t(1) << m_baseLevel);
+    QVector2D heightsSize(float(m_mipSizes[0].height()) * scale, float(m_mipSizes[0].width()) * scale);
+    m_shProg.setUniformValue("mvp_matrix", mvp);
+    m_shProg.setUniformValue("u_gridSize", gridSize);
+    m_shProg.setUniformValue("u_raster", 1);
+    m_shProg.setUniformValue("u_heights", kTextureUnit);
+    m_shProg.setUniformValue("u_heightsSize", heightsSize);
+    m_shProg.setUniformValue("u_heightScale", float(m_heightScale));
+    m_shProg.setUniformValue("u_hole", QVector4D());
+    if(overlay) overlay->apply(m_shProg);
+    else m_shProg.setUniformValue("u_overlayMode", 0);
+    if(lighting) lighting->apply(m_shProg);
+    else m_shProg.setUniformValue("u_lighting", false);
+
+    glActiveTexture(GL_TEXTURE0 + kTextureUnit);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    glActiveTexture(GL_TEXTURE0);
+
+    //The quad lies flat at height zero; the depth buffer stays free for lines drawn on top.
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glEnable(GL_CULL_FACE);
+    glEnable(GL_DEPTH_TEST);
+
+    glActiveTexture(GL_TEXTURE0 + kTextureUnit);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    m_shProg.disableAttributeArray(cornerLoc);
+    m_vbo.release();
+}
+
+/**
+ * Needs a current context.
+ */
+void RasterRenderer::initialize()
+{
+    if(m_initialized) return;
+    initializeOpenGLFunctions();
+    if(not m_shProg.addShaderFromSourceFile(QOpenGLShader::Vertex, ":/shader/vraster.glsl")
+       or not m_shProg.addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shader/fshader.glsl")
+       or not m_shProg.link())
+    {
+        qDebug() << "Cannot build raster shader pipeline:" << m_shProg.log();
+        return;
+    }
+    const float corners[8] = {0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f};
+    m_vbo.create();
+    m_vbo.bind();
+    m_vbo.allocate(corners, int(sizeof(corners)));
+    m_vbo.release();
+    m_initialized = true;
+    m_dirty = true;
+}
+
+/**
+ * Frees all GPU resources. Needs a current context.
+ */
+void RasterRenderer::release()
+{
+    if(not m_initialized) return;
+    if(m_texture) glDeleteTextures(1, &m_texture);
+    m_texture = 0;
+    m_vbo.destroy();
+    m_shProg.removeAllShaders();
+    m_initialized = false;
+}
+
+/**
+ * Sets the grid to draw and its pyramid, which may be null or empty to draw without mip
+ * levels. Both must outlive the renderer or be replaced before they are destroyed.
+ */
+void RasterRenderer::setTerrain(const tv::HeightGrid* grid, const tv::HeightPyramid* pyramid, double heightScale)
+{
+    m_grid = grid and not grid->isEmpty() ? grid : nullptr;
+    m_pyramid = pyramid;
+    m_heightScale = heightScale;
+    m_pendingRects.clear();
+    m_dirty = true;
+}
+
+/**
+ * Queues an edited rectangle of the grid for upload. The pyramid must already be up to
+ * date for it.
+ */
+void RasterRenderer::updateRegion(const tv::GridRect& rect)
+{
+    if(m_grid and not m_dirty) m_pendingRects.push_back(rect);
+}
+
+//------->Private
+
+/**
+ * Level i of the pyramid, the grid itself being level 0.
+ */
+const tv::HeightGrid& RasterRenderer::level(size_t i) const
+{
+    return i == 0 ? *m_grid : m_pyramid->level(i);
+}
+
+size_t RasterRenderer::numLevels() const
+{
+    return 1 + (m_pyramid ? m_pyramid->numLevels() : 0);
+}
+
+void RasterRenderer::upload()
+{
+    m_dirty = false;
+    m_mipSizes.clear();
+    if(m_texture) glDeleteTextures(1, &m_texture);
+    m_texture = 0;
+    if(not m_grid) return;
+
+    //GL halves mip sizes rounding down where the pyramid rounds up. Padding the base to a
+    //multiple of 2^mips keeps every halving exact, so texel i of each mip level covers
+    //the same samples as sample i of the pyramid level.
+    size_t mips = 0;
+    auto padded = [&mips](size_t n)
+    {
+        size_t block = size_t(1) << mips;
+        return (n + block - 1) / block * block;
+    };
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    for(m_baseLevel = 0; m_baseLevel < numLevels(); ++m_baseLevel)
+    {
+        mips = std::min(numLevels() - 1 - m_baseLevel, kMaxMipLevels);
+        if(padded(level(m_baseLevel).numCols()) <= size_t(maxSize)
+           and padded(level(m_baseLevel).numRows()) <= size_t(maxSize)) break;
+    }
+    if(m_baseLevel == numLevels())
+    {
+        qDebug() << "Grid of" << m_grid->numCols() << "x" << m_grid->numRows() << "samples exceeds the texture size limit.";
+        return;
+    }
+
+    int w = int(padded(level(m_baseLevel).numCols()));
+    int h = int(padded(level(m_baseLevel).numRows()));
+    for(size_t m = 0; m <= mips; ++m) m_mipSizes.emplace_back(w >> m, h >> m);
+
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, m_mipSizes.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(m_mipSizes.size()) - 1);
+    for(size_t m = 0; m < m_mipSizes.size(); ++m)
+    {
+        const tv::HeightGrid& src = level(m_baseLevel + m);
+        glTexImage2D(GL_TEXTURE_2D, GLint(m), GL_R32F, m_mipSizes[m].width(), m_mipSizes[m].height(), 0,
+                     GL_RED, GL_FLOAT, nullptr);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, GLint(src.numCols()));
+        glTexSubImage2D(GL_TEXTURE_2D, GLint(m), 0, 0, GLsizei(src.numCols()), GLsizei(src.numRows()),
+                        GL_RED, GL_FLOAT, src.data());
+        uploadPadding(m);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/**
+ * Fills the texels of a mip level past its pyramid level with the level's last column
+ * and row, so that filtering at the grid's edge blends in nothing else. Needs the
+ * texture bound and leaves the unpack row length at 0.
+ */
+void RasterRenderer::uploadPadding(size_t mip)
+{
+    const tv::HeightGrid& src = level(m_baseLevel + mip);
+    size_t cols = src.numCols();
+    size_t rows = src.numRows();
+    size_t width = size_t(m_mipSizes[mip].width());
+    size_t height = size_t(m_mipSizes[mip].height());
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    std::vector<float> strip;
+    if(width > cols)
+    {
+        size_t pad = width - cols;
+        strip.resize(pad * rows);
+        for(size_t r = 0; r < rows; ++r) std::fill_n(strip.data() + r * pad, pad, src.row(r)[cols - 1]);
+        glTexSubImage2D(GL_TEXTURE_2D, GLint(mip), GLint(cols), 0, GLsizei(pad), GLsizei(rows), GL_RED, GL_FLOAT,
+                        strip.data());
+    }
+    if(height > rows)
+    {
+        strip.resize(width * (height - rows));
+        const float* last = src.row(rows - 1);
+        for(size_t r = 0; r < height - rows; ++r)
+        {
+            float* dst = strip.data() + r * width;
+            std::copy_n(last, cols, dst);
+            std::fill(dst + cols, dst + width, last[cols - 1]);
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, GLint(mip), 0, GLint(rows), GLsizei(width), GLsizei(height - rows), GL_RED,
+                        GL_FLOAT, strip.data());
+    }
+}
+
+/**
+ * Re-uploads the texels of every mip level that cover an edited rectangle of the grid.
+ */
+void RasterRenderer::uploadRegion(const tv::GridRect& rect)
+{
+    if(not m_texture) return;
+    tv::GridRect r = rect;
+    for(size_t i = 0; i < m_baseLevel; ++i) r = r.halved();
+
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    for(size_t m = 0; m < m_mipSizes.size(); ++m, r = r.halved())
+    {
+        const tv::HeightGrid& src = level(m_baseLevel + m);
+        tv::GridRect clipped = r.intersected(src.bounds());
+        if(clipped.isEmpty()) continue;
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, GLint(src.numCols()));
+        glTexSubImage2D(GL_TEXTURE_2D, GLint(m), GLint(clipped.col0), GLint(clipped.row0),
+                        GLsizei(clipped.numCols()), GLsizei(clipped.numRows()), GL_RED, GL_FLOAT,
+                        src.row(clipped.row0) + clipped.col0);
+        //The padding repeats the last row and column.
+        if(clipped.row1 == src.numRows() or clipped.col1 == src.numCols()) uploadPadding(m);
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+} //namespace render
@@ -0,0 +1,64 @@
+#ifndef RASTERRENDERER_H
+#define RASTERRENDERER_H
+
+#include "heightpyramid.h"
+#include "horizonmap.h"
+#include "overlaytexture.h"
+#include <QMatrix4x4>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QSize>
+#include <QtOpenGL/QOpenGLBuffer>
+
+namespace render
+{
+
+/**
+ * Top down terrain renderer for the orthographic view. The grid is one float texture on
+ * a single quad, colored by the terrain palette per fragment, so drawing costs the same
+ * for any grid size. The texture's mip levels are taken from the height pyramid instead
+ * of being averaged by the driver, which keeps NODATA out of the coarser levels; grids
+ * beyond the texture size limit start at the first pyramid level that fits. The texture is
+ * padded to a multiple of 2^kMaxMipLevels, so that GL's mip chain, which halves sizes
+ * rounding down, lines up texel for texel with the pyramid, which rounds up.
+ *
+ * The texture is uploaded by the next draw after setTerrain() and only edited regions
+ * after updateRegion(), so both can be called from any thread that holds the scene lock.
+ */
+class RasterRenderer : protected QOpenGLExtraFunctions
+{
+public:
+    static constexpr int kTextureUnit = 3;
+    static constexpr size_t kMaxMipLevels = 8;
+
+    RasterRenderer() = default;
+    bool isInitialized() const{return m_initialized;}
+    void draw(const QMatrix4x4& mvp, OverlayTexture* overlay = nullptr, const Lighting* lighting = nullptr);
+    void initialize();
+    void release();
+    void setTerrain(const tv::HeightGrid* grid, const tv::HeightPyramid* pyramid, double heightScale);
+    void updateRegion(const tv::GridRect& rect);
+
+private:
+    bool                        m_initialized   = false;
+    bool                        m_dirty         = false;
+    const tv::HeightGrid*       m_grid          = nullptr;
+    const tv::HeightPyramid*    m_pyramid       = nullptr;
+    double                      m_heightScale   = 1.0;
+    GLuint                      m_texture       = 0;
+    size_t                      m_baseLevel     = 0;
+    QOpenGLBuffer               m_vbo;
+    QOpenGLShaderProgram        m_shProg;
+    std::vector<QSize>          m_mipSizes;
+    std::vector<tv::GridRect>   m_pendingRects;
+
+    const tv::HeightGrid& level(size_t i) const;
+    size_t numLevels() const;
+    void upload();
+    void uploadPadding(size_t mip);
+    void uploadRegion(const tv::GridRect& rect);
+};
+
+} //namespace render
+
+#endif // RASTERRENDERER_H
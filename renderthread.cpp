@@ -0,0 +1,120 @@
+#include "renderthread.h"
+#include <QDebug>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+
+namespace render
+{
+
+/**
+ * Must be constructed on the GUI thread, which is where offscreen surfaces are created.
+ */
+RenderThread::RenderThread(QOpenGLContext* shareContext, const RenderFunction& render, QObject* parent) :
+    QThread(parent),
+    m_context(new QOpenGLContext),
+    m_surface(new QOffscreenSurface),
+    m_render(render)
+{
+    m_surface->setFormat(shareContext->format());
+    m_surface->create();
+
+    m_context->setFormat(shareContext->format());
+    m_context->setShareContext(shareContext);
+    if(not m_context->create()) qDebug() << "Cannot create render thread context.";
+    m_context->moveToThread(this);
+}
+
+RenderThread::~RenderThread()
+{
+    stop();
+    delete m_context;
+    delete m_surface;
+}
+
+/**
+ * Wakes the thread to draw the latest published camera states. Never blocks; requests
+ * that arrive while a frame is in flight are merged into one.
+ */
+void RenderThread::requestFrame()
+{
+    m_wake.release();
+}
+
+void RenderThread::stop()
+{
+    if(not isRunning()) return;
+    m_quit = true;
+    m_wake.release();
+    wait();
+}
+
+void RenderThread::run()
+{
+    if(not m_context->makeCurrent(m_surface))
+    {
+        qDebug() << "Cannot make render thread context current.";
+        m_context->moveToThread(thread());
+        return;
+    }
+    initializeOpenGLFunctions();
+    glClearColor(0, 0, 0, 1);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glCullFace(GL_BACK);
+    m_frameTimer.initialize();
+
+    while(true)
+    {
+        m_wake.acquire();
+        m_wake.tryAcquire(m_wake.available());
+        if(m_quit) break;
+        m_cameras.fetch();
+        renderFrame(m_cameras.front());
+    }
+
+    m_frameTimer.release();
+    for(int i = 0; i < 3; ++i)
+    {
+        Frame& frame = m_frames.slot(i);
+        if(frame.fence) glDeleteSync(frame.fence);
+        delete frame.fbo;
+        frame = Frame();
+    }
+    m_context->doneCurrent();
+    m_context->moveToThread(thread());
+}
+
+//------->Private
+
+void RenderThread::renderFrame(const cam::ViewSet& frameViews)
+{
+    QSize size = frameViews.size;
+    if(size.isEmpty()) return;
+
+    Frame& frame = m_frames.back();
+    if(frame.fence)
+    {
+        glDeleteSync(frame.fence);
+        frame.fence = nullptr;
+    }
+    if(not frame.fbo or frame.fbo->size() != size)
+    {
+        delete frame.fbo;
+        frame.fbo = new QOpenGLFramebufferObject(size, QOpenGLFramebufferObject::Depth);
+    }
+
+    frame.fbo->bind();
+    glViewport(0, 0, size.width(), size.height());
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    m_render(frameViews, m_frameTimer);
+    frame.fbo->release();
+
+    frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    m_frames.publish();
+    emit frameReady();
+}
+
+} //namespace render
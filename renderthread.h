@@ -0,0 +1,69 @@
+#ifndef RENDERTHREAD_H
+#define RENDERTHREAD_H
+
+#include "frametimer.h"
+#include "glcamera.h"
+#include "snapshotbuffer.h"
+#include <QOpenGLExtraFunctions>
+#include <QSemaphore>
+#include <QThread>
+#include <QtOpenGL/QOpenGLFramebufferObject>
+#include <atomic>
+#include <functional>
+
+class QOffscreenSurface;
+class QOpenGLContext;
+
+namespace render
+{
+
+/**
+ * Renders frames on a dedicated thread with its own context that shares objects with
+ * the GUI context. Camera states come in and finished frames go out through lock-free
+ * snapshot buffers, so the GUI thread never waits for a frame to be drawn.
+ */
+class RenderThread : public QThread, protected QOpenGLExtraFunctions
+{
+    Q_OBJECT
+
+public:
+    using RenderFunction = std::function<void(const cam::ViewSet&, FrameTimer&)>;
+
+    /**
+     * A finished frame. The fence is signaled once the GPU is done drawing it.
+     */
+    struct Frame
+    {
+        QOpenGLFramebufferObject*   fbo     = nullptr;
+        GLsync                      fence   = nullptr;
+    };
+
+    RenderThread(QOpenGLContext* shareContext, const RenderFunction& render, QObject* parent = nullptr);
+    ~RenderThread();
+    tv::SnapshotBuffer<cam::ViewSet>& cameras(){return m_cameras;}
+    tv::SnapshotBuffer<Frame>& frames(){return m_frames;}
+    void requestFrame();
+    void stop();
+
+signals:
+    void frameReady();
+
+protected:
+    void run() override;
+
+private:
+    QOpenGLContext*                         m_context;
+    QOffscreenSurface*                      m_surface;
+    QSemaphore                              m_wake;
+    FrameTimer                              m_frameTimer;
+    RenderFunction                          m_render;
+    std::atomic<bool>                       m_quit      {false};
+    tv::SnapshotBuffer<cam::ViewSet>        m_cameras;
+    tv::SnapshotBuffer<Frame>               m_frames;
+
+    void renderFrame(const cam::ViewSet& frameViews);
+};
+
+} //namespace render
+
+#endif // RENDERTHREAD_H
@@ -0,0 +1,37 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+/**
+ * Functions marked TV_TARGET_AVX2 may use AVX2 and FMA intrinsics even when the rest of
+ * the build targets plain x86-64. Only call them if tv::hasAvx2() says so.
+ */
+#if defined(__GNUC__) and (defined(__x86_64__) or defined(__i386__))
+#include <immintrin.h>
+#define TV_HAS_AVX2
+#define TV_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+/**
+ * SSE2 is part of every x86-64 build, so its paths need no check at run time.
+ */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define TV_HAS_SSE2
+#endif
+
+namespace tv
+{
+
+inline bool hasAvx2()
+{
+#ifdef TV_HAS_AVX2
+    static const bool supported = __builtin_cpu_supports("avx2") and __builtin_cpu_supports("fma");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+} //namespace tv
+
+#endif // SIMD_H
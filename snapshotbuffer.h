@@ -0,0 +1,55 @@
+#ifndef SNAPSHOTBUFFER_H
+#define SNAPSHOTBUFFER_H
+
+#include <atomic>
+
+namespace tv
+{
+
+/**
+ * Lock-free hand-over of values from one producer thread to one consumer thread.
+ * The producer fills back() and publishes it, the consumer fetches the latest published
+ * value into front(). Neither side ever waits for the other; a third slot in between
+ * keeps the two from touching the same value, and stale values are simply overwritten.
+ */
+template<typename T>
+class SnapshotBuffer
+{
+public:
+    SnapshotBuffer() = default;
+    SnapshotBuffer(const SnapshotBuffer&) = delete;
+    SnapshotBuffer& operator=(const SnapshotBuffer&) = delete;
+
+    //> Producer side
+    T& back(){return m_slots[m_back];}
+    void publish()
+    {
+        m_back = m_middle.exchange(m_back | Fresh, std::memory_order_acq_rel) & IndexMask;
+    }
+
+    //> Consumer side
+    const T& front() const{return m_slots[m_front];}
+    T& front(){return m_slots[m_front];}
+    bool fetch()
+    {
+        if(not (m_middle.load(std::memory_order_acquire) & Fresh)) return false;
+        m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & IndexMask;
+        return true;
+    }
+
+    //> Either side, only while the other one is idle
+    T& slot(int i){return m_slots[i];}
+
+private:
+    static constexpr unsigned Fresh     = 4;
+    static constexpr unsigned IndexMask = 3;
+
+    T                       m_slots[3];
+    unsigned                m_back      = 0;
+    unsigned                m_front     = 1;
+    std::atomic<unsigned>   m_middle    {2};
+};
+
+} //namespace tv
+
+#endif // SNAPSHOTBUFFER_H
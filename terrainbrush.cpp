@@ -0,0 +1,186 @@
+#include "terrainbrush.h"
+#include <QtMath>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace edit
+{
+
+namespace
+{
+
+tv::GridRect brushRect(const ascii::EsriAsciiReader& terrain, double row, double col, double radius)
+{
+    double r0 = std::max(0.0, std::floor(row - radius));
+    double c0 = std::max(0.0, std::floor(col - radius));
+    double r1 = std::min(double(terrain.numRows()), std::ceil(row + radius) + 1);
+    double c1 = std::min(double(terrain.numCols()), std::ceil(col + radius) + 1);
+    if(r1 <= r0 or c1 <= c0) return tv::GridRect();
+    return tv::GridRect(size_t(r0), size_t(c0), size_t(r1), size_t(c1));
+}
+
+/**
+ * Smooth falloff from 1 in the brush center to 0 at its radius.
+ */
+inline float falloff(double dr, double dc, double radius)
+{
+    double d = qSqrt(dr * dr + dc * dc) / radius;
+    return d >= 1.0 ? 0.0f : float(0.5 + 0.5 * qCos(d * M_PI));
+}
+
+} //namespace
+
+/**
+ * Replaces NODATA samples inside the rectangle by the mean of their valid neighbours.
+ * Holes are closed from their rims inwards, one ring at a time, each ring averaging the
+ * samples filled before it. Only the hole samples are visited again per ring, and the
+ * grid is edited once at the end.
+ */
+void fillHoles(ascii::EsriAsciiReader& terrain, const tv::GridRect& rect)
+{
+    const tv::HeightGrid& grid = terrain.heightGrid();
+    tv::GridRect r = rect.intersected(grid.bounds());
+    if(r.isEmpty()) return;
+    size_t cols = r.numCols();
+    std::vector<float> heights(r.numRows() * cols);
+    for(size_t row = r.row0; row < r.row1; ++row)
+    {
+        std::copy(grid.row(row) + r.col0, grid.row(row) + r.col1, heights.begin() + std::ptrdiff_t((row - r.row0) * cols));
+    }
+
+    //Samples inside the rectangle come from the copy being filled, the rest from the grid.
+    auto heightAt = [&](long row, long col)
+    {
+        row = std::min(std::max(row, 0L), long(grid.numRows()) - 1);
+        col = std::min(std::max(col, 0L), long(grid.numCols()) - 1);
+        if(size_t(row) < r.row0 or size_t(row) >= r.row1 or size_t(col) < r.col0 or size_t(col) >= r.col1)
+        {
+            return grid.at(size_t(row), size_t(col));
+        }
+        return heights[(size_t(row) - r.row0) * cols + size_t(col) - r.col0];
+    };
+    auto hasValidNeighbour = [&](size_t i)
+    {
+        long row = long(r.row0 + i / cols);
+        long col = long(r.col0 + i % cols);
+        for(long dr = -1; dr <= 1; ++dr)
+        {
+            for(long dc = -1; dc <= 1; ++dc)
+            {
+                if(not terrain.isNoData(heightAt(row + dr, col + dc))) return true;
+            }
+        }
+        return false;
+    };
+
+    std::vector<uint8_t> queued(heights.size(), 0);
+    std::vector<size_t> ring;
+    for(size_t i = 0; i < heights.size(); ++i)
+    {
+        if(terrain.isNoData(heights[i]) and hasValidNeighbour(i))
+        {
+            ring.push_back(i);
+            queued[i] = 1;
+        }
+    }
+    if(ring.empty()) return;
+
+    std::vector<float> values;
+    std::vector<size_t> next;
+    while(not ring.empty())
+    {
+        values.resize(ring.size());
+        for(size_t k = 0; k < ring.size(); ++k)
+        {
+            long row = long(r.row0 + ring[k] / cols);
+            long col = long(r.col0 + ring[k] % cols);
+            double sum = 0.0;
+            int count = 0;
+            for(long dr = -1; dr <= 1; ++dr)
+            {
+                for(long dc = -1; dc <= 1; ++dc)
+                {
+                    float v = heightAt(row + dr, col + dc);
+                    if(terrain.isNoData(v)) continue;
+                    sum += v;
+                    ++count;
+                }
+            }
+            values[k] = float(sum / count);
+        }
+        for(size_t k = 0; k < ring.size(); ++k) heights[ring[k]] = values[k];
+
+        //The next ring are the holes next to this one.
+        next.clear();
+        for(size_t i : ring)
+        {
+            size_t row = i / cols;
+            size_t col = i % cols;
+            for(size_t nr = row > 0 ? row - 1 : 0; nr <= std::min(row + 1, r.numRows() - 1); ++nr)
+            {
+                for(size_t nc = col > 0 ? col - 1 : 0; nc <= std::min(col + 1, cols - 1); ++nc)
+                {
+                    size_t n = nr * cols + nc;
+                    if(queued[n] or not terrain.isNoData(heights[n])) continue;
+                    queued[n] = 1;
+                    next.push_back(n);
+                }
+            }
+        }
+        ring.swap(next);
+    }
+
+    terrain.editHeights(r, [&](size_t row, size_t col, float)
+    {
+        return heights[(row - r.row0) * cols + col - r.col0];
+    });
+}
+
+void raise(ascii::EsriAsciiReader& terrain, double row, double col, double radius, float amount)
+{
+    terrain.editHeights(brushRect(terrain, row, col, radius), [&](size_t r, size_t c, float h)
+    {
+        if(terrain.isNoData(h)) return h;
+        return h + amount * falloff(r - row, c - col, radius);
+    });
+}
+
+/**
+ * Blends every sample under the brush towards the mean of its 3x3 neighbourhood.
+ */
+void smooth(ascii::EsriAsciiReader& terrain, double row, double col, double radius, float strength)
+{
+    const tv::HeightGrid& grid = terrain.heightGrid();
+    tv::GridRect r = brushRect(terrain, row, col, radius);
+    if(r.isEmpty()) return;
+    std::vector<float> mean(r.numRows() * r.numCols());
+    for(size_t y = r.row0; y < r.row1; ++y)
+    {
+        for(size_t x = r.col0; x < r.col1; ++x)
+        {
+            double sum = 0.0;
+            int count = 0;
+            for(long dr = -1; dr <= 1; ++dr)
+            {
+                for(long dc = -1; dc <= 1; ++dc)
+                {
+                    float v = grid.clampedAt(long(y) + dr, long(x) + dc);
+                    if(terrain.isNoData(v)) continue;
+                    sum += v;
+                    ++count;
+                }
+            }
+            mean[(y - r.row0) * r.numCols() + x - r.col0] = count > 0 ? float(sum / count) : grid.at(y, x);
+        }
+    }
+    terrain.editHeights(r, [&](size_t y, size_t x, float h)
+    {
+        if(terrain.isNoData(h)) return h;
+        float w = strength * falloff(y - row, x - col, radius);
+        return h + (mean[(y - r.row0) * r.numCols() + x - r.col0] - h) * w;
+    });
+}
+
+} //namespace edit
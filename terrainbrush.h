@@ -0,0 +1,20 @@
+#ifndef TERRAINBRUSH_H
+#define TERRAINBRUSH_H
+
+#include "esriasciiireader.h"
+
+namespace edit
+{
+
+/**
+ * Interactive height editing tools. All of them touch only the cells under the brush,
+ * so their cost grows with the brush area and not with the grid.
+ */
+
+void fillHoles(ascii::EsriAsciiReader& terrain, const tv::GridRect& rect);
+void raise(ascii::EsriAsciiReader& terrain, double row, double col, double radius, float amount);
+void smooth(ascii::EsriAsciiReader& terrain, double row, double col, double radius, float strength);
+
+} //namespace edit
+
+#endif // TERRAINBRUSH_H
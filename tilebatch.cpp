@@ -0,0 +1,128 @@
+#include "tilebatch.h"
+#include "float4x4.h"
+#include <QDebug>
+#include <QOpenGLContext>
+
+namespace render
+{
+
+/**
+ * Draws the tiles of the bound vertex and index buffers that the mvp matrix keeps in
+ * view. The shader program and its attributes must be set up.
+ */
+void TileBatch::draw(const std::vector<tv::MeshTile>& tiles, const QMatrix4x4& mvp)
+{
+    if(not m_initialized) return;
+    collect(tiles, mvp);
+    if(m_commands.empty()) return;
+
+    if(m_path == Path::Indirect)
+    {
+        GLsizeiptr size = GLsizeiptr(m_commands.size() * sizeof(Command));
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_buffer);
+        //Orphaning keeps the driver from waiting for the draws of the last frame.
+        if(size > m_capacity) m_capacity = size;
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, m_capacity, nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, size, m_commands.data());
+        m_multiDrawIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, GLsizei(m_commands.size()), 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        return;
+    }
+
+    m_counts.clear();
+    m_offsets.clear();
+    for(const Command& c : m_commands)
+    {
+        m_counts.push_back(GLsizei(c.count));
+        m_offsets.push_back(reinterpret_cast<const void*>(size_t(c.firstIndex) * sizeof(GLuint)));
+    }
+    if(m_path == Path::MultiDraw)
+    {
+        m_multiDraw(GL_TRIANGLES, m_counts.data(), GL_UNSIGNED_INT, m_offsets.data(), GLsizei(m_counts.size()));
+        return;
+    }
+    for(size_t i = 0; i < m_counts.size(); ++i) glDrawElements(GL_TRIANGLES, m_counts[i], GL_UNSIGNED_INT, m_offsets[i]);
+}
+
+/**
+ * Picks the submission path the current context supports. Needs a current context.
+ */
+void TileBatch::initialize()
+{
+    if(m_initialized) return;
+    initializeOpenGLFunctions();
+    QOpenGLContext* ctx = QOpenGLContext::currentContext();
+    if(not ctx->isOpenGLES())
+    {
+        if(ctx->format().version() >= qMakePair(4, 3) or ctx->hasExtension("GL_ARB_multi_draw_indirect"))
+        {
+            m_multiDrawIndirect = reinterpret_cast<MultiDrawElementsIndirect>(ctx->getProcAddress("glMultiDrawElementsIndirect"));
+        }
+        m_multiDraw = reinterpret_cast<MultiDrawElements>(ctx->getProcAddress("glMultiDrawElements"));
+    }
+    else if(ctx->hasExtension("GL_EXT_multi_draw_arrays"))
+    {
+        m_multiDraw = reinterpret_cast<MultiDrawElements>(ctx->getProcAddress("glMultiDrawElementsEXT"));
+    }
+
+    if(m_multiDrawIndirect)
+    {
+        glGenBuffers(1, &m_buffer);
+        m_path = Path::Indirect;
+    }
+    else if(m_multiDraw)
+    {
+        m_path = Path::MultiDraw;
+    }
+    qDebug() << "Tile submission:" << (m_path == Path::Indirect ? "multi draw indirect"
+                                       : m_path == Path::MultiDraw ? "multi draw" : "draw per tile");
+    m_initialized = true;
+}
+
+/**
+ * Frees the command buffer. Needs a current context.
+ */
+void TileBatch::release()
+{
+    if(not m_initialized) return;
+    if(m_buffer) glDeleteBuffers(1, &m_buffer);
+    m_buffer = 0;
+    m_capacity = 0;
+    m_multiDraw = nullptr;
+    m_multiDrawIndirect = nullptr;
+    m_path = Path::Loop;
+    m_initialized = false;
+}
+
+//------->Private
+
+/**
+ * Turns the tiles whose bounds reach into the frustum into commands, testing all bounds
+ * in one batch first. Tiles that follow each other in the index array extend the last
+ * command.
+ */
+void TileBatch::collect(const std::vector<tv::MeshTile>& tiles, const QMatrix4x4& mvp)
+{
+    m_commands.clear();
+    if(tiles.empty()) return;
+    m_visible.resize(tiles.size());
+    tv::Frustum frustum(tv::Float4x4::fromQMatrix(mvp));
+    tv::frustumTest(frustum, &tiles.front().bounds, tiles.size(), m_visible.data(), sizeof(tv::MeshTile));
+
+    for(size_t i = 0; i < tiles.size(); ++i)
+    {
+        const tv::MeshTile& tile = tiles[i];
+        if(not m_visible[i] or tile.numIndices == 0) continue;
+        if(not m_commands.empty() and m_commands.back().firstIndex + m_commands.back().count == tile.firstIndex)
+        {
+            m_commands.back().count += GLuint(tile.numIndices);
+            continue;
+        }
+        Command c;
+        c.count = GLuint(tile.numIndices);
+        c.firstIndex = GLuint(tile.firstIndex);
+        m_commands.push_back(c);
+    }
+}
+
+} //namespace render
@@ -0,0 +1,72 @@
+#ifndef TILEBATCH_H
+#define TILEBATCH_H
+
+#include "utils.h"
+#include <QMatrix4x4>
+#include <QOpenGLExtraFunctions>
+#include <vector>
+
+namespace render
+{
+
+/**
+ * Submits the tiles of a mesh that lie in the view frustum with as few calls as the
+ * context allows. Visible tiles become draw commands, neighbours in the index array
+ * merged into one, and all of them go out in a single glMultiDrawElementsIndirect from
+ * a buffer refilled every draw. Contexts before OpenGL 4.3 take glMultiDrawElements with
+ * the same commands, and those without that a loop of glDrawElements.
+ *
+ * Tiles carry no state of their own, everything per dataset stays a uniform, so there is
+ * nothing to fetch per draw in the shader.
+ */
+class TileBatch : protected QOpenGLExtraFunctions
+{
+public:
+    enum class Path
+    {
+        Loop        = 0,
+        MultiDraw   = 1,
+        Indirect    = 2
+    };
+
+    TileBatch() = default;
+    bool isInitialized() const{return m_initialized;}
+    Path path() const{return m_path;}
+    size_t numCommands() const{return m_commands.size();}
+    void draw(const std::vector<tv::MeshTile>& tiles, const QMatrix4x4& mvp);
+    void initialize();
+    void release();
+
+private:
+    /**
+     * Layout of DrawElementsIndirectCommand.
+     */
+    struct Command
+    {
+        GLuint  count           = 0;
+        GLuint  instanceCount   = 1;
+        GLuint  firstIndex      = 0;
+        GLint   baseVertex      = 0;
+        GLuint  baseInstance    = 0;
+    };
+
+    using MultiDrawElements = void (QOPENGLF_APIENTRYP)(GLenum, const GLsizei*, GLenum, const void* const*, GLsizei);
+    using MultiDrawElementsIndirect = void (QOPENGLF_APIENTRYP)(GLenum, GLenum, const void*, GLsizei, GLsizei);
+
+    bool                        m_initialized       = false;
+    GLuint                      m_buffer            = 0;
+    GLsizeiptr                  m_capacity          = 0;
+    MultiDrawElements           m_multiDraw         = nullptr;
+    MultiDrawElementsIndirect   m_multiDrawIndirect = nullptr;
+    Path                        m_path              = Path::Loop;
+    std::vector<Command>        m_commands;
+    std::vector<GLsizei>        m_counts;
+    std::vector<const void*>    m_offsets;
+    std::vector<uint8_t>        m_visible;
+
+    void collect(const std::vector<tv::MeshTile>& tiles, const QMatrix4x4& mvp);
+};
+
+} //namespace render
+
+#endif // TILEBATCH_H
@@ -0,0 +1,242 @@
+#include "tileexporter.h"
+#include <QDebug>
+#include <algorithm>
+
+namespace render
+{
+
+/**
+ * The view keeps its own viewport's aspect ratio, so imageSize should have the same to
+ * avoid stretching. Encoding starts right away on the writer thread; tiles are drawn by
+ * step().
+ */
+TileExporter::TileExporter(const cam::CameraState& view, const QSize& imageSize, const QString& fileName,
+                           const RenderFunction& render, QObject* parent) :
+    QObject(parent),
+    m_tilesX((imageSize.width() + kTileSize - 1) / kTileSize),
+    m_tilesY((imageSize.height() + kTileSize - 1) / kTileSize),
+    m_imageSize(imageSize),
+    m_fileName(fileName),
+    m_view(view),
+    m_render(render),
+    m_writer(std::make_unique<tv::PngWriter>(fileName, size_t(std::max(0, imageSize.width())),
+                                             size_t(std::max(0, imageSize.height()))))
+{
+    if(not m_writer->isValid()) m_failed = true;
+    m_thread = std::thread(&TileExporter::writeBands, this);
+}
+
+/**
+ * Stops the writer, which removes the image unless it was completed. GPU resources must
+ * have been freed by release() before.
+ */
+TileExporter::~TileExporter()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_bandsLock);
+        m_aborted = true;
+        m_closed = true;
+    }
+    m_bandsChanged.notify_all();
+    m_thread.join();
+}
+
+/**
+ * Frees all GPU resources. Needs a current context.
+ */
+void TileExporter::release()
+{
+    if(not m_initialized) return;
+    glDeleteBuffers(2, m_pbos);
+    m_pbos[0] = m_pbos[1] = 0;
+    m_fbo.reset();
+    m_initialized = false;
+}
+
+/**
+ * Draws the next tile and collects the one before. Needs a current context that shares
+ * objects with the one the scene was set up in. Returns false once every tile has been
+ * handed to the writer or the export failed; finished() follows when the writer is done.
+ */
+bool TileExporter::step()
+{
+    if(m_failed or m_next > numTiles()) return false;
+    {
+        //The writer is behind: draw on once it has caught up instead of holding more rows.
+        std::lock_guard<std::mutex> lock(m_bandsLock);
+        if(m_bands.size() >= size_t(kMaxBands)) return true;
+    }
+    if(not m_initialized) initialize();
+
+    if(m_next < numTiles()) renderTile(m_next);
+    if(m_next > 0) collectTile(m_next - 1);
+    ++m_next;
+    if(m_next > numTiles() or m_failed) closeBands();
+    return not m_failed and m_next <= numTiles();
+}
+
+/**
+ * Narrows a projection to the part of the view that one tile of an image covers. The tile
+ * is given in pixels of the image with the origin at its lower left corner, like viewports.
+ */
+QMatrix4x4 TileExporter::tileProjection(const QMatrix4x4& projection, const QSize& imageSize, const QRect& tile)
+{
+    float l = 2.0f * float(tile.x()) / float(imageSize.width()) - 1.0f;
+    float r = 2.0f * float(tile.x() + tile.width()) / float(imageSize.width()) - 1.0f;
+    float b = 2.0f * float(tile.y()) / float(imageSize.height()) - 1.0f;
+    float t = 2.0f * float(tile.y() + tile.height()) / float(imageSize.height()) - 1.0f;
+    QMatrix4x4 narrow;
+    narrow.scale(2.0f / (r - l), 2.0f / (t - b), 1.0f);
+    narrow.translate(-0.5f * (l + r), -0.5f * (b + t), 0.0f);
+    return narrow * projection;
+}
+
+//------->Private
+
+/**
+ * Tells the writer that no more bands will come.
+ */
+void TileExporter::closeBands()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_bandsLock);
+        m_closed = true;
+    }
+    m_bandsChanged.notify_all();
+}
+
+/**
+ * Copies a tile read back by renderTile() into the current band, flipping it upright and
+ * dropping alpha, and hands the band to the writer once its last tile is in.
+ */
+void TileExporter::collectTile(size_t tile)
+{
+    QRect rect = tileRect(tile);
+    int w = rect.width();
+    int h = rect.height();
+    size_t stride = size_t(m_imageSize.width()) * 3;
+    bool first = tile % size_t(m_tilesX) == 0;
+    bool last = tile % size_t(m_tilesX) == size_t(m_tilesX) - 1;
+    if(first)
+    {
+        m_band.numRows = size_t(h);
+        m_band.rgb.resize(stride * size_t(h));
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbos[tile % 2]);
+    const unsigned char* rgba = static_cast<const unsigned char*>(
+        glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, GLsizeiptr(w) * h * 4, GL_MAP_READ_BIT));
+    if(not rgba)
+    {
+        qDebug() << "Cannot map the pixels of export tile" << tile;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        m_failed = true;
+        return;
+    }
+    for(int y = 0; y < h; ++y)
+    {
+        const unsigned char* src = rgba + size_t(y) * size_t(w) * 4;
+        unsigned char* dst = m_band.rgb.data() + size_t(h - 1 - y) * stride + size_t(rect.x()) * 3;
+        for(int x = 0; x < w; ++x, src += 4, dst += 3)
+        {
+            dst[0] = src[0];
+            dst[1] = src[1];
+            dst[2] = src[2];
+        }
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    ++m_collected;
+
+    if(last)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_bandsLock);
+            m_bands.push_back(std::move(m_band));
+        }
+        m_band = Band();
+        m_bandsChanged.notify_all();
+    }
+}
+
+void TileExporter::initialize()
+{
+    initializeOpenGLFunctions();
+    QSize fboSize(std::min(kTileSize, m_imageSize.width()), std::min(kTileSize, m_imageSize.height()));
+    m_fbo = std::make_unique<QOpenGLFramebufferObject>(fboSize, QOpenGLFramebufferObject::Depth);
+    glGenBuffers(2, m_pbos);
+    for(GLuint pbo : m_pbos)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(fboSize.width()) * fboSize.height() * 4, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    m_initialized = true;
+}
+
+/**
+ * Draws a tile and starts reading it back into its pixel buffer. The read only completes
+ * on the GPU, while the caller goes on.
+ */
+void TileExporter::renderTile(size_t tile)
+{
+    QRect rect = tileRect(tile);
+    cam::CameraState st = m_view;
+    st.projection = tileProjection(m_view.projection, m_imageSize, rect);
+    st.viewport = QRect(0, 0, rect.width(), rect.height());
+
+    m_fbo->bind();
+    glViewport(0, 0, rect.width(), rect.height());
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    m_render(st);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbos[tile % 2]);
+    glReadPixels(0, 0, rect.width(), rect.height(), GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    m_fbo->release();
+}
+
+/**
+ * Pixels of the image a tile covers, with the origin at the lower left corner. Tiles are
+ * numbered row by row from the top, which is the order PNG stores rows in.
+ */
+QRect TileExporter::tileRect(size_t tile) const
+{
+    int tx = int(tile % size_t(m_tilesX));
+    int ty = int(tile / size_t(m_tilesX));
+    int top = ty * kTileSize;
+    int h = std::min(kTileSize, m_imageSize.height() - top);
+    int x = tx * kTileSize;
+    return QRect(x, m_imageSize.height() - top - h, std::min(kTileSize, m_imageSize.width() - x), h);
+}
+
+/**
+ * Writer thread: encodes bands in order until the last one is in, then completes the
+ * image. A band stays queued while it is encoded, which keeps it counted against
+ * kMaxBands.
+ */
+void TileExporter::writeBands()
+{
+    while(true)
+    {
+        std::unique_lock<std::mutex> lock(m_bandsLock);
+        m_bandsChanged.wait(lock, [this]()
+        {
+            return m_closed or m_failed or not m_bands.empty();
+        });
+        if(m_aborted or m_failed or m_bands.empty()) break;
+        Band& band = m_bands.front();
+        lock.unlock();
+
+        if(not m_writer->writeRows(band.rgb.data(), band.numRows)) m_failed = true;
+
+        lock.lock();
+        m_bands.pop_front();
+    }
+
+    bool ok = not m_aborted and not m_failed and m_writer->finish();
+    m_writer.reset();
+    if(not m_aborted) emit finished(ok);
+}
+
+} //namespace render
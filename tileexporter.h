@@ -0,0 +1,97 @@
+#ifndef TILEEXPORTER_H
+#define TILEEXPORTER_H
+
+#include "glcamera.h"
+#include "pngwriter.h"
+#include <QObject>
+#include <QOpenGLExtraFunctions>
+#include <QtOpenGL/QOpenGLFramebufferObject>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace render
+{
+
+/**
+ * Renders a camera view into a PNG image of any size, one tile per step. Every tile is
+ * drawn with the projection narrowed to its part of the view and read back through one
+ * of two pixel buffers, so reading tile n overlaps with drawing tile n + 1. Finished
+ * rows of tiles go to a writer thread, which encodes them while further tiles are drawn;
+ * at most a few rows of tiles are held at once.
+ *
+ * Steps never wait for the writer, so that driving them from the event loop keeps the
+ * GUI responsive. finished() is emitted from the writer thread.
+ */
+class TileExporter : public QObject, protected QOpenGLExtraFunctions
+{
+    Q_OBJECT
+
+public:
+    using RenderFunction = std::function<void(const cam::CameraState&)>;
+
+    static constexpr int kMaxBands      = 2;
+    static constexpr int kTileSize      = 1024;
+
+    TileExporter(const cam::CameraState& view, const QSize& imageSize, const QString& fileName,
+                 const RenderFunction& render, QObject* parent = nullptr);
+    ~TileExporter();
+    const QString& fileName() const{return m_fileName;}
+    const QSize& imageSize() const{return m_imageSize;}
+    size_t numTiles() const{return size_t(m_tilesX) * size_t(m_tilesY);}
+    size_t tilesDone() const{return m_collected;}
+    void release();
+    bool step();
+    static QMatrix4x4 tileProjection(const QMatrix4x4& projection, const QSize& imageSize, const QRect& tile);
+
+signals:
+    void finished(bool ok);
+
+private:
+    /**
+     * Rows of the image from top to bottom, as tightly packed RGB.
+     */
+    struct Band
+    {
+        std::vector<unsigned char>  rgb;
+        size_t                      numRows = 0;
+    };
+
+    bool                        m_closed        = false;
+    bool                        m_initialized   = false;
+    int                         m_tilesX;
+    int                         m_tilesY;
+    size_t                      m_collected     = 0;
+    size_t                      m_next          = 0;
+    GLuint                      m_pbos[2]       = {0, 0};
+    QSize                       m_imageSize;
+    QString                     m_fileName;
+    cam::CameraState            m_view;
+    RenderFunction              m_render;
+    Band                        m_band;
+    std::unique_ptr<QOpenGLFramebufferObject> m_fbo;
+    std::unique_ptr<tv::PngWriter> m_writer;
+
+    //> Shared with the writer thread
+    std::atomic<bool>           m_aborted       {false};
+    std::atomic<bool>           m_failed        {false};
+    std::condition_variable     m_bandsChanged;
+    std::deque<Band>            m_bands;
+    std::mutex                  m_bandsLock;
+    std::thread                 m_thread;
+
+    void closeBands();
+    void collectTile(size_t tile);
+    void initialize();
+    void renderTile(size_t tile);
+    QRect tileRect(size_t tile) const;
+    void writeBands();
+};
+
+} //namespace render
+
+#endif // TILEEXPORTER_H
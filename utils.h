@@ -3,22 +3,44 @@
 
 #include <GL/gl.h>
 #include <QVector3D>
+#include <memory_resource>
+#include <vector>
 
 namespace tv
 {
 
 /**
- * Contains a three dimensional vector of a triangle with its corresponding normal vector.
+ * Position of a terrain mesh vertex. Shading takes its normals from the normal map, so
+ * vertices carry none.
  */
 struct Vertex3d
 {
     QVector3D pos;
-    QVector3D norm;
-    Vertex3d(const QVector3D& p, const QVector3D& n) :
-        pos(p), norm(n)
+    explicit Vertex3d(const QVector3D& p) :
+        pos(p)
     {}
 };
 
+/**
+ * Axis aligned bounding box.
+ */
+struct Aabb
+{
+    QVector3D   min;
+    QVector3D   max;
+};
+
+/**
+ * Block of the mesh whose triangles lie contiguous in the index array, with the bounds of
+ * its vertices. Tiles follow each other in the index array band after band.
+ */
+struct MeshTile
+{
+    size_t      firstIndex  = 0;
+    size_t      numIndices  = 0;
+    Aabb        bounds;
+};
+
 inline QPointF qv2ToQpf(const QVector2D& v)
 {
     return {v.x(), v.y()};
@@ -72,7 +94,7 @@ inline double formatDegree(double degree)
 
 } //namespace tv
 
-using Indices   = std::vector<GLuint>;
-using Vertices  = std::vector<tv::Vertex3d>;
+using Indices   = std::pmr::vector<GLuint>;
+using Vertices  = std::pmr::vector<tv::Vertex3d>;
 
 #endif // UTILS_H
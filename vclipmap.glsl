@@ -0,0 +1,36 @@
+uniform mat4 mvp_matrix;
+uniform sampler2D u_fine;
+uniform sampler2D u_coarse;
+uniform vec2 u_gridMax;
+uniform vec2 u_origin;
+uniform float u_heightScale;
+uniform float u_morph;
+uniform float u_n;
+uniform float u_spacing;
+uniform float u_texSize;
+
+attribute vec2 a_grid;
+
+varying vec3 v_coord;
+
+float levelHeight(sampler2D tex, vec2 g, float spacing)
+{
+    return texture2DLod(tex, (g.yx / spacing + 0.5) / u_texSize, 0.0).r;
+}
+
+void main()
+{
+    vec2 g = clamp(u_origin + a_grid * u_spacing, vec2(0.0), u_gridMax);
+    float h = levelHeight(u_fine, g, u_spacing);
+
+    // blend towards the coarser level near the outer border to close the seams
+    float halfExt = 0.5 * u_n * u_spacing;
+    vec2 d = abs(g - (u_origin + halfExt)) / halfExt;
+    float alpha = u_morph * clamp((max(d.x, d.y) - 0.8) / 0.15, 0.0, 1.0);
+    if(alpha > 0.0) h = mix(h, levelHeight(u_coarse, g, 2.0 * u_spacing), alpha);
+
+    vec3 pos = vec3(g, h * u_heightScale);
+    gl_Position = mvp_matrix * vec4(pos, 1.0);
+
+    v_coord = pos;
+}
@@ -0,0 +1,160 @@
+#include "viewshed.h"
+#include "parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <memory>
+
+namespace analysis
+{
+
+namespace
+{
+
+/**
+ * Analysed cells, bounds inclusive.
+ */
+struct Area
+{
+    long    r0;
+    long    c0;
+    long    r1;
+    long    c1;
+
+    size_t numBorderCells() const{return size_t(2 * ((r1 - r0) + (c1 - c0)));}
+    size_t width() const{return size_t(c1 - c0 + 1);}
+    bool contains(long r, long c) const{return r >= r0 and r <= r1 and c >= c0 and c <= c1;}
+    /**
+     * The i-th border cell, going clockwise from the top left corner.
+     */
+    void borderCell(size_t i, long& r, long& c) const
+    {
+        long w = c1 - c0;
+        long h = r1 - r0;
+        long k = long(i);
+        if(k < w)
+        {
+            r = r0;
+            c = c0 + k;
+        }
+        else if((k -= w) < h)
+        {
+            r = r0 + k;
+            c = c1;
+        }
+        else if((k -= h) < w)
+        {
+            r = r1;
+            c = c1 - k;
+        }
+        else
+        {
+            r = r1 - (k - w);
+            c = c0;
+        }
+    }
+};
+
+inline float blend(float a, float b, float t, float noData)
+{
+    if(a == noData) return b;
+    if(b == noData) return a;
+    return a + (b - a) * t;
+}
+
+} //namespace
+
+void viewshed(const tv::HeightGrid& grid, size_t row, size_t col, const ViewshedParams& params, tv::HeightGrid& out)
+{
+    size_t rows = grid.numRows();
+    size_t cols = grid.numCols();
+    if(out.numRows() != rows or out.numCols() != cols) out.resize(cols, rows);
+    if(grid.isEmpty()) return;
+    std::fill(out.data(), out.data() + out.size(), -1.0f);
+    if(row >= rows or col >= cols or grid.at(row, col) == params.noData) return;
+
+    long orow = long(row);
+    long ocol = long(col);
+    long reach = params.radius > 0.0f ? long(std::ceil(params.radius)) : std::max(long(rows), long(cols));
+    Area area{std::max(0L, orow - reach), std::max(0L, ocol - reach),
+              std::min(long(rows) - 1, orow + reach), std::min(long(cols) - 1, ocol + reach)};
+    float maxDist2 = params.radius > 0.0f ? params.radius * params.radius : std::numeric_limits<float>::max();
+
+    size_t numCells = size_t(area.r1 - area.r0 + 1) * area.width();
+    std::unique_ptr<std::atomic<unsigned char>[]> visible(new std::atomic<unsigned char>[numCells]);
+    for(size_t i = 0; i < numCells; ++i) visible[i].store(0, std::memory_order_relaxed);
+    auto markVisible = [&](long r, long c)
+    {
+        visible[size_t(r - area.r0) * area.width() + size_t(c - area.c0)].store(1, std::memory_order_relaxed);
+    };
+    markVisible(orow, ocol);
+
+    const float eye = grid.at(row, col) + params.observerHeight;
+    const float noData = params.noData;
+    auto castRay = [&](long tr, long tc)
+    {
+        long dr = tr - orow;
+        long dc = tc - ocol;
+        long steps = std::max(std::abs(dr), std::abs(dc));
+        bool rowMajor = std::abs(dr) >= std::abs(dc);
+        long majorStep = (rowMajor ? dr : dc) > 0 ? 1 : -1;
+        double minorStep = double(rowMajor ? dc : dr) / double(steps);
+        double minorStart = rowMajor ? ocol : orow;
+        long minorMax = rowMajor ? area.c1 : area.r1;
+        float stepLength = float(std::sqrt(double(dr) * dr + double(dc) * dc) / double(steps)) * params.cellSize;
+        float horizon = -std::numeric_limits<float>::infinity();
+        for(long i = 1; i <= steps; ++i)
+        {
+            // The ray crosses a whole row (column) at every step; the horizon height is
+            // blended from the two cells it passes between, the cell tested is the nearer one.
+            double minor = minorStart + minorStep * double(i);
+            long lo = long(std::floor(minor));
+            float frac = float(minor - double(lo));
+            long nearest = frac < 0.5f ? lo : lo + 1;
+            long hi = std::min(lo + 1, minorMax);
+            long r = rowMajor ? orow + majorStep * i : nearest;
+            long c = rowMajor ? nearest : ocol + majorStep * i;
+            float cellDist2 = float((r - orow) * (r - orow) + (c - ocol) * (c - ocol));
+            if(cellDist2 > maxDist2) break;
+
+            float crossing = rowMajor ? blend(grid.at(size_t(r), size_t(lo)), grid.at(size_t(r), size_t(hi)), frac, noData)
+                                      : blend(grid.at(size_t(lo), size_t(c)), grid.at(size_t(hi), size_t(c)), frac, noData);
+            float h = grid.at(size_t(r), size_t(c));
+            if(h != noData and h + params.targetHeight - eye >= horizon * std::sqrt(cellDist2) * params.cellSize)
+            {
+                markVisible(r, c);
+            }
+            if(crossing != noData) horizon = std::max(horizon, (crossing - eye) / (stepLength * float(i)));
+        }
+    };
+
+    // Sectors of consecutive border cells; more than workers, as rays differ in length.
+    size_t border = area.numBorderCells();
+    size_t numSectors = std::min(border, tv::numWorkers() * 16);
+    tv::parallelTasks(numSectors, [&](size_t sector)
+    {
+        long tr = 0;
+        long tc = 0;
+        for(size_t i = border * sector / numSectors; i < border * (sector + 1) / numSectors; ++i)
+        {
+            area.borderCell(i, tr, tc);
+            castRay(tr, tc);
+        }
+    });
+
+    tv::parallelFor(size_t(area.r0), size_t(area.r1) + 1, [&](size_t r0, size_t r1, size_t)
+    {
+        for(size_t r = r0; r < r1; ++r)
+        {
+            for(size_t c = size_t(area.c0); c <= size_t(area.c1); ++c)
+            {
+                float dist2 = float((long(r) - orow) * (long(r) - orow) + (long(c) - ocol) * (long(c) - ocol));
+                if(grid.at(r, c) == noData or dist2 > maxDist2) continue;
+                out.at(r, c) = visible[(r - size_t(area.r0)) * area.width() + (c - size_t(area.c0))].load(std::memory_order_relaxed);
+            }
+        }
+    }, 64);
+}
+
+} //namespace analysis
@@ -0,0 +1,37 @@
+#ifndef VIEWSHED_H
+#define VIEWSHED_H
+
+#include "heightgrid.h"
+
+namespace analysis
+{
+
+/**
+ * Heights are in the units of the grid samples; the cell size is the sample spacing in
+ * the same units. A radius of zero covers the whole grid, otherwise only samples within
+ * that many cells of the observer are analysed.
+ */
+struct ViewshedParams
+{
+    float   observerHeight  = 2.0f;
+    float   targetHeight    = 0.0f;
+    float   cellSize        = 1.0f;
+    float   noData          = -9999.0f;
+    float   radius          = 0.0f;
+};
+
+/**
+ * Visibility of every sample from an observer standing on the given sample, written to
+ * out as 1 for visible, 0 for hidden and -1 for NODATA or beyond the radius.
+ *
+ * R2 style: a ray is cast from the observer to every cell on the border of the analysed
+ * area, keeping the steepest horizon seen so far, and every cell the ray passes is visible
+ * if it rises above that horizon. The border is cut into sectors that are traced in
+ * parallel. Near the observer cells are passed by several rays; a cell counts as visible
+ * if any of them sees it.
+ */
+void viewshed(const tv::HeightGrid& grid, size_t row, size_t col, const ViewshedParams& params, tv::HeightGrid& out);
+
+} //namespace analysis
+
+#endif // VIEWSHED_H
@@ -0,0 +1,10 @@
+uniform mat4 mvp_matrix;
+
+attribute vec4 a_position;
+
+void main()
+{
+    gl_Position = mvp_matrix * a_position;
+    // pull lines slightly towards the viewer so they win against the surface they lie on
+    gl_Position.z -= 0.0005 * gl_Position.w;
+}
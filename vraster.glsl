@@ -0,0 +1,15 @@
+uniform mat4 mvp_matrix;
+uniform vec2 u_gridSize;
+
+attribute vec2 a_corner;
+
+varying vec3 v_coord;
+
+void main()
+{
+    // one quad over the whole grid, reaching half a cell past the outer samples
+    vec2 g = a_corner * u_gridSize - 0.5;
+    gl_Position = mvp_matrix * vec4(g, 0.0, 1.0);
+
+    v_coord = vec3(g, 0.0);
+}